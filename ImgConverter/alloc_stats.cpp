@@ -0,0 +1,80 @@
+// Замена глобальных operator new/delete: каждое выделение в куче учитывается
+// в статистике img_lib, пока она включена (--stats). Память по-прежнему
+// выделяется через malloc, как и стандартной реализацией
+
+#include <stats.h>
+
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+namespace {
+
+void* AllocateCounted(size_t size) {
+    img_lib::CountHeapAllocation();
+    if (size == 0) {
+        size = 1;
+    }
+
+    while (true) {
+        if (void* data = malloc(size)) {
+            return data;
+        }
+        const new_handler handler = get_new_handler();
+        if (!handler) {
+            throw bad_alloc();
+        }
+        handler();
+    }
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+    return AllocateCounted(size);
+}
+
+void* operator new[](size_t size) {
+    return AllocateCounted(size);
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    try {
+        return AllocateCounted(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept {
+    try {
+        return AllocateCounted(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void operator delete(void* data) noexcept {
+    free(data);
+}
+
+void operator delete[](void* data) noexcept {
+    free(data);
+}
+
+void operator delete(void* data, size_t) noexcept {
+    free(data);
+}
+
+void operator delete[](void* data, size_t) noexcept {
+    free(data);
+}
+
+void operator delete(void* data, const nothrow_t&) noexcept {
+    free(data);
+}
+
+void operator delete[](void* data, const nothrow_t&) noexcept {
+    free(data);
+}
\ No newline at end of file
@@ -0,0 +1,238 @@
+#include "batch.h"
+#include "format_interface.h"
+#include "memory_scheduler.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <string_view>
+#include <system_error>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace converter {
+
+// Сопоставление имени файла с шаблоном: * - любая последовательность, ? - один символ
+static bool MatchWildcard(string_view pattern, string_view name) {
+    size_t p = 0, n = 0;
+    size_t star = string_view::npos, star_n = 0;
+
+    while (n < name.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+            ++p;
+            ++n;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            star_n = n;
+        } else if (star != string_view::npos) {
+            // откатываемся к последней звёздочке и расширяем её на один символ
+            p = star + 1;
+            n = ++star_n;
+        } else {
+            return false;
+        }
+    }
+
+    while (p < pattern.size() && pattern[p] == '*') {
+        ++p;
+    }
+    return p == pattern.size();
+}
+
+static bool IsWildcard(const string& s) {
+    return s.find_first_of("*?"sv) != string::npos;
+}
+
+static img_lib::Path MakeOutPath(const img_lib::Path& out_dir, const img_lib::Path& relative, const string& out_ext) {
+    img_lib::Path out = out_dir / relative;
+    out.replace_extension(out_ext.empty() || out_ext[0] == '.' ? out_ext : "." + out_ext);
+    return out;
+}
+
+static bool IsKnownInput(const img_lib::Path& path) {
+    return format_interface::GetFormatByExtension(path) != format_interface::Format::UNKNOWN;
+}
+
+optional<vector<BatchJob>> CollectJobs(const img_lib::Path& source, const img_lib::Path& out_dir, const string& out_ext) {
+    vector<BatchJob> jobs;
+    error_code ec;
+
+    const string file_pattern = source.filename().string();
+    if (IsWildcard(file_pattern)) {
+        img_lib::Path dir = source.parent_path();
+        if (dir.empty()) {
+            dir = ".";
+        }
+        for (const fs::directory_entry& entry : fs::directory_iterator(dir, ec)) {
+            const string name = entry.path().filename().string();
+            if (entry.is_regular_file() && MatchWildcard(file_pattern, name)) {
+                jobs.push_back({entry.path(), MakeOutPath(out_dir, name, out_ext)});
+            }
+        }
+        if (ec) {
+            return nullopt;
+        }
+    } else if (fs::is_directory(source, ec)) {
+        for (const fs::directory_entry& entry : fs::recursive_directory_iterator(source, ec)) {
+            if (entry.is_regular_file() && IsKnownInput(entry.path())) {
+                jobs.push_back({entry.path(), MakeOutPath(out_dir, fs::relative(entry.path(), source), out_ext)});
+            }
+        }
+        if (ec) {
+            return nullopt;
+        }
+    } else {
+        return nullopt;
+    }
+
+    sort(jobs.begin(), jobs.end(), [](const BatchJob& lhs, const BatchJob& rhs) {
+        return lhs.in_path < rhs.in_path;
+    });
+    return jobs;
+}
+
+optional<vector<BatchJob>> ReadManifest(const img_lib::Path& manifest) {
+    ifstream ifs(manifest);
+    if (!ifs.is_open()) {
+        return nullopt;
+    }
+
+    vector<BatchJob> jobs;
+    string line;
+    while (getline(ifs, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        const size_t begin = line.find_first_not_of(" \t"sv);
+        if (begin == string::npos || line[begin] == '#') {
+            continue;
+        }
+
+        size_t sep = line.find('\t', begin);
+        if (sep == string::npos) {
+            sep = line.find(' ', begin);
+        }
+        if (sep == string::npos) {
+            return nullopt;
+        }
+        const size_t out_begin = line.find_first_not_of(" \t"sv, sep);
+        if (out_begin == string::npos) {
+            return nullopt;
+        }
+        const size_t out_end = line.find_last_not_of(" \t"sv);
+
+        jobs.push_back({line.substr(begin, sep - begin), line.substr(out_begin, out_end - out_begin + 1)});
+    }
+    return jobs;
+}
+
+// Абсолютный путь без . и .. и с раскрытыми ссылками; выходного файла может ещё не быть
+static img_lib::Path GetFileKey(const img_lib::Path& path) {
+    error_code ec;
+    const img_lib::Path canonical = fs::weakly_canonical(path, ec);
+    return ec ? fs::absolute(path, ec).lexically_normal() : canonical;
+}
+
+vector<JobConflict> FindJobConflicts(const vector<BatchJob>& jobs) {
+    vector<JobConflict> conflicts;
+    map<img_lib::Path, size_t> writers;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const auto [it, inserted] = writers.emplace(GetFileKey(jobs[i].out_path), i);
+        if (!inserted) {
+            conflicts.push_back({it->second, i, false});
+        }
+    }
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const auto it = writers.find(GetFileKey(jobs[i].in_path));
+        if (it != writers.end() && it->second != i) {
+            conflicts.push_back({it->second, i, true});
+        }
+    }
+    return conflicts;
+}
+
+vector<BatchResult> RunBatch(const vector<BatchJob>& jobs, size_t thread_count, const ConvertOptions& options,
+                             uint64_t max_memory) {
+    vector<BatchResult> results(jobs.size());
+    ThreadPool pool(thread_count);
+
+    // файлы и так обрабатываются параллельно, поэтому кодеки и масштабирование
+    // внутри одного файла не должно занимать дополнительные потоки
+    ConvertOptions job_options = options;
+    if (pool.GetThreadCount() > 1) {
+        job_options.resize_options.threads = 1;
+        job_options.codec_threads = 1;
+    }
+
+    // Крупные задания ставим в очередь первыми: тогда к концу работы
+    // остаются мелкие задачи, которые легко распределить между потоками.
+    // С бюджетом памяти крупность - оценка памяти по заголовку, иначе - размер файла
+    vector<pair<uintmax_t, size_t>> order;
+    order.reserve(jobs.size());
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        if (max_memory > 0) {
+            order.emplace_back(EstimateMemory(jobs[i].in_path, jobs[i].out_path, job_options), i);
+            continue;
+        }
+        error_code ec;
+        const uintmax_t size = fs::file_size(jobs[i].in_path, ec);
+        order.emplace_back(ec ? 0 : size, i);
+    }
+    stable_sort(order.begin(), order.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.first > rhs.first;
+    });
+
+    // планировщик разрушается раньше пула и дожидается своих заданий
+    MemoryScheduler scheduler(pool, max_memory);
+
+    for (const auto& [cost, i] : order) {
+        scheduler.Submit(max_memory > 0 ? cost : 0, [&jobs, &results, &job_options, i = i] {
+            const BatchJob& job = jobs[i];
+            BatchResult& result = results[i];
+            result.job = job;
+
+            const auto start = chrono::steady_clock::now();
+            error_code ec;
+            if (job.out_path.has_parent_path()) {
+                fs::create_directories(job.out_path.parent_path(), ec);
+            }
+            try {
+                result.status = ConvertFile(job.in_path, job.out_path, job_options);
+            } catch (...) {
+                result.status = ConversionStatus::SAVING_FAILED;
+            }
+            result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        });
+    }
+    scheduler.Wait();
+
+    return results;
+}
+
+void PrintReport(const vector<BatchResult>& results, ostream& out) {
+    size_t failed = 0;
+    double total_seconds = 0.;
+
+    out << "# code\tseconds\tin_file\tout_file\tmessage"sv << '\n';
+    for (const BatchResult& result : results) {
+        if (result.status != ConversionStatus::OK) {
+            ++failed;
+        }
+        total_seconds += result.seconds;
+        out << static_cast<int>(result.status) << '\t'
+            << fixed << setprecision(3) << result.seconds << '\t'
+            << result.job.in_path.string() << '\t'
+            << result.job.out_path.string() << '\t'
+            << GetStatusMessage(result.status) << '\n';
+    }
+    out << "# total: "sv << results.size()
+        << ", converted: "sv << results.size() - failed
+        << ", failed: "sv << failed
+        << ", job-seconds: "sv << fixed << setprecision(3) << total_seconds << '\n';
+}
+
+}  // namespace converter
\ No newline at end of file
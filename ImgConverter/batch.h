@@ -0,0 +1,65 @@
+#pragma once
+
+#include "converter.h"
+
+#include <img_lib.h>
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace converter {
+
+// Одна пара "входной файл - выходной файл"
+struct BatchJob {
+    img_lib::Path in_path;
+    img_lib::Path out_path;
+};
+
+struct BatchResult {
+    BatchJob job;
+    ConversionStatus status = ConversionStatus::OK;
+    double seconds = 0.;
+};
+
+// Собирает задания из каталога (рекурсивно, с сохранением структуры подкаталогов)
+// или из шаблона вида dir/*.jpg (поддерживаются * и ?).
+// Выходные файлы получают расширение out_ext и кладутся в out_dir.
+// Возвращает nullopt, если источник не существует
+std::optional<std::vector<BatchJob>> CollectJobs(const img_lib::Path& source,
+                                                 const img_lib::Path& out_dir,
+                                                 const std::string& out_ext);
+
+// Читает манифест: по одной паре "<in_file> <out_file>" в строке.
+// Если в строке есть табуляция, разделителем считается она - так можно указывать пути с пробелами.
+// Пустые строки и строки, начинающиеся с #, пропускаются
+std::optional<std::vector<BatchJob>> ReadManifest(const img_lib::Path& manifest);
+
+// Два задания, которые нельзя выполнять параллельно
+struct JobConflict {
+    // задание, которое пишет выходной файл
+    size_t writer;
+    // задание, которое пишет тот же файл или читает его как входной
+    size_t other;
+    bool reads_output = false;
+};
+
+// Ищет задания, которые пишут в один выходной файл (например, a.jpg и a.bmp при общем
+// расширении выхода) или пишут во входной файл другого задания. Пути сравниваются
+// абсолютными, с раскрытыми символическими ссылками. Конвертация файла в самого себя
+// конфликтом не считается: ConvertFile проводит её через временный файл
+std::vector<JobConflict> FindJobConflicts(const std::vector<BatchJob>& jobs);
+
+// Конвертирует все задания на пуле из thread_count потоков.
+// Если max_memory больше нуля, одновременно выполняются задания, оценки памяти которых
+// (EstimateMemory) в сумме не превышают max_memory, см. MemoryScheduler.
+// Результаты возвращаются в порядке заданий
+std::vector<BatchResult> RunBatch(const std::vector<BatchJob>& jobs, size_t thread_count,
+                                  const ConvertOptions& options = {}, uint64_t max_memory = 0);
+
+// Печатает отчёт: строку на каждый файл (код, время, пути, сообщение) и итог
+void PrintReport(const std::vector<BatchResult>& results, std::ostream& out);
+
+}  // namespace converter
\ No newline at end of file
@@ -0,0 +1,494 @@
+#include "cache.h"
+#include "format_interface.h"
+
+#include <mapped_file.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+#include <vector>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace converter {
+
+namespace {
+
+const string_view INDEX_HEADER = "imgconv-cache 1"sv;
+// меняется, если кодировщики начинают выдавать другие файлы при тех же опциях
+constexpr uint64_t ENCODER_VERSION = 1;
+// файлы хешируются частями этого размера; хеш части служит затравкой следующей
+constexpr size_t HASH_CHUNK_BYTES = 1 << 20;
+
+// MurmurHash64A: быстрый некриптографический хеш, около байта за такт
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed) {
+    constexpr uint64_t m = 0xc6a4a7935bd1e995ULL;
+    constexpr int r = 47;
+
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    uint64_t h = seed ^ (size * m);
+
+    const size_t blocks = size / 8;
+    for (size_t i = 0; i < blocks; ++i) {
+        uint64_t k;
+        memcpy(&k, bytes + i * 8, sizeof(k));
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    const unsigned char* tail = bytes + blocks * 8;
+    switch (size & 7) {
+        case 7: h ^= uint64_t(tail[6]) << 48; [[fallthrough]];
+        case 6: h ^= uint64_t(tail[5]) << 40; [[fallthrough]];
+        case 5: h ^= uint64_t(tail[4]) << 32; [[fallthrough]];
+        case 4: h ^= uint64_t(tail[3]) << 24; [[fallthrough]];
+        case 3: h ^= uint64_t(tail[2]) << 16; [[fallthrough]];
+        case 2: h ^= uint64_t(tail[1]) << 8; [[fallthrough]];
+        case 1:
+            h ^= uint64_t(tail[0]);
+            h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+uint64_t HashValue(uint64_t value, uint64_t seed) {
+    return HashBytes(&value, sizeof(value), seed);
+}
+
+// Хеш содержимого файла. Файл по возможности отображается в память,
+// иначе читается теми же частями - результат не зависит от способа чтения
+optional<uint64_t> HashFile(const img_lib::Path& path) {
+    uint64_t hash = 0;
+
+    img_lib::MappedFile file;
+    if (file.Open(path)) {
+        for (size_t offset = 0; offset < file.GetSize(); offset += HASH_CHUNK_BYTES) {
+            hash = HashBytes(file.GetData() + offset, min(HASH_CHUNK_BYTES, file.GetSize() - offset), hash);
+        }
+        return hash;
+    }
+
+    ifstream in(path, ios::binary);
+    if (!in) {
+        return nullopt;
+    }
+    vector<char> chunk(HASH_CHUNK_BYTES);
+    while (in) {
+        in.read(chunk.data(), chunk.size());
+        if (in.gcount() > 0) {
+            hash = HashBytes(chunk.data(), static_cast<size_t>(in.gcount()), hash);
+        }
+    }
+    if (in.bad()) {
+        return nullopt;
+    }
+    return hash;
+}
+
+// Хеш опций, от которых зависит содержимое результата. Число потоков масштабирования
+// результат не меняет, а число потоков кодека меняет: JPEG пишется полосами.
+// nullopt - если формат входного или выходного файла неизвестен
+optional<uint64_t> HashOptions(const img_lib::Path& in_path, const img_lib::Path& out_path,
+                               const ConvertOptions& options) {
+    using format_interface::Format;
+    const Format in_format = options.in_format.value_or(format_interface::GetFormatByExtension(in_path));
+    const Format out_format = options.out_format.value_or(format_interface::GetFormatByExtension(out_path));
+    if (in_format == Format::UNKNOWN || out_format == Format::UNKNOWN) {
+        return nullopt;
+    }
+
+    uint64_t hash = HashValue(ENCODER_VERSION, 0);
+    hash = HashValue(static_cast<uint64_t>(in_format), hash);
+    hash = HashValue(static_cast<uint64_t>(out_format), hash);
+    for (const optional<img_lib::Size>& size : {options.max_size, options.resize}) {
+        hash = HashValue(size ? (uint64_t(uint32_t(size->width)) << 32 | uint32_t(size->height)) + 1 : 0, hash);
+    }
+    if (options.resize) {
+        hash = HashValue(static_cast<uint64_t>(options.resize_options.filter), hash);
+    }
+    hash = HashValue(options.codec_threads, hash);
+    // выше ограничения памяти изображение масштабируется потоком, за один проход
+    if (options.max_size || options.resize || options.codec_threads != 1) {
+        hash = HashValue(options.memory_limit, hash);
+    }
+    if (in_format == Format::JPEG) {
+        const img_lib::JpegLoadOptions& load = options.jpeg_load;
+        hash = HashValue(static_cast<uint64_t>(load.dct_method), hash);
+        hash = HashValue(uint64_t(load.fancy_upsampling) | uint64_t(load.block_smoothing) << 1
+                         | uint64_t(load.auto_orient) << 2, hash);
+    }
+    if (out_format == Format::JPEG) {
+        const img_lib::JpegSaveOptions& save = options.jpeg_save;
+        hash = HashValue(static_cast<uint64_t>(save.quality), hash);
+        hash = HashValue(static_cast<uint64_t>(save.dct_method), hash);
+        hash = HashValue(static_cast<uint64_t>(save.subsampling), hash);
+        hash = HashValue(static_cast<uint64_t>(save.restart_rows), hash);
+        hash = HashValue(uint64_t(save.optimize_coding) | uint64_t(save.progressive) << 1, hash);
+    }
+    if (out_format == Format::PPM) {
+        hash = HashValue(static_cast<uint64_t>(options.ppm_save.format), hash);
+        hash = HashValue(static_cast<uint64_t>(options.ppm_save.max_value), hash);
+    }
+    for (const img_lib::PixelOp& op : options.pixel_ops.GetOps()) {
+        hash = HashValue(static_cast<uint64_t>(op.type), hash);
+        if (op.type == img_lib::PixelOpType::LUT) {
+            hash = HashBytes(op.table.data(), op.table.size(), hash);
+        } else if (op.type == img_lib::PixelOpType::SWAP_CHANNELS) {
+            hash = HashValue(uint64_t(op.order[0]) | uint64_t(op.order[1]) << 8 | uint64_t(op.order[2]) << 16
+                             | uint64_t(op.order[3]) << 24, hash);
+        } else if (op.type == img_lib::PixelOpType::FILL_ALPHA) {
+            hash = HashValue(op.alpha, hash);
+        }
+    }
+    if (options.jpeg_transform) {
+        const img_lib::JpegTransformOptions& transform = *options.jpeg_transform;
+        hash = HashValue(static_cast<uint64_t>(transform.transform) + 1, hash);
+        const optional<img_lib::Size>& crop = transform.crop_size;
+        hash = HashValue(crop ? (uint64_t(uint32_t(crop->width)) << 32 | uint32_t(crop->height)) + 1 : 0, hash);
+        hash = HashValue(uint64_t(uint32_t(transform.crop_x)) << 32 | uint32_t(transform.crop_y), hash);
+        hash = HashValue(uint64_t(transform.trim) | uint64_t(transform.copy_markers) << 1, hash);
+    }
+    return hash;
+}
+
+string FormatKey(uint64_t key) {
+    char buffer[16];
+    for (int i = 15; i >= 0; --i) {
+        buffer[i] = "0123456789abcdef"[key & 0xf];
+        key >>= 4;
+    }
+    return string(buffer, sizeof(buffer));
+}
+
+optional<uint64_t> ParseKey(string_view str) {
+    uint64_t key = 0;
+    const auto [ptr, ec] = from_chars(str.data(), str.data() + str.size(), key, 16);
+    if (ec != errc{} || ptr != str.data() + str.size()) {
+        return nullopt;
+    }
+    return key;
+}
+
+template <typename Number>
+optional<Number> ParseNumber(string_view str) {
+    Number value = 0;
+    const auto [ptr, ec] = from_chars(str.data(), str.data() + str.size(), value);
+    if (ec != errc{} || ptr != str.data() + str.size()) {
+        return nullopt;
+    }
+    return value;
+}
+
+vector<string_view> SplitFields(string_view line, size_t max_fields) {
+    vector<string_view> fields;
+    while (fields.size() + 1 < max_fields) {
+        const size_t end = line.find('\t');
+        if (end == string_view::npos) {
+            break;
+        }
+        fields.push_back(line.substr(0, end));
+        line.remove_prefix(end + 1);
+    }
+    fields.push_back(line);
+    return fields;
+}
+
+int64_t GetModificationTime(const img_lib::Path& path, error_code& ec) {
+    return fs::last_write_time(path, ec).time_since_epoch().count();
+}
+
+// Копия или жёсткая ссылка. Жёсткая ссылка невозможна между файловыми системами,
+// тогда файл копируется
+bool PlaceFile(const img_lib::Path& from, const img_lib::Path& to, bool hard_link) {
+    error_code ec;
+    if (hard_link) {
+        fs::create_hard_link(from, to, ec);
+        if (!ec) {
+            return true;
+        }
+    }
+    fs::copy_file(from, to, fs::copy_options::overwrite_existing, ec);
+    if (ec) {
+        fs::remove(to, ec);
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+bool ConversionCache::Open(const CacheOptions& options) {
+    lock_guard lock(mutex_);
+    options_ = options;
+    objects_.clear();
+    sources_.clear();
+
+    error_code ec;
+    fs::create_directories(options_.dir / "objects", ec);
+    if (!fs::is_directory(options_.dir / "objects", ec)) {
+        return false;
+    }
+    LoadIndex();
+    RemoveUnindexedObjects();
+    return true;
+}
+
+img_lib::Path ConversionCache::GetObjectPath(uint64_t key) const {
+    return options_.dir / "objects" / FormatKey(key);
+}
+
+// Индекс - текстовый файл, поля разделены табуляцией:
+//   imgconv-cache 1
+//   O <key> <size> <last_used> <hash>                     - файл objects/<key>
+//   S <options_hash> <size> <mtime> <key> <in_file>       - ключ входного файла с такими размером и временем
+void ConversionCache::LoadIndex() {
+    ifstream in(options_.dir / "index");
+    string line;
+    if (!getline(in, line) || line != INDEX_HEADER) {
+        return;
+    }
+
+    while (getline(in, line)) {
+        const vector<string_view> fields = SplitFields(line, 6);
+        if (fields.size() == 5 && fields[0] == "O"sv) {
+            const optional<uint64_t> key = ParseKey(fields[1]);
+            const optional<uint64_t> size = ParseNumber<uint64_t>(fields[2]);
+            const optional<uint64_t> last_used = ParseNumber<uint64_t>(fields[3]);
+            const optional<uint64_t> hash = ParseKey(fields[4]);
+            if (key && size && last_used && hash) {
+                objects_[*key] = {*size, *last_used, *hash};
+                use_counter_ = max(use_counter_, *last_used);
+            }
+        } else if (fields.size() == 6 && fields[0] == "S"sv) {
+            const optional<uint64_t> options_hash = ParseKey(fields[1]);
+            const optional<uint64_t> size = ParseNumber<uint64_t>(fields[2]);
+            const optional<int64_t> mtime = ParseNumber<int64_t>(fields[3]);
+            const optional<uint64_t> key = ParseKey(fields[4]);
+            if (options_hash && size && mtime && key) {
+                sources_[{string(fields[5]), *options_hash}] = {*size, *mtime, *key};
+            }
+        }
+    }
+}
+
+// остатки прерванных запусков: временные файлы и файлы, не попавшие в индекс
+void ConversionCache::RemoveUnindexedObjects() {
+    error_code ec;
+    vector<img_lib::Path> unindexed;
+    for (fs::directory_iterator it(options_.dir / "objects", ec), end; !ec && it != end; it.increment(ec)) {
+        const optional<uint64_t> key = ParseKey(it->path().filename().string());
+        if (!key || objects_.count(*key) == 0) {
+            unindexed.push_back(it->path());
+        }
+    }
+    for (const img_lib::Path& path : unindexed) {
+        fs::remove(path, ec);
+    }
+}
+
+optional<uint64_t> ConversionCache::FindKey(const img_lib::Path& in_path, uint64_t options_hash) {
+    error_code ec;
+    const uint64_t size = fs::file_size(in_path, ec);
+    if (ec) {
+        return nullopt;
+    }
+    const int64_t mtime = GetModificationTime(in_path, ec);
+    const pair<string, uint64_t> source_id{fs::absolute(in_path, ec).lexically_normal().string(), options_hash};
+
+    if (!options_.verify) {
+        lock_guard lock(mutex_);
+        const auto it = sources_.find(source_id);
+        if (it != sources_.end() && it->second.size == size && it->second.mtime == mtime) {
+            return it->second.key;
+        }
+    }
+
+    const optional<uint64_t> content_hash = HashFile(in_path);
+    if (!content_hash) {
+        return nullopt;
+    }
+    const uint64_t key = HashValue(options_hash, *content_hash);
+
+    lock_guard lock(mutex_);
+    sources_[source_id] = {size, mtime, key};
+    return key;
+}
+
+bool ConversionCache::Restore(const img_lib::Path& object_path, const Object& object, const img_lib::Path& out_path) {
+    error_code ec;
+    if (fs::file_size(object_path, ec) != object.size || ec) {
+        return false;
+    }
+    if (options_.verify && HashFile(object_path) != object.hash) {
+        return false;
+    }
+
+    // выходной файл, который уже совпадает с кэшем, не переписывается
+    if (fs::equivalent(object_path, out_path, ec)
+        || (fs::file_size(out_path, ec) == object.size && !ec && HashFile(out_path) == object.hash)) {
+        lock_guard lock(mutex_);
+        ++stats_.up_to_date;
+        return true;
+    }
+
+    // Копия появляется рядом и переименованием заменяет выходной файл: он может быть
+    // жёсткой ссылкой на другой файл кэша или самим входным файлом, который нельзя терять
+    img_lib::Path temp_path = out_path;
+    {
+        lock_guard lock(mutex_);
+        temp_path += "."s + to_string(++temp_counter_) + ".tmp"s;
+    }
+    if (!PlaceFile(object_path, temp_path, options_.hard_link)) {
+        return false;
+    }
+    fs::rename(temp_path, out_path, ec);
+    if (ec) {
+        fs::remove(temp_path, ec);
+        return false;
+    }
+    lock_guard lock(mutex_);
+    ++stats_.hits;
+    return true;
+}
+
+void ConversionCache::Store(uint64_t key, const img_lib::Path& out_path) {
+    img_lib::Path temp_path;
+    {
+        lock_guard lock(mutex_);
+        temp_path = GetObjectPath(key);
+        temp_path += "."s + to_string(++temp_counter_) + ".tmp"s;
+    }
+
+    // файл кэша появляется под своим именем только целиком
+    error_code ec;
+    const optional<uint64_t> hash = HashFile(out_path);
+    const uint64_t size = fs::file_size(out_path, ec);
+    if (!hash || ec || !PlaceFile(out_path, temp_path, options_.hard_link)) {
+        return;
+    }
+    fs::rename(temp_path, GetObjectPath(key), ec);
+    if (ec) {
+        fs::remove(temp_path, ec);
+        return;
+    }
+
+    lock_guard lock(mutex_);
+    objects_[key] = {size, ++use_counter_, *hash};
+}
+
+ConversionStatus ConversionCache::Convert(const img_lib::Path& in_path, const img_lib::Path& out_path,
+                                          const ConvertOptions& options) {
+    ConvertOptions uncached = options;
+    uncached.cache = nullptr;
+
+    // неизвестный формат или нечитаемый входной файл - ошибку сообщит ConvertFile
+    const optional<uint64_t> options_hash = HashOptions(in_path, out_path, options);
+    const optional<uint64_t> key = options_hash ? FindKey(in_path, *options_hash) : nullopt;
+    if (!key) {
+        return ConvertFile(in_path, out_path, uncached);
+    }
+
+    const img_lib::Path object_path = GetObjectPath(*key);
+    optional<Object> object;
+    {
+        lock_guard lock(mutex_);
+        const auto it = objects_.find(*key);
+        if (it != objects_.end()) {
+            it->second.last_used = ++use_counter_;
+            object = it->second;
+        }
+    }
+    if (object) {
+        if (Restore(object_path, *object, out_path)) {
+            return ConversionStatus::OK;
+        }
+        // файл кэша пропал или повреждён: результат строится заново
+        lock_guard lock(mutex_);
+        objects_.erase(*key);
+    }
+
+    // Запись поверх жёсткой ссылки испортила бы файл кэша. Входной файл не удаляется:
+    // конвертацию файла в самого себя ConvertFile проводит через временный файл
+    error_code ec;
+    if (!fs::equivalent(in_path, out_path, ec)) {
+        fs::remove(out_path, ec);
+    }
+    const ConversionStatus status = ConvertFile(in_path, out_path, uncached);
+    if (status == ConversionStatus::OK) {
+        Store(*key, out_path);
+        lock_guard lock(mutex_);
+        ++stats_.misses;
+    }
+    return status;
+}
+
+bool ConversionCache::Save() {
+    lock_guard lock(mutex_);
+
+    if (options_.max_bytes > 0) {
+        uint64_t total_bytes = 0;
+        vector<pair<uint64_t, uint64_t>> by_use;  // last_used, key
+        for (const auto& [key, object] : objects_) {
+            total_bytes += object.size;
+            by_use.emplace_back(object.last_used, key);
+        }
+        sort(by_use.begin(), by_use.end());
+
+        error_code ec;
+        for (const auto& [last_used, key] : by_use) {
+            if (total_bytes <= options_.max_bytes) {
+                break;
+            }
+            fs::remove(GetObjectPath(key), ec);
+            total_bytes -= objects_[key].size;
+            objects_.erase(key);
+            ++stats_.evicted;
+        }
+    }
+
+    // ключи входных файлов без файла в кэше больше не нужны
+    for (auto it = sources_.begin(); it != sources_.end();) {
+        it = objects_.count(it->second.key) ? next(it) : sources_.erase(it);
+    }
+
+    // индекс заменяется целиком, чтобы прерванная запись не оставила его наполовину
+    const img_lib::Path index_path = options_.dir / "index";
+    img_lib::Path temp_path = index_path;
+    temp_path += ".tmp"s;
+    {
+        ofstream out(temp_path);
+        out << INDEX_HEADER << '\n';
+        for (const auto& [key, object] : objects_) {
+            out << "O\t"sv << FormatKey(key) << '\t' << object.size << '\t' << object.last_used << '\t'
+                << FormatKey(object.hash) << '\n';
+        }
+        for (const auto& [source_id, source] : sources_) {
+            out << "S\t"sv << FormatKey(source_id.second) << '\t' << source.size << '\t' << source.mtime << '\t'
+                << FormatKey(source.key) << '\t' << source_id.first << '\n';
+        }
+        if (!out.good()) {
+            return false;
+        }
+    }
+
+    error_code ec;
+    fs::rename(temp_path, index_path, ec);
+    return !ec;
+}
+
+CacheStats ConversionCache::GetStats() const {
+    lock_guard lock(mutex_);
+    return stats_;
+}
+
+}  // namespace converter
\ No newline at end of file
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "converter.h"
+
+#include <img_lib.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace converter {
+
+struct CacheOptions {
+    // каталог кэша: файл index и готовые выходные файлы в objects/
+    img_lib::Path dir;
+    // предельный объём выходных файлов в кэше, 0 - без ограничения.
+    // Лишние файлы удаляются при Save, начиная с давно не использованных
+    uint64_t max_bytes = 0;
+    // Перед использованием файл кэша перечитывается и сверяется с хешем из индекса,
+    // а входной файл хешируется заново, даже если его размер и время изменения не менялись
+    bool verify = false;
+    // Выходной файл делается жёсткой ссылкой на файл кэша вместо копии.
+    // Быстрее и не тратит место, но запись в выходной файл поверх испортит кэш
+    bool hard_link = false;
+};
+
+struct CacheStats {
+    size_t up_to_date = 0;  // выходной файл уже совпадает с кэшем
+    size_t hits = 0;        // выходной файл взят из кэша
+    size_t misses = 0;      // файл сконвертирован и добавлен в кэш
+    size_t evicted = 0;     // удалено из кэша по ограничению объёма
+};
+
+// Кэш результатов конвертации на диске. Ключ - хеш содержимого входного файла
+// вместе с форматом результата и опциями, влияющими на него. Для неизменившегося
+// входа результат берётся из кэша без декодирования, а если выходной файл уже
+// совпадает с кэшем, он не трогается вовсе.
+// Методы потокобезопасны; один каталог кэша не рассчитан на несколько процессов сразу
+class ConversionCache {
+public:
+    ConversionCache() = default;
+
+    ConversionCache(const ConversionCache&) = delete;
+    ConversionCache& operator=(const ConversionCache&) = delete;
+
+    // Создаёт каталог кэша, если его нет, и читает индекс. Файлы в objects/,
+    // которых нет в индексе, удаляются. false - если каталог недоступен
+    bool Open(const CacheOptions& options);
+
+    // То же, что ConvertFile, но с использованием кэша. options.cache не учитывается
+    ConversionStatus Convert(const img_lib::Path& in_path, const img_lib::Path& out_path,
+                             const ConvertOptions& options);
+
+    // Удаляет лишнее по ограничению объёма и записывает индекс.
+    // Без вызова Save результаты этого запуска при следующем не найдутся
+    bool Save();
+
+    CacheStats GetStats() const;
+
+private:
+    // готовый выходной файл в objects/
+    struct Object {
+        uint64_t size = 0;
+        uint64_t last_used = 0;
+        uint64_t hash = 0;
+    };
+
+    // размер и время изменения входного файла, когда был вычислен его ключ
+    struct Source {
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        uint64_t key = 0;
+    };
+
+    img_lib::Path GetObjectPath(uint64_t key) const;
+    std::optional<uint64_t> FindKey(const img_lib::Path& in_path, uint64_t options_hash);
+    // false - если файла в кэше нет или он повреждён
+    bool Restore(const img_lib::Path& object_path, const Object& object, const img_lib::Path& out_path);
+    void Store(uint64_t key, const img_lib::Path& out_path);
+    void LoadIndex();
+    void RemoveUnindexedObjects();
+
+    CacheOptions options_;
+    mutable std::mutex mutex_;
+    std::unordered_map<uint64_t, Object> objects_;
+    // ключ - путь входного файла и хеш опций
+    std::map<std::pair<std::string, uint64_t>, Source> sources_;
+    CacheStats stats_;
+    // счётчик обращений: чем больше last_used, тем позже объект использовался
+    uint64_t use_counter_ = 0;
+    // для имён временных файлов
+    uint64_t temp_counter_ = 0;
+};
+
+}  // namespace converter
\ No newline at end of file
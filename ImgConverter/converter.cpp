@@ -0,0 +1,367 @@
+#include "converter.h"
+#include "cache.h"
+#include "format_interface.h"
+
+#include <async_io.h>
+#include <tiled_image.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+using namespace std;
+
+namespace converter {
+
+string_view GetStatusMessage(ConversionStatus status) {
+    switch (status) {
+        case ConversionStatus::OK:
+            return "Successfully converted"sv;
+        case ConversionStatus::UNKNOWN_INPUT_FORMAT:
+            return "Unknown format of the input file."sv;
+        case ConversionStatus::UNKNOWN_OUTPUT_FORMAT:
+            return "Unknown format of the output file."sv;
+        case ConversionStatus::LOADING_FAILED:
+            return "Loading failed"sv;
+        case ConversionStatus::SAVING_FAILED:
+            return "Saving failed"sv;
+        case ConversionStatus::UNSUPPORTED_OPTIONS:
+            return "Lossless transforms need JPEG input and output and no resizing or pixel operations"sv;
+        case ConversionStatus::TRANSFORM_FAILED:
+            return "Lossless transform failed"sv;
+    }
+    return "Unknown status"sv;
+}
+
+// нулевая сторона target вычисляется по пропорциям изображения
+static img_lib::Size GetResizeTarget(img_lib::Size image, img_lib::Size target) {
+    const double aspect = static_cast<double>(image.width) / image.height;
+    if (target.width == 0) {
+        target.width = max(1, static_cast<int>(lround(target.height * aspect)));
+    } else if (target.height == 0) {
+        target.height = max(1, static_cast<int>(lround(target.width / aspect)));
+    }
+    return target;
+}
+
+// Источник, который запоминает ошибку чтения: при масштабировании потоком
+// иначе не понять, что не удалось - чтение или запись
+class TrackedSource : public img_lib::ScanlineSource {
+public:
+    explicit TrackedSource(img_lib::ScanlineSource& source)
+        : source_(source) {
+    }
+
+    img_lib::Size GetSize() const override {
+        return source_.GetSize();
+    }
+
+    bool ReadRow(img_lib::Color* row) override {
+        failed_ = failed_ || !source_.ReadRow(row);
+        return !failed_;
+    }
+
+    bool HasFailed() const {
+        return failed_;
+    }
+
+private:
+    img_lib::ScanlineSource& source_;
+    bool failed_ = false;
+};
+
+static uint64_t GetImageBytes(img_lib::Size size) {
+    return static_cast<uint64_t>(size.width) * size.height * sizeof(img_lib::Color);
+}
+
+static const format_interface::ImageFormatInterface* GetInputInterface(const img_lib::Path& in_path,
+                                                                       const ConvertOptions& options) {
+    return options.in_format ? format_interface::GetFormatInterface(*options.in_format)
+                             : format_interface::GetFormatInterface(in_path);
+}
+
+static const format_interface::ImageFormatInterface* GetOutputInterface(const img_lib::Path& out_path,
+                                                                        const ConvertOptions& options) {
+    return options.out_format ? format_interface::GetFormatInterface(*options.out_format)
+                              : format_interface::GetFormatInterface(out_path);
+}
+
+static format_interface::CodecOptions GetCodecOptions(const ConvertOptions& options) {
+    format_interface::CodecOptions codec_options;
+    codec_options.threads = options.codec_threads;
+    codec_options.jpeg_load = options.jpeg_load;
+    codec_options.jpeg_save = options.jpeg_save;
+    codec_options.ppm_save = options.ppm_save;
+    return codec_options;
+}
+
+// Поворот по EXIF требует изображения целиком или в тайлах: строки результата - столбцы файла
+static bool NeedsOrientation(const img_lib::Path& in_path, const ConvertOptions& options) {
+    return options.jpeg_load.auto_orient
+        && options.in_format.value_or(format_interface::GetFormatByExtension(in_path)) == format_interface::Format::JPEG
+        && img_lib::GetJPEGOrientation(in_path) != img_lib::ImageTransform::NONE;
+}
+
+// Масштабирование и многопоточные кодеки требуют изображения целиком,
+// если только оно не превышает ограничения памяти
+static bool NeedsImage(const ConvertOptions& options, bool needs_orientation) {
+    return options.max_size || options.resize || options.codec_threads != 1 || needs_orientation;
+}
+
+static bool ExceedsMemoryLimit(img_lib::Size size, const ConvertOptions& options) {
+    return options.memory_limit > 0 && GetImageBytes(size) > options.memory_limit;
+}
+
+static img_lib::TiledImageOptions GetTiledImageOptions(const ConvertOptions& options) {
+    img_lib::TiledImageOptions tiled_options;
+    tiled_options.memory_budget = static_cast<size_t>(options.memory_limit);
+    return tiled_options;
+}
+
+// Выходной файл совпадает со входным: запись обрезала бы вход раньше, чем он прочитан.
+// Результат пишется во временный файл рядом и затем заменяет вход
+static ConversionStatus ConvertInPlace(const img_lib::Path& in_path, const img_lib::Path& out_path,
+                                       const ConvertOptions& options) {
+    static atomic<uint64_t> temp_counter = 0;
+    img_lib::Path temp_path = out_path;
+    temp_path += "."s + to_string(++temp_counter) + ".tmp"s;
+
+    // формат определяется по имени итогового файла, а не временного
+    ConvertOptions temp_options = options;
+    temp_options.out_format = options.out_format.value_or(format_interface::GetFormatByExtension(out_path));
+
+    error_code ec;
+    const ConversionStatus status = ConvertFile(in_path, temp_path, temp_options);
+    if (status == ConversionStatus::OK) {
+        filesystem::rename(temp_path, out_path, ec);
+        if (!ec) {
+            return status;
+        }
+    }
+    filesystem::remove(temp_path, ec);
+    return status == ConversionStatus::OK ? ConversionStatus::SAVING_FAILED : status;
+}
+
+ConversionStatus ConvertFile(const img_lib::Path& in_path, const img_lib::Path& out_path,
+                             const ConvertOptions& options) {
+    if (options.cache) {
+        return options.cache->Convert(in_path, out_path, options);
+    }
+
+    // 1. Проверить формат входного файла
+    const format_interface::ImageFormatInterface* fmt_interface_in = GetInputInterface(in_path, options);
+    if (!fmt_interface_in) {
+        return ConversionStatus::UNKNOWN_INPUT_FORMAT;
+    }
+
+    // 2. Проверить формат выходного файла
+    const format_interface::ImageFormatInterface* fmt_interface_out = GetOutputInterface(out_path, options);
+    if (!fmt_interface_out) {
+        return ConversionStatus::UNKNOWN_OUTPUT_FORMAT;
+    }
+
+    error_code ec;
+    if (filesystem::equivalent(in_path, out_path, ec)) {
+        return ConvertInPlace(in_path, out_path, options);
+    }
+
+    // JPEG в JPEG без потерь: коэффициенты DCT переставляются без декодирования,
+    // поэтому ни масштабирование, ни другие форматы здесь невозможны
+    if (options.jpeg_transform) {
+        using format_interface::Format;
+        const Format in_format = options.in_format.value_or(format_interface::GetFormatByExtension(in_path));
+        const Format out_format = options.out_format.value_or(format_interface::GetFormatByExtension(out_path));
+        if (in_format != Format::JPEG || out_format != Format::JPEG || options.max_size || options.resize
+            || !options.pixel_ops.IsEmpty()) {
+            return ConversionStatus::UNSUPPORTED_OPTIONS;
+        }
+
+        img_lib::JpegTransformOptions transform = *options.jpeg_transform;
+        transform.restart_rows = options.jpeg_save.restart_rows;
+        transform.optimize_coding = options.jpeg_save.optimize_coding;
+        transform.progressive = options.jpeg_save.progressive;
+        if (!img_lib::TransformJPEG(in_path, out_path, transform)) {
+            return ConversionStatus::TRANSFORM_FAILED;
+        }
+        return ConversionStatus::OK;
+    }
+
+    const format_interface::CodecOptions codec_options = GetCodecOptions(options);
+
+    // 3. Загрузить изображение целиком, если оно нужно и не превышает ограничения памяти
+    const bool needs_orientation = NeedsOrientation(in_path, options);
+    const bool needs_image = NeedsImage(options, needs_orientation);
+    // Изображение сверх ограничения, которое нужно повернуть, складывается в тайлы
+    // с бюджетом memory_limit и читается из них по строкам уже повёрнутым
+    img_lib::TiledImage tiled;
+    unique_ptr<img_lib::ScanlineSource> source;
+    if (needs_image && options.memory_limit > 0) {
+        source = fmt_interface_in->OpenSource(in_path, codec_options);
+        if (!source) {
+            return ConversionStatus::LOADING_FAILED;
+        }
+        if (!ExceedsMemoryLimit(source->GetSize(), options)) {
+            source.reset();
+        } else if (needs_orientation) {
+            tiled = img_lib::ReadTiledImage(*source, GetTiledImageOptions(options));
+            if (!tiled) {
+                return ConversionStatus::LOADING_FAILED;
+            }
+            source = make_unique<img_lib::TiledImageSource>(tiled, img_lib::GetJPEGOrientation(in_path));
+        }
+    }
+
+    if (needs_image && !source) {
+        img_lib::Image image = options.max_size
+            ? fmt_interface_in->LoadThumbnail(in_path, *options.max_size, codec_options)
+            : fmt_interface_in->LoadImage(in_path, codec_options);
+        if (!image) {
+            return ConversionStatus::LOADING_FAILED;
+        }
+        if (options.resize) {
+            const img_lib::Size image_size{image.GetWidth(), image.GetHeight()};
+            image = img_lib::Resize(image, GetResizeTarget(image_size, *options.resize), options.resize_options);
+        }
+        options.pixel_ops.Apply(image, options.resize_options.threads);
+        if (!fmt_interface_out->SaveImage(out_path, image, codec_options)) {
+            return ConversionStatus::SAVING_FAILED;
+        }
+        return ConversionStatus::OK;
+    }
+
+    // 4. Открыть декодер. Изображение целиком не загружается:
+    // строки по одной передаются из декодера в кодировщик
+    if (!source) {
+        source = fmt_interface_in->OpenSource(in_path, codec_options);
+    }
+    if (!source) {
+        return ConversionStatus::LOADING_FAILED;
+    }
+
+    const img_lib::Size src_size = source->GetSize();
+    img_lib::Size size = options.max_size ? img_lib::FitWithin(src_size, *options.max_size) : src_size;
+    if (options.resize) {
+        size = GetResizeTarget(size, *options.resize);
+    }
+    unique_ptr<img_lib::ScanlineSink> file_sink = fmt_interface_out->CreateSink(out_path, size, codec_options);
+    if (!file_sink) {
+        return ConversionStatus::SAVING_FAILED;
+    }
+    // операции выполняются над каждой строкой перед кодированием, пока она в кэше
+    const img_lib::FusedPixelOps pixel_ops(options.pixel_ops);
+    img_lib::PixelOpsSink ops_sink(*file_sink, pixel_ops);
+    img_lib::ScanlineSink* sink = pixel_ops.IsEmpty() ? file_sink.get() : &ops_sink;
+
+    if (size.width != src_size.width || size.height != src_size.height) {
+        TrackedSource tracked(*source);
+        if (!img_lib::Resize(tracked, size, *sink, options.resize_options)) {
+            return tracked.HasFailed() ? ConversionStatus::LOADING_FAILED : ConversionStatus::SAVING_FAILED;
+        }
+        return ConversionStatus::OK;
+    }
+
+    // 5. Перекачать строки
+    vector<img_lib::Color> row(size.width);
+    for (int y = 0; y < size.height; ++y) {
+        if (!source->ReadRow(row.data())) {
+            return ConversionStatus::LOADING_FAILED;
+        }
+        if (!sink->WriteRow(row.data())) {
+            return ConversionStatus::SAVING_FAILED;
+        }
+    }
+
+    if (!sink->Finish()) {
+        return ConversionStatus::SAVING_FAILED;
+    }
+
+    return ConversionStatus::OK;
+}
+
+uint64_t EstimateMemory(const img_lib::Path& in_path, const img_lib::Path& out_path, const ConvertOptions& options) {
+    const format_interface::ImageFormatInterface* fmt_interface_in = GetInputInterface(in_path, options);
+    const format_interface::ImageFormatInterface* fmt_interface_out = GetOutputInterface(out_path, options);
+    if (!fmt_interface_in || !fmt_interface_out) {
+        return 0;
+    }
+
+    // TransformJPEG держит коэффициенты исходного и преобразованного изображения
+    if (options.jpeg_transform) {
+        const optional<img_lib::ImageInfo> info = img_lib::ProbeJPEG(in_path, options.jpeg_load);
+        return info ? info->decoder_bytes + 2 * info->coefficient_bytes + img_lib::WriteBehindFile::GetMaxBufferBytes()
+                    : 0;
+    }
+
+    const format_interface::CodecOptions codec_options = GetCodecOptions(options);
+    const optional<img_lib::ImageInfo> info = fmt_interface_in->ReadInfo(in_path, nullopt, codec_options);
+    if (!info) {
+        return 0;
+    }
+
+    const bool needs_orientation = NeedsOrientation(in_path, options);
+    const bool needs_image = NeedsImage(options, needs_orientation);
+    if (!needs_image || ExceedsMemoryLimit(info->size, options)) {
+        // строки идут от декодера к кодировщику, масштабирование держит только окно строк;
+        // поворот идёт через тайлы, часть которых вытесняется на диск
+        const img_lib::Size src_size = info->size;
+        img_lib::Size size = options.max_size ? img_lib::FitWithin(src_size, *options.max_size) : src_size;
+        if (options.resize) {
+            size = GetResizeTarget(size, *options.resize);
+        }
+        uint64_t total = info->decoder_bytes + fmt_interface_out->EstimateSaveMemory(size, codec_options);
+        if (needs_orientation) {
+            total += img_lib::TiledImage::GetMaxTileBytes(src_size, GetTiledImageOptions(options))
+                + static_cast<uint64_t>(src_size.width + src_size.height) * sizeof(img_lib::Color);
+        }
+        if (size.width != src_size.width || size.height != src_size.height) {
+            total += img_lib::EstimateResizeMemory(src_size, size, options.resize_options, true);
+        } else {
+            total += static_cast<uint64_t>(size.width) * sizeof(img_lib::Color);
+        }
+        return total;
+    }
+
+    // Изображение целиком: каждый шаг создаёт новое, пока предыдущее ещё в памяти.
+    // live - память под текущее изображение, peak - наибольшая сумма за все шаги
+    optional<img_lib::ImageInfo> loaded = info;
+    if (options.max_size) {
+        loaded = fmt_interface_in->ReadInfo(in_path, options.max_size, codec_options);
+        if (!loaded) {
+            return 0;
+        }
+    }
+    img_lib::Size size = loaded->size;
+    uint64_t live = 0;
+    uint64_t peak = 0;
+    // work - вся память шага вместе с результатом
+    const auto step = [&live, &peak](uint64_t work, uint64_t result) {
+        peak = max(peak, live + work);
+        live = result;
+    };
+
+    step(loaded->decoder_bytes + GetImageBytes(size), GetImageBytes(size));
+    if (needs_orientation) {
+        step(GetImageBytes(size), GetImageBytes(size));
+    }
+    if (options.max_size) {
+        const img_lib::Size target = img_lib::FitWithin(size, *options.max_size);
+        if (target.width != size.width || target.height != size.height) {
+            step(img_lib::EstimateResizeMemory(size, target), GetImageBytes(target));
+            size = target;
+        }
+    }
+    if (options.resize) {
+        const img_lib::Size target = GetResizeTarget(size, *options.resize);
+        step(img_lib::EstimateResizeMemory(size, target, options.resize_options), GetImageBytes(target));
+        size = target;
+    }
+    step(fmt_interface_out->EstimateSaveMemory(size, codec_options), 0);
+    return peak;
+}
+
+}  // namespace converter
\ No newline at end of file
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "format_interface.h"
+
+#include <img_lib.h>
+#include <jpeg_image.h>
+#include <pixel_ops.h>
+#include <ppm_image.h>
+#include <resample.h>
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+namespace converter {
+
+class ConversionCache;
+
+// Результат конвертации одного файла.
+// Значения совпадают с кодами возврата imgconv в режиме одного файла
+enum class ConversionStatus {
+    OK = 0,
+    UNKNOWN_INPUT_FORMAT = 2,
+    UNKNOWN_OUTPUT_FORMAT = 3,
+    LOADING_FAILED = 4,
+    SAVING_FAILED = 5,
+    // преобразование без потерь запрошено не для JPEG в JPEG, вместе с масштабированием
+    // или с поточечными операциями
+    UNSUPPORTED_OPTIONS = 7,
+    TRANSFORM_FAILED = 8
+};
+
+std::string_view GetStatusMessage(ConversionStatus status);
+
+struct ConvertOptions {
+    // если задано, изображение уменьшается, чтобы вписаться в этот размер
+    std::optional<img_lib::Size> max_size;
+    // если задано, изображение масштабируется до этого размера;
+    // нулевая сторона вычисляется по пропорциям исходного изображения
+    std::optional<img_lib::Size> resize;
+    img_lib::ResizeOptions resize_options;
+    // Потоков на кодирование и декодирование одного файла, 0 - по числу ядер.
+    // Если больше одного, изображение загружается целиком, а не передаётся построчно
+    size_t codec_threads = 1;
+    // Если больше нуля, изображение, которое заняло бы в памяти больше стольких байт,
+    // не загружается целиком: масштабирование идёт потоком, кодеки - в одном потоке.
+    // JPEG, повёрнутый по EXIF (jpeg_load.auto_orient), загружается целиком всегда
+    uint64_t memory_limit = 0;
+    // параметры кодека JPEG (--jpeg-*); threads и max_size в них не учитываются
+    img_lib::JpegLoadOptions jpeg_load;
+    img_lib::JpegSaveOptions jpeg_save;
+    // разновидность сохраняемого PPM (--ppm-*); threads в ней не учитывается
+    img_lib::PpmSaveOptions ppm_save;
+    // Поточечные операции (--op) в порядке записи. Выполняются над пикселями результата,
+    // после масштабирования, за один проход вместе с загрузкой или сохранением строк
+    img_lib::PixelPipeline pixel_ops;
+    // Если задано, JPEG преобразуется в JPEG без перекодирования (--lossless, --crop,
+    // --jpeg-metadata). Параметры записи берутся из jpeg_save, а не из этой структуры
+    std::optional<img_lib::JpegTransformOptions> jpeg_transform;
+    // если заданы, формат файла берётся отсюда, а не из расширения
+    std::optional<format_interface::Format> in_format;
+    std::optional<format_interface::Format> out_format;
+    // если задан, результат берётся из кэша или кладётся в него (cache.h)
+    ConversionCache* cache = nullptr;
+};
+
+// Конвертирует один файл, формат определяется по расширениям или по опциям.
+// Функция потокобезопасна и может вызываться из нескольких потоков
+ConversionStatus ConvertFile(const img_lib::Path& in_path, const img_lib::Path& out_path,
+                             const ConvertOptions& options = {});
+
+// Оценка наибольшей памяти, которую займёт ConvertFile с теми же аргументами: изображения
+// и промежуточные результаты, буферы кодеков и файлов. Читаются только заголовки файла,
+// кэш не учитывается. 0 - если формат не определён или заголовок не читается:
+// такая конвертация завершится ошибкой, не заняв памяти
+uint64_t EstimateMemory(const img_lib::Path& in_path, const img_lib::Path& out_path,
+                        const ConvertOptions& options = {});
+
+}  // namespace converter
\ No newline at end of file
@@ -0,0 +1,203 @@
+#include "format_interface.h"
+
+#include <async_io.h>
+#include <jpeg_image.h>
+#include <ppm_image.h>
+#include <bmp_image.h>
+#include <resample.h>
+
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+namespace format_interface {
+
+Format GetFormatByName(string_view name) {
+    if (name == "jpg"sv || name == "jpeg"sv) {
+        return Format::JPEG;
+    }
+
+    // PGM и PNM читаются тем же кодеком: разновидность задаёт сигнатура файла
+    if (name == "ppm"sv || name == "pgm"sv || name == "pnm"sv) {
+        return Format::PPM;
+    }
+
+    if (name == "bmp"sv) {
+        return Format::BMP;
+    }
+
+    return Format::UNKNOWN;
+}
+
+Format GetFormatByExtension(const img_lib::Path& input_file) {
+    const string ext = input_file.extension().string();
+    if (ext.empty()) {
+        return Format::UNKNOWN;
+    }
+    return GetFormatByName(string_view(ext).substr(1));
+}
+
+
+img_lib::Image ImageFormatInterface::LoadThumbnail(const img_lib::Path& file, img_lib::Size max_size,
+                                                   const CodecOptions& options) const {
+    CodecOptions load_options = options;
+    load_options.threads = 1;
+    img_lib::Image image = LoadImage(file, load_options);
+    if (!image) {
+        return image;
+    }
+
+    const img_lib::Size size = img_lib::FitWithin({image.GetWidth(), image.GetHeight()}, max_size);
+    if (size.width == image.GetWidth() && size.height == image.GetHeight()) {
+        return image;
+    }
+    return img_lib::Resize(image, size);
+}
+
+uint64_t ImageFormatInterface::EstimateSaveMemory(img_lib::Size size, const CodecOptions&) const {
+    return img_lib::WriteBehindFile::GetMaxBufferBytes() + static_cast<uint64_t>(size.width) * sizeof(img_lib::Color);
+}
+
+
+class PpmFormatInterface : public ImageFormatInterface {
+public:
+    bool SaveImage(const img_lib::Path& file, img_lib::ImageView image, const CodecOptions& options) const override {
+        img_lib::PpmSaveOptions ppm_options = options.ppm_save;
+        ppm_options.threads = options.threads;
+        return img_lib::SavePPM(file, image, ppm_options);
+    }
+
+    img_lib::Image LoadImage(const img_lib::Path& file, const CodecOptions&) const override {
+        return img_lib::LoadPPM(file);
+    }
+
+    std::unique_ptr<img_lib::ScanlineSource> OpenSource(const img_lib::Path& file,
+                                                        const CodecOptions&) const override {
+        return img_lib::OpenPPMSource(file);
+    }
+
+    std::unique_ptr<img_lib::ScanlineSink> CreateSink(const img_lib::Path& file, img_lib::Size size,
+                                                      const CodecOptions& options) const override {
+        return img_lib::CreatePPMSink(file, size, options.ppm_save);
+    }
+
+    std::optional<img_lib::ImageInfo> ReadInfo(const img_lib::Path& file, std::optional<img_lib::Size>,
+                                               const CodecOptions&) const override {
+        return img_lib::ProbePPM(file);
+    }
+};
+
+
+class JpegFormatInterface : public ImageFormatInterface {
+public:
+    bool SaveImage(const img_lib::Path& file, img_lib::ImageView image, const CodecOptions& options) const override {
+        img_lib::JpegSaveOptions jpeg_options = options.jpeg_save;
+        jpeg_options.threads = options.threads;
+        return img_lib::SaveJPEG(file, image, jpeg_options);
+    }
+
+    img_lib::Image LoadImage(const img_lib::Path& file, const CodecOptions& options) const override {
+        img_lib::JpegLoadOptions jpeg_options = options.jpeg_load;
+        jpeg_options.max_size.reset();
+        jpeg_options.threads = options.threads;
+        return img_lib::LoadJPEG(file, jpeg_options);
+    }
+
+    // JPEG уменьшается прямо в декодере
+    img_lib::Image LoadThumbnail(const img_lib::Path& file, img_lib::Size max_size,
+                                 const CodecOptions& options) const override {
+        img_lib::JpegLoadOptions jpeg_options = options.jpeg_load;
+        jpeg_options.max_size = max_size;
+        return img_lib::LoadJPEG(file, jpeg_options);
+    }
+
+    std::unique_ptr<img_lib::ScanlineSource> OpenSource(const img_lib::Path& file,
+                                                        const CodecOptions& options) const override {
+        img_lib::JpegLoadOptions jpeg_options = options.jpeg_load;
+        jpeg_options.max_size.reset();
+        return img_lib::OpenJPEGSource(file, jpeg_options);
+    }
+
+    std::unique_ptr<img_lib::ScanlineSink> CreateSink(const img_lib::Path& file, img_lib::Size size,
+                                                      const CodecOptions& options) const override {
+        return img_lib::CreateJPEGSink(file, size, options.jpeg_save);
+    }
+
+    std::optional<img_lib::ImageInfo> ReadInfo(const img_lib::Path& file, std::optional<img_lib::Size> max_size,
+                                               const CodecOptions& options) const override {
+        img_lib::JpegLoadOptions jpeg_options = options.jpeg_load;
+        jpeg_options.max_size = max_size;
+        // LoadJPEG поворачивает изображение после декодирования, и max_size задан для повёрнутого
+        const img_lib::ImageTransform orientation = jpeg_options.auto_orient
+            ? img_lib::GetJPEGOrientation(file)
+            : img_lib::ImageTransform::NONE;
+        if (max_size) {
+            jpeg_options.max_size = img_lib::GetTransformedSize(*max_size, orientation);
+        }
+        std::optional<img_lib::ImageInfo> info = img_lib::ProbeJPEG(file, jpeg_options);
+        if (info) {
+            info->size = img_lib::GetTransformedSize(info->size, orientation);
+        }
+        return info;
+    }
+
+    uint64_t EstimateSaveMemory(img_lib::Size size, const CodecOptions& options) const override {
+        return img_lib::EstimateJPEGSaveMemory(size, options.jpeg_save);
+    }
+};
+
+
+class BmpFormatInterface : public ImageFormatInterface {
+public:
+    bool SaveImage(const img_lib::Path& file, img_lib::ImageView image, const CodecOptions& options) const override {
+        img_lib::BmpSaveOptions bmp_options;
+        bmp_options.threads = options.threads;
+        return img_lib::SaveBMP(file, image, bmp_options);
+    }
+
+    img_lib::Image LoadImage(const img_lib::Path& file, const CodecOptions&) const override {
+        return img_lib::LoadBMP(file);
+    }
+
+    std::unique_ptr<img_lib::ScanlineSource> OpenSource(const img_lib::Path& file,
+                                                        const CodecOptions&) const override {
+        return img_lib::OpenBMPSource(file);
+    }
+
+    std::unique_ptr<img_lib::ScanlineSink> CreateSink(const img_lib::Path& file, img_lib::Size size,
+                                                      const CodecOptions&) const override {
+        return img_lib::CreateBMPSink(file, size);
+    }
+
+    std::optional<img_lib::ImageInfo> ReadInfo(const img_lib::Path& file, std::optional<img_lib::Size>,
+                                               const CodecOptions&) const override {
+        return img_lib::ProbeBMP(file);
+    }
+};
+
+
+const ImageFormatInterface* GetFormatInterface(const img_lib::Path& path) {
+    return GetFormatInterface(GetFormatByExtension(path));
+}
+
+const ImageFormatInterface* GetFormatInterface(Format format) {
+    // статические переменные живут на протяжении всей жизни программы,
+    // так что при пакетной обработке интерфейсы не создаются заново для каждого файла
+    static const PpmFormatInterface ppm_interface;
+    static const JpegFormatInterface jpeg_interface;
+    static const BmpFormatInterface bmp_interface;
+
+    switch (format) {
+        case Format::PPM:
+            return &ppm_interface;
+        case Format::JPEG:
+            return &jpeg_interface;
+        case Format::BMP:
+            return &bmp_interface;
+        default:
+            return nullptr;
+    }
+}
+
+}  // namespace format_interface
\ No newline at end of file
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <img_lib.h>
+#include <jpeg_image.h>
+#include <ppm_image.h>
+#include <scanline.h>
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+
+namespace format_interface {
+
+enum class Format{
+    PPM,
+    JPEG,
+    BMP,
+    UNKNOWN
+};
+
+Format GetFormatByExtension(const img_lib::Path& input_file);
+// формат по имени без точки: jpg, jpeg, ppm, pgm, pnm или bmp
+Format GetFormatByName(std::string_view name);
+
+// параметры загрузки и сохранения изображения
+struct CodecOptions {
+    // потоков на одно изображение, 0 - по числу ядер; форматы без
+    // параллельной реализации и построчный доступ это значение игнорируют
+    size_t threads = 1;
+    // параметры libjpeg; их поля threads и max_size не учитываются
+    img_lib::JpegLoadOptions jpeg_load;
+    img_lib::JpegSaveOptions jpeg_save;
+    // разновидность и наибольшее значение сохраняемого PPM; поле threads не учитывается
+    img_lib::PpmSaveOptions ppm_save;
+};
+
+
+class ImageFormatInterface {
+public:
+    virtual ~ImageFormatInterface() = default;
+
+    virtual bool SaveImage(const img_lib::Path& file, img_lib::ImageView image, const CodecOptions& options) const = 0;
+    virtual img_lib::Image LoadImage(const img_lib::Path& file, const CodecOptions& options) const = 0;
+
+    // Загружает изображение, уменьшенное так, чтобы вписаться в max_size.
+    // По умолчанию загружает изображение целиком и масштабирует его
+    virtual img_lib::Image LoadThumbnail(const img_lib::Path& file, img_lib::Size max_size,
+                                         const CodecOptions& options) const;
+
+    // построчный доступ: конвертер передаёт строки от декодера к кодировщику,
+    // не создавая изображение целиком
+    virtual std::unique_ptr<img_lib::ScanlineSource> OpenSource(const img_lib::Path& file,
+                                                                const CodecOptions& options) const = 0;
+    virtual std::unique_ptr<img_lib::ScanlineSink> CreateSink(const img_lib::Path& file, img_lib::Size size,
+                                                              const CodecOptions& options) const = 0;
+
+    // Читает заголовок, не декодируя пикселей: размер изображения, которое вернёт LoadImage
+    // или, если задан max_size, LoadThumbnail перед окончательным масштабированием,
+    // и память декодера. nullopt - если файл не открывается или заголовок некорректен
+    virtual std::optional<img_lib::ImageInfo> ReadInfo(const img_lib::Path& file,
+                                                       std::optional<img_lib::Size> max_size,
+                                                       const CodecOptions& options) const = 0;
+    // Оценка памяти на сохранение изображения size сверх самого изображения.
+    // По умолчанию - буферы отложенной записи файла и одна строка
+    virtual uint64_t EstimateSaveMemory(img_lib::Size size, const CodecOptions& options) const;
+};
+
+
+// Возвращает указатель на интерфейс нужного формата или nullptr,
+// если формат не удалось определить.
+// Интерфейсы не хранят состояния, поэтому один и тот же объект
+// можно использовать одновременно из нескольких потоков
+const ImageFormatInterface* GetFormatInterface(const img_lib::Path& path);
+const ImageFormatInterface* GetFormatInterface(Format format);
+
+}  // namespace format_interface
\ No newline at end of file
@@ -1,154 +1,384 @@
-// Программа для конвертации JPEG в PPM
+// Программа для конвертации изображений между форматами JPEG, PPM и BMP
+
+#include "batch.h"
+#include "cache.h"
+#include "converter.h"
+#include "options.h"
+#include "server.h"
 
 #include <img_lib.h>
-#include <jpeg_image.h>
-#include <ppm_image.h>
-#include <bmp_image.h>
+#include <resample.h>
+#include <stats.h>
 
+#include <algorithm>
+#include <fstream>
+#include <iostream>
 #include <filesystem>
+#include <optional>
+#include <string>
 #include <string_view>
-#include <iostream>
+#include <system_error>
+#include <vector>
 
 using namespace std;
 
 
-namespace format_interface {
-
-
-enum class Format{
-    PPM,
-    JPEG,
-    BMP,
-    UNKNOWN
-};
+namespace {
+
+// код возврата пакетного режима, если хотя бы один файл не сконвертирован
+constexpr int BATCH_FAILED_CODE = 6;
+
+void PrintUsage(string_view program) {
+    cerr << "Usage: "sv << program << " [options] <in_file> <out_file>"sv << endl;
+    cerr << "       "sv << program << " --batch [-j N] [--max-memory N] [--report <file>] [options] <dir|glob> <out_dir> <out_ext>"sv << endl;
+    cerr << "       "sv << program << " --batch [-j N] [--max-memory N] [--report <file>] [options] --manifest <file>"sv << endl;
+    cerr << "       "sv << program << " --serve [-j N] [--max-memory N] [--socket <path>] [options]"sv << endl;
+    cerr << "       "sv << program << " --client <socket> [options] <in_file> <out_file>"sv << endl;
+    cerr << "Options:"sv << endl;
+    cerr << "  --max-size WxH   fit the image into WxH, JPEG is downscaled while decoding"sv << endl;
+    cerr << "  --resize WxH     resize the image to WxH, 0 for one side keeps the aspect ratio"sv << endl;
+    cerr << "  --filter <name>  nearest, bilinear, bicubic or lanczos3 (default: bilinear)"sv << endl;
+    cerr << "  --threads N      threads per image for codecs and resizing, 0 for all cores"sv << endl;
+    cerr << "  --memory-limit N[K|M|G]  stream and resize row by row images larger than this when decoded"sv << endl;
+    cerr << "  --max-memory N[K|M|G]  batch and server: run at once only jobs whose estimated memory,"sv << endl;
+    cerr << "                   read from the file headers, fits into N; smaller jobs fill in around large ones"sv << endl;
+    cerr << "  --in-format <f>  --out-format <f>  jpg, ppm, pgm, pnm or bmp instead of the file extension"sv << endl;
+    cerr << "  --jpeg-preset <p>  fast, balanced (default) or small; later --jpeg-* options refine it"sv << endl;
+    cerr << "  --jpeg-quality N   1..100 (default: 75)"sv << endl;
+    cerr << "  --jpeg-dct <m>     islow (default), ifast or float, for decoding and encoding"sv << endl;
+    cerr << "  --jpeg-subsampling 444|422|420  chroma subsampling of the output (default: 420)"sv << endl;
+    cerr << "  --jpeg-restart-rows N  restart marker every N MCU rows, 0 for none"sv << endl;
+    cerr << "  --jpeg-fancy-upsampling on|off  --jpeg-block-smoothing on|off  decoder quality knobs"sv << endl;
+    cerr << "  --jpeg-auto-orient on|off  rotate by the EXIF orientation; rotated images are loaded whole"sv << endl;
+    cerr << "                   or, above --memory-limit, go through tiles paged to a temporary file"sv << endl;
+    cerr << "  --jpeg-optimize on|off  --jpeg-progressive on|off  smaller output, slower encoding"sv << endl;
+    cerr << "  --ppm-format <f> p6 (default), p5 (grayscale), p3 or p2 (the same as text); any is read"sv << endl;
+    cerr << "  --ppm-maxval N   largest PPM sample value, 1..65535; above 255 samples take two bytes"sv << endl;
+    cerr << "  --lossless <t>   JPEG to JPEG without re-encoding: none, flip-h, flip-v, rot90, rot180, rot270,"sv << endl;
+    cerr << "                   transpose or transverse; edge blocks that cannot be mirrored are trimmed"sv << endl;
+    cerr << "  --crop WxH+X+Y   lossless JPEG crop, the corner is moved up and left to the MCU boundary"sv << endl;
+    cerr << "  --jpeg-metadata keep|strip  copy EXIF, ICC and comments in lossless mode (default: keep)"sv << endl;
+    cerr << "  --op <op>        per-pixel operation, repeat to chain them; applied after resizing in one pass:"sv << endl;
+    cerr << "                   grayscale, invert, gamma=G, brightness=B, contrast=C, swap=bgra, alpha=N"sv << endl;
+    cerr << "  --cache <dir>    reuse results of earlier runs for unchanged inputs and options"sv << endl;
+    cerr << "  --cache-max-size N[K|M|G]  drop least recently used cache entries above this size"sv << endl;
+    cerr << "  --cache-verify   re-hash inputs and check cached files before using them"sv << endl;
+    cerr << "  --cache-link     hard-link outputs to cached files instead of copying"sv << endl;
+    cerr << "  --stats          print per-stage timings, I/O and memory counters as JSON to stderr"sv << endl;
+}
 
+// опция с некорректным или пропущенным значением
+void PrintOptionError(const vector<string_view>& args, size_t i, string_view program) {
+    if (converter::IsMissingConvertValue(args, i) || converter::IsMissingCacheValue(args, i)) {
+        cerr << "Missing value for "sv << args[i] << endl;
+        return;
+    }
+    PrintUsage(program);
+}
 
-Format GetFormatByExtension(const img_lib::Path& input_file) {
-    const string ext = input_file.extension().string();
-    if (ext == ".jpg"sv || ext == ".jpeg"sv) {
-        return Format::JPEG;
+int RunSingle(const vector<string_view>& args, string_view program, converter::ConversionCache* cache) {
+    converter::ConvertOptions options;
+    options.cache = cache;
+    vector<string_view> positional;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        bool handled = false;
+        if (!converter::ParseConvertOption(args, i, options, handled)) {
+            PrintOptionError(args, i, program);
+            return 1;
+        }
+        if (!handled) {
+            positional.push_back(args[i]);
+        }
     }
 
-    if (ext == ".ppm"sv) {
-        return Format::PPM;
+    // Проверить количество аргументов
+    if (positional.size() != 2) {
+        PrintUsage(program);
+        return 1;
     }
 
-    if (ext == ".bmp"sv) {
-        return Format::BMP;
+    const converter::ConversionStatus status = converter::ConvertFile(string(positional[0]), string(positional[1]), options);
+    if (status != converter::ConversionStatus::OK) {
+        cerr << converter::GetStatusMessage(status) << endl;
+        return static_cast<int>(status);
     }
 
-    return Format::UNKNOWN;
+    cout << converter::GetStatusMessage(status) << endl;
+    return 0;
 }
 
+int RunBatch(const vector<string_view>& args, string_view program, converter::ConversionCache* cache) {
+    size_t thread_count = 0;
+    uint64_t max_memory = 0;
+    converter::ConvertOptions options;
+    options.cache = cache;
+    optional<img_lib::Path> report_path;
+    optional<img_lib::Path> manifest_path;
+    vector<string_view> positional;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        const string_view arg = args[i];
+        const bool has_value = i + 1 < args.size();
+        bool handled = false;
+        if (!converter::ParseConvertOption(args, i, options, handled)) {
+            PrintOptionError(args, i, program);
+            return 1;
+        }
+        if (handled) {
+            continue;
+        }
+
+        if ((arg == "-j"sv || arg == "--jobs"sv) && has_value) {
+            const optional<size_t> count = converter::ParseCount(args[++i]);
+            if (!count) {
+                PrintUsage(program);
+                return 1;
+            }
+            thread_count = *count;
+        } else if (arg == "--max-memory"sv && has_value) {
+            const optional<uint64_t> budget = converter::ParseByteSize(args[++i]);
+            if (!budget) {
+                PrintUsage(program);
+                return 1;
+            }
+            max_memory = *budget;
+        } else if (arg == "--report"sv && has_value) {
+            report_path = string(args[++i]);
+        } else if (arg == "--manifest"sv && has_value) {
+            manifest_path = string(args[++i]);
+        } else {
+            positional.push_back(arg);
+        }
+    }
 
-class ImageFormatInterface {
-public:
-    virtual bool SaveImage(const img_lib::Path& file, const img_lib::Image& image) const = 0;
-    virtual img_lib::Image LoadImage(const img_lib::Path& file) const = 0;
-}; 
-
+    optional<vector<converter::BatchJob>> jobs;
+    if (manifest_path && positional.empty()) {
+        jobs = converter::ReadManifest(*manifest_path);
+    } else if (!manifest_path && positional.size() == 3) {
+        jobs = converter::CollectJobs(string(positional[0]), string(positional[1]), string(positional[2]));
+    } else {
+        PrintUsage(program);
+        return 1;
+    }
 
-class PpmFormatInterface : public ImageFormatInterface {
-public:
-    bool SaveImage(const img_lib::Path& file, const img_lib::Image& image) const override {
-        return img_lib::SavePPM(file, image);
+    if (!jobs) {
+        cerr << "Cannot read the list of files to convert"sv << endl;
+        return 1;
+    }
+    const vector<converter::JobConflict> conflicts = converter::FindJobConflicts(*jobs);
+    for (const converter::JobConflict& conflict : conflicts) {
+        const converter::BatchJob& writer = (*jobs)[conflict.writer];
+        const converter::BatchJob& other = (*jobs)[conflict.other];
+        if (conflict.reads_output) {
+            cerr << "Output file "sv << writer.out_path << " of "sv << writer.in_path
+                 << " is the input of another job"sv << endl;
+        } else {
+            cerr << "Output file "sv << other.out_path << " would be written from both "sv
+                 << writer.in_path << " and "sv << other.in_path << endl;
+        }
+    }
+    if (!conflicts.empty()) {
+        return 1;
     }
 
-    virtual img_lib::Image LoadImage(const img_lib::Path& file) const override{
-        return img_lib::LoadPPM(file);
+    const vector<converter::BatchResult> results = converter::RunBatch(*jobs, thread_count, options, max_memory);
+
+    converter::PrintReport(results, cout);
+    if (cache) {
+        const converter::CacheStats stats = cache->GetStats();
+        cout << "# cache: "sv << stats.up_to_date << " up to date, "sv << stats.hits << " restored, "sv
+             << stats.misses << " converted"sv << endl;
+    }
+    if (report_path) {
+        ofstream report(*report_path);
+        converter::PrintReport(results, report);
+        if (!report.good()) {
+            cerr << "Cannot write the report"sv << endl;
+        }
     }
-};
 
+    for (const converter::BatchResult& result : results) {
+        if (result.status != converter::ConversionStatus::OK) {
+            return BATCH_FAILED_CODE;
+        }
+    }
+    return 0;
+}
 
-class JpegFormatInterface : public ImageFormatInterface {
-public:
-    bool SaveImage(const img_lib::Path& file, const img_lib::Image& image) const override {
-        return img_lib::SaveJPEG(file, image);
+// Сервер читает запросы из stdin или из Unix-сокета; протокол описан в server.h
+int RunServe(const vector<string_view>& args, string_view program, converter::ConversionCache* cache) {
+    converter::ServerOptions options;
+    options.defaults.cache = cache;
+    optional<img_lib::Path> socket_path;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        const string_view arg = args[i];
+        const bool has_value = i + 1 < args.size();
+        bool handled = false;
+        if (!converter::ParseConvertOption(args, i, options.defaults, handled)) {
+            PrintOptionError(args, i, program);
+            return 1;
+        }
+        if (handled) {
+            continue;
+        }
+
+        if ((arg == "-j"sv || arg == "--jobs"sv) && has_value) {
+            const optional<size_t> count = converter::ParseCount(args[++i]);
+            if (!count) {
+                PrintUsage(program);
+                return 1;
+            }
+            options.thread_count = *count;
+        } else if (arg == "--max-memory"sv && has_value) {
+            const optional<uint64_t> budget = converter::ParseByteSize(args[++i]);
+            if (!budget) {
+                PrintUsage(program);
+                return 1;
+            }
+            options.max_memory = *budget;
+        } else if (arg == "--socket"sv && has_value) {
+            socket_path = string(args[++i]);
+        } else {
+            PrintUsage(program);
+            return 1;
+        }
     }
 
-    virtual img_lib::Image LoadImage(const img_lib::Path& file) const override {
-        return img_lib::LoadJPEG(file);
+    if (!socket_path) {
+        converter::ServeStream(cin, cout, options);
+        return 0;
     }
-};
+    return converter::ServeSocket(*socket_path, options) ? 0 : 1;
+}
 
-class BmpFormatInterface : public ImageFormatInterface {
-public:
-    bool SaveImage(const img_lib::Path& file, const img_lib::Image& image) const override {
-        return img_lib::SaveBMP(file, image);
+// Клиент отправляет серверу одно задание и, как режим одного файла,
+// возвращает его код и печатает сообщение
+int RunClient(const vector<string_view>& args, string_view program) {
+    if (args.empty()) {
+        PrintUsage(program);
+        return 1;
     }
 
-    virtual img_lib::Image LoadImage(const img_lib::Path& file) const override{
-        return img_lib::LoadBMP(file);
+    converter::ConvertOptions options;
+    vector<string_view> option_args;
+    vector<string_view> positional;
+    for (size_t i = 1; i < args.size(); ++i) {
+        const size_t option_begin = i;
+        bool handled = false;
+        if (!converter::ParseConvertOption(args, i, options, handled)) {
+            PrintOptionError(args, i, program);
+            return 1;
+        }
+        if (handled) {
+            option_args.insert(option_args.end(), args.begin() + option_begin, args.begin() + i + 1);
+        } else {
+            positional.push_back(args[i]);
+        }
     }
-};
 
+    if (positional.size() != 2) {
+        PrintUsage(program);
+        return 1;
+    }
 
-// Возвращает указатель на интерфейс нужного формата или nullptr, 
-// если формат не удалось определить
-ImageFormatInterface* GetFormatInterface(const img_lib::Path& path) {
-    Format fmt = GetFormatByExtension(path);
-    
-    switch(fmt) {
-        case Format::PPM:
-            // статическая переменная будет жить на протяжении всей жизни программы 
-            // static const PpmFormatInterface ppm_interface;
-            return new PpmFormatInterface;
-            break;
-        case Format::JPEG:
-            // static const JpegFormatInterface jpeg_interface;
-            return new JpegFormatInterface;
-            break;
-        case Format::BMP:
-            return new BmpFormatInterface;
-            break;
-        default:
-            return nullptr;
+    // у сервера может быть другой рабочий каталог
+    error_code ec;
+    string request = "1\t"s + filesystem::absolute(positional[0], ec).string()
+                     + '\t' + filesystem::absolute(positional[1], ec).string();
+    for (const string_view arg : option_args) {
+        request += '\t';
+        request += arg;
     }
 
-    return nullptr;
-} 
+    const optional<string> reply = converter::SendRequest(string(args[0]), request);
+    // ответ: <id> <code> <wait_seconds> <seconds> <message>
+    vector<string_view> fields;
+    for (size_t begin = 0, end = 0; reply && end != string::npos; begin = end + 1) {
+        end = reply->find('\t', begin);
+        fields.push_back(string_view(*reply).substr(begin, end == string::npos ? string::npos : end - begin));
+    }
+    const optional<size_t> code = fields.size() == 5 ? converter::ParseCount(fields[1]) : nullopt;
+    if (!code) {
+        cerr << "No reply from the server"sv << endl;
+        return 1;
+    }
 
+    if (*code != 0) {
+        cerr << fields[4] << endl;
+        return static_cast<int>(*code);
+    }
+    cout << fields[4] << endl;
+    return 0;
+}
 
-}  // namespace format_interface
+}  // namespace
 
 
 int main(int argc, const char** argv) {
-    
-    // 0. Проверить количество аргументов
-    if (argc != 3) {
-        cerr << "Usage: "sv << argv[0] << " <in_file> <out_file>"sv << endl;
-        return 1;
+    vector<string_view> args(argv + 1, argv + argc);
+
+    // --stats действует в обоих режимах, поэтому убирается из аргументов заранее
+    const auto stats_it = find(args.begin(), args.end(), "--stats"sv);
+    const bool print_stats = stats_it != args.end();
+    if (print_stats) {
+        args.erase(stats_it);
+        img_lib::EnableStats(true);
     }
 
-    img_lib::Path in_path = argv[1];
-    img_lib::Path out_path = argv[2];
-
-    // 1. Проверить формат входного файла
-    format_interface::ImageFormatInterface* fmt_interface_in = format_interface::GetFormatInterface(in_path);
-    if (!fmt_interface_in) {
-        cerr << "Unknown format of the input file."sv << endl;
-        return 2;
+    // опции кэша тоже общие для всех режимов, кроме клиента: кэшем пользуется сервер
+    converter::CacheOptions cache_options;
+    bool has_cache_options = false;
+    for (size_t i = 0; i < args.size();) {
+        const size_t option_begin = i;
+        bool handled = false;
+        if (!converter::ParseCacheOption(args, i, cache_options, handled)) {
+            PrintOptionError(args, i, argv[0]);
+            return 1;
+        }
+        if (handled) {
+            args.erase(args.begin() + option_begin, args.begin() + i + 1);
+            i = option_begin;
+            has_cache_options = true;
+        } else {
+            ++i;
+        }
     }
 
-    // 2. Проверить формат выходного файла
-    format_interface::ImageFormatInterface* fmt_interface_out = format_interface::GetFormatInterface(out_path);
-    if (!fmt_interface_out) {
-        cerr << "Unknown format of the output file."sv << endl;
-        return 3;
+    const bool is_client = !args.empty() && args[0] == "--client"sv;
+    if (has_cache_options && (cache_options.dir.empty() || is_client)) {
+        PrintUsage(argv[0]);
+        return 1;
     }
 
-    img_lib::Image image = fmt_interface_in->LoadImage(in_path);
-    if (!image) {
-        cerr << "Loading failed"sv << endl;
-        return 4;
+    optional<converter::ConversionCache> cache;
+    if (has_cache_options) {
+        cache.emplace();
+        if (!cache->Open(cache_options)) {
+            cerr << "Cannot open the cache directory"sv << endl;
+            return 1;
+        }
     }
-
-    if (!fmt_interface_out->SaveImage(out_path, image)) {
-        cerr << "Saving failed"sv << endl;
-        return 5;
+    converter::ConversionCache* const cache_ptr = cache ? &*cache : nullptr;
+
+    int code;
+    if (!args.empty() && args[0] == "--batch"sv) {
+        code = RunBatch({args.begin() + 1, args.end()}, argv[0], cache_ptr);
+    } else if (!args.empty() && args[0] == "--serve"sv) {
+        code = RunServe({args.begin() + 1, args.end()}, argv[0], cache_ptr);
+    } else if (is_client) {
+        code = RunClient({args.begin() + 1, args.end()}, argv[0]);
+    } else {
+        code = RunSingle(args, argv[0], cache_ptr);
     }
 
-    cout << "Successfully converted"sv << endl;
-    return 0;
+    if (cache && !cache->Save()) {
+        cerr << "Cannot write the cache index"sv << endl;
+    }
 
+    if (print_stats) {
+        img_lib::PrintStatsJson(img_lib::GetStats(), cerr);
+    }
+    return code;
 }
\ No newline at end of file
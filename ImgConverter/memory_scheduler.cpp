@@ -0,0 +1,84 @@
+#include "memory_scheduler.h"
+
+#include <buffer_pool.h>
+
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace converter {
+
+// сколько раз можно обойти задание, которое не помещается в бюджет
+static const size_t MAX_BYPASSES = 16;
+
+MemoryScheduler::MemoryScheduler(ThreadPool& pool, uint64_t budget)
+    : pool_(pool)
+    , budget_(budget) {
+}
+
+MemoryScheduler::~MemoryScheduler() {
+    Wait();
+}
+
+void MemoryScheduler::Submit(uint64_t memory, Task task) {
+    lock_guard lock(mutex_);
+    queue_.push_back({memory, move(task)});
+    Dispatch();
+}
+
+void MemoryScheduler::Wait() {
+    unique_lock lock(mutex_);
+    done_cv_.wait(lock, [this] {
+        return queue_.empty() && running_ == 0;
+    });
+}
+
+void MemoryScheduler::Dispatch() {
+    // Без бюджета задания не ждут. С бюджетом допускается не больше заданий, чем потоков:
+    // задание, ждущее в очереди пула, занимало бы бюджет, ничего не делая
+    const size_t max_running = budget_ == 0 ? queue_.size() + running_ : pool_.GetThreadCount();
+
+    // задания, которые не поместились в этом проходе
+    vector<Job*> skipped;
+    for (auto it = queue_.begin(); it != queue_.end() && running_ < max_running;) {
+        const bool fits = budget_ == 0 || running_ == 0 || reserved_ + it->memory <= budget_;
+        if (!fits) {
+            if (it->bypassed >= MAX_BYPASSES) {
+                // память копится для этого задания, обходить его больше нельзя
+                break;
+            }
+            skipped.push_back(&*it);
+            ++it;
+            continue;
+        }
+
+        for (Job* job : skipped) {
+            ++job->bypassed;
+        }
+        ++running_;
+        reserved_ += it->memory;
+        // Свободные буферы пула в оценки заданий не входят, но память занимают.
+        // Буферы выполняемых заданий учтены в reserved_, остальное пул должен отдать системе
+        if (budget_ > 0) {
+            img_lib::BufferPool::Instance().Trim(reserved_ < budget_ ? budget_ - reserved_ : 0);
+        }
+        pool_.Submit([this, memory = it->memory, task = move(it->task)] {
+            task();
+            Finish(memory);
+        });
+        it = queue_.erase(it);
+    }
+}
+
+void MemoryScheduler::Finish(uint64_t memory) {
+    lock_guard lock(mutex_);
+    --running_;
+    reserved_ -= memory;
+    Dispatch();
+    if (queue_.empty() && running_ == 0) {
+        done_cv_.notify_all();
+    }
+}
+
+}  // namespace converter
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+
+namespace converter {
+
+// Допускает задания в пул потоков по бюджету памяти. Задание попадает в пул, только когда
+// его оценка памяти вместе с оценками выполняемых заданий укладывается в бюджет и в пуле
+// есть свободный поток. Очередь просматривается по порядку: если первое задание не помещается,
+// за ним допускаются следующие, которые помещаются, - так потоки заняты мелкими заданиями,
+// пока крупное ждёт памяти. Чтобы мелкие задания не откладывали крупное бесконечно,
+// его обходят не больше MAX_BYPASSES раз, после чего за ним никого не допускают.
+// Задание больше всего бюджета выполняется, когда остальные закончились.
+// Перед допуском задания свободные буферы img_lib::BufferPool сверх остатка бюджета
+// возвращаются системе, чтобы кэш пула не держал память поверх max_memory
+class MemoryScheduler {
+public:
+    using Task = std::function<void()>;
+
+    // budget - бюджет в байтах; 0 - без ограничения, задания сразу передаются в пул
+    MemoryScheduler(ThreadPool& pool, uint64_t budget);
+
+    MemoryScheduler(const MemoryScheduler&) = delete;
+    MemoryScheduler& operator=(const MemoryScheduler&) = delete;
+
+    // дожидается выполнения всех заданий
+    ~MemoryScheduler();
+
+    // ставит задание в очередь; memory - оценка его памяти, см. EstimateMemory
+    void Submit(uint64_t memory, Task task);
+
+    // блокируется, пока не будут выполнены все добавленные задания
+    void Wait();
+
+private:
+    struct Job {
+        uint64_t memory = 0;
+        Task task;
+        // сколько раз задание обошли задания, стоявшие в очереди за ним
+        size_t bypassed = 0;
+    };
+
+    // передаёт в пул задания, которые можно допустить; вызывается под mutex_
+    void Dispatch();
+    void Finish(uint64_t memory);
+
+    ThreadPool& pool_;
+    const uint64_t budget_;
+
+    std::mutex mutex_;
+    std::condition_variable done_cv_;
+    std::list<Job> queue_;
+    size_t running_ = 0;
+    // сумма оценок выполняемых заданий
+    uint64_t reserved_ = 0;
+};
+
+}  // namespace converter
\ No newline at end of file
@@ -0,0 +1,499 @@
+#include "options.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <utility>
+
+using namespace std;
+
+namespace converter {
+
+optional<size_t> ParseCount(string_view str) {
+    size_t value = 0;
+    const auto [ptr, ec] = from_chars(str.data(), str.data() + str.size(), value);
+    if (ec != errc{} || ptr != str.data() + str.size()) {
+        return nullopt;
+    }
+    return value;
+}
+
+optional<img_lib::Size> ParseSize(string_view str) {
+    const size_t x_pos = str.find('x');
+    if (x_pos == string_view::npos) {
+        return nullopt;
+    }
+
+    const optional<size_t> width = ParseCount(str.substr(0, x_pos));
+    const optional<size_t> height = ParseCount(str.substr(x_pos + 1));
+    constexpr size_t max_side = 1 << 20;
+    if (!width || !height || *width > max_side || *height > max_side) {
+        return nullopt;
+    }
+    return img_lib::Size{static_cast<int>(*width), static_cast<int>(*height)};
+}
+
+optional<img_lib::ResampleFilter> ParseFilter(string_view name) {
+    if (name == "nearest"sv) {
+        return img_lib::ResampleFilter::NEAREST;
+    }
+    if (name == "bilinear"sv) {
+        return img_lib::ResampleFilter::BILINEAR;
+    }
+    if (name == "bicubic"sv) {
+        return img_lib::ResampleFilter::BICUBIC;
+    }
+    if (name == "lanczos3"sv) {
+        return img_lib::ResampleFilter::LANCZOS3;
+    }
+    return nullopt;
+}
+
+optional<uint64_t> ParseByteSize(string_view str) {
+    uint64_t multiplier = 1;
+    if (!str.empty()) {
+        switch (str.back()) {
+            case 'K': multiplier = uint64_t(1) << 10; break;
+            case 'M': multiplier = uint64_t(1) << 20; break;
+            case 'G': multiplier = uint64_t(1) << 30; break;
+        }
+    }
+    if (multiplier != 1) {
+        str.remove_suffix(1);
+    }
+
+    const optional<size_t> value = ParseCount(str);
+    if (!value || *value > UINT64_MAX / multiplier) {
+        return nullopt;
+    }
+    return *value * multiplier;
+}
+
+optional<img_lib::JpegPreset> ParseJpegPreset(string_view name) {
+    if (name == "fast"sv) {
+        return img_lib::JpegPreset::FAST;
+    }
+    if (name == "balanced"sv) {
+        return img_lib::JpegPreset::BALANCED;
+    }
+    if (name == "small"sv) {
+        return img_lib::JpegPreset::SMALL;
+    }
+    return nullopt;
+}
+
+optional<bool> ParseSwitch(string_view str) {
+    if (str == "on"sv) {
+        return true;
+    }
+    if (str == "off"sv) {
+        return false;
+    }
+    return nullopt;
+}
+
+static optional<img_lib::JpegDctMethod> ParseDctMethod(string_view name) {
+    if (name == "islow"sv) {
+        return img_lib::JpegDctMethod::ISLOW;
+    }
+    if (name == "ifast"sv) {
+        return img_lib::JpegDctMethod::IFAST;
+    }
+    if (name == "float"sv) {
+        return img_lib::JpegDctMethod::FLOAT;
+    }
+    return nullopt;
+}
+
+static optional<img_lib::JpegSubsampling> ParseSubsampling(string_view name) {
+    if (name == "444"sv) {
+        return img_lib::JpegSubsampling::S444;
+    }
+    if (name == "422"sv) {
+        return img_lib::JpegSubsampling::S422;
+    }
+    if (name == "420"sv) {
+        return img_lib::JpegSubsampling::S420;
+    }
+    return nullopt;
+}
+
+static optional<img_lib::JpegTransform> ParseTransform(string_view name) {
+    using img_lib::JpegTransform;
+    static const pair<string_view, JpegTransform> transforms[] = {
+        {"none"sv, JpegTransform::NONE},
+        {"flip-h"sv, JpegTransform::FLIP_H},
+        {"flip-v"sv, JpegTransform::FLIP_V},
+        {"rot90"sv, JpegTransform::ROTATE_90},
+        {"rot180"sv, JpegTransform::ROTATE_180},
+        {"rot270"sv, JpegTransform::ROTATE_270},
+        {"transpose"sv, JpegTransform::TRANSPOSE},
+        {"transverse"sv, JpegTransform::TRANSVERSE},
+    };
+    for (const auto& [transform_name, transform] : transforms) {
+        if (name == transform_name) {
+            return transform;
+        }
+    }
+    return nullopt;
+}
+
+// Область WxH+X+Y: размер WxH с левым верхним углом (X, Y)
+static bool ParseCrop(string_view str, img_lib::JpegTransformOptions& options) {
+    const size_t x_pos = str.find('+');
+    const size_t y_pos = x_pos == string_view::npos ? string_view::npos : str.find('+', x_pos + 1);
+    if (y_pos == string_view::npos) {
+        return false;
+    }
+
+    const optional<img_lib::Size> size = ParseSize(str.substr(0, x_pos));
+    const optional<size_t> x = ParseCount(str.substr(x_pos + 1, y_pos - x_pos - 1));
+    const optional<size_t> y = ParseCount(str.substr(y_pos + 1));
+    constexpr size_t max_offset = 1 << 20;
+    if (!size || size->width == 0 || size->height == 0 || !x || !y || *x > max_offset || *y > max_offset) {
+        return false;
+    }
+    options.crop_size = *size;
+    options.crop_x = static_cast<int>(*x);
+    options.crop_y = static_cast<int>(*y);
+    return true;
+}
+
+// Опции преобразования JPEG без потерь: --lossless, --crop, --jpeg-metadata.
+// Любая из них включает преобразование; handled и i - как у ParseConvertOption
+static bool ParseTransformOption(const vector<string_view>& args, size_t& i, ConvertOptions& options, bool& handled) {
+    const string_view name = args[i];
+    const string_view value = args[i + 1];
+    if (name != "--lossless"sv && name != "--crop"sv && name != "--jpeg-metadata"sv) {
+        return true;
+    }
+    handled = true;
+    ++i;
+
+    img_lib::JpegTransformOptions& transform = options.jpeg_transform ? *options.jpeg_transform
+                                                                      : options.jpeg_transform.emplace();
+    if (name == "--lossless"sv) {
+        const optional<img_lib::JpegTransform> parsed = ParseTransform(value);
+        if (parsed) {
+            transform.transform = *parsed;
+        }
+        return parsed.has_value();
+    }
+    if (name == "--crop"sv) {
+        return ParseCrop(value, transform);
+    }
+    if (value == "keep"sv || value == "strip"sv) {
+        transform.copy_markers = value == "keep"sv;
+        return true;
+    }
+    return false;
+}
+
+static optional<img_lib::PpmFormat> ParsePpmFormat(string_view name) {
+    if (name == "p6"sv) {
+        return img_lib::PpmFormat::P6;
+    }
+    if (name == "p5"sv) {
+        return img_lib::PpmFormat::P5;
+    }
+    if (name == "p3"sv) {
+        return img_lib::PpmFormat::P3;
+    }
+    if (name == "p2"sv) {
+        return img_lib::PpmFormat::P2;
+    }
+    return nullopt;
+}
+
+// опции --ppm-format и --ppm-maxval; handled и i - как у ParseConvertOption
+static bool ParsePpmOption(const vector<string_view>& args, size_t& i, ConvertOptions& options, bool& handled) {
+    if (args[i] == "--ppm-format"sv) {
+        handled = true;
+        const optional<img_lib::PpmFormat> format = ParsePpmFormat(args[++i]);
+        if (format) {
+            options.ppm_save.format = *format;
+        }
+        return format.has_value();
+    }
+    if (args[i] == "--ppm-maxval"sv) {
+        handled = true;
+        const optional<size_t> max_value = ParseCount(args[++i]);
+        if (!max_value || *max_value < 1 || *max_value > 65535) {
+            return false;
+        }
+        options.ppm_save.max_value = static_cast<int>(*max_value);
+        return true;
+    }
+    return true;
+}
+
+static optional<double> ParseNumber(string_view str) {
+    double value = 0;
+    const auto [ptr, ec] = from_chars(str.data(), str.data() + str.size(), value);
+    if (ec != errc{} || ptr != str.data() + str.size() || !isfinite(value)) {
+        return nullopt;
+    }
+    return value;
+}
+
+// перестановка каналов из четырёх букв r, g, b, a: канал результата - канал источника с этой буквой
+static optional<array<int, 4>> ParseChannelOrder(string_view str) {
+    if (str.size() != 4) {
+        return nullopt;
+    }
+    array<int, 4> order;
+    for (size_t c = 0; c < 4; ++c) {
+        const size_t channel = "rgba"sv.find(str[c]);
+        if (channel == string_view::npos) {
+            return nullopt;
+        }
+        order[c] = static_cast<int>(channel);
+    }
+    return order;
+}
+
+// Операция --op: grayscale, invert, gamma=G, brightness=B, contrast=C, swap=bgra, alpha=N.
+// Дописывает её в конец цепочки; false - если операция неизвестна или значение некорректно
+static bool ParsePixelOp(string_view spec, img_lib::PixelPipeline& pipeline) {
+    const size_t eq_pos = spec.find('=');
+    const string_view name = spec.substr(0, eq_pos);
+    const string_view value = eq_pos == string_view::npos ? ""sv : spec.substr(eq_pos + 1);
+    if (eq_pos == string_view::npos) {
+        if (name == "grayscale"sv) {
+            pipeline.Grayscale();
+            return true;
+        }
+        if (name == "invert"sv) {
+            pipeline.Invert();
+            return true;
+        }
+        return false;
+    }
+
+    if (name == "swap"sv) {
+        const optional<array<int, 4>> order = ParseChannelOrder(value);
+        if (order) {
+            pipeline.SwapChannels(*order);
+        }
+        return order.has_value();
+    }
+    if (name == "alpha"sv) {
+        const optional<size_t> alpha = ParseCount(value);
+        if (!alpha || *alpha > 255) {
+            return false;
+        }
+        pipeline.FillAlpha(static_cast<uint8_t>(*alpha));
+        return true;
+    }
+
+    const optional<double> number = ParseNumber(value);
+    if (!number) {
+        return false;
+    }
+    if (name == "gamma"sv && *number > 0) {
+        pipeline.Gamma(*number);
+        return true;
+    }
+    if (name == "brightness"sv && *number >= -255 && *number <= 255) {
+        pipeline.BrightnessContrast(*number, 1.0);
+        return true;
+    }
+    if (name == "contrast"sv && *number >= 0) {
+        pipeline.BrightnessContrast(0, *number);
+        return true;
+    }
+    return false;
+}
+
+// опции --jpeg-*; handled и i - как у ParseConvertOption
+static bool ParseJpegOption(const vector<string_view>& args, size_t& i, ConvertOptions& options, bool& handled) {
+    const string_view name = args[i];
+    const string_view value = args[i + 1];
+    handled = true;
+
+    if (name == "--jpeg-preset"sv) {
+        const optional<img_lib::JpegPreset> preset = ParseJpegPreset(value);
+        if (preset) {
+            options.jpeg_load = img_lib::GetJpegLoadPreset(*preset);
+            options.jpeg_save = img_lib::GetJpegSavePreset(*preset);
+        }
+        ++i;
+        return preset.has_value();
+    }
+    if (name == "--jpeg-quality"sv) {
+        const optional<size_t> quality = ParseCount(value);
+        ++i;
+        if (!quality || *quality < 1 || *quality > 100) {
+            return false;
+        }
+        options.jpeg_save.quality = static_cast<int>(*quality);
+        return true;
+    }
+    if (name == "--jpeg-dct"sv) {
+        // метод DCT один для декодирования и кодирования
+        const optional<img_lib::JpegDctMethod> method = ParseDctMethod(value);
+        if (method) {
+            options.jpeg_load.dct_method = *method;
+            options.jpeg_save.dct_method = *method;
+        }
+        ++i;
+        return method.has_value();
+    }
+    if (name == "--jpeg-subsampling"sv) {
+        const optional<img_lib::JpegSubsampling> subsampling = ParseSubsampling(value);
+        if (subsampling) {
+            options.jpeg_save.subsampling = *subsampling;
+        }
+        ++i;
+        return subsampling.has_value();
+    }
+    if (name == "--jpeg-restart-rows"sv) {
+        const optional<size_t> rows = ParseCount(value);
+        ++i;
+        // libjpeg хранит интервал в 16 битах
+        if (!rows || *rows > 65535) {
+            return false;
+        }
+        options.jpeg_save.restart_rows = static_cast<int>(*rows);
+        return true;
+    }
+
+    bool* flag = nullptr;
+    if (name == "--jpeg-fancy-upsampling"sv) {
+        flag = &options.jpeg_load.fancy_upsampling;
+    } else if (name == "--jpeg-block-smoothing"sv) {
+        flag = &options.jpeg_load.block_smoothing;
+    } else if (name == "--jpeg-auto-orient"sv) {
+        flag = &options.jpeg_load.auto_orient;
+    } else if (name == "--jpeg-optimize"sv) {
+        flag = &options.jpeg_save.optimize_coding;
+    } else if (name == "--jpeg-progressive"sv) {
+        flag = &options.jpeg_save.progressive;
+    } else {
+        handled = false;
+        return true;
+    }
+    const optional<bool> enabled = ParseSwitch(value);
+    if (enabled) {
+        *flag = *enabled;
+    }
+    ++i;
+    return enabled.has_value();
+}
+
+// опции конвертации, за которыми следует значение
+static const string_view CONVERT_VALUE_OPTIONS[] = {
+    "--max-size"sv, "--resize"sv, "--threads"sv, "--memory-limit"sv, "--filter"sv,
+    "--in-format"sv, "--out-format"sv, "--op"sv,
+    "--lossless"sv, "--crop"sv, "--jpeg-metadata"sv,
+    "--ppm-format"sv, "--ppm-maxval"sv,
+    "--jpeg-preset"sv, "--jpeg-quality"sv, "--jpeg-dct"sv, "--jpeg-subsampling"sv, "--jpeg-restart-rows"sv,
+    "--jpeg-fancy-upsampling"sv, "--jpeg-block-smoothing"sv, "--jpeg-auto-orient"sv,
+    "--jpeg-optimize"sv, "--jpeg-progressive"sv,
+};
+
+bool IsMissingConvertValue(const vector<string_view>& args, size_t i) {
+    return i + 1 == args.size()
+        && find(begin(CONVERT_VALUE_OPTIONS), end(CONVERT_VALUE_OPTIONS), args[i]) != end(CONVERT_VALUE_OPTIONS);
+}
+
+bool ParseConvertOption(const vector<string_view>& args, size_t& i, converter::ConvertOptions& options, bool& handled) {
+    handled = false;
+    if (i + 1 >= args.size()) {
+        // известная опция без значения - ошибка, а не позиционный аргумент
+        handled = IsMissingConvertValue(args, i);
+        return !handled;
+    }
+
+    if (args[i] == "--max-size"sv) {
+        handled = true;
+        options.max_size = ParseSize(args[++i]);
+        return options.max_size && options.max_size->width > 0 && options.max_size->height > 0;
+    }
+    if (args[i] == "--resize"sv) {
+        handled = true;
+        options.resize = ParseSize(args[++i]);
+        return options.resize && (options.resize->width > 0 || options.resize->height > 0);
+    }
+    if (args[i] == "--threads"sv) {
+        handled = true;
+        const optional<size_t> threads = ParseCount(args[++i]);
+        if (threads) {
+            options.codec_threads = *threads;
+            options.resize_options.threads = *threads;
+        }
+        return threads.has_value();
+    }
+    if (args[i] == "--memory-limit"sv) {
+        handled = true;
+        const optional<uint64_t> limit = ParseByteSize(args[++i]);
+        if (limit) {
+            options.memory_limit = *limit;
+        }
+        return limit.has_value();
+    }
+    if (args[i] == "--filter"sv) {
+        handled = true;
+        const optional<img_lib::ResampleFilter> filter = ParseFilter(args[++i]);
+        if (filter) {
+            options.resize_options.filter = *filter;
+        }
+        return filter.has_value();
+    }
+    if (args[i] == "--in-format"sv || args[i] == "--out-format"sv) {
+        handled = true;
+        optional<format_interface::Format>& format = args[i] == "--in-format"sv ? options.in_format : options.out_format;
+        format = format_interface::GetFormatByName(args[++i]);
+        return *format != format_interface::Format::UNKNOWN;
+    }
+    if (args[i] == "--op"sv) {
+        handled = true;
+        return ParsePixelOp(args[++i], options.pixel_ops);
+    }
+    for (auto parse : {ParseTransformOption, ParsePpmOption, ParseJpegOption}) {
+        const bool ok = parse(args, i, options, handled);
+        if (!ok || handled) {
+            return ok;
+        }
+    }
+    return true;
+}
+
+bool IsMissingCacheValue(const vector<string_view>& args, size_t i) {
+    return i + 1 == args.size() && (args[i] == "--cache"sv || args[i] == "--cache-max-size"sv);
+}
+
+bool ParseCacheOption(const vector<string_view>& args, size_t& i, CacheOptions& options, bool& handled) {
+    handled = true;
+    if (args[i] == "--cache-verify"sv) {
+        options.verify = true;
+        return true;
+    }
+    if (args[i] == "--cache-link"sv) {
+        options.hard_link = true;
+        return true;
+    }
+
+    handled = false;
+    if (i + 1 >= args.size()) {
+        handled = IsMissingCacheValue(args, i);
+        return !handled;
+    }
+    if (args[i] == "--cache"sv) {
+        handled = true;
+        options.dir = string(args[++i]);
+        return !options.dir.empty();
+    }
+    if (args[i] == "--cache-max-size"sv) {
+        handled = true;
+        const optional<uint64_t> max_bytes = ParseByteSize(args[++i]);
+        if (max_bytes) {
+            options.max_bytes = *max_bytes;
+        }
+        return max_bytes.has_value();
+    }
+    return true;
+}
+
+}  // namespace converter
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "cache.h"
+#include "converter.h"
+
+#include <img_lib.h>
+#include <jpeg_image.h>
+#include <resample.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace converter {
+
+// неотрицательное целое без знака и лишних символов
+std::optional<size_t> ParseCount(std::string_view str);
+
+// Размер в виде WxH. Стороны могут быть нулевыми - это проверяет вызывающий
+std::optional<img_lib::Size> ParseSize(std::string_view str);
+
+// nearest, bilinear, bicubic или lanczos3
+std::optional<img_lib::ResampleFilter> ParseFilter(std::string_view name);
+
+// объём в байтах с необязательным суффиксом K, M или G
+std::optional<uint64_t> ParseByteSize(std::string_view str);
+
+// fast, balanced или small
+std::optional<img_lib::JpegPreset> ParseJpegPreset(std::string_view name);
+
+// on или off
+std::optional<bool> ParseSwitch(std::string_view str);
+
+// Разбирает опцию конвертации args[i] со значением args[i + 1]: --max-size, --resize,
+// --threads, --filter, --memory-limit, --in-format, --out-format и параметры JPEG:
+// --jpeg-preset (задаёт все параметры JPEG сразу, следующие опции уточняют его),
+// --jpeg-quality, --jpeg-dct, --jpeg-fancy-upsampling, --jpeg-block-smoothing,
+// --jpeg-optimize, --jpeg-progressive, --jpeg-subsampling, --jpeg-restart-rows, --jpeg-auto-orient;
+// преобразования JPEG без потерь: --lossless, --crop WxH+X+Y, --jpeg-metadata keep|strip;
+// разновидность сохраняемого PPM: --ppm-format p6|p5|p3|p2, --ppm-maxval N;
+// поточечные операции --op в порядке следования: grayscale, invert, gamma=G,
+// brightness=B (-255..255), contrast=C, swap=<перестановка rgba>, alpha=N (0..255).
+// Возвращает false, если значение опции некорректно или не указано (см. IsMissingConvertValue).
+// Если args[i] не является такой опцией, handled остаётся false; иначе i указывает на значение
+bool ParseConvertOption(const std::vector<std::string_view>& args, size_t& i, ConvertOptions& options, bool& handled);
+
+// true, если args[i] - опция конвертации, которой нужно значение, а она стоит последней
+bool IsMissingConvertValue(const std::vector<std::string_view>& args, size_t i);
+
+// То же для опций кэша: --cache <dir>, --cache-max-size <N[K|M|G]>, --cache-verify, --cache-link
+bool ParseCacheOption(const std::vector<std::string_view>& args, size_t& i, CacheOptions& options, bool& handled);
+
+// true, если args[i] - --cache или --cache-max-size без значения
+bool IsMissingCacheValue(const std::vector<std::string_view>& args, size_t i);
+
+}  // namespace converter
\ No newline at end of file
@@ -0,0 +1,377 @@
+#include "server.h"
+#include "options.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define IMGCONV_HAS_UNIX_SOCKETS 1
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace converter {
+
+static vector<string_view> SplitFields(string_view line) {
+    vector<string_view> fields;
+    size_t begin = 0;
+    while (true) {
+        const size_t end = line.find('\t', begin);
+        fields.push_back(line.substr(begin, end == string_view::npos ? string_view::npos : end - begin));
+        if (end == string_view::npos) {
+            return fields;
+        }
+        begin = end + 1;
+    }
+}
+
+static string FormatReply(string_view id, int code, double wait_seconds, double seconds, string_view message) {
+    ostringstream out;
+    out << id << '\t' << code << '\t' << fixed << setprecision(3) << wait_seconds << '\t' << seconds << '\t' << message;
+    return out.str();
+}
+
+// строки запросов без пустых строк и комментариев
+static bool IsRequestLine(string& line) {
+    if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
+    return !line.empty() && line[0] != '#';
+}
+
+ConversionServer::ConversionServer(const ServerOptions& options)
+    : defaults_(options.defaults)
+    , max_memory_(options.max_memory)
+    , pool_(options.thread_count)
+    , scheduler_(pool_, options.max_memory) {
+    // задания и так выполняются параллельно, поэтому по умолчанию
+    // кодеки и масштабирование внутри одного файла работают в одном потоке
+    if (pool_.GetThreadCount() > 1) {
+        defaults_.resize_options.threads = 1;
+        defaults_.codec_threads = 1;
+    }
+    // очередь держит по нескольку заданий на поток, чтобы потоки не простаивали
+    // между ответом и следующим запросом
+    max_in_flight_ = pool_.GetThreadCount() * 4;
+}
+
+void ConversionServer::Submit(string_view request, ReplyCallback reply) {
+    const auto submitted = chrono::steady_clock::now();
+
+    const vector<string_view> fields = SplitFields(request);
+    if (fields.size() < 3 || fields[1].empty() || fields[2].empty()) {
+        reply(FormatReply(fields[0], BAD_REQUEST_CODE, 0., 0., "Bad request: expected <id> <in_file> <out_file>"sv));
+        return;
+    }
+
+    ConvertOptions options = defaults_;
+    for (size_t i = 3; i < fields.size(); ++i) {
+        bool handled = false;
+        if (!ParseConvertOption(fields, i, options, handled) || !handled) {
+            const string_view what = IsMissingConvertValue(fields, i) ? "missing value for "sv : "invalid option "sv;
+            reply(FormatReply(fields[0], BAD_REQUEST_CODE, 0., 0., "Bad request: "s + string(what) + string(fields[i])));
+            return;
+        }
+    }
+
+    // оценка читает только заголовок входного файла
+    const uint64_t memory = max_memory_ > 0
+        ? EstimateMemory(img_lib::Path(fields[1]), img_lib::Path(fields[2]), options)
+        : 0;
+
+    {
+        unique_lock lock(mutex_);
+        slot_cv_.wait(lock, [this] {
+            return in_flight_ < max_in_flight_;
+        });
+        ++in_flight_;
+    }
+
+    scheduler_.Submit(memory, [this, id = string(fields[0]), in_path = img_lib::Path(fields[1]),
+                  out_path = img_lib::Path(fields[2]), options, reply = move(reply), submitted] {
+        const auto start = chrono::steady_clock::now();
+        error_code ec;
+        if (out_path.has_parent_path()) {
+            fs::create_directories(out_path.parent_path(), ec);
+        }
+
+        ConversionStatus status;
+        try {
+            status = ConvertFile(in_path, out_path, options);
+        } catch (...) {
+            status = ConversionStatus::SAVING_FAILED;
+        }
+
+        const auto end = chrono::steady_clock::now();
+        reply(FormatReply(id, static_cast<int>(status), chrono::duration<double>(start - submitted).count(),
+                          chrono::duration<double>(end - start).count(), GetStatusMessage(status)));
+        Finish();
+    });
+}
+
+void ConversionServer::Finish() {
+    {
+        lock_guard lock(mutex_);
+        --in_flight_;
+    }
+    slot_cv_.notify_one();
+}
+
+void ConversionServer::Wait() {
+    scheduler_.Wait();
+}
+
+
+void ServeStream(istream& in, ostream& out, const ServerOptions& options) {
+    mutex out_mutex;
+    ConversionServer server(options);
+
+    string line;
+    while (getline(in, line)) {
+        if (!IsRequestLine(line)) {
+            continue;
+        }
+        server.Submit(line, [&out, &out_mutex](const string& reply) {
+            lock_guard lock(out_mutex);
+            // клиент ждёт ответа, поэтому он отправляется сразу
+            out << reply << '\n' << flush;
+        });
+    }
+    server.Wait();
+}
+
+
+#ifdef IMGCONV_HAS_UNIX_SOCKETS
+
+// ограничение на длину запроса: защищает от клиента, не присылающего перевода строки
+static const size_t MAX_REQUEST_BYTES = 1 << 16;
+
+// Соединение с клиентом. Ответы в него могут писать несколько рабочих потоков сразу
+class Connection {
+public:
+    explicit Connection(int fd)
+        : fd_(fd) {
+    }
+
+    ~Connection() {
+        ::close(fd_);
+    }
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    // Читает очередную строку без перевода строки. false - соединение закрыто
+    bool ReadLine(string& line) {
+        while (true) {
+            const size_t end = buffer_.find('\n');
+            if (end != string::npos) {
+                line = buffer_.substr(0, end);
+                buffer_.erase(0, end + 1);
+                return true;
+            }
+            if (buffer_.size() > MAX_REQUEST_BYTES) {
+                return false;
+            }
+
+            char chunk[4096];
+            const ssize_t received = ::recv(fd_, chunk, sizeof(chunk), 0);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received <= 0) {
+                // последняя строка может быть без перевода строки
+                line = move(buffer_);
+                buffer_.clear();
+                return !line.empty();
+            }
+            buffer_.append(chunk, static_cast<size_t>(received));
+        }
+    }
+
+    // Отправляет строку с переводом строки. Ошибки игнорируются:
+    // ушедший клиент не должен мешать остальным заданиям
+    void Send(const string& reply) {
+        lock_guard lock(write_mutex_);
+        const string data = reply + '\n';
+        size_t sent = 0;
+        while (sent < data.size()) {
+            const ssize_t result = ::send(fd_, data.data() + sent, data.size() - sent, 0);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                return;
+            }
+            sent += static_cast<size_t>(result);
+        }
+    }
+
+    // будит поток, читающий запросы: recv вернёт конец данных
+    void StopReading() {
+        ::shutdown(fd_, SHUT_RD);
+    }
+
+private:
+    int fd_;
+    mutex write_mutex_;
+    string buffer_;
+};
+
+static bool MakeSocketAddress(const img_lib::Path& socket_path, sockaddr_un& addr) {
+    const string path = socket_path.string();
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+static atomic<bool> stop_requested = false;
+
+static void RequestStop(int) {
+    stop_requested = true;
+}
+
+bool ServeSocket(const img_lib::Path& socket_path, const ServerOptions& options) {
+    sockaddr_un addr;
+    if (!MakeSocketAddress(socket_path, addr)) {
+        cerr << "Socket path is too long"sv << endl;
+        return false;
+    }
+
+    const int listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        cerr << "Cannot create the socket"sv << endl;
+        return false;
+    }
+
+    // сокет, оставшийся от прежнего запуска, заменяется; другие файлы не трогаем
+    error_code ec;
+    if (fs::is_socket(socket_path, ec)) {
+        fs::remove(socket_path, ec);
+    }
+    if (::bind(listen_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0
+        || ::listen(listen_fd, SOMAXCONN) != 0) {
+        cerr << "Cannot listen on "sv << socket_path.string() << endl;
+        ::close(listen_fd);
+        return false;
+    }
+
+    // запись в закрытое клиентом соединение не должна завершать сервер
+    signal(SIGPIPE, SIG_IGN);
+    stop_requested = false;
+    signal(SIGINT, RequestStop);
+    signal(SIGTERM, RequestStop);
+
+    struct Reader {
+        shared_ptr<Connection> connection;
+        shared_ptr<atomic<bool>> done;
+        thread worker;
+    };
+
+    ConversionServer server(options);
+    vector<Reader> readers;
+
+    while (!stop_requested) {
+        // accept ждёт с таймаутом, чтобы вовремя заметить сигнал остановки
+        pollfd pfd = {listen_fd, POLLIN, 0};
+        if (::poll(&pfd, 1, 200) > 0) {
+            const int fd = ::accept(listen_fd, nullptr, nullptr);
+            if (fd >= 0) {
+                auto connection = make_shared<Connection>(fd);
+                auto done = make_shared<atomic<bool>>(false);
+                thread reader([&server, connection, done] {
+                    string line;
+                    while (connection->ReadLine(line)) {
+                        if (!IsRequestLine(line)) {
+                            continue;
+                        }
+                        server.Submit(line, [connection](const string& reply) {
+                            connection->Send(reply);
+                        });
+                    }
+                    *done = true;
+                });
+                readers.push_back({move(connection), move(done), move(reader)});
+            }
+        }
+
+        // потоки закрытых соединений больше не нужны
+        for (Reader& reader : readers) {
+            if (*reader.done && reader.worker.joinable()) {
+                reader.worker.join();
+            }
+        }
+        readers.erase(remove_if(readers.begin(), readers.end(), [](const Reader& reader) {
+            return !reader.worker.joinable();
+        }), readers.end());
+    }
+
+    ::close(listen_fd);
+    fs::remove(socket_path, ec);
+
+    // новые запросы не принимаются, а принятые доделываются и получают ответы
+    for (Reader& reader : readers) {
+        reader.connection->StopReading();
+        reader.worker.join();
+    }
+    server.Wait();
+    return true;
+}
+
+optional<string> SendRequest(const img_lib::Path& socket_path, string_view request) {
+    sockaddr_un addr;
+    if (!MakeSocketAddress(socket_path, addr)) {
+        return nullopt;
+    }
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return nullopt;
+    }
+    Connection connection(fd);
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+        return nullopt;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    connection.Send(string(request));
+    string reply;
+    if (!connection.ReadLine(reply)) {
+        return nullopt;
+    }
+    return reply;
+}
+
+#else
+
+bool ServeSocket(const img_lib::Path&, const ServerOptions&) {
+    cerr << "Unix domain sockets are not supported on this platform"sv << endl;
+    return false;
+}
+
+optional<string> SendRequest(const img_lib::Path&, string_view) {
+    return nullopt;
+}
+
+#endif
+
+}  // namespace converter
\ No newline at end of file
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "converter.h"
+#include "memory_scheduler.h"
+#include "thread_pool.h"
+
+#include <img_lib.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace converter {
+
+// Протокол сервера - строки текста, поля разделены табуляцией.
+// Запрос: <id> <in_file> <out_file> [<опция> <значение>]...
+//         опции те же, что у imgconv: --max-size, --resize, --filter, --threads, --memory-limit,
+//         --in-format, --out-format, --jpeg-*, --lossless, --crop, --ppm-*, --op.
+// Ответ:  <id> <code> <wait_seconds> <seconds> <message>
+//         code - значение ConversionStatus или BAD_REQUEST_CODE, wait_seconds - время в очереди.
+// Ответы отправляются по мере готовности, не обязательно в порядке запросов.
+// Пустые строки и строки, начинающиеся с #, пропускаются
+
+// код ответа на запрос, который не удалось разобрать
+constexpr int BAD_REQUEST_CODE = 1;
+
+struct ServerOptions {
+    // потоков конвертации, 0 - по числу ядер
+    size_t thread_count = 0;
+    // опции по умолчанию; опции запроса дополняют и переопределяют их
+    ConvertOptions defaults;
+    // Бюджет памяти одновременно выполняемых заданий, 0 - без ограничения.
+    // Задания допускаются по оценке EstimateMemory, см. MemoryScheduler
+    uint64_t max_memory = 0;
+};
+
+// Выполняет задания на общем пуле потоков. Интерфейсы форматов и пул буферов
+// изображений живут всё время работы, поэтому следующее задание их переиспользует.
+// Число принятых, но не завершённых заданий ограничено: при переполнении Submit ждёт.
+// С бюджетом памяти принятые задания ждут допуска в очереди планировщика
+class ConversionServer {
+public:
+    using ReplyCallback = std::function<void(const std::string& reply)>;
+
+    explicit ConversionServer(const ServerOptions& options);
+
+    ConversionServer(const ConversionServer&) = delete;
+    ConversionServer& operator=(const ConversionServer&) = delete;
+
+    // Разбирает строку запроса и ставит задание в очередь. reply вызывается ровно
+    // один раз: из рабочего потока или сразу, если запрос некорректен
+    void Submit(std::string_view request, ReplyCallback reply);
+
+    // блокируется, пока не будут выполнены все принятые задания
+    void Wait();
+
+private:
+    void Finish();
+
+    ConvertOptions defaults_;
+    uint64_t max_memory_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable slot_cv_;
+    size_t in_flight_ = 0;
+    size_t max_in_flight_ = 0;
+
+    // Пул и планировщик объявлены последними: при разрушении они дожидаются заданий,
+    // которые обращаются к остальным полям. Планировщик разрушается первым
+    ThreadPool pool_;
+    MemoryScheduler scheduler_;
+};
+
+// Обслуживает запросы из in до конца ввода и пишет ответы в out
+void ServeStream(std::istream& in, std::ostream& out, const ServerOptions& options);
+
+// Слушает Unix-сокет socket_path; каждое соединение - такой же поток строк запросов.
+// Работает до SIGINT или SIGTERM. Возвращает false, если сокет создать не удалось
+bool ServeSocket(const img_lib::Path& socket_path, const ServerOptions& options);
+
+// Отправляет серверу один запрос и ждёт ответа. nullopt - если связи с сервером нет
+std::optional<std::string> SendRequest(const img_lib::Path& socket_path, std::string_view request);
+
+}  // namespace converter
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include "thread_pool.h"
+
+#include <limits>
+
+using namespace std;
+
+namespace converter {
+
+// индекс очереди текущего рабочего потока (или максимум size_t вне пула)
+static thread_local const ThreadPool* current_pool = nullptr;
+static thread_local size_t current_index = numeric_limits<size_t>::max();
+
+ThreadPool::ThreadPool(size_t thread_count) {
+    if (thread_count == 0) {
+        thread_count = max(1u, thread::hardware_concurrency());
+    }
+
+    queues_.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        queues_.push_back(make_unique<WorkQueue>());
+    }
+
+    workers_.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers_.emplace_back([this, i] {
+            WorkerLoop(i);
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    Wait();
+    {
+        lock_guard lock(wake_mutex_);
+        stop_ = true;
+    }
+    wake_cv_.notify_all();
+    for (thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::Submit(Task task) {
+    {
+        lock_guard lock(done_mutex_);
+        ++pending_;
+    }
+
+    size_t index;
+    if (current_pool == this) {
+        index = current_index;
+    } else {
+        index = next_queue_.fetch_add(1, memory_order_relaxed) % queues_.size();
+    }
+
+    {
+        WorkQueue& queue = *queues_[index];
+        lock_guard lock(queue.mutex);
+        queue.tasks.push_back(move(task));
+    }
+
+    {
+        // счётчик меняется под мьютексом, чтобы не потерять пробуждение
+        lock_guard lock(wake_mutex_);
+        ++queued_;
+    }
+    wake_cv_.notify_one();
+}
+
+void ThreadPool::Wait() {
+    unique_lock lock(done_mutex_);
+    done_cv_.wait(lock, [this] {
+        return pending_ == 0;
+    });
+}
+
+bool ThreadPool::TryPop(size_t index, Task& task) {
+    WorkQueue& queue = *queues_[index];
+    lock_guard lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    task = move(queue.tasks.front());
+    queue.tasks.pop_front();
+    return true;
+}
+
+bool ThreadPool::TrySteal(size_t index, Task& task) {
+    // обходим чужие очереди, начиная с соседней
+    for (size_t i = 1; i < queues_.size(); ++i) {
+        WorkQueue& queue = *queues_[(index + i) % queues_.size()];
+        lock_guard lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = move(queue.tasks.back());
+            queue.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::WorkerLoop(size_t index) {
+    current_pool = this;
+    current_index = index;
+
+    while (true) {
+        Task task;
+        if (TryPop(index, task) || TrySteal(index, task)) {
+            --queued_;
+            task();
+
+            lock_guard lock(done_mutex_);
+            if (--pending_ == 0) {
+                done_cv_.notify_all();
+            }
+            continue;
+        }
+
+        unique_lock lock(wake_mutex_);
+        wake_cv_.wait(lock, [this] {
+            return queued_ > 0 || stop_;
+        });
+        if (stop_ && queued_ == 0) {
+            return;
+        }
+    }
+}
+
+}  // namespace converter
\ No newline at end of file
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace converter {
+
+// Пул потоков с перехватом задач (work stealing).
+// У каждого потока своя очередь: поток берёт задачи из начала своей очереди,
+// а когда она опустела - забирает задачи с конца чужих очередей.
+// Так один долгий файл не задерживает задачи, стоящие за ним в очереди
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    // thread_count == 0 означает число аппаратных потоков
+    explicit ThreadPool(size_t thread_count = 0);
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // дожидается выполнения всех задач и останавливает потоки
+    ~ThreadPool();
+
+    // Добавляет задачу. Задачи, добавленные из рабочего потока,
+    // попадают в его собственную очередь
+    void Submit(Task task);
+
+    // блокируется, пока не будут выполнены все добавленные задачи
+    void Wait();
+
+    size_t GetThreadCount() const {
+        return workers_.size();
+    }
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void WorkerLoop(size_t index);
+    bool TryPop(size_t index, Task& task);
+    bool TrySteal(size_t index, Task& task);
+
+    std::vector<std::unique_ptr<WorkQueue>> queues_;
+    std::vector<std::thread> workers_;
+
+    // защищает queued_ и stop_ при ожидании новых задач
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+    std::atomic<size_t> queued_ = 0;
+    bool stop_ = false;
+
+    // число добавленных, но ещё не выполненных задач
+    std::mutex done_mutex_;
+    std::condition_variable done_cv_;
+    size_t pending_ = 0;
+
+    std::atomic<size_t> next_queue_ = 0;
+};
+
+}  // namespace converter
\ No newline at end of file
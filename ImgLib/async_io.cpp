@@ -0,0 +1,345 @@
+#include "async_io.h"
+#include "stats.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#define IMGLIB_HAS_POSIX_READ 1
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace img_lib {
+
+// Блок достаточно крупный, чтобы системных вызовов было мало, и достаточно мелкий,
+// чтобы несколько одновременных конвертаций не занимали заметной памяти
+static const size_t ASYNC_BLOCK_BYTES = 1 << 20;
+// один блок заполняется, остальные пишутся или ждут записи
+static const size_t MAX_WRITE_BLOCKS = 3;
+// сколько прочитанных заранее блоков ждут разбора
+static const size_t MAX_READY_BLOCKS = 2;
+
+WriteBehindFile::~WriteBehindFile() {
+    Close();
+}
+
+bool WriteBehindFile::Open(const Path& file, uint64_t size) {
+    Close();
+    open_ = file_.Open(file, size);
+    if (open_) {
+        position_ = 0;
+        stop_ = false;
+        failed_ = false;
+        current_.data.reserve(ASYNC_BLOCK_BYTES);
+        block_count_ = 1;
+    }
+    return open_;
+}
+
+bool WriteBehindFile::Write(const void* data, size_t size) {
+    return WriteAt(position_, data, size);
+}
+
+bool WriteBehindFile::WriteAt(uint64_t offset, const void* data, size_t size) {
+    if (!open_ || failed_) {
+        return false;
+    }
+
+    // запись не подряд с накопленными данными начинает новый блок
+    if (!current_.data.empty() && offset != current_.offset + current_.data.size()) {
+        Submit();
+    }
+
+    const std::byte* bytes = static_cast<const std::byte*>(data);
+    while (size > 0) {
+        if (current_.data.empty()) {
+            current_.offset = offset;
+        }
+        const size_t part = std::min(size, ASYNC_BLOCK_BYTES - current_.data.size());
+        current_.data.insert(current_.data.end(), bytes, bytes + part);
+        bytes += part;
+        offset += part;
+        size -= part;
+        if (current_.data.size() == ASYNC_BLOCK_BYTES) {
+            Submit();
+        }
+    }
+
+    position_ = offset;
+    return !failed_;
+}
+
+void WriteBehindFile::Submit() {
+    std::unique_lock lock(mutex_);
+    if (!writer_.joinable()) {
+        writer_ = std::thread(&WriteBehindFile::Run, this);
+    }
+    queue_.push_back(std::move(current_));
+    cv_.notify_all();
+
+    current_ = Block{};
+    if (free_.empty() && block_count_ < MAX_WRITE_BLOCKS) {
+        ++block_count_;
+        lock.unlock();
+        current_.data.reserve(ASYNC_BLOCK_BYTES);
+        return;
+    }
+
+    // диск не успевает за кодированием: ждём, пока фоновый поток освободит блок
+    cv_.wait(lock, [this] {
+        return !free_.empty();
+    });
+    current_ = std::move(free_.back());
+    free_.pop_back();
+}
+
+void WriteBehindFile::Run() {
+    std::unique_lock lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this] {
+            return stop_ || !queue_.empty();
+        });
+        if (queue_.empty()) {
+            return;
+        }
+
+        Block block = std::move(queue_.front());
+        queue_.pop_front();
+        lock.unlock();
+
+        // после ошибки блоки только возвращаются, чтобы пишущий поток не ждал вечно
+        if (!failed_ && !file_.WriteAt(block.offset, block.data.data(), block.data.size())) {
+            failed_ = true;
+        }
+        block.data.clear();
+
+        lock.lock();
+        free_.push_back(std::move(block));
+        cv_.notify_all();
+    }
+}
+
+bool WriteBehindFile::Close() {
+    if (!open_) {
+        return !failed_;
+    }
+    open_ = false;
+
+    if (!writer_.joinable()) {
+        // весь файл уместился в одном блоке
+        if (!current_.data.empty() && !file_.WriteAt(current_.offset, current_.data.data(), current_.data.size())) {
+            failed_ = true;
+        }
+    } else {
+        {
+            std::lock_guard lock(mutex_);
+            if (!current_.data.empty()) {
+                queue_.push_back(std::move(current_));
+            }
+            stop_ = true;
+        }
+        cv_.notify_all();
+        writer_.join();
+    }
+
+    current_ = Block{};
+    free_.clear();
+    block_count_ = 0;
+
+    const bool close_ok = file_.Close();
+    return close_ok && !failed_;
+}
+
+size_t WriteBehindFile::GetMaxBufferBytes() {
+    return MAX_WRITE_BLOCKS * ASYNC_BLOCK_BYTES;
+}
+
+
+ReadAheadFile::~ReadAheadFile() {
+    Stop();
+#ifdef IMGLIB_HAS_POSIX_READ
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+#endif
+}
+
+size_t ReadAheadFile::GetMaxBufferBytes(const Path& file) {
+    std::error_code ec;
+    const uintmax_t file_size = std::filesystem::file_size(file, ec);
+    return !ec && file_size < ASYNC_BLOCK_BYTES ? ASYNC_BLOCK_BYTES : (MAX_READY_BLOCKS + 2) * ASYNC_BLOCK_BYTES;
+}
+
+#ifdef IMGLIB_HAS_POSIX_READ
+
+bool ReadAheadFile::Open(const Path& file) {
+    fd_ = ::open(file.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        return false;
+    }
+#ifdef __linux__
+    // подсказка системе: читать с диска впрок и крупнее обычного
+    ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    if (!ReadBlock(current_)) {
+        failed_ = true;
+        return false;
+    }
+    // короткий первый блок - весь файл, и фоновый поток не нужен
+    if (current_.size() == ASYNC_BLOCK_BYTES) {
+        done_ = false;
+        reader_ = std::thread(&ReadAheadFile::Run, this);
+    }
+    return true;
+}
+
+bool ReadAheadFile::ReadBlock(std::vector<std::byte>& data) {
+    data.resize(ASYNC_BLOCK_BYTES);
+    size_t size = 0;
+    while (size < data.size()) {
+        const ssize_t received = ::read(fd_, data.data() + size, data.size() - size);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received < 0) {
+            data.clear();
+            return false;
+        }
+        if (received == 0) {
+            break;
+        }
+        size += static_cast<size_t>(received);
+    }
+    data.resize(size);
+    AddCounter(Counter::BYTES_READ, size);
+    return true;
+}
+
+#else
+
+bool ReadAheadFile::Open(const Path& file) {
+    ifs_.open(file, std::ios::binary);
+    if (!ifs_.is_open()) {
+        return false;
+    }
+
+    if (!ReadBlock(current_)) {
+        failed_ = true;
+        return false;
+    }
+    if (current_.size() == ASYNC_BLOCK_BYTES) {
+        done_ = false;
+        reader_ = std::thread(&ReadAheadFile::Run, this);
+    }
+    return true;
+}
+
+bool ReadAheadFile::ReadBlock(std::vector<std::byte>& data) {
+    data.resize(ASYNC_BLOCK_BYTES);
+    ifs_.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    if (ifs_.bad()) {
+        data.clear();
+        return false;
+    }
+    data.resize(static_cast<size_t>(ifs_.gcount()));
+    AddCounter(Counter::BYTES_READ, data.size());
+    return true;
+}
+
+#endif
+
+void ReadAheadFile::Run() {
+    while (true) {
+        std::vector<std::byte> block;
+        {
+            std::unique_lock lock(mutex_);
+            cv_.wait(lock, [this] {
+                return stop_ || ready_.size() < MAX_READY_BLOCKS;
+            });
+            if (stop_) {
+                done_ = true;
+                return;
+            }
+            if (!free_.empty()) {
+                block = std::move(free_.back());
+                free_.pop_back();
+            }
+        }
+
+        const bool ok = ReadBlock(block);
+        const bool end = !ok || block.empty();
+        {
+            std::lock_guard lock(mutex_);
+            if (!ok) {
+                failed_ = true;
+            }
+            if (!end) {
+                ready_.push_back(std::move(block));
+            }
+            done_ = end;
+        }
+        cv_.notify_all();
+        if (end) {
+            return;
+        }
+    }
+}
+
+ByteSpan ReadAheadFile::Peek() {
+    if (pos_ < current_.size()) {
+        return {current_.data() + pos_, current_.size() - pos_};
+    }
+
+    std::unique_lock lock(mutex_);
+    cv_.wait(lock, [this] {
+        return !ready_.empty() || done_;
+    });
+    if (ready_.empty()) {
+        return {};
+    }
+
+    free_.push_back(std::move(current_));
+    current_ = std::move(ready_.front());
+    ready_.pop_front();
+    pos_ = 0;
+    lock.unlock();
+    cv_.notify_all();
+    return {current_.data(), current_.size()};
+}
+
+void ReadAheadFile::Consume(size_t size) {
+    pos_ = std::min(pos_ + size, current_.size());
+}
+
+size_t ReadAheadFile::Read(void* data, size_t size) {
+    std::byte* dst = static_cast<std::byte*>(data);
+    size_t total = 0;
+    while (total < size) {
+        const ByteSpan available = Peek();
+        if (available.size == 0) {
+            break;
+        }
+        const size_t part = std::min(size - total, available.size);
+        std::memcpy(dst + total, available.data, part);
+        Consume(part);
+        total += part;
+    }
+    return total;
+}
+
+void ReadAheadFile::Stop() {
+    if (reader_.joinable()) {
+        {
+            std::lock_guard lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        reader_.join();
+    }
+}
+
+}  // namespace img_lib
\ No newline at end of file
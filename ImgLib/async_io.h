@@ -0,0 +1,125 @@
+#pragma once
+#include "img_lib.h"
+#include "output_file.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace img_lib {
+
+// Запись в файл с отложенным сбросом на диск. Данные копятся в блоке, заполненный
+// блок отдаётся фоновому потоку, а вызывающий продолжает работу со следующим блоком.
+// Так кодирование не простаивает, пока система пишет предыдущий блок. Блоков не больше
+// трёх; если все заняты, запись ждёт освобождения одного из них. Фоновый поток
+// запускается при первом заполненном блоке, поэтому маленькие файлы пишутся одним
+// вызовом в Close без лишнего потока. Класс рассчитан на один пишущий поток
+class WriteBehindFile {
+public:
+    WriteBehindFile() = default;
+    ~WriteBehindFile();
+
+    WriteBehindFile(const WriteBehindFile&) = delete;
+    WriteBehindFile& operator=(const WriteBehindFile&) = delete;
+
+    // создаёт файл; size - ожидаемый размер для резервирования места, 0 - неизвестен
+    bool Open(const Path& file, uint64_t size = 0);
+    // дописывает данные после последней записи
+    bool Write(const void* data, size_t size);
+    // Записывает данные по смещению offset. Записи подряд собираются в один блок.
+    // false - если эта или одна из прошлых записей не удалась
+    bool WriteAt(uint64_t offset, const void* data, size_t size);
+    // дожидается записи всех блоков и закрывает файл; false, если какая-то из записей не удалась
+    bool Close();
+
+    // наибольший объём блоков одного файла
+    static size_t GetMaxBufferBytes();
+
+private:
+    struct Block {
+        std::vector<std::byte> data;
+        uint64_t offset = 0;
+    };
+
+    // отдаёт текущий блок фоновому потоку и берёт свободный
+    void Submit();
+    void Run();
+
+    OutputFile file_;
+    bool open_ = false;
+    uint64_t position_ = 0;
+    Block current_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    // заполненные блоки в порядке записи
+    std::deque<Block> queue_;
+    std::vector<Block> free_;
+    size_t block_count_ = 0;
+    bool stop_ = false;
+    std::atomic<bool> failed_ = false;
+    std::thread writer_;
+};
+
+// Последовательное чтение файла с упреждением. Первый блок читается при открытии;
+// если файл длиннее, фоновый поток читает следующие блоки заранее, пока вызывающий
+// разбирает текущий, и держит наготове не больше двух. Класс рассчитан на один читающий поток
+class ReadAheadFile {
+public:
+    ReadAheadFile() = default;
+    ~ReadAheadFile();
+
+    ReadAheadFile(const ReadAheadFile&) = delete;
+    ReadAheadFile& operator=(const ReadAheadFile&) = delete;
+
+    bool Open(const Path& file);
+
+    // Непрочитанные данные текущего блока, при необходимости ждёт следующий блок.
+    // Данные действительны до следующего вызова Peek или Read.
+    // Пустой диапазон - конец файла или ошибка чтения
+    ByteSpan Peek();
+    // отмечает первые size байт из Peek прочитанными
+    void Consume(size_t size);
+    // копирует до size байт в data; меньше - только в конце файла или при ошибке
+    size_t Read(void* data, size_t size);
+
+    bool IsFailed() const {
+        return failed_;
+    }
+
+    // Наибольший объём блоков при чтении file: текущий, готовые и читаемый
+    // фоновым потоком. Файл короче блока читается одним блоком
+    static size_t GetMaxBufferBytes(const Path& file);
+
+private:
+    // читает следующий блок файла; пустой блок - конец файла
+    bool ReadBlock(std::vector<std::byte>& data);
+    void Run();
+    void Stop();
+
+#if defined(__unix__) || defined(__APPLE__)
+    int fd_ = -1;
+#else
+    std::ifstream ifs_;
+#endif
+    std::vector<std::byte> current_;
+    size_t pos_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::vector<std::byte>> ready_;
+    std::vector<std::vector<std::byte>> free_;
+    // фоновый поток дочитал файл до конца или до ошибки
+    bool done_ = true;
+    bool stop_ = false;
+    std::atomic<bool> failed_ = false;
+    std::thread reader_;
+};
+
+}  // namespace img_lib
\ No newline at end of file
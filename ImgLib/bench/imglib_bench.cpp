@@ -0,0 +1,391 @@
+// Микробенчмарк кодеков ImgLib и ядер упаковки пикселей.
+// Генерирует синтетические изображения нескольких размеров и видов,
+// замеряет Load*/Save* и перепаковку строк и печатает по одной JSON-строке
+// на замер - такой вывод удобно накапливать и сравнивать между сборками
+
+#include <bmp_image.h>
+#include <img_lib.h>
+#include <jpeg_image.h>
+#include <pixel_kernels.h>
+#include <ppm_image.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <jpeglib.h>
+
+using namespace std;
+using namespace img_lib;
+namespace fs = std::filesystem;
+
+namespace {
+
+struct BenchConfig {
+    vector<Size> sizes = {{256, 256}, {1920, 1080}, {4000, 3000}};
+    // каждый замер повторяется, пока не наберётся столько времени
+    double min_seconds = 0.2;
+    int min_iterations = 3;
+    fs::path work_dir;
+    optional<fs::path> out_path;
+};
+
+enum class Content {
+    NOISE,
+    GRADIENT,
+    PHOTO
+};
+
+string_view GetContentName(Content content) {
+    switch (content) {
+        case Content::NOISE:
+            return "noise"sv;
+        case Content::GRADIENT:
+            return "gradient"sv;
+        case Content::PHOTO:
+            return "photo"sv;
+    }
+    return "unknown"sv;
+}
+
+string_view GetKernelLevelName(KernelLevel level) {
+    switch (level) {
+        case KernelLevel::SCALAR:
+            return "scalar"sv;
+        case KernelLevel::SSSE3:
+            return "ssse3"sv;
+        case KernelLevel::AVX2:
+            return "avx2"sv;
+    }
+    return "unknown"sv;
+}
+
+// простой детерминированный генератор, чтобы изображения не менялись между запусками
+class XorShift {
+public:
+    uint32_t Next() {
+        state_ ^= state_ << 13;
+        state_ ^= state_ >> 17;
+        state_ ^= state_ << 5;
+        return state_;
+    }
+
+private:
+    uint32_t state_ = 2463534242u;
+};
+
+byte ToChannel(double value) {
+    return static_cast<byte>(clamp(static_cast<int>(lround(value)), 0, 255));
+}
+
+// "Фотография": плавные пятна света, несколько резких границ и слабый шум сенсора.
+// Сжимается JPEG примерно как настоящие снимки, в отличие от шума и градиентов
+Image MakeImage(Size size, Content content) {
+    Image image(size.width, size.height);
+    XorShift rng;
+
+    for (int y = 0; y < size.height; ++y) {
+        Color* line = image.GetLine(y);
+        const double fy = static_cast<double>(y) / size.height;
+
+        for (int x = 0; x < size.width; ++x) {
+            const double fx = static_cast<double>(x) / size.width;
+            switch (content) {
+                case Content::NOISE: {
+                    const uint32_t value = rng.Next();
+                    line[x] = {static_cast<byte>(value), static_cast<byte>(value >> 8),
+                               static_cast<byte>(value >> 16), byte{255}};
+                    break;
+                }
+                case Content::GRADIENT:
+                    line[x] = {ToChannel(255 * fx), ToChannel(255 * fy), ToChannel(255 * (1 - fx) * fy), byte{255}};
+                    break;
+                case Content::PHOTO: {
+                    const double light = 0.5 + 0.25 * sin(fx * 7.1 + fy * 2.3) + 0.2 * cos(fy * 9.7 - fx * 3.1);
+                    const bool object = (fx - 0.6) * (fx - 0.6) + (fy - 0.4) * (fy - 0.4) < 0.05;
+                    const double noise = static_cast<int>(rng.Next() % 9) - 4;
+                    const double r = object ? 200 * light + 30 : 120 * light + 60 * fy;
+                    const double g = object ? 80 * light : 140 * light + 40 * fx;
+                    const double b = object ? 40 * light : 90 + 100 * light * (1 - fy);
+                    line[x] = {ToChannel(r + noise), ToChannel(g + noise), ToChannel(b + noise), byte{255}};
+                    break;
+                }
+            }
+        }
+    }
+    return image;
+}
+
+struct Measurement {
+    int iterations = 0;
+    double best_seconds = 0.;
+    double median_seconds = 0.;
+};
+
+// повторяет op, пока не наберутся min_iterations запусков и min_seconds времени
+Measurement Measure(const BenchConfig& config, const function<bool()>& op) {
+    vector<double> times;
+    double total = 0.;
+    while (static_cast<int>(times.size()) < config.min_iterations || total < config.min_seconds) {
+        const auto start = chrono::steady_clock::now();
+        if (!op()) {
+            return {};
+        }
+        const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        times.push_back(seconds);
+        total += seconds;
+    }
+
+    sort(times.begin(), times.end());
+    return {static_cast<int>(times.size()), times.front(), times[times.size() / 2]};
+}
+
+class Reporter {
+public:
+    explicit Reporter(ostream& out)
+        : out_(out) {
+    }
+
+    // Одна JSON-строка на замер. Скорость считается по 24-битным пикселям
+    // (3 байта на пиксель), чтобы кодеки разных форматов можно было сравнивать
+    void Report(string_view op, string_view variant, Content content, Size size,
+                const Measurement& measurement, uintmax_t file_bytes = 0) {
+        const double pixels = static_cast<double>(size.width) * size.height;
+        out_ << "{\"op\":\""sv << op << "\",\"variant\":\""sv << variant
+             << "\",\"content\":\""sv << GetContentName(content)
+             << "\",\"width\":"sv << size.width << ",\"height\":"sv << size.height;
+
+        if (measurement.iterations == 0) {
+            out_ << ",\"error\":true}"sv << endl;
+            cerr << op << ' ' << variant << ' ' << GetContentName(content) << ' '
+                 << size.width << 'x' << size.height << ": FAILED"sv << endl;
+            return;
+        }
+
+        const double ns_per_pixel = measurement.best_seconds * 1e9 / pixels;
+        const double mb_per_s = pixels * 3 / measurement.best_seconds / 1e6;
+        out_ << ",\"iterations\":"sv << measurement.iterations
+             << ",\"best_ms\":"sv << measurement.best_seconds * 1e3
+             << ",\"median_ms\":"sv << measurement.median_seconds * 1e3
+             << ",\"ns_per_pixel\":"sv << ns_per_pixel
+             << ",\"mb_per_s\":"sv << mb_per_s;
+        if (file_bytes > 0) {
+            out_ << ",\"file_bytes\":"sv << file_bytes;
+        }
+        out_ << '}' << endl;
+
+        cerr << op << ' ' << variant << ' ' << GetContentName(content) << ' '
+             << size.width << 'x' << size.height << ": "sv << ns_per_pixel << " ns/px, "sv
+             << mb_per_s << " MB/s"sv << endl;
+    }
+
+    void ReportHeader() {
+        out_ << "{\"bench\":\"imglib\",\"kernel_level\":\""sv << GetKernelLevelName(GetBestKernelLevel())
+             << "\",\"libjpeg_version\":"sv << JPEG_LIB_VERSION
+#ifdef __VERSION__
+             << ",\"compiler\":\""sv << __VERSION__ << '"'
+#endif
+             << '}' << endl;
+    }
+
+private:
+    ostream& out_;
+};
+
+uintmax_t GetFileSize(const fs::path& path) {
+    error_code ec;
+    const uintmax_t size = fs::file_size(path, ec);
+    return ec ? 0 : size;
+}
+
+struct Codec {
+    string_view name;
+    string_view extension;
+    function<bool(const fs::path&, const Image&)> save;
+    function<Image(const fs::path&)> load;
+};
+
+void BenchCodecs(const BenchConfig& config, Reporter& reporter, const Image& image, Content content) {
+    const Size size = {image.GetWidth(), image.GetHeight()};
+    const vector<Codec> codecs = {
+        {"JPEG"sv, ".jpg"sv, [](const fs::path& p, const Image& i) { return SaveJPEG(p, i); },
+         [](const fs::path& p) { return LoadJPEG(p); }},
+        {"BMP"sv, ".bmp"sv, [](const fs::path& p, const Image& i) { return SaveBMP(p, i); },
+         [](const fs::path& p) { return LoadBMP(p); }},
+        {"PPM"sv, ".ppm"sv, [](const fs::path& p, const Image& i) { return SavePPM(p, i); },
+         [](const fs::path& p) { return LoadPPM(p); }},
+    };
+
+    for (const Codec& codec : codecs) {
+        const fs::path path = config.work_dir / (string(GetContentName(content)) + string(codec.extension));
+
+        const Measurement save = Measure(config, [&] {
+            return codec.save(path, image);
+        });
+        reporter.Report("Save"s + string(codec.name), "default"sv, content, size, save, GetFileSize(path));
+
+        const Measurement load = Measure(config, [&] {
+            return static_cast<bool>(codec.load(path));
+        });
+        reporter.Report("Load"s + string(codec.name), "default"sv, content, size, load, GetFileSize(path));
+    }
+}
+
+// ядра перепаковки строк на всех уровнях, которые поддерживает процессор
+void BenchKernels(const BenchConfig& config, Reporter& reporter, const Image& image, Content content) {
+    const Size size = {image.GetWidth(), image.GetHeight()};
+    vector<byte> packed(static_cast<size_t>(size.width) * 3);
+    Image unpacked(size.width, size.height);
+
+    for (int level = 0; level <= static_cast<int>(GetBestKernelLevel()); ++level) {
+        const PixelKernels& kernels = GetPixelKernels(static_cast<KernelLevel>(level));
+        const string_view variant = GetKernelLevelName(kernels.level);
+
+        const auto pack = [&](PixelKernels::PackFn fn) {
+            return Measure(config, [&] {
+                for (int y = 0; y < size.height; ++y) {
+                    fn(image.GetLine(y), packed.data(), size.width);
+                }
+                return true;
+            });
+        };
+        const auto unpack = [&](PixelKernels::UnpackFn fn) {
+            return Measure(config, [&] {
+                for (int y = 0; y < size.height; ++y) {
+                    fn(packed.data(), unpacked.GetLine(y), size.width);
+                }
+                return true;
+            });
+        };
+
+        reporter.Report("PackRGB"sv, variant, content, size, pack(kernels.pack_rgb));
+        reporter.Report("PackBGR"sv, variant, content, size, pack(kernels.pack_bgr));
+        reporter.Report("UnpackRGB"sv, variant, content, size, unpack(kernels.unpack_rgb));
+        reporter.Report("UnpackBGR"sv, variant, content, size, unpack(kernels.unpack_bgr));
+    }
+}
+
+optional<int> ParseInt(string_view str) {
+    int value = 0;
+    const auto [ptr, ec] = from_chars(str.data(), str.data() + str.size(), value);
+    if (ec != errc{} || ptr != str.data() + str.size()) {
+        return nullopt;
+    }
+    return value;
+}
+
+// положительное число секунд
+optional<double> ParseSeconds(string_view str) {
+    double value = 0;
+    const auto [ptr, ec] = from_chars(str.data(), str.data() + str.size(), value);
+    if (ec != errc{} || ptr != str.data() + str.size() || !isfinite(value) || value <= 0) {
+        return nullopt;
+    }
+    return value;
+}
+
+// список размеров вида 640x480,1920x1080
+optional<vector<Size>> ParseSizes(string_view str) {
+    vector<Size> sizes;
+    while (!str.empty()) {
+        const size_t comma = str.find(',');
+        const string_view item = str.substr(0, comma);
+        const size_t x_pos = item.find('x');
+        if (x_pos == string_view::npos) {
+            return nullopt;
+        }
+        const optional<int> width = ParseInt(item.substr(0, x_pos));
+        const optional<int> height = ParseInt(item.substr(x_pos + 1));
+        if (!width || !height || *width <= 0 || *height <= 0) {
+            return nullopt;
+        }
+        sizes.push_back({*width, *height});
+        str = comma == string_view::npos ? string_view{} : str.substr(comma + 1);
+    }
+    return sizes.empty() ? nullopt : optional(sizes);
+}
+
+void PrintUsage(string_view program) {
+    cerr << "Usage: "sv << program << " [--sizes WxH[,WxH...]] [--min-time <seconds>] [--out <file.jsonl>] [--dir <work_dir>]"sv << endl;
+}
+
+}  // namespace
+
+
+int main(int argc, const char** argv) {
+    BenchConfig config;
+    const vector<string_view> args(argv + 1, argv + argc);
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        const bool has_value = i + 1 < args.size();
+        if (args[i] == "--sizes"sv && has_value) {
+            const optional<vector<Size>> sizes = ParseSizes(args[++i]);
+            if (!sizes) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            config.sizes = *sizes;
+        } else if (args[i] == "--min-time"sv && has_value) {
+            const optional<double> seconds = ParseSeconds(args[++i]);
+            if (!seconds) {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            config.min_seconds = *seconds;
+        } else if (args[i] == "--out"sv && has_value) {
+            config.out_path = string(args[++i]);
+        } else if (args[i] == "--dir"sv && has_value) {
+            config.work_dir = string(args[++i]);
+        } else {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // временные файлы кодеков пишутся в отдельный каталог, который затем удаляется
+    const bool own_dir = config.work_dir.empty();
+    if (own_dir) {
+        config.work_dir = fs::temp_directory_path() / "imglib_bench";
+    }
+    error_code ec;
+    fs::create_directories(config.work_dir, ec);
+    if (ec) {
+        cerr << "Cannot create "sv << config.work_dir << endl;
+        return 1;
+    }
+
+    ofstream out_file;
+    if (config.out_path) {
+        out_file.open(*config.out_path);
+        if (!out_file) {
+            cerr << "Cannot open "sv << *config.out_path << endl;
+            return 1;
+        }
+    }
+    Reporter reporter(config.out_path ? out_file : cout);
+    reporter.ReportHeader();
+
+    for (const Size size : config.sizes) {
+        for (const Content content : {Content::NOISE, Content::GRADIENT, Content::PHOTO}) {
+            const Image image = MakeImage(size, content);
+            BenchCodecs(config, reporter, image, content);
+            BenchKernels(config, reporter, image, content);
+        }
+    }
+
+    if (own_dir) {
+        fs::remove_all(config.work_dir, ec);
+    }
+    return 0;
+}
\ No newline at end of file
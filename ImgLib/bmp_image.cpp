@@ -1,10 +1,20 @@
 #include "bmp_image.h"
+#include "async_io.h"
+#include "output_file.h"
 #include "pack_defines.h"
+#include "pixel_format.h"
+#include "pixel_kernels.h"
+#include "stats.h"
 
+#include <algorithm>
 #include <array>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <string_view>
 #include <iostream>
+#include <type_traits>
+#include <vector>
 
 using namespace std;
 
@@ -13,6 +23,12 @@ namespace img_lib {
 static const char BMP_SIGN[2] = {'B', 'M'}; 
 static const int BMP_INFO_HEADER_SIZE = 40;
 static const int BMP_FILE_HEADER_SIZE = 14;
+static const int BMP_V4_HEADER_SIZE = 108;
+
+// типы сжатия: без сжатия и несжатые пиксели с масками каналов
+static const uint32_t BMP_BI_RGB = 0;
+static const uint32_t BMP_BI_BITFIELDS = 3;
+static const uint32_t BMP_BI_ALPHABITFIELDS = 6;
 
 
 // поля заголовка Bitmap File Header
@@ -29,10 +45,10 @@ PACKED_STRUCT_END
 PACKED_STRUCT_BEGIN BitmapInfoHeader {
     uint32_t info_header_size = BMP_INFO_HEADER_SIZE;  //Размер заголовка. Учитывается только размер второй части заголовка.
     int32_t img_width;  // Ширина изображения в пикселях — 4 байта, знаковое целое.
-    int32_t img_height;  // Высота изображения в пикселях — 4 байта, знаковое целое.
+    int32_t img_height;  // Высота изображения в пикселях — 4 байта, знаковое целое. Отрицательная - строки идут сверху вниз.
     uint16_t num_of_layers = 1;  // Количество плоскостей. В нашем случае всегда 1 — одна RGB плоскость.
-    uint16_t bits_per_pixel = 24;  // Количество бит на пиксель. В нашем случае всегда 24.
-    uint32_t compress_type = 0;  // Тип сжатия. В нашем случае всегда 0 — отсутствие сжатия.
+    uint16_t bits_per_pixel = 24;  // Количество бит на пиксель: 24 или 32.
+    uint32_t compress_type = 0;  // Тип сжатия: 0 — отсутствие сжатия, 3 — несжатые пиксели с масками каналов.
     uint32_t data_size;  // Количество байт в данных. Произведение отступа на высоту.
     int32_t h_resolution = 11811;  // Горизонтальное разрешение, пикселей на метр. 11811 соответствует 300 DPI.
     int32_t v_resolution = 11811;  // Вертикальное разрешение, пикселей на метр. 11811 соответствует 300 DPI.
@@ -41,141 +57,623 @@ PACKED_STRUCT_BEGIN BitmapInfoHeader {
 }
 PACKED_STRUCT_END
 
+// Продолжение заголовка до BITMAPV4HEADER - в нём 32-битные файлы хранят маски каналов,
+// в том числе альфа-канала, которой нет в 40-байтном заголовке
+PACKED_STRUCT_BEGIN BitmapV4Fields {
+    uint32_t red_mask = 0;
+    uint32_t green_mask = 0;
+    uint32_t blue_mask = 0;
+    uint32_t alpha_mask = 0;
+    uint32_t color_space = 0x73524742;  // 'sRGB'
+    uint32_t endpoints[9] = {};  // координаты основных цветов, для sRGB не используются
+    uint32_t gamma[3] = {};
+}
+PACKED_STRUCT_END
+
+// Заголовки файла подряд, как они лежат в файле. 24-битные файлы пишутся
+// с 40-байтным заголовком, поля v4 записываются только для 32 бит
+PACKED_STRUCT_BEGIN BitmapHeaders {
+    BitmapFileHeader file;
+    BitmapInfoHeader info;
+    BitmapV4Fields v4;
+}
+PACKED_STRUCT_END
+
+// маски каналов и соответствующий им порядок байт пикселя
+struct BmpChannelMasks {
+    uint32_t red, green, blue, alpha;
+    ChannelOrder order;
+};
+
+static const BmpChannelMasks BMP_CHANNEL_MASKS[] = {
+    {0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000, ChannelOrder::BGRA},
+    {0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000, ChannelOrder::RGBA},
+    {0x00ff0000, 0x0000ff00, 0x000000ff, 0, ChannelOrder::BGRX},
+    {0x000000ff, 0x0000ff00, 0x00ff0000, 0, ChannelOrder::RGBX},
+};
+
 
 // функция вычисления отступа по ширине
-static int GetBMPStride(int w) {
-    return 4 * ((w * 3 + 3) / 4);
+static int64_t GetBMPStride(int w, int pixel_bytes) {
+    return 4 * ((static_cast<int64_t>(w) * pixel_bytes + 3) / 4);
 }
 
+static ChannelOrder GetSaveOrder(BmpPixelLayout layout) {
+    switch (layout) {
+        case BmpPixelLayout::BGRA32:
+            return ChannelOrder::BGRA;
+        case BmpPixelLayout::RGBA32:
+            return ChannelOrder::RGBA;
+        default:
+            return ChannelOrder::BGR;
+    }
+}
 
-// напишите эту функцию
-bool SaveBMP(const Path& file, const Image& image){
-    bool res = false;
-    ofstream ofs(file, ios::binary);
 
-    if (!ofs.is_open()) {
-        std::cerr << "Error in input file opening"sv << std::endl;
-        return res;
+// заполняет заголовки файла для изображения заданного размера
+static BitmapHeaders MakeBMPHeaders(Size size, const BmpSaveOptions& options) {
+    BitmapHeaders headers;
+    const ChannelOrder order = GetSaveOrder(options.layout);
+    const int pixel_bytes = GetPixelBytes(order);
+
+    headers.info.img_height = options.top_down ? -size.height : size.height;
+    headers.info.img_width = size.width;
+    headers.info.bits_per_pixel = static_cast<uint16_t>(pixel_bytes * 8);
+    // размер данных в байтах = произведение отступа на высоту
+    headers.info.data_size = static_cast<uint32_t>(GetBMPStride(size.width, pixel_bytes) * size.height);
+
+    if (pixel_bytes == 4) {
+        headers.info.info_header_size = BMP_V4_HEADER_SIZE;
+        headers.info.compress_type = BMP_BI_BITFIELDS;
+        for (const BmpChannelMasks& masks : BMP_CHANNEL_MASKS) {
+            if (masks.order == order) {
+                headers.v4.red_mask = masks.red;
+                headers.v4.green_mask = masks.green;
+                headers.v4.blue_mask = masks.blue;
+                headers.v4.alpha_mask = masks.alpha;
+            }
+        }
     }
 
-    
-    // Инициируем структуры header-ов BMP
+    headers.file.data_shift = BMP_FILE_HEADER_SIZE + headers.info.info_header_size;
+    headers.file.full_size = headers.file.data_shift + headers.info.data_size;
+    return headers;
+}
+
+
+// Раскладка пикселей, прочитанная из заголовков
+struct BmpLayout {
+    Size size = {0, 0};
+    bool top_down = false;
+    ChannelOrder order = ChannelOrder::BGR;
+    int64_t stride = 0;
+    uint64_t data_shift = 0;
+};
+
+// сколько байт от начала файла нужно разбору заголовков: с масками каналов после 40-байтного заголовка
+static const size_t BMP_MAX_HEADERS_SIZE = BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE + 4 * sizeof(uint32_t);
+
+// Проверяет заголовки в начале файла: поддерживаются несжатые изображения 24 бит
+// и 32 бит (без масок или с масками BGRA и RGBA), строки снизу вверх и сверху вниз
+static std::optional<BmpLayout> ParseBMPHeaders(ByteSpan data) {
     BitmapFileHeader file_header;
     BitmapInfoHeader info_header;
+    if (data.size < sizeof(file_header) + sizeof(info_header)) {
+        std::cerr << "Error in reading the headers"sv << std::endl;
+        return std::nullopt;
+    }
+
+    // заголовки копируем: в памяти они могут быть не выровнены
+    std::memcpy(&file_header, data.data, sizeof(file_header));
+    std::memcpy(&info_header, data.data + sizeof(file_header), sizeof(info_header));
 
-    // вычисляем отступ
-    int stride = GetBMPStride(image.GetWidth());
+    // проверяем сигнатуру
+    if (file_header.sign[0] != BMP_SIGN[0] || file_header.sign[1] != BMP_SIGN[1]) {
+        std::cerr << "Incorrect signature of file" << std::endl;
+        return std::nullopt;
+    }
 
-    info_header.img_height = image.GetHeight();
-    info_header.img_width = image.GetWidth();
-    info_header.data_size = stride * info_header.img_height;  // размер данных в байтах = произведение отступа на высоту
-    info_header.info_header_size = sizeof(info_header);
+    if (info_header.img_width <= 0 || info_header.img_height == 0 || info_header.img_height == INT32_MIN) {
+        std::cerr << "Incorrect size in BMP info header"sv << std::endl;
+        return std::nullopt;
+    }
 
-    file_header.full_size = sizeof(file_header) + sizeof(info_header) + info_header.data_size;
-    
-    // Записываем заголовки
-    ofs.write(reinterpret_cast<char*>(&file_header), sizeof(file_header));
-    ofs.write(reinterpret_cast<char*>(&info_header), sizeof(info_header));
+    BmpLayout layout;
+    if (info_header.bits_per_pixel == 24 && info_header.compress_type == BMP_BI_RGB) {
+        layout.order = ChannelOrder::BGR;
+    } else if (info_header.bits_per_pixel == 32 && info_header.compress_type == BMP_BI_RGB) {
+        layout.order = ChannelOrder::BGRX;
+    } else if (info_header.bits_per_pixel == 32 && (info_header.compress_type == BMP_BI_BITFIELDS
+                                                    || info_header.compress_type == BMP_BI_ALPHABITFIELDS)) {
+        // маски идут сразу за 40-байтным заголовком или входят в заголовок большего размера;
+        // маска альфа-канала есть в заголовках от 56 байт и при BI_ALPHABITFIELDS
+        const bool has_alpha_mask = info_header.info_header_size >= 56 || info_header.compress_type == BMP_BI_ALPHABITFIELDS;
+        uint32_t masks[4] = {};
+        const size_t masks_size = (has_alpha_mask ? 4 : 3) * sizeof(uint32_t);
+        if (data.size < sizeof(file_header) + sizeof(info_header) + masks_size) {
+            std::cerr << "Error in reading the headers"sv << std::endl;
+            return std::nullopt;
+        }
+        std::memcpy(masks, data.data + sizeof(file_header) + sizeof(info_header), masks_size);
 
-    if (!ofs.good()) {
-        std::cerr << "Error in writing the headers"sv << std::endl;
-        return res;
-    }
-    
-    // В буфер будем записывать строку изображения с учетом padding
-    std::vector<char> buff(stride);
-    try{
-        // Идем по строкам изображения 
-        for (int y = (info_header.img_height - 1) ; y >= 0; --y) {
-            // берем очередную строку изображения
-            const Color* color_line = image.GetLine(y);
-            for (int x = 0; x < info_header.img_width; ++x) {
-                buff[3 * x] = static_cast<char>(color_line[x].b);
-                buff[3 * x + 1] = static_cast<char>(color_line[x].g);
-                buff[3 * x + 2] = static_cast<char>(color_line[x].r);
+        const BmpChannelMasks* found = nullptr;
+        for (const BmpChannelMasks& known : BMP_CHANNEL_MASKS) {
+            if (known.red == masks[0] && known.green == masks[1] && known.blue == masks[2] && known.alpha == masks[3]) {
+                found = &known;
             }
-            // Заполняем padding
-            for (int i = 3 * info_header.img_width; i < stride; i++) {
-                // цвета в BMP в обратном порядке blue-green-red
-                buff[i] = static_cast<char>(0);
-            }
-            ofs.write(buff.data(), stride);
         }
-    } catch (...) {
-        std::cerr << "Error in image writing"sv << endl;
-        return res;
+        if (!found) {
+            std::cerr << "Unsupported channel masks in BMP info header"sv << std::endl;
+            return std::nullopt;
+        }
+        layout.order = found->order;
+    } else {
+        std::cerr << "Unsupported bit depth or compression in BMP info header"sv << std::endl;
+        return std::nullopt;
     }
-    res = ofs.good();
 
-    return res;
+    // маски после 40-байтного заголовка тоже не должны пересекаться с пикселями
+    uint64_t headers_end = sizeof(file_header) + info_header.info_header_size;
+    if (info_header.info_header_size == BMP_INFO_HEADER_SIZE && info_header.compress_type != BMP_BI_RGB) {
+        headers_end += (info_header.compress_type == BMP_BI_ALPHABITFIELDS ? 4 : 3) * sizeof(uint32_t);
+    }
+
+    layout.top_down = info_header.img_height < 0;
+    layout.size = {info_header.img_width, layout.top_down ? -info_header.img_height : info_header.img_height};
+    layout.stride = GetBMPStride(layout.size.width, GetPixelBytes(layout.order));
+    layout.data_shift = file_header.data_shift;
+
+    // для несжатых файлов размер данных может быть не указан
+    const int64_t data_size = layout.stride * layout.size.height;
+    if (info_header.data_size != 0 && data_size != static_cast<int64_t>(info_header.data_size)) {
+        std::cerr << "Incorrect stride or data size in BMP info header"sv << std::endl;
+        return std::nullopt;
+    }
+    if (layout.data_shift < headers_end) {
+        std::cerr << "Incorrect data offset in BMP file header"sv << std::endl;
+        return std::nullopt;
+    }
+
+    return layout;
 }
 
 
-// напишите эту функцию
-Image LoadBMP(const Path& file) {
-    // открываем поток с флагом ios::binary
-    // поскольку будем читать даные в двоичном формате
-    ifstream ifs(file, ios::binary);
+// упаковывает строку Color в порядок каналов файла
+static void PackRow(const Color* src, ChannelOrder order, byte* dst, int width) {
+    switch (order) {
+        case ChannelOrder::RGBA:
+            // порядок байт совпадает с Color
+            std::memcpy(dst, src, sizeof(Color) * width);
+            break;
+        case ChannelOrder::BGRA:
+            PackBGRA(src, dst, width);
+            break;
+        default:
+            PackBGR(src, dst, width);
+            break;
+    }
+}
 
-    if (!ifs.is_open()) {
-        std::cerr << "Error in output file opening"sv << std::endl;
-        return {};
+
+// Размер блока строк, которые источник и приёмник переставляют за одно обращение к файлу.
+// Строки в BMP обычно идут снизу вверх, поэтому блок из нескольких соседних строк изображения
+// занимает в файле непрерывный участок и читается или пишется целиком
+static const int BMP_BLOCK_BYTES = 1 << 20;
+
+static int GetBMPBlockRows(int64_t stride, int height) {
+    return static_cast<int>(std::max<int64_t>(1, std::min<int64_t>(height, BMP_BLOCK_BYTES / std::max<int64_t>(stride, 1))));
+}
+
+// Источник строк BMP: читает файл блоками (с конца, если строки хранятся снизу вверх),
+// а строки выдаёт сверху вниз
+class BmpSource : public ScanlineSource {
+public:
+    bool Open(const Path& file) {
+        ScopedStageTimer timer(Stage::OPEN);
+        // открываем поток с флагом ios::binary
+        // поскольку будем читать даные в двоичном формате
+        ifs_.open(file, ios::binary);
+
+        if (!ifs_.is_open()) {
+            std::cerr << "Error in output file opening"sv << std::endl;
+            return false;
+        }
+
+        // читаем заголовки вместе с масками каналов; файл может быть короче
+        std::array<byte, BMP_MAX_HEADERS_SIZE> headers;
+        ifs_.read(reinterpret_cast<char*>(headers.data()), headers.size());
+        AddCounter(Counter::BYTES_READ, ifs_.gcount());
+        ifs_.clear();
+
+        const std::optional<BmpLayout> layout = ParseBMPHeaders({headers.data(), static_cast<size_t>(ifs_.gcount())});
+        if (!layout) {
+            return false;
+        }
+
+        layout_ = *layout;
+        block_rows_ = GetBMPBlockRows(layout_.stride, layout_.size.height);
+        block_.resize(static_cast<size_t>(block_rows_) * layout_.stride);
+        return true;
     }
 
-    std::string sign;
-    BitmapFileHeader file_header;
-    BitmapInfoHeader info_header;
+    Size GetSize() const override {
+        return layout_.size;
+    }
 
-    // читаем заголовки
-    ifs.read(reinterpret_cast<char*>(&file_header), sizeof(file_header));
-    ifs.read(reinterpret_cast<char*>(&info_header), sizeof(info_header));
+    bool ReadRow(Color* line) override {
+        if (next_y_ >= layout_.size.height) {
+            return false;
+        }
+        if (next_y_ >= block_end_ && !ReadBlock()) {
+            std::cerr << "Error in image reading"sv << std::endl;
+            return false;
+        }
 
-    if (!ifs.good()) {
-        std::cerr << "Error in reading the headers"sv << std::endl;
-        return {};
+        // при хранении снизу вверх строка y лежит в блоке тем ближе к началу, чем ниже она в изображении
+        const int row_in_block = layout_.top_down ? next_y_ - block_begin_ : block_end_ - 1 - next_y_;
+        const byte* buff = block_.data() + static_cast<size_t>(row_in_block) * layout_.stride;
+        // а записываем в изображение без padding-а, в порядке каналов Color
+        ScopedStageTimer timer(Stage::CONVERT);
+        UnpackRow(buff, layout_.order, line, layout_.size.width);
+        ++next_y_;
+        return true;
     }
 
+private:
+    // читает строки [next_y_, next_y_ + block_rows_) - в файле они лежат подряд
+    bool ReadBlock() {
+        ScopedStageTimer timer(Stage::READ);
+        block_begin_ = next_y_;
+        block_end_ = std::min(layout_.size.height, next_y_ + block_rows_);
+        const int64_t first_file_row = layout_.top_down ? block_begin_ : layout_.size.height - block_end_;
+        ifs_.seekg(layout_.data_shift + first_file_row * layout_.stride);
+        ifs_.read(reinterpret_cast<char*>(block_.data()), static_cast<std::streamsize>(block_end_ - block_begin_) * layout_.stride);
+        AddCounter(Counter::BYTES_READ, ifs_.gcount());
+        return ifs_.good();
+    }
 
-    // мы поддерживаем изображения только формата P6
-    // с максимальным значением цвета 255
-    if (file_header.sign[0] != BMP_SIGN[0] || file_header.sign[1] != BMP_SIGN[1]) {
-        std::cerr << "Incorrect signature of file" << std::endl;
-        return {};
+    ifstream ifs_;
+    BmpLayout layout_;
+    int block_rows_ = 1;
+    int next_y_ = 0;
+    int block_begin_ = 0;
+    int block_end_ = 0;
+    std::vector<byte> block_;
+};
+
+
+// Приёмник строк BMP: копит блок строк и записывает его в нужное место файла.
+// Блоки уходят на диск в фоновом потоке, пока заполняются следующие
+class BmpSink : public ScanlineSink {
+public:
+    bool Open(const Path& file, Size size, const BmpSaveOptions& options) {
+        size_ = size;
+        order_ = GetSaveOrder(options.layout);
+        top_down_ = options.top_down;
+
+        // Инициируем структуры header-ов BMP
+        const BitmapHeaders headers = MakeBMPHeaders(size_, options);
+
+        // вычисляем отступ
+        stride_ = GetBMPStride(size_.width, GetPixelBytes(order_));
+        data_shift_ = headers.file.data_shift;
+
+        if (!file_.Open(file, headers.file.full_size)) {
+            std::cerr << "Error in input file opening"sv << std::endl;
+            return false;
+        }
+
+        // Записываем заголовки
+        if (!file_.Write(&headers, data_shift_)) {
+            std::cerr << "Error in writing the headers"sv << std::endl;
+            return false;
+        }
+
+        block_rows_ = GetBMPBlockRows(stride_, size_.height);
+        // padding заполняется нулями один раз: пиксели его не перезаписывают
+        block_.assign(static_cast<size_t>(block_rows_) * stride_, byte{0});
+        return true;
     }
 
+    Size GetSize() const override {
+        return size_;
+    }
 
-    // определяем отступ
-    int stride = GetBMPStride(info_header.img_width);
+    bool WriteRow(const Color* color_line) override {
+        if (next_y_ >= size_.height) {
+            return false;
+        }
 
-    if (stride * info_header.img_height != info_header.data_size) {
-        std::cerr << "Incorrect stride or data size in BMP info header"sv << std::endl;
-        return {};
+        const int row_in_block = (next_y_ - block_begin_);
+        // строки в блоке хранятся в порядке файла: при хранении снизу вверх - от конца блока
+        const int block_row = top_down_ ? row_in_block : block_rows_ - 1 - row_in_block;
+        byte* buff = block_.data() + static_cast<size_t>(block_row) * stride_;
+        {
+            ScopedStageTimer timer(Stage::CONVERT);
+            PackRow(color_line, order_, buff, size_.width);
+        }
+        ++next_y_;
+
+        if (next_y_ - block_begin_ == block_rows_ || next_y_ == size_.height) {
+            return FlushBlock();
+        }
+        return true;
+    }
+
+    bool Finish() override {
+        ScopedStageTimer timer(Stage::WRITE);
+        if (!file_.Close() || next_y_ != size_.height) {
+            std::cerr << "Error in image writing"sv << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    // записывает накопленные строки [block_begin_, next_y_)
+    bool FlushBlock() {
+        ScopedStageTimer timer(Stage::WRITE);
+        const int rows = next_y_ - block_begin_;
+        // заполненные строки лежат в начале блока или, при хранении снизу вверх, в конце
+        const int64_t first_file_row = top_down_ ? block_begin_ : size_.height - next_y_;
+        const byte* first = block_.data() + (top_down_ ? 0 : static_cast<size_t>(block_rows_ - rows) * stride_);
+        // сверху вниз блоки идут в файле подряд и собираются в крупные записи
+        block_begin_ = next_y_;
+        return file_.WriteAt(data_shift_ + first_file_row * stride_, first, static_cast<size_t>(rows) * stride_);
     }
 
-    Image result_img(info_header.img_width, info_header.img_height, Color::Black());
-    // буфер размером в отступ (3 ширины и добавка до целого количества блоков по 4 байта)
-    std::vector<char> buff(stride);
+    WriteBehindFile file_;
+    Size size_ = {0, 0};
+    ChannelOrder order_ = ChannelOrder::BGR;
+    bool top_down_ = false;
+    int64_t stride_ = 0;
+    int64_t data_shift_ = 0;
+    int block_rows_ = 1;
+    int next_y_ = 0;
+    int block_begin_ = 0;
+    std::vector<byte> block_;
+};
+
+
+std::unique_ptr<ScanlineSource> OpenBMPSource(const Path& file) {
+    auto source = std::make_unique<BmpSource>();
+    if (!source->Open(file)) {
+        return nullptr;
+    }
+    return source;
+}
+
+std::unique_ptr<ScanlineSink> CreateBMPSink(const Path& file, Size size) {
+    return CreateBMPSink(file, size, {});
+}
+
+std::unique_ptr<ScanlineSink> CreateBMPSink(const Path& file, Size size, const BmpSaveOptions& options) {
+    auto sink = std::make_unique<BmpSink>();
+    if (!sink->Open(file, size, options)) {
+        return nullptr;
+    }
+    return sink;
+}
+
+std::optional<ImageInfo> ProbeBMP(const Path& file) {
+    ScopedStageTimer timer(Stage::HEADER);
+    ifstream ifs(file, ios::binary);
+    if (!ifs.is_open()) {
+        return std::nullopt;
+    }
+
+    std::array<byte, BMP_MAX_HEADERS_SIZE> headers;
+    ifs.read(reinterpret_cast<char*>(headers.data()), headers.size());
+    AddCounter(Counter::BYTES_READ, ifs.gcount());
+    const std::optional<BmpLayout> layout = ParseBMPHeaders({headers.data(), static_cast<size_t>(ifs.gcount())});
+    if (!layout) {
+        return std::nullopt;
+    }
+
+    ImageInfo info;
+    info.size = layout->size;
+    // источник держит в памяти один блок строк файла
+    info.decoder_bytes = static_cast<uint64_t>(GetBMPBlockRows(layout->stride, layout->size.height)) * layout->stride;
+    return info;
+}
+
+
+// упаковывает строку в порядок каналов файла; форматы, отличные от Color, приводятся к нему через буфер потока
+template <typename Pixel>
+static void PackRowAs(const Pixel* line, ChannelOrder order, byte* dst, int width) {
+    if constexpr (is_same_v<Pixel, Color>) {
+        PackRow(line, order, dst, width);
+    } else {
+        thread_local vector<Color> row;
+        row.resize(width);
+        ConvertRow(line, row.data(), width);
+        PackRow(row.data(), order, dst, width);
+    }
+}
+
+// упаковывает строку файла целиком, вместе с нулевым padding-ом до stride
+template <typename Pixel>
+static void PackRowBMP(const Pixel* line, ChannelOrder order, byte* dst, int width, int64_t stride) {
+    PackRowAs(line, order, dst, width);
+    std::fill(dst + GetPixelBytes(order) * width, dst + stride, byte{0});
+}
+
+// Пиксели RGBA, хранящиеся сверху вниз, совпадают с памятью изображения Color построчно.
+// Если к тому же строки изображения идут без промежутков, блок пикселей файла - это его буфер целиком
+template <typename Pixel>
+static bool IsImageBlockLayout(BasicImageView<const Pixel> image, const BmpSaveOptions& options) {
+    return is_same_v<Pixel, Color> && image && options.layout == BmpPixelLayout::RGBA32 && options.top_down
+           && image.GetStep() == image.GetWidth();
+}
+
+// Размер файла известен заранее, поэтому строки упаковываются и записываются
+// полосами прямо на свои места в файле, в том числе из нескольких потоков
+template <typename Pixel>
+static bool SaveBMPImpl(const Path& file, BasicImageView<const Pixel> image, const BmpSaveOptions& options) {
+    const Size size = {image.GetWidth(), image.GetHeight()};
+    const BitmapHeaders headers = MakeBMPHeaders(size, options);
+
+    OutputFile out;
+    if (!out.Open(file, headers.file.full_size)) {
+        std::cerr << "Error in input file opening"sv << std::endl;
+        return false;
+    }
+
+    if (!out.WriteAt(0, &headers, headers.file.data_shift)) {
+        std::cerr << "Error in writing the headers"sv << std::endl;
+        return false;
+    }
 
-    for (int y = info_header.img_height - 1; y >= 0; --y) {
-        Color* line = result_img.GetLine(y);
-        // читаем всю строку (c padding-ом)
-        ifs.read(buff.data(), stride);
-        
-        // а записываем в изображение без padding-а
-        for (int x = 0; x < info_header.img_width; ++x) {
-            // цвета в обратном порядке
-            line[x].b = static_cast<byte>(buff[x * 3 + 0]);
-            line[x].g = static_cast<byte>(buff[x * 3 + 1]);
-            line[x].r = static_cast<byte>(buff[x * 3 + 2]);
-        }    
+    const ChannelOrder order = GetSaveOrder(options.layout);
+    const int64_t stride = GetBMPStride(size.width, GetPixelBytes(order));
+    bool rows_ok;
+    if (IsImageBlockLayout(image, options)) {
+        ScopedStageTimer timer(Stage::WRITE);
+        rows_ok = out.WriteAt(headers.file.data_shift, image.GetLine(0), headers.info.data_size);
+    } else {
+        rows_ok = WriteRowsParallel(out, headers.file.data_shift, stride, size.height, !options.top_down, options.threads,
+                                    [&image, &size, order, stride](int y, byte* dst) {
+            PackRowBMP(image.GetLine(y), order, dst, size.width, stride);
+        });
     }
 
-    if (!ifs.good()) {
+    if (!out.Close() || !rows_ok) {
         std::cerr << "Error in image writing"sv << std::endl;
-        return{};
+        return false;
     }
+    return true;
+}
+
+bool SaveBMP(const Path& file, ImageView image) {
+    return SaveBMPImpl(file, image, {});
+}
+
+bool SaveBMP(const Path& file, ImageView image, const BmpSaveOptions& options) {
+    return SaveBMPImpl(file, image, options);
+}
+
+bool SaveBMP(const Path& file, RGBImageView image) {
+    return SaveBMPImpl(file, image, {});
+}
+
+bool SaveBMP(const Path& file, GrayImageView image) {
+    return SaveBMPImpl(file, image, {});
+}
+
+// то же в буфер памяти: out получает содержимое файла целиком
+template <typename Pixel>
+static bool SaveBMPImpl(ByteBuffer& out, BasicImageView<const Pixel> image, const BmpSaveOptions& options) {
+    const Size size = {image.GetWidth(), image.GetHeight()};
+    const BitmapHeaders headers = MakeBMPHeaders(size, options);
+
+    out.resize(headers.file.full_size);
+    std::memcpy(out.data(), &headers, headers.file.data_shift);
+
+    const ChannelOrder order = GetSaveOrder(options.layout);
+    const int64_t stride = GetBMPStride(size.width, GetPixelBytes(order));
+    if (IsImageBlockLayout(image, options)) {
+        std::memcpy(out.data() + headers.file.data_shift, image.GetLine(0), headers.info.data_size);
+        return true;
+    }
+    FillRowsParallel(out.data() + headers.file.data_shift, stride, size.height, !options.top_down, options.threads,
+                     [&image, &size, order, stride](int y, byte* dst) {
+        PackRowBMP(image.GetLine(y), order, dst, size.width, stride);
+    });
+    return true;
+}
+
+bool SaveBMP(ByteBuffer& out, ImageView image) {
+    return SaveBMPImpl(out, image, {});
+}
+
+bool SaveBMP(ByteBuffer& out, ImageView image, const BmpSaveOptions& options) {
+    return SaveBMPImpl(out, image, options);
+}
+
+bool SaveBMP(ByteBuffer& out, RGBImageView image) {
+    return SaveBMPImpl(out, image, {});
+}
+
+bool SaveBMP(ByteBuffer& out, GrayImageView image) {
+    return SaveBMPImpl(out, image, {});
+}
+
+
+// разбирает заголовки файла, целиком лежащего в памяти
+static std::optional<PackedRowsView> ParseBMP(ByteSpan data) {
+    const std::optional<BmpLayout> layout = ParseBMPHeaders(data);
+    if (!layout) {
+        return std::nullopt;
+    }
+
+    if (layout->data_shift + static_cast<uint64_t>(layout->stride) * layout->size.height > data.size) {
+        std::cerr << "Error in image reading"sv << std::endl;
+        return std::nullopt;
+    }
+
+    // при хранении снизу вверх последняя строка файла - верхняя строка изображения
+    PackedRowsView view;
+    view.top_row = data.data + layout->data_shift + (layout->top_down ? 0 : layout->stride * (layout->size.height - 1));
+    view.row_step = layout->top_down ? layout->stride : -layout->stride;
+    view.size = layout->size;
+    view.order = layout->order;
+    return view;
+}
+
+// разбирает заголовки уже отображённого файла
+static std::optional<MappedImage> ParseMappedBMP(MappedFile mapped) {
+    const std::optional<PackedRowsView> view = ParseBMP({mapped.GetData(), mapped.GetSize()});
+    if (!view) {
+        return std::nullopt;
+    }
+    return MappedImage(std::move(mapped), *view);
+}
+
+std::optional<MappedImage> MapBMP(const Path& file) {
+    MappedFile mapped;
+    if (!mapped.Open(file)) {
+        return std::nullopt;
+    }
+    return ParseMappedBMP(std::move(mapped));
+}
+
+
+template <typename Pixel>
+BasicImage<Pixel> LoadBMPAs(const Path& file) {
+    // на POSIX-системах файл отображается в память, и пиксели
+    // переставляются прямо из отображения в изображение
+    if (MappedFile mapped; mapped.Open(file)) {
+        const std::optional<MappedImage> image = ParseMappedBMP(std::move(mapped));
+        return image ? image->ToImageAs<Pixel>() : BasicImage<Pixel>{};
+    }
+
+    auto source = OpenBMPSource(file);
+    if (!source) {
+        return {};
+    }
+    return ReadImageAs<Pixel>(*source);
+}
+
+template Image LoadBMPAs<Color>(const Path& file);
+template RGBImage LoadBMPAs<RGB24>(const Path& file);
+template GrayImage LoadBMPAs<Gray8>(const Path& file);
+
+Image LoadBMP(const Path& file) {
+    return LoadBMPAs<Color>(file);
+}
+
+template <typename Pixel>
+BasicImage<Pixel> LoadBMPAs(ByteSpan data) {
+    const std::optional<PackedRowsView> view = ParseBMP(data);
+    return view ? UnpackRowsAs<Pixel>(*view) : BasicImage<Pixel>{};
+}
+
+template Image LoadBMPAs<Color>(ByteSpan data);
+template RGBImage LoadBMPAs<RGB24>(ByteSpan data);
+template GrayImage LoadBMPAs<Gray8>(ByteSpan data);
 
-    return result_img;
+Image LoadBMP(ByteSpan data) {
+    return LoadBMPAs<Color>(data);
 }
 
 
@@ -1,12 +1,74 @@
 #pragma once
 #include "img_lib.h"
+#include "mapped_file.h"
+#include "scanline.h"
 
 #include <filesystem>
+#include <memory>
+#include <optional>
 
 namespace img_lib {
 using Path = std::filesystem::path;
 
-bool SaveBMP(const Path& file, const Image& image);
+// раскладка пикселей сохраняемого файла
+enum class BmpPixelLayout {
+    // 24 бита, B G R - понимают все программы
+    BGR24,
+    // 32 бита с масками каналов (BI_BITFIELDS), байты B G R A
+    BGRA32,
+    // 32 бита с масками каналов, байты R G B A - как в Color, поэтому строки копируются без перестановки
+    RGBA32
+};
+
+struct BmpSaveOptions {
+    // Потоков на упаковку строк (0 - по числу ядер). Файл создаётся сразу
+    // нужного размера, и потоки записывают в него непересекающиеся полосы строк
+    size_t threads = 1;
+    BmpPixelLayout layout = BmpPixelLayout::BGR24;
+    // Строки хранятся сверху вниз (отрицательная высота в заголовке).
+    // С RGBA32 и шириной, кратной 16, пиксели изображения записываются одним блоком
+    bool top_down = false;
+};
+
+// Загружаются несжатые файлы 24 и 32 бит (BI_RGB и BI_BITFIELDS с порядком BGRA или RGBA),
+// со строками снизу вверх и сверху вниз
+bool SaveBMP(const Path& file, ImageView image);
+bool SaveBMP(const Path& file, ImageView image, const BmpSaveOptions& options);
 Image LoadBMP(const Path& file);
 
+// Загружает изображение сразу в заданный формат пикселей: Color, RGB24 или Gray8
+template <typename Pixel>
+BasicImage<Pixel> LoadBMPAs(const Path& file);
+
+// сохранение изображений без альфа-канала и в оттенках серого
+bool SaveBMP(const Path& file, RGBImageView image);
+bool SaveBMP(const Path& file, GrayImageView image);
+
+// Построчное чтение и запись BMP. Строки в файле обычно хранятся снизу вверх,
+// поэтому источник и приёмник переставляют их блоками ограниченного размера.
+// При ошибке открытия или некорректном заголовке возвращается nullptr
+std::unique_ptr<ScanlineSource> OpenBMPSource(const Path& file);
+std::unique_ptr<ScanlineSink> CreateBMPSink(const Path& file, Size size);
+// options.threads не учитывается: приёмник пишет строки по мере поступления
+std::unique_ptr<ScanlineSink> CreateBMPSink(const Path& file, Size size, const BmpSaveOptions& options);
+
+// Читает только заголовки: размер изображения и память источника строк.
+// nullopt - если файл не открывается или заголовок некорректен
+std::optional<ImageInfo> ProbeBMP(const Path& file);
+
+// Отображает BMP в память и возвращает представление его строк без копирования.
+// nullopt - если отображение недоступно или файл некорректен
+std::optional<MappedImage> MapBMP(const Path& file);
+
+// Чтение и запись BMP в памяти - без временных файлов. data - содержимое файла,
+// out получает содержимое файла целиком; прежнее содержимое out заменяется
+Image LoadBMP(ByteSpan data);
+template <typename Pixel>
+BasicImage<Pixel> LoadBMPAs(ByteSpan data);
+
+bool SaveBMP(ByteBuffer& out, ImageView image);
+bool SaveBMP(ByteBuffer& out, ImageView image, const BmpSaveOptions& options);
+bool SaveBMP(ByteBuffer& out, RGBImageView image);
+bool SaveBMP(ByteBuffer& out, GrayImageView image);
+
 } // namespace img_lib
\ No newline at end of file
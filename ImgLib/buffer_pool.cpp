@@ -0,0 +1,124 @@
+#include "buffer_pool.h"
+
+#include <new>
+#include <utility>
+
+namespace img_lib {
+
+// размеры округляются до страницы, чтобы изображения близких размеров делили буферы
+static const size_t PAGE_SIZE = 4096;
+
+static size_t RoundUpToPage(size_t bytes) {
+    return (bytes + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+}
+
+static void* AllocateAligned(size_t bytes) {
+    return ::operator new(bytes, std::align_val_t{BufferPool::ALIGNMENT});
+}
+
+static void FreeAligned(void* data) {
+    ::operator delete(data, std::align_val_t{BufferPool::ALIGNMENT});
+}
+
+
+BufferPool& BufferPool::Instance() {
+    // пул намеренно не разрушается: изображения в статических переменных
+    // могут вернуть в него буферы уже после выхода из main
+    static BufferPool* pool = new BufferPool;
+    return *pool;
+}
+
+BufferPool::~BufferPool() {
+    Trim();
+}
+
+void* BufferPool::Acquire(size_t bytes, size_t& capacity) {
+    const size_t rounded = RoundUpToPage(bytes == 0 ? 1 : bytes);
+    {
+        std::lock_guard lock(mutex_);
+        // подходит наименьший свободный буфер не более чем на четверть больше запрошенного
+        auto it = free_.lower_bound(rounded);
+        if (it != free_.end() && it->first <= rounded + rounded / 4) {
+            capacity = it->first;
+            void* data = it->second;
+            free_.erase(it);
+            stats_.cached_bytes -= capacity;
+            ++stats_.reuses;
+            return data;
+        }
+        ++stats_.allocations;
+    }
+
+    capacity = rounded;
+    return AllocateAligned(rounded);
+}
+
+void BufferPool::Release(void* data, size_t capacity) {
+    if (!data) {
+        return;
+    }
+
+    {
+        std::lock_guard lock(mutex_);
+        if (capacity <= max_cached_bytes_) {
+            EvictUntil(max_cached_bytes_ - capacity);
+            free_.emplace(capacity, data);
+            stats_.cached_bytes += capacity;
+            return;
+        }
+    }
+
+    FreeAligned(data);
+}
+
+void BufferPool::SetCapacity(size_t bytes) {
+    std::lock_guard lock(mutex_);
+    max_cached_bytes_ = bytes;
+    EvictUntil(bytes);
+}
+
+void BufferPool::Trim(size_t limit) {
+    std::lock_guard lock(mutex_);
+    EvictUntil(limit);
+}
+
+BufferPool::Stats BufferPool::GetStats() const {
+    std::lock_guard lock(mutex_);
+    return stats_;
+}
+
+// освобождает самые крупные буферы, пока в пуле больше limit байт; mutex_ должен быть захвачен
+void BufferPool::EvictUntil(size_t limit) {
+    while (stats_.cached_bytes > limit && !free_.empty()) {
+        auto it = std::prev(free_.end());
+        stats_.cached_bytes -= it->first;
+        FreeAligned(it->second);
+        free_.erase(it);
+    }
+}
+
+
+PixelBuffer::PixelBuffer(size_t bytes) {
+    // capacity_ заполняется внутри Acquire, поэтому не в списке инициализации
+    data_ = BufferPool::Instance().Acquire(bytes, capacity_);
+}
+
+PixelBuffer::~PixelBuffer() {
+    BufferPool::Instance().Release(data_, capacity_);
+}
+
+PixelBuffer::PixelBuffer(PixelBuffer&& other) noexcept
+    : data_(std::exchange(other.data_, nullptr))
+    , capacity_(std::exchange(other.capacity_, 0)) {
+}
+
+PixelBuffer& PixelBuffer::operator=(PixelBuffer&& other) noexcept {
+    if (this != &other) {
+        BufferPool::Instance().Release(data_, capacity_);
+        data_ = std::exchange(other.data_, nullptr);
+        capacity_ = std::exchange(other.capacity_, 0);
+    }
+    return *this;
+}
+
+}  // namespace img_lib
\ No newline at end of file
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+
+namespace img_lib {
+
+// Потокобезопасный пул буферов пикселей.
+// Буферы выравниваются по строке кэша. Освобождённый буфер не возвращается
+// системе, а остаётся в пуле и выдаётся следующему изображению подходящего размера -
+// при пакетной обработке это избавляет от повторных выделений и page fault-ов
+class BufferPool {
+public:
+    static constexpr size_t ALIGNMENT = 64;
+    // по умолчанию пул удерживает до 512 МБ свободных буферов
+    static constexpr size_t DEFAULT_CAPACITY = size_t{512} << 20;
+
+    struct Stats {
+        size_t allocations = 0;   // выделено у системы
+        size_t reuses = 0;        // выдано повторно из пула
+        size_t cached_bytes = 0;  // сейчас свободно в пуле
+    };
+
+    // общий пул библиотеки
+    static BufferPool& Instance();
+
+    BufferPool() = default;
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Выдаёт буфер не меньше bytes байт; настоящий размер записывается в capacity
+    // и должен быть передан обратно в Release
+    void* Acquire(size_t bytes, size_t& capacity);
+    void Release(void* data, size_t capacity);
+
+    // ограничивает объём свободных буферов, лишнее сразу освобождается
+    void SetCapacity(size_t bytes);
+    // возвращает системе свободные буферы, пока в пуле больше limit байт;
+    // в отличие от SetCapacity не меняет, сколько пул может удерживать потом
+    void Trim(size_t limit = 0);
+
+    Stats GetStats() const;
+
+private:
+    void EvictUntil(size_t limit);
+
+    mutable std::mutex mutex_;
+    // свободные буферы, упорядоченные по размеру
+    std::multimap<size_t, void*> free_;
+    size_t max_cached_bytes_ = DEFAULT_CAPACITY;
+    Stats stats_;
+};
+
+
+// Владеющий указатель на буфер из пула. При уничтожении буфер возвращается в пул
+class PixelBuffer {
+public:
+    PixelBuffer() = default;
+    explicit PixelBuffer(size_t bytes);
+    ~PixelBuffer();
+
+    PixelBuffer(const PixelBuffer&) = delete;
+    PixelBuffer& operator=(const PixelBuffer&) = delete;
+
+    PixelBuffer(PixelBuffer&& other) noexcept;
+    PixelBuffer& operator=(PixelBuffer&& other) noexcept;
+
+    void* GetData() const {
+        return data_;
+    }
+
+private:
+    void* data_ = nullptr;
+    size_t capacity_ = 0;
+};
+
+}  // namespace img_lib
\ No newline at end of file
@@ -1,35 +1,110 @@
 #include "img_lib.h"
 
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <utility>
+
 namespace img_lib {
 
-Image::Image(int w, int h, Color fill)
+// шаг строки в пикселях: ширина, округлённая так, чтобы строка занимала целое число строк кэша
+template <typename Pixel>
+static int GetAlignedStep(int w) {
+    const size_t step_pixels = BasicImage<Pixel>::ROW_ALIGNMENT / std::gcd(BasicImage<Pixel>::ROW_ALIGNMENT, sizeof(Pixel));
+    return static_cast<int>((static_cast<size_t>(w) + step_pixels - 1) / step_pixels * step_pixels);
+}
+
+template <typename Pixel>
+BasicImage<Pixel>::BasicImage(int w, int h)
     : width_(w)
     , height_(h)
-    , step_(w)
-    , pixels_(step_ * height_, fill) {
+    , step_(GetAlignedStep<Pixel>(w))
+    , pixels_(w > 0 && h > 0 ? PixelBuffer(static_cast<size_t>(step_) * h * sizeof(Pixel)) : PixelBuffer()) {
+}
+
+template <typename Pixel>
+BasicImage<Pixel>::BasicImage(int w, int h, Pixel fill)
+    : BasicImage(w, h) {
+    Pixel* data = static_cast<Pixel*>(pixels_.GetData());
+    std::fill(data, data + static_cast<size_t>(step_) * height_, fill);
 }
 
-Color* Image::GetLine(int y) {
+template <typename Pixel>
+BasicImage<Pixel>::BasicImage(const BasicImage& other)
+    : BasicImage(other.width_, other.height_) {
+    if (*this) {
+        std::memcpy(pixels_.GetData(), other.pixels_.GetData(), static_cast<size_t>(step_) * height_ * sizeof(Pixel));
+    }
+}
+
+template <typename Pixel>
+BasicImage<Pixel>& BasicImage<Pixel>::operator=(const BasicImage& other) {
+    if (this != &other) {
+        *this = BasicImage(other);
+    }
+    return *this;
+}
+
+template <typename Pixel>
+BasicImage<Pixel>::BasicImage(BasicImage&& other) noexcept
+    : width_(std::exchange(other.width_, 0))
+    , height_(std::exchange(other.height_, 0))
+    , step_(std::exchange(other.step_, 0))
+    , pixels_(std::move(other.pixels_)) {
+}
+
+template <typename Pixel>
+BasicImage<Pixel>& BasicImage<Pixel>::operator=(BasicImage&& other) noexcept {
+    if (this != &other) {
+        width_ = std::exchange(other.width_, 0);
+        height_ = std::exchange(other.height_, 0);
+        step_ = std::exchange(other.step_, 0);
+        pixels_ = std::move(other.pixels_);
+    }
+    return *this;
+}
+
+template <typename Pixel>
+BasicImage<Pixel>::BasicImage(BasicImageView<const Pixel> view)
+    : BasicImage(view.GetWidth(), view.GetHeight()) {
+    CopyPixels<Pixel>(view, *this);
+}
+
+template <typename Pixel>
+Pixel* BasicImage<Pixel>::GetLine(int y) {
     assert(y >= 0 && y < height_);
-    return pixels_.data() + step_ * y;
+    return static_cast<Pixel*>(pixels_.GetData()) + static_cast<ptrdiff_t>(step_) * y;
 }
 
-const Color* Image::GetLine(int y) const {
-    return const_cast<Image*>(this)->GetLine(y);
+template <typename Pixel>
+const Pixel* BasicImage<Pixel>::GetLine(int y) const {
+    return const_cast<BasicImage*>(this)->GetLine(y);
 }
 
-int Image::GetWidth() const {
+template <typename Pixel>
+int BasicImage<Pixel>::GetWidth() const {
     return width_;
 }
 
-int Image::GetHeight() const {
+template <typename Pixel>
+int BasicImage<Pixel>::GetHeight() const {
     return height_;
 }
 
 // шаг задаёт смещение соседних строк изображения
 // он обычно совпадает с width, но может быть больше
-int Image::GetStep() const {
+template <typename Pixel>
+int BasicImage<Pixel>::GetStep() const {
     return step_;
 }
 
+template class BasicImage<Color>;
+template class BasicImage<RGB24>;
+template class BasicImage<Gray8>;
+
+
+PlanarImage::PlanarImage(int w, int h)
+    : planes_{GrayImage(w, h), GrayImage(w, h), GrayImage(w, h)} {
+}
+
 }  // namespace img_lib
\ No newline at end of file
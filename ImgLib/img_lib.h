@@ -1,14 +1,19 @@
 #pragma once
 
+#include "buffer_pool.h"
+
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
+#include <type_traits>
 #include <vector>
 
 
 namespace img_lib {
-    
+
 using Path = std::filesystem::path;
 
 struct Size {
@@ -16,6 +21,38 @@ struct Size {
     int height;
 };
 
+// Закодированное изображение в памяти - то, что иначе лежало бы в файле
+using ByteBuffer = std::vector<std::byte>;
+
+// Участок памяти с закодированным изображением. Данными не владеет
+struct ByteSpan {
+    ByteSpan() = default;
+    ByteSpan(const std::byte* data, size_t size)
+        : data(data)
+        , size(size) {
+    }
+    ByteSpan(const ByteBuffer& buffer)
+        : data(buffer.data())
+        , size(buffer.size()) {
+    }
+
+    const std::byte* data = nullptr;
+    size_t size = 0;
+};
+
+// Сведения из заголовка файла, прочитанные без декодирования пикселей (ProbeBMP, ProbePPM, ProbeJPEG).
+// По ним заранее оценивают, сколько памяти займёт конвертация
+struct ImageInfo {
+    // размер изображения на выходе декодера
+    Size size = {0, 0};
+    // Оценка памяти декодера при построчном чтении, сверх самих строк: буферы файла
+    // и внутренние буферы кодека. Прогрессивный JPEG держит коэффициенты всего изображения
+    uint64_t decoder_bytes = 0;
+    // только для JPEG: объём коэффициентов DCT всего изображения, см. TransformJPEG
+    uint64_t coefficient_bytes = 0;
+};
+
+// Пиксель RGBA, 4 байта. Основной формат изображений библиотеки
 struct Color {
     static Color Black() {
         return {std::byte{0}, std::byte{0}, std::byte{0}, std::byte{255}};
@@ -24,34 +61,183 @@ struct Color {
     std::byte r, g, b, a;
 };
 
-class Image {
+// Пиксель RGB без альфа-канала, 3 байта. Совпадает с форматом строк JPEG и PPM
+struct RGB24 {
+    static RGB24 Black() {
+        return {std::byte{0}, std::byte{0}, std::byte{0}};
+    }
+
+    std::byte r, g, b;
+};
+
+// Пиксель в оттенках серого, 1 байт
+struct Gray8 {
+    static Gray8 Black() {
+        return {std::byte{0}};
+    }
+
+    std::byte v;
+};
+
+// формат пикселей изображения
+enum class PixelFormat {
+    RGBA32,
+    RGB24,
+    GRAY8
+};
+
+template <typename Pixel>
+class BasicImage;
+
+// Прямоугольник пикселей без владения: первый пиксель, размер и шаг строк в пикселях.
+// Pixel с const - представление только для чтения. Копируется дёшево и действительно,
+// пока живут пиксели, на которые указывает. Часть изображения (GetSubView) - тоже
+// представление, поэтому вырезание фрагмента и деление на полосы обходятся без копирования
+template <typename Pixel>
+class BasicImageView {
 public:
+    using PixelType = std::remove_const_t<Pixel>;
+    using ConstView = BasicImageView<const PixelType>;
+
+    // пустое представление
+    BasicImageView() = default;
+
+    BasicImageView(Pixel* data, int w, int h, int step)
+        : data_(data)
+        , width_(w)
+        , height_(h)
+        , step_(step) {
+    }
+
+    // Представление всего изображения. Конструкторы неявные,
+    // чтобы изображение можно было передать туда, где ожидается представление
+    BasicImageView(BasicImage<PixelType>& image);
+    template <typename P = Pixel, typename = std::enable_if_t<std::is_const_v<P>>>
+    BasicImageView(const BasicImage<PixelType>& image);
+
+    // изменяемое представление приводится к представлению только для чтения
+    template <typename P = Pixel, typename = std::enable_if_t<std::is_const_v<P>>>
+    BasicImageView(const BasicImageView<PixelType>& other)
+        : BasicImageView(other.data_, other.width_, other.height_, other.step_) {
+    }
+
+    Pixel& GetPixel(int x, int y) const {
+        assert(x < width_ && y < height_ && x >= 0 && y >= 0);
+        return GetLine(y)[x];
+    }
+
+    Pixel* GetLine(int y) const {
+        assert(y >= 0 && y < height_);
+        return data_ + static_cast<ptrdiff_t>(step_) * y;
+    }
+
+    int GetWidth() const {
+        return width_;
+    }
+    int GetHeight() const {
+        return height_;
+    }
+    // у части изображения шаг больше ширины
+    int GetStep() const {
+        return step_;
+    }
+
+    // Часть представления: прямоугольник w x h с левым верхним углом (x, y),
+    // обрезанный по границам. Пиксели не копируются
+    BasicImageView GetSubView(int x, int y, int w, int h) const {
+        const int left = std::clamp(x, 0, width_);
+        const int top = std::clamp(y, 0, height_);
+        const int right = std::clamp(x + std::max(w, 0), left, width_);
+        const int bottom = std::clamp(y + std::max(h, 0), top, height_);
+        if (right == left || bottom == top) {
+            return {};
+        }
+        return {GetLine(top) + left, right - left, bottom - top, step_};
+    }
+
+    explicit operator bool() const {
+        return width_ > 0 && height_ > 0;
+    }
+
+    bool operator!() const {
+        return !operator bool();
+    }
+
+private:
+    template <typename>
+    friend class BasicImageView;
+
+    Pixel* data_ = nullptr;
+    int width_ = 0;
+    int height_ = 0;
+    int step_ = 0;
+};
+
+// Изображение с пикселями заданного типа.
+// Поддерживаются Color, RGB24 и Gray8 - для них шаблон явно инстанцирован в img_lib.cpp
+template <typename Pixel>
+class BasicImage {
+public:
+    using PixelType = Pixel;
+
     // создаёт пустое изображение
-    Image() = default;
+    BasicImage() = default;
+
+    // Создаёт изображение заданного размера, не инициализируя пиксели.
+    // Память берётся из BufferPool - для загрузчиков, которые сразу перезаписывают все строки
+    BasicImage(int w, int h);
 
     // создаёт изображение заданного размера, заполняя его заданным цветом
-    Image(int w, int h, Color fill);
+    BasicImage(int w, int h, Pixel fill);
+
+    BasicImage(const BasicImage& other);
+    BasicImage& operator=(const BasicImage& other);
+    // после перемещения исходное изображение становится пустым
+    BasicImage(BasicImage&& other) noexcept;
+    BasicImage& operator=(BasicImage&& other) noexcept;
+
+    // копирует пиксели представления, например части другого изображения
+    explicit BasicImage(BasicImageView<const Pixel> view);
+
+    // представление всего изображения
+    BasicImageView<Pixel> GetView() {
+        return *this;
+    }
+    BasicImageView<const Pixel> GetView() const {
+        return *this;
+    }
+
+    // часть изображения без копирования, см. BasicImageView::GetSubView
+    BasicImageView<Pixel> GetSubView(int x, int y, int w, int h) {
+        return GetView().GetSubView(x, y, w, h);
+    }
+    BasicImageView<const Pixel> GetSubView(int x, int y, int w, int h) const {
+        return GetView().GetSubView(x, y, w, h);
+    }
 
     // геттеры для отдельного пикселя изображения
-    Color GetPixel(int x, int y) const {
-        return const_cast<Image*>(this)->GetPixel(x, y);
+    Pixel GetPixel(int x, int y) const {
+        return const_cast<BasicImage*>(this)->GetPixel(x, y);
     }
-    Color& GetPixel(int x, int y) {
+    Pixel& GetPixel(int x, int y) {
         assert(x < GetWidth() && y < GetHeight() && x >= 0 && y >= 0);
         return GetLine(y)[x];
     }
 
     // геттер для заданной строки изображения
-    Color* GetLine(int y);
-    const Color* GetLine(int y) const;
+    Pixel* GetLine(int y);
+    const Pixel* GetLine(int y) const;
 
     int GetWidth() const;
     int GetHeight() const;
 
-    // шаг задаёт смещение соседних строк изображения
-    // он обычно совпадает с шириной, но может быть больше неё
+    // Шаг задаёт смещение соседних строк изображения в пикселях.
+    // Он округляется вверх так, чтобы каждая строка начиналась
+    // на границе строки кэша (ROW_ALIGNMENT байт), поэтому может быть больше ширины
     int GetStep() const;
 
+    static constexpr size_t ROW_ALIGNMENT = BufferPool::ALIGNMENT;
+
     // будем считать изображение корректным, если
     // его площадь положительна
     explicit operator bool() const {
@@ -65,9 +251,83 @@ public:
 private:
     int width_ = 0;
     int height_ = 0;
-    int step_;
+    int step_ = 0;
+
+    PixelBuffer pixels_;
+};
+
+extern template class BasicImage<Color>;
+extern template class BasicImage<RGB24>;
+extern template class BasicImage<Gray8>;
+
+using Image = BasicImage<Color>;
+using RGBImage = BasicImage<RGB24>;
+using GrayImage = BasicImage<Gray8>;
+
+template <typename Pixel>
+BasicImageView<Pixel>::BasicImageView(BasicImage<PixelType>& image)
+    : BasicImageView(image ? image.GetLine(0) : nullptr, image.GetWidth(), image.GetHeight(), image.GetStep()) {
+}
 
-    std::vector<Color> pixels_;
+template <typename Pixel>
+template <typename P, typename>
+BasicImageView<Pixel>::BasicImageView(const BasicImage<PixelType>& image)
+    : BasicImageView(image ? image.GetLine(0) : nullptr, image.GetWidth(), image.GetHeight(), image.GetStep()) {
+}
+
+// представления только для чтения - в таком виде изображения принимают функции сохранения
+using ImageView = BasicImageView<const Color>;
+using RGBImageView = BasicImageView<const RGB24>;
+using GrayImageView = BasicImageView<const Gray8>;
+using MutableImageView = BasicImageView<Color>;
+
+// Копирует пиксели src в dst, начиная с левого верхнего угла; копируется
+// пересечение размеров. Так часть одного изображения переносится в другое
+template <typename Pixel>
+void CopyPixels(typename BasicImageView<Pixel>::ConstView src, BasicImageView<Pixel> dst) {
+    const int width = std::min(src.GetWidth(), dst.GetWidth());
+    const int height = std::min(src.GetHeight(), dst.GetHeight());
+    for (int y = 0; y < height && width > 0; ++y) {
+        std::copy_n(src.GetLine(y), width, dst.GetLine(y));
+    }
+}
+
+
+// Планарное изображение: каналы R, G и B хранятся в отдельных плоскостях
+class PlanarImage {
+public:
+    static constexpr int PLANE_COUNT = 3;
+
+    PlanarImage() = default;
+    PlanarImage(int w, int h);
+
+    // плоскость канала: 0 - R, 1 - G, 2 - B
+    GrayImage& GetPlane(int index) {
+        assert(index >= 0 && index < PLANE_COUNT);
+        return planes_[index];
+    }
+    const GrayImage& GetPlane(int index) const {
+        assert(index >= 0 && index < PLANE_COUNT);
+        return planes_[index];
+    }
+
+    int GetWidth() const {
+        return planes_[0].GetWidth();
+    }
+    int GetHeight() const {
+        return planes_[0].GetHeight();
+    }
+
+    explicit operator bool() const {
+        return static_cast<bool>(planes_[0]);
+    }
+
+    bool operator!() const {
+        return !operator bool();
+    }
+
+private:
+    std::array<GrayImage, PLANE_COUNT> planes_;
 };
 
 }  // namespace img_lib
\ No newline at end of file
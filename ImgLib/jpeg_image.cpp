@@ -1,10 +1,29 @@
 #include "jpeg_image.h"
+#include "async_io.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "pixel_kernels.h"
+#include "resample.h"
+#include "stats.h"
 
 #include <jpeglib.h>
+#include <jerror.h>
 
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <csetjmp>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 
 namespace img_lib {
@@ -30,204 +49,1741 @@ my_error_exit (j_common_ptr cinfo) {
 
 
 // тип JSAMPLE фактически псевдоним для unsigned char
-void SaveScanlineToImage(const JSAMPLE* row, int y, Image& out_image) {
-    Color* line = out_image.GetLine(y);
-    for (int x = 0; x < out_image.GetWidth(); ++x) {
-        const JSAMPLE* pixel = row + x * 3;
-        line[x] = Color{std::byte{pixel[0]}, std::byte{pixel[1]}, std::byte{pixel[2]}, std::byte{255}};
+static void SaveScanlineToImage(const JSAMPLE* row, Color* line, int width) {
+    UnpackRGB(reinterpret_cast<const std::byte*>(row), line, width);
+}
+
+
+// тип JSAMPLE фактически псевдоним для unsigned char
+static void SaveImageLineToJPEGRow(const Color* line, int width, JSAMPLE* row) {
+    PackRGB(line, reinterpret_cast<std::byte*>(row), width);
+}
+
+
+// Источник данных libjpeg поверх файла с упреждающим чтением: пока декодер
+// разбирает один блок, следующий уже читается в фоновом потоке.
+// Устроен как jpeg_stdio_src из jdatasrc.c, но блоки отдаются без копирования
+struct JpegFileSource {
+    jpeg_source_mgr pub;
+    ReadAheadFile* file;
+    bool start_of_file;
+};
+
+METHODDEF(void)
+init_file_source(j_decompress_ptr cinfo) {
+    reinterpret_cast<JpegFileSource*>(cinfo->src)->start_of_file = true;
+}
+
+METHODDEF(boolean)
+fill_file_input_buffer(j_decompress_ptr cinfo) {
+    static const JOCTET fake_eoi[2] = {0xFF, JPEG_EOI};
+
+    JpegFileSource* src = reinterpret_cast<JpegFileSource*>(cinfo->src);
+    const ByteSpan data = src->file->Peek();
+    if (data.size == 0) {
+        if (src->start_of_file) {
+            ERREXIT(cinfo, JERR_INPUT_EMPTY);
+        }
+        // обрезанный файл: как и jpeg_stdio_src, предупреждаем и дописываем конец изображения
+        WARNMS(cinfo, JWRN_JPEG_EOF);
+        src->pub.next_input_byte = fake_eoi;
+        src->pub.bytes_in_buffer = 2;
+        return TRUE;
     }
+
+    // блок остаётся действительным до следующего вызова Peek, то есть до следующего заполнения
+    src->file->Consume(data.size);
+    src->pub.next_input_byte = reinterpret_cast<const JOCTET*>(data.data);
+    src->pub.bytes_in_buffer = data.size;
+    src->start_of_file = false;
+    return TRUE;
 }
 
+METHODDEF(void)
+skip_file_input_data(j_decompress_ptr cinfo, long num_bytes) {
+    jpeg_source_mgr* src = cinfo->src;
+    if (num_bytes <= 0) {
+        return;
+    }
+    while (num_bytes > static_cast<long>(src->bytes_in_buffer)) {
+        num_bytes -= static_cast<long>(src->bytes_in_buffer);
+        (void) (*src->fill_input_buffer)(cinfo);
+    }
+    src->next_input_byte += num_bytes;
+    src->bytes_in_buffer -= static_cast<size_t>(num_bytes);
+}
 
-img_lib::Image LoadJPEG(const Path& file) {
-    jpeg_decompress_struct cinfo;
+METHODDEF(void)
+term_file_source(j_decompress_ptr) {
+}
+
+static void SetFileSource(jpeg_decompress_struct& cinfo, JpegFileSource& src, ReadAheadFile& file) {
+    src.pub.init_source = init_file_source;
+    src.pub.fill_input_buffer = fill_file_input_buffer;
+    src.pub.skip_input_data = skip_file_input_data;
+    src.pub.resync_to_restart = jpeg_resync_to_restart;
+    src.pub.term_source = term_file_source;
+    src.pub.bytes_in_buffer = 0;
+    src.pub.next_input_byte = nullptr;
+    src.file = &file;
+    cinfo.src = &src.pub;
+}
+
+
+// Приёмник данных libjpeg поверх файла с отложенной записью: сжатые данные копятся
+// в буфере и передаются WriteBehindFile, который пишет их на диск в фоновом потоке
+struct JpegFileDestination {
+    jpeg_destination_mgr pub;
+    WriteBehindFile* file;
+    std::vector<JOCTET> buffer;
+};
+
+// буфер кодировщика; крупные блоки для диска собирает WriteBehindFile
+static const size_t JPEG_DEST_BUFFER_BYTES = 1 << 16;
+
+METHODDEF(void)
+init_file_destination(j_compress_ptr cinfo) {
+    JpegFileDestination* dest = reinterpret_cast<JpegFileDestination*>(cinfo->dest);
+    dest->buffer.resize(JPEG_DEST_BUFFER_BYTES);
+    dest->pub.next_output_byte = dest->buffer.data();
+    dest->pub.free_in_buffer = dest->buffer.size();
+}
+
+METHODDEF(boolean)
+empty_file_output_buffer(j_compress_ptr cinfo) {
+    JpegFileDestination* dest = reinterpret_cast<JpegFileDestination*>(cinfo->dest);
+    // libjpeg требует записать буфер целиком, независимо от free_in_buffer
+    if (!dest->file->Write(dest->buffer.data(), dest->buffer.size())) {
+        ERREXIT(cinfo, JERR_FILE_WRITE);
+    }
+    dest->pub.next_output_byte = dest->buffer.data();
+    dest->pub.free_in_buffer = dest->buffer.size();
+    return TRUE;
+}
+
+METHODDEF(void)
+term_file_destination(j_compress_ptr cinfo) {
+    JpegFileDestination* dest = reinterpret_cast<JpegFileDestination*>(cinfo->dest);
+    const size_t size = dest->buffer.size() - dest->pub.free_in_buffer;
+    if (size > 0 && !dest->file->Write(dest->buffer.data(), size)) {
+        ERREXIT(cinfo, JERR_FILE_WRITE);
+    }
+}
+
+static void SetFileDestination(jpeg_compress_struct& cinfo, JpegFileDestination& dest, WriteBehindFile& file) {
+    dest.pub.init_destination = init_file_destination;
+    dest.pub.empty_output_buffer = empty_file_output_buffer;
+    dest.pub.term_destination = term_file_destination;
+    dest.file = &file;
+    cinfo.dest = &dest.pub;
+}
+
+
+// Выбирает наибольшее уменьшение scale_num/8, при котором изображение на выходе
+// декодера ещё покрывает целевой размер. Масштабирование происходит прямо в IDCT
+// и обходится гораздо дешевле полного декодирования. Старые версии libjpeg
+// поддерживают только 1/2, 1/4 и 1/8 - поэтому размер проверяется
+// через jpeg_calc_output_dimensions, а не вычисляется самостоятельно
+static void ChooseDCTScale(jpeg_decompress_struct& cinfo, Size max_size) {
+    const Size target = FitWithin({static_cast<int>(cinfo.image_width), static_cast<int>(cinfo.image_height)}, max_size);
+
+    for (unsigned int scale_num = 1; scale_num <= 8; ++scale_num) {
+        cinfo.scale_num = scale_num;
+        cinfo.scale_denom = 8;
+        jpeg_calc_output_dimensions(&cinfo);
+        if (static_cast<int>(cinfo.output_width) >= target.width
+            && static_cast<int>(cinfo.output_height) >= target.height) {
+            return;
+        }
+    }
+
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = 1;
+}
+
+static J_DCT_METHOD GetDctMethod(JpegDctMethod method) {
+    switch (method) {
+        case JpegDctMethod::IFAST:
+            return JDCT_IFAST;
+        case JpegDctMethod::FLOAT:
+            return JDCT_FLOAT;
+        default:
+            return JDCT_ISLOW;
+    }
+}
+
+// Параметры декодирования; вызывается между jpeg_read_header и jpeg_start_decompress.
+// Значения по умолчанию совпадают с теми, что выставляет jpeg_read_header
+static void ApplyLoadOptions(jpeg_decompress_struct& cinfo, const JpegLoadOptions& options) {
+    cinfo.dct_method = GetDctMethod(options.dct_method);
+    cinfo.do_fancy_upsampling = options.fancy_upsampling ? TRUE : FALSE;
+    cinfo.do_block_smoothing = options.block_smoothing ? TRUE : FALSE;
+}
+
+// Параметры сжатия; вызывается после jpeg_set_defaults.
+// Значения по умолчанию дают тот же файл, что и jpeg_set_defaults
+static void ApplySaveOptions(jpeg_compress_struct& cinfo, const JpegSaveOptions& options) {
+    jpeg_set_quality(&cinfo, options.quality, TRUE);
+    cinfo.dct_method = GetDctMethod(options.dct_method);
+    cinfo.optimize_coding = options.optimize_coding ? TRUE : FALSE;
+    cinfo.restart_in_rows = options.restart_rows;
+
+    // прореживается цветность, то есть все компоненты, кроме яркости
+    if (cinfo.num_components == 3) {
+        cinfo.comp_info[0].h_samp_factor = options.subsampling == JpegSubsampling::S444 ? 1 : 2;
+        cinfo.comp_info[0].v_samp_factor = options.subsampling == JpegSubsampling::S420 ? 2 : 1;
+    }
+
+    if (options.progressive) {
+        jpeg_simple_progression(&cinfo);
+    }
+}
+
+JpegLoadOptions GetJpegLoadPreset(JpegPreset preset) {
+    JpegLoadOptions options;
+    if (preset == JpegPreset::FAST) {
+        options.dct_method = JpegDctMethod::IFAST;
+        options.fancy_upsampling = false;
+        options.block_smoothing = false;
+    }
+    return options;
+}
+
+JpegSaveOptions GetJpegSavePreset(JpegPreset preset) {
+    JpegSaveOptions options;
+    if (preset == JpegPreset::FAST) {
+        options.dct_method = JpegDctMethod::IFAST;
+    } else if (preset == JpegPreset::SMALL) {
+        options.optimize_coding = true;
+        options.progressive = true;
+    }
+    return options;
+}
+
+
+// Источник строк JPEG. Объект декодирования живёт всё время чтения,
+// а каждая выдаваемая строка сразу берётся из jpeg_read_scanlines.
+// Любой вызов libjpeg может завершиться через longjmp, поэтому
+// каждый метод устанавливает свою точку возврата setjmp
+class JpegSource : public ScanlineSource {
+public:
+    ~JpegSource() override {
+        if (created_) {
+            jpeg_destroy_decompress(&cinfo_);
+        }
+    }
+
+    // out_color_space - JCS_RGB или JCS_GRAYSCALE: libjpeg сам приводит изображение к нему
+    bool Open(const Path& file, J_COLOR_SPACE out_color_space = JCS_RGB, const JpegLoadOptions& options = {}) {
+        {
+            ScopedStageTimer timer(Stage::OPEN);
+            if (!infile_.Open(file)) {
+                return false;
+            }
+            from_file_ = true;
+        }
+        return Start(out_color_space, options);
+    }
+
+    // декодирует файл, целиком лежащий в памяти; data должна жить дольше источника
+    bool Open(ByteSpan data, J_COLOR_SPACE out_color_space = JCS_RGB, const JpegLoadOptions& options = {}) {
+        data_ = data;
+        return Start(out_color_space, options);
+    }
+
+    Size GetSize() const override {
+        return {static_cast<int>(cinfo_.output_width), static_cast<int>(cinfo_.output_height)};
+    }
+
+    bool ReadRow(Color* line) override {
+        assert(cinfo_.out_color_space == JCS_RGB);
+        if (!ReadRawRow(buffer_.data())) {
+            return false;
+        }
+        ScopedStageTimer timer(Stage::CONVERT);
+        SaveScanlineToImage(buffer_.data(), line, cinfo_.output_width);
+        return true;
+    }
+
+    // Декодирует очередную строку прямо в row: output_width * output_components байт.
+    // Так изображения RGB24 и Gray8 заполняются без промежуточного буфера
+    bool ReadRawRow(JSAMPLE* row) {
+        if (failed_ || cinfo_.output_scanline >= cinfo_.output_height) {
+            return false;
+        }
+
+        ScopedStageTimer timer(Stage::DECODE);
+
+        if (setjmp(jerr_.setjmp_buffer)) {
+            failed_ = true;
+            return false;
+        }
+
+        /* Шаг 6: читаем очередную строку */
+
+        JSAMPROW row_pointer[1] = {row};
+        (void) jpeg_read_scanlines(&cinfo_, row_pointer, 1);
+
+        /* Шаг 7: после последней строки останавливаем декодирование */
+
+        if (cinfo_.output_scanline == cinfo_.output_height) {
+            (void) jpeg_finish_decompress(&cinfo_);
+        }
+        return true;
+    }
+
+private:
+    // Начинает декодирование из уже выбранного источника: файла или памяти
+    bool Start(J_COLOR_SPACE out_color_space, const JpegLoadOptions& options) {
+        ScopedStageTimer timer(Stage::HEADER);
+
+        /* Шаг 1: выделяем память и инициализируем объект декодирования JPEG */
+
+        cinfo_.err = jpeg_std_error(&jerr_.pub);
+        jerr_.pub.error_exit = my_error_exit;
+
+        if (setjmp(jerr_.setjmp_buffer)) {
+            return false;
+        }
+
+        jpeg_create_decompress(&cinfo_);
+        created_ = true;
+
+        /* Шаг 2: устанавливаем источник данных */
+
+        if (from_file_) {
+            SetFileSource(cinfo_, file_source_, infile_);
+        } else {
+            jpeg_mem_src(&cinfo_, reinterpret_cast<const unsigned char*>(data_.data), data_.size);
+        }
+
+        /* Шаг 3: читаем параметры изображения через jpeg_read_header() */
+
+        (void) jpeg_read_header(&cinfo_, TRUE);
+
+        /* Шаг 4: устанавливаем параметры декодирования */
+
+        // установим желаемый формат изображения
+        cinfo_.out_color_space = out_color_space;
+        ApplyLoadOptions(cinfo_, options);
+        if (options.max_size) {
+            ChooseDCTScale(cinfo_, *options.max_size);
+        }
+
+        /* Шаг 5: начинаем декодирование */
+
+        (void) jpeg_start_decompress(&cinfo_);
+
+        // буфер не из пула libjpeg: jpeg_finish_decompress освобождает пул
+        // сразу после последней строки, а её ещё нужно перепаковать
+        buffer_.resize(cinfo_.output_width * cinfo_.output_components);
+
+        return true;
+    }
+
+    jpeg_decompress_struct cinfo_;
+    my_error_mgr jerr_;
+    bool created_ = false;
+    bool failed_ = false;
+    // файл читается с упреждением; объём прочитанного учитывает сам ReadAheadFile
+    ReadAheadFile infile_;
+    JpegFileSource file_source_;
+    bool from_file_ = false;
+    ByteSpan data_;
+    std::vector<JSAMPLE> buffer_;
+};
+
+
+// Приёмник строк JPEG. Параметры сжатия задаются JpegSaveOptions
+class JpegSink : public ScanlineSink {
+public:
+    ~JpegSink() override {
+        if (created_) {
+            jpeg_destroy_compress(&cinfo_);
+        }
+        free(mem_buffer_);
+    }
+
+    // in_color_space - JCS_RGB (3 компоненты) или JCS_GRAYSCALE (1 компонента)
+    bool Open(const Path& file, Size size, J_COLOR_SPACE in_color_space = JCS_RGB, const JpegSaveOptions& options = {}) {
+        if (!outfile_.Open(file)) {
+            return false;
+        }
+        to_file_ = true;
+        return Start(size, in_color_space, options);
+    }
+
+    // сжимает в память: после успешного Finish в out лежит содержимое файла целиком
+    bool Open(ByteBuffer& out, Size size, J_COLOR_SPACE in_color_space = JCS_RGB, const JpegSaveOptions& options = {}) {
+        out_ = &out;
+        return Start(size, in_color_space, options);
+    }
+
+    Size GetSize() const override {
+        return size_;
+    }
+
+    bool WriteRow(const Color* line) override {
+        assert(cinfo_.in_color_space == JCS_RGB);
+
+        /* Шаг 5: из строки изображения записываем строку в буфер попиксельно,
+           а из буфера затем разом в jpeg-объект */
+
+        {
+            ScopedStageTimer timer(Stage::CONVERT);
+            SaveImageLineToJPEGRow(line, size_.width, row_buffer_.data());
+        }
+        return WriteRawRow(row_buffer_.data());
+    }
+
+    // передаёт кодировщику готовую строку в формате in_color_space
+    bool WriteRawRow(const JSAMPLE* row) {
+        if (failed_ || cinfo_.next_scanline >= cinfo_.image_height) {
+            return false;
+        }
+
+        ScopedStageTimer timer(Stage::ENCODE);
+
+        if (setjmp(jerr_.setjmp_buffer)) {
+            failed_ = true;
+            return false;
+        }
+
+        // libjpeg не меняет входные строки, но принимает их по неконстантному указателю
+        JSAMPROW row_pointer[1] = {const_cast<JSAMPLE*>(row)};
+        (void) jpeg_write_scanlines(&cinfo_, row_pointer, 1);
+        return true;
+    }
+
+    bool Finish() override {
+        if (failed_ || cinfo_.next_scanline != cinfo_.image_height) {
+            return false;
+        }
+
+        // сюда входит сброс последних блоков кодировщика
+        ScopedStageTimer timer(Stage::WRITE);
+
+        if (setjmp(jerr_.setjmp_buffer)) {
+            failed_ = true;
+            return false;
+        }
+
+        /* Шаг 6: Завершение записи/сжатия */
+
+        jpeg_finish_compress(&cinfo_);
+
+        if (!to_file_) {
+            const std::byte* data = reinterpret_cast<const std::byte*>(mem_buffer_);
+            out_->assign(data, data + mem_size_);
+            return true;
+        }
+
+        /* After finish_compress, we can close the output file. */
+        // Close дожидается, пока фоновый поток допишет последние блоки
+        return outfile_.Close();
+    }
+
+private:
+    // Начинает сжатие в уже выбранный приёмник: файл или память
+    bool Start(Size size, J_COLOR_SPACE in_color_space, const JpegSaveOptions& options) {
+        size_ = size;
+
+        /* Шаг 1. Инициализация объекта JPEG */
+
+        // перед инициализацией запишем в данные указатель на менеджер ошибок, а то вдруг при инициализации ошибка будет
+        cinfo_.err = jpeg_std_error(&jerr_.pub);
+        jerr_.pub.error_exit = my_error_exit;
+
+        if (setjmp(jerr_.setjmp_buffer)) {
+            return false;
+        }
+
+        jpeg_create_compress(&cinfo_);
+        created_ = true;
+
+        // Шаг 2. Устанавливаем файл или буфер, куда будем записывать изображение
+
+        if (to_file_) {
+            SetFileDestination(cinfo_, file_dest_, outfile_);
+        } else {
+            jpeg_mem_dest(&cinfo_, &mem_buffer_, &mem_size_);
+        }
+
+        // Шаг 3. Устанавливаем параметры изображения
+
+        cinfo_.image_width = size_.width;  /* image width and height, in pixels */
+        cinfo_.image_height = size_.height;
+        cinfo_.input_components = in_color_space == JCS_GRAYSCALE ? 1 : 3;  /* # of color components per pixel */
+        cinfo_.in_color_space = in_color_space;  /* colorspace of input image */
+
+        // Устанавливаем параметры по умолчанию и поверх них - заданные
+        jpeg_set_defaults(&cinfo_);
+        ApplySaveOptions(cinfo_, options);
+
+        /* Шаг 4. Запуск сжатия */
+
+        /* TRUE ensures that we will write a complete interchange-JPEG file.
+        * Pass TRUE unless you are very sure of what you're doing.
+        */
+        jpeg_start_compress(&cinfo_, TRUE);
+
+        row_buffer_.resize(size_.width * cinfo_.input_components);
+        return true;
+    }
+
+    jpeg_compress_struct cinfo_;
+    my_error_mgr jerr_;
+    Size size_ = {0, 0};
+    bool created_ = false;
+    bool failed_ = false;
+    // сжатые данные пишутся на диск в фоновом потоке, пока кодируются следующие строки
+    WriteBehindFile outfile_;
+    JpegFileDestination file_dest_;
+    bool to_file_ = false;
+    // буфер libjpeg при сжатии в память; освобождается нами
+    unsigned char* mem_buffer_ = nullptr;
+    unsigned long mem_size_ = 0;
+    ByteBuffer* out_ = nullptr;
+    std::vector<JSAMPLE> row_buffer_;
+};
+
+
+// ---------- параллельное кодирование и декодирование полосами ----------
+//
+// Маркер RST сбрасывает предсказание DC и выравнивает данные скана на границу байта,
+// поэтому участки между маркерами кодируются и декодируются независимо.
+// Кодировщик сжимает каждую полосу изображения как отдельный JPEG с маркером RST
+// после каждой строки MCU, затем склеивает данные сканов в один, перенумеровав маркеры.
+// Декодер делает обратное: делит скан по маркерам RST и собирает из каждой группы
+// участков отдельный JPEG с тем же заголовком
+
+static const unsigned char JPEG_MARKER_SOF0 = 0xC0;
+static const unsigned char JPEG_MARKER_SOF1 = 0xC1;
+static const unsigned char JPEG_MARKER_RST0 = 0xD0;
+static const unsigned char JPEG_MARKER_SOI = 0xD8;
+static const unsigned char JPEG_MARKER_EOI = 0xD9;
+static const unsigned char JPEG_MARKER_SOS = 0xDA;
+static const unsigned char JPEG_MARKER_DRI = 0xDD;
+static const unsigned char JPEG_MARKER_APP1 = 0xE1;
+static const unsigned char JPEG_MARKER_COM = 0xFE;
+
+// При прореживании цветности 4:2:0 строка MCU - 16 строк пикселей, без прореживания
+// по вертикали - 8; полосы кратны 16 строкам и подходят для обоих случаев
+static const int JPEG_STRIP_MCU_ROWS = 16;
+// более мелкие полосы не окупают запуск отдельного кодировщика
+static const int JPEG_MIN_STRIP_ROWS = 64;
+
+static int ReadBigEndian16(const unsigned char* data) {
+    return (data[0] << 8) | data[1];
+}
+
+static void WriteBigEndian16(unsigned char* data, int value) {
+    data[0] = static_cast<unsigned char>(value >> 8);
+    data[1] = static_cast<unsigned char>(value & 0xFF);
+}
+
+static bool IsRestartMarker(unsigned char marker) {
+    return marker >= JPEG_MARKER_RST0 && marker < JPEG_MARKER_RST0 + 8;
+}
+
+// Маркеры SOFn; C4 (DHT), C8 и CC (DAC) из того же диапазона к кадру не относятся
+static bool IsFrameMarker(unsigned char marker) {
+    return marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+}
+
+// Расположение заголовка файла, в котором один последовательный скан
+struct JpegLayout {
+    size_t sof_pos = 0;   // маркер SOF
+    size_t sos_pos = 0;   // маркер SOS
+    size_t scan_pos = 0;  // начало данных скана
+    int width = 0;
+    int height = 0;
+    int mcu_width = 0;
+    int mcu_height = 0;
+    int restart_interval = 0;  // в MCU, 0 - маркеров RST нет
+};
+
+// Разбирает сегменты до первого SOS. Возвращает nullopt для прогрессивных
+// и арифметических файлов и для сканов, в которых чередуются не все компоненты
+static std::optional<JpegLayout> ParseJpegLayout(const unsigned char* data, size_t size) {
+    if (size < 4 || data[0] != 0xFF || data[1] != JPEG_MARKER_SOI) {
+        return std::nullopt;
+    }
+
+    JpegLayout layout;
+    int components = 0;
+    int max_h = 1;
+    int max_v = 1;
+
+    size_t pos = 2;
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) {
+            return std::nullopt;
+        }
+        const unsigned char marker = data[pos + 1];
+        if (marker == 0xFF) {
+            // заполняющий байт перед маркером
+            ++pos;
+            continue;
+        }
+
+        const size_t length = ReadBigEndian16(data + pos + 2);
+        if (length < 2 || pos + 2 + length > size) {
+            return std::nullopt;
+        }
+        const unsigned char* body = data + pos + 4;
+
+        if (IsFrameMarker(marker)) {
+            if ((marker != JPEG_MARKER_SOF0 && marker != JPEG_MARKER_SOF1) || length < 8) {
+                return std::nullopt;
+            }
+            components = body[5];
+            if (components == 0 || length < 8 + 3 * static_cast<size_t>(components)) {
+                return std::nullopt;
+            }
+            layout.sof_pos = pos;
+            layout.height = ReadBigEndian16(body + 1);
+            layout.width = ReadBigEndian16(body + 3);
+            for (int c = 0; c < components; ++c) {
+                max_h = std::max(max_h, body[6 + 3 * c + 1] >> 4);
+                max_v = std::max(max_v, body[6 + 3 * c + 1] & 0x0F);
+            }
+        } else if (marker == JPEG_MARKER_DRI) {
+            if (length < 4) {
+                return std::nullopt;
+            }
+            layout.restart_interval = ReadBigEndian16(body);
+        } else if (marker == JPEG_MARKER_SOS) {
+            if (components == 0 || body[0] != components) {
+                return std::nullopt;
+            }
+            layout.sos_pos = pos;
+            layout.scan_pos = pos + 2 + length;
+            // скан из одной компоненты не чередуется, и его MCU - один блок 8x8
+            layout.mcu_width = components == 1 ? DCTSIZE : max_h * DCTSIZE;
+            layout.mcu_height = components == 1 ? DCTSIZE : max_v * DCTSIZE;
+            return layout;
+        }
+
+        pos += 2 + length;
+    }
+    return std::nullopt;
+}
+
+// Делит данные скана на участки между маркерами RST: пары [начало, конец).
+// Возвращает nullopt, если скан завершается не маркером EOI - например,
+// если за ним следуют другие сканы
+static std::optional<std::vector<std::pair<size_t, size_t>>> SplitRestartIntervals(
+        const unsigned char* data, size_t size, size_t scan_pos) {
+    std::vector<std::pair<size_t, size_t>> intervals;
+    size_t start = scan_pos;
+    size_t pos = scan_pos;
+
+    while (true) {
+        const void* found = std::memchr(data + pos, 0xFF, size - pos);
+        if (!found) {
+            return std::nullopt;
+        }
+        pos = static_cast<const unsigned char*>(found) - data;
+        if (pos + 1 >= size) {
+            return std::nullopt;
+        }
+
+        const unsigned char next = data[pos + 1];
+        if (next == 0x00 || next == 0xFF) {
+            // байт 0xFF внутри данных или заполняющий байт
+            ++pos;
+        } else if (IsRestartMarker(next)) {
+            intervals.emplace_back(start, pos);
+            pos += 2;
+            start = pos;
+        } else if (next == JPEG_MARKER_EOI) {
+            intervals.emplace_back(start, pos);
+            return intervals;
+        } else {
+            return std::nullopt;
+        }
+    }
+}
+
+// Перенумеровывает маркеры RST внутри данных скана, продолжая счётчик next_restart
+static void RenumberRestartMarkers(unsigned char* data, size_t size, int& next_restart) {
+    for (size_t pos = 0; pos + 1 < size; ++pos) {
+        if (data[pos] == 0xFF && IsRestartMarker(data[pos + 1])) {
+            data[pos + 1] = static_cast<unsigned char>(JPEG_MARKER_RST0 + (next_restart++ & 7));
+            ++pos;
+        }
+    }
+}
+
+static int GetJpegStripRows(int height, size_t threads) {
+    // полос вдвое больше, чем потоков, чтобы потоки не простаивали в конце
+    const int target = static_cast<int>((height + threads * 2 - 1) / (threads * 2));
+    const int rows = std::max(target, JPEG_MIN_STRIP_ROWS);
+    return (rows + JPEG_STRIP_MCU_ROWS - 1) / JPEG_STRIP_MCU_ROWS * JPEG_STRIP_MCU_ROWS;
+}
+
+// Сжимает полосу - часть изображения во всю ширину - как отдельный JPEG в память,
+// с маркером RST после каждой строки MCU
+static bool EncodeJpegStrip(ImageView strip, const JpegSaveOptions& options, std::vector<unsigned char>& out) {
+    ScopedStageTimer timer(Stage::ENCODE);
+    jpeg_compress_struct cinfo;
     my_error_mgr jerr;
-    
-    FILE* infile;
-    JSAMPARRAY buffer;
-    int row_stride;
-
-    // Тут не избежать функции открытия файла из языка C,
-    // поэтому приходится использовать конвертацию пути к string.
-    // Под Visual Studio это может быть опасно, и нужно применить
-    // нестандартную функцию _wfopen
-#ifdef _MSC_VER
-    if ((infile = _wfopen(file.wstring().c_str(), "rb")) == NULL) {
-#else
-    if ((infile = fopen(file.string().c_str(), "rb")) == NULL) {
-#endif
-        return {};
+    unsigned char* buffer = nullptr;
+    unsigned long buffer_size = 0;
+    std::vector<JSAMPLE> row(strip.GetWidth() * 3);
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = my_error_exit;
+
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_compress(&cinfo);
+        free(buffer);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buffer, &buffer_size);
+
+    cinfo.image_width = strip.GetWidth();
+    cinfo.image_height = strip.GetHeight();
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    ApplySaveOptions(cinfo, options);
+    cinfo.restart_in_rows = 1;
+
+    jpeg_start_compress(&cinfo, TRUE);
+    // полосы склеиваются только по границам строк MCU
+    if (JPEG_STRIP_MCU_ROWS % (cinfo.max_v_samp_factor * DCTSIZE) != 0) {
+        jpeg_destroy_compress(&cinfo);
+        free(buffer);
+        return false;
+    }
+
+    for (int y = 0; y < strip.GetHeight(); ++y) {
+        SaveImageLineToJPEGRow(strip.GetLine(y), strip.GetWidth(), row.data());
+        JSAMPROW row_pointer[1] = {row.data()};
+        (void) jpeg_write_scanlines(&cinfo, row_pointer, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+
+    out.assign(buffer, buffer + buffer_size);
+    jpeg_destroy_compress(&cinfo);
+    free(buffer);
+    return true;
+}
+
+// Склеивает полосы в один файл: заголовок первой полосы с исправленной высотой,
+// затем данные сканов всех полос, разделённые маркерами RST. Части файла
+// по порядку передаются в write(data, size)
+template <typename Write>
+static bool JoinJpegStrips(std::vector<std::vector<unsigned char>>& strips, int height, Write&& write) {
+    std::vector<JpegLayout> layouts;
+    for (const std::vector<unsigned char>& strip : strips) {
+        const std::optional<JpegLayout> layout = ParseJpegLayout(strip.data(), strip.size());
+        if (!layout || layout->restart_interval == 0 || strip.size() < layout->scan_pos + 2
+            || strip[strip.size() - 2] != 0xFF || strip.back() != JPEG_MARKER_EOI) {
+            return false;
+        }
+        layouts.push_back(*layout);
     }
 
-    /* Шаг 1: выделяем память и инициализируем объект декодирования JPEG */
+    std::vector<unsigned char> header(strips[0].begin(), strips[0].begin() + layouts[0].scan_pos);
+    WriteBigEndian16(header.data() + layouts[0].sof_pos + 5, height);
+    write(header.data(), header.size());
+
+    int next_restart = 0;
+    for (size_t i = 0; i < strips.size(); ++i) {
+        if (i > 0) {
+            const unsigned char marker[2] = {0xFF, static_cast<unsigned char>(JPEG_MARKER_RST0 + (next_restart++ & 7))};
+            write(marker, 2);
+        }
+        unsigned char* scan = strips[i].data() + layouts[i].scan_pos;
+        const size_t scan_size = strips[i].size() - 2 - layouts[i].scan_pos;
+        RenumberRestartMarkers(scan, scan_size, next_restart);
+        write(scan, scan_size);
+    }
+
+    const unsigned char eoi[2] = {0xFF, JPEG_MARKER_EOI};
+    write(eoi, 2);
+    return true;
+}
+
+static bool WriteJpegStrips(const Path& file, std::vector<std::vector<unsigned char>>& strips, int height) {
+    WriteBehindFile out;
+    if (!out.Open(file)) {
+        return false;
+    }
+
+    ScopedStageTimer timer(Stage::WRITE);
+    bool ok = true;
+    if (!JoinJpegStrips(strips, height, [&out, &ok](const unsigned char* data, size_t size) {
+            ok = out.Write(data, size) && ok;
+        })) {
+        return false;
+    }
+    return out.Close() && ok;
+}
+
+static bool WriteJpegStrips(ByteBuffer& out, std::vector<std::vector<unsigned char>>& strips, int height) {
+    out.clear();
+    return JoinJpegStrips(strips, height, [&out](const unsigned char* data, size_t size) {
+        const std::byte* bytes = reinterpret_cast<const std::byte*>(data);
+        out.insert(out.end(), bytes, bytes + size);
+    });
+}
+
+// output - путь к файлу или ByteBuffer
+template <typename Output>
+static bool SaveJPEGStrips(Output& output, ImageView image, const JpegSaveOptions& options, size_t threads) {
+    const int height = image.GetHeight();
+    const int strip_rows = GetJpegStripRows(height, threads);
+    const int strip_count = (height + strip_rows - 1) / strip_rows;
+
+    std::vector<std::vector<unsigned char>> strips(strip_count);
+    std::atomic<bool> ok = true;
+    ParallelFor(0, strip_count, 1, threads, [&](int from, int to) {
+        for (int i = from; i < to && ok; ++i) {
+            const int first_row = i * strip_rows;
+            const ImageView strip = image.GetSubView(0, first_row, image.GetWidth(), strip_rows);
+            if (!EncodeJpegStrip(strip, options, strips[i])) {
+                ok = false;
+            }
+        }
+    });
+
+    return ok && WriteJpegStrips(output, strips, height);
+}
+
+// Декодирует участки скана [first, last) в строки изображения. Чтобы сглаживающая
+// интерполяция цветности на границах полос давала тот же результат, что и при
+// последовательном декодировании, по соседнему участку с каждой стороны
+// декодируется и отбрасывается
+static bool DecodeJpegStrip(const unsigned char* data, const JpegLayout& layout,
+                            const std::vector<std::pair<size_t, size_t>>& intervals,
+                            size_t first, size_t last, int interval_rows, const JpegLoadOptions& options,
+                            Image& result) {
+    ScopedStageTimer timer(Stage::DECODE);
+    const size_t decode_first = first > 0 ? first - 1 : 0;
+    const size_t decode_last = std::min(intervals.size(), last + 1);
+    const int first_row = static_cast<int>(decode_first) * interval_rows;
+    const int rows = std::min(layout.height, static_cast<int>(decode_last) * interval_rows) - first_row;
+    const int keep_from = static_cast<int>(first) * interval_rows;
+    const int keep_to = std::min(layout.height, static_cast<int>(last) * interval_rows);
+
+    // отдельный JPEG: заголовок исходного файла с высотой полосы и её участки
+    std::vector<unsigned char> strip(data, data + layout.scan_pos);
+    WriteBigEndian16(strip.data() + layout.sof_pos + 5, rows);
+    for (size_t i = decode_first; i < decode_last; ++i) {
+        if (i > decode_first) {
+            strip.push_back(0xFF);
+            strip.push_back(static_cast<unsigned char>(JPEG_MARKER_RST0 + ((i - decode_first - 1) & 7)));
+        }
+        strip.insert(strip.end(), data + intervals[i].first, data + intervals[i].second);
+    }
+    strip.push_back(0xFF);
+    strip.push_back(JPEG_MARKER_EOI);
+
+    jpeg_decompress_struct cinfo;
+    my_error_mgr jerr;
+    std::vector<JSAMPLE> row(layout.width * 3);
 
     cinfo.err = jpeg_std_error(&jerr.pub);
     jerr.pub.error_exit = my_error_exit;
 
     if (setjmp(jerr.setjmp_buffer)) {
         jpeg_destroy_decompress(&cinfo);
-        fclose(infile);
-        return {};
+        return false;
     }
 
     jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, strip.data(), strip.size());
+    (void) jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_RGB;
+    ApplyLoadOptions(cinfo, options);
+    (void) jpeg_start_decompress(&cinfo);
 
-    /* Шаг 2: устанавливаем источник данных */
+    if (static_cast<int>(cinfo.output_width) != layout.width || static_cast<int>(cinfo.output_height) != rows) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
 
-    jpeg_stdio_src(&cinfo, infile);
+    for (int y = first_row; y < first_row + rows; ++y) {
+        JSAMPROW row_pointer[1] = {row.data()};
+        (void) jpeg_read_scanlines(&cinfo, row_pointer, 1);
+        if (y >= keep_from && y < keep_to) {
+            SaveScanlineToImage(row.data(), result.GetLine(y), layout.width);
+        }
+    }
 
-    /* Шаг 3: читаем параметры изображения через jpeg_read_header() */
+    (void) jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
 
-    (void) jpeg_read_header(&cinfo, TRUE);
+// Возвращает nullopt, если файл нельзя разделить на полосы -
+// тогда его нужно декодировать последовательно
+static std::optional<Image> LoadJPEGStrips(ByteSpan file, const JpegLoadOptions& options, size_t threads) {
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(file.data);
+    const size_t size = file.size;
 
-    /* Шаг 4: устанавливаем параметры декодирования */
+    const std::optional<JpegLayout> layout = ParseJpegLayout(data, size);
+    if (!layout || layout->restart_interval == 0 || layout->width == 0 || layout->height == 0) {
+        return std::nullopt;
+    }
 
-    // установим желаемый формат изображения
-    cinfo.out_color_space = JCS_RGB;
-    cinfo.output_components = 3;
+    // участки между маркерами должны состоять из целых строк MCU
+    const int mcus_per_row = (layout->width + layout->mcu_width - 1) / layout->mcu_width;
+    const int mcu_rows = (layout->height + layout->mcu_height - 1) / layout->mcu_height;
+    if (layout->restart_interval % mcus_per_row != 0) {
+        return std::nullopt;
+    }
+    const int interval_mcu_rows = layout->restart_interval / mcus_per_row;
 
-    /* Шаг 5: начинаем декодирование */
+    const std::optional<std::vector<std::pair<size_t, size_t>>> intervals =
+        SplitRestartIntervals(data, size, layout->scan_pos);
+    if (!intervals || intervals->size() < 2
+        || static_cast<int>(intervals->size()) != (mcu_rows + interval_mcu_rows - 1) / interval_mcu_rows) {
+        return std::nullopt;
+    }
 
-    (void) jpeg_start_decompress(&cinfo);
-    
-    row_stride = cinfo.output_width * cinfo.output_components;
-    
-    buffer = (*cinfo.mem->alloc_sarray)
-                ((j_common_ptr) &cinfo, JPOOL_IMAGE, row_stride, 1);
+    const size_t strip_count = std::min(intervals->size(), threads * 2);
+    Image result(layout->width, layout->height);
+    std::atomic<bool> ok = true;
+    ParallelFor(0, static_cast<int>(strip_count), 1, threads, [&](int from, int to) {
+        for (int i = from; i < to && ok; ++i) {
+            const size_t first = intervals->size() * i / strip_count;
+            const size_t last = intervals->size() * (i + 1) / strip_count;
+            if (!DecodeJpegStrip(data, *layout, *intervals, first, last,
+                                 interval_mcu_rows * layout->mcu_height, options, result)) {
+                ok = false;
+            }
+        }
+    });
 
-    /* Шаг 5a: выделим изображение ImgLib */
-    Image result(cinfo.output_width, cinfo.output_height, Color::Black());
+    if (!ok) {
+        return Image{};
+    }
+    return result;
+}
+
+static std::optional<Image> LoadJPEGStrips(const Path& file, const JpegLoadOptions& options, size_t threads) {
+    MappedFile mapped;
+    if (!mapped.Open(file)) {
+        return std::nullopt;
+    }
+    std::optional<Image> result = LoadJPEGStrips(ByteSpan{mapped.GetData(), mapped.GetSize()}, options, threads);
+    if (result) {
+        AddCounter(Counter::BYTES_READ, mapped.GetSize());
+    }
+    return result;
+}
 
-    /* Шаг 6: while (остаются строки изображения) */
-    /*                     jpeg_read_scanlines(...); */
 
-    while (cinfo.output_scanline < cinfo.output_height) {
-        int y = cinfo.output_scanline;
-        (void) jpeg_read_scanlines(&cinfo, buffer, 1);
+std::unique_ptr<ScanlineSource> OpenJPEGSource(const Path& file) {
+    return OpenJPEGSource(file, JpegLoadOptions{});
+}
 
-        SaveScanlineToImage(buffer[0], y, result);
+std::unique_ptr<ScanlineSource> OpenJPEGSource(const Path& file, const JpegLoadOptions& options) {
+    auto source = std::make_unique<JpegSource>();
+    if (!source->Open(file, JCS_RGB, options)) {
+        return nullptr;
     }
+    return source;
+}
 
-    /* Шаг 7: Останавливаем декодирование */
+std::unique_ptr<ScanlineSink> CreateJPEGSink(const Path& file, Size size) {
+    return CreateJPEGSink(file, size, JpegSaveOptions{});
+}
 
-    (void) jpeg_finish_decompress(&cinfo);
+std::unique_ptr<ScanlineSink> CreateJPEGSink(const Path& file, Size size, const JpegSaveOptions& options) {
+    auto sink = std::make_unique<JpegSink>();
+    if (!sink->Open(file, size, JCS_RGB, options)) {
+        return nullptr;
+    }
+    return sink;
+}
+
+
+// Значение тега Orientation (0x0112) из первого каталога TIFF-структуры EXIF, 0 - если его нет
+static int ParseExifOrientation(const unsigned char* tiff, size_t size) {
+    if (size < 8 || tiff[0] != tiff[1] || (tiff[0] != 'I' && tiff[0] != 'M')) {
+        return 0;
+    }
+    // II - порядок байт от младшего к старшему, MM - наоборот
+    const bool little_endian = tiff[0] == 'I';
+    const auto read16 = [tiff, little_endian](size_t pos) {
+        return little_endian ? tiff[pos] | tiff[pos + 1] << 8 : tiff[pos] << 8 | tiff[pos + 1];
+    };
+    const auto read32 = [&read16, little_endian](size_t pos) {
+        const uint32_t first = read16(pos);
+        const uint32_t second = read16(pos + 2);
+        return little_endian ? first | second << 16 : first << 16 | second;
+    };
 
-    /* Шаг 8: Освобождаем объект декодирования */
+    const size_t ifd = read32(4);
+    if (read16(2) != 42 || ifd > size - 2) {
+        return 0;
+    }
+    const int count = read16(ifd);
+    for (int i = 0; i < count; ++i) {
+        const size_t entry = ifd + 2 + 12 * static_cast<size_t>(i);
+        if (entry + 12 > size) {
+            return 0;
+        }
+        // тип 3 - SHORT, значение лежит в первых двух байтах поля
+        if (read16(entry) == 0x0112 && read16(entry + 2) == 3) {
+            return read16(entry + 8);
+        }
+    }
+    return 0;
+}
+
+// Обходит сегменты JPEG от SOI до первого SOS включительно. visit(marker, pos, length)
+// получает маркер, смещение сегмента и его длину из заголовка; false - закончить обход.
+// read(pos, size, dst) читает size байт с позиции pos; false - если их нет.
+// Возвращает false, если сегменты закончились раньше, чем visit остановил обход
+template <typename Read, typename Visit>
+static bool WalkJpegSegments(Read& read, Visit&& visit) {
+    unsigned char head[4];
+    if (!read(0, 2, head) || head[0] != 0xFF || head[1] != JPEG_MARKER_SOI) {
+        return false;
+    }
+
+    size_t pos = 2;
+    while (read(pos, 4, head)) {
+        if (head[0] != 0xFF) {
+            return false;
+        }
+        const unsigned char marker = head[1];
+        if (marker == 0xFF) {
+            ++pos;
+            continue;
+        }
+
+        const size_t length = ReadBigEndian16(head + 2);
+        if (length < 2) {
+            return false;
+        }
+        if (!visit(marker, pos, length)) {
+            return true;
+        }
+        if (marker == JPEG_MARKER_SOS) {
+            return false;
+        }
+        pos += 2 + length;
+    }
+    return false;
+}
+
+// Ищет APP1 с EXIF среди сегментов до начала кадра
+template <typename Read>
+static ImageTransform FindExifOrientation(Read& read) {
+    static const unsigned char EXIF_ID[6] = {'E', 'x', 'i', 'f', 0, 0};
+
+    ImageTransform result = ImageTransform::NONE;
+    WalkJpegSegments(read, [&](unsigned char marker, size_t pos, size_t length) {
+        // EXIF стоит перед кадром, дальше искать незачем
+        if (marker == JPEG_MARKER_SOS || IsFrameMarker(marker)) {
+            return false;
+        }
+        if (marker != JPEG_MARKER_APP1 || length <= 2 + sizeof(EXIF_ID)) {
+            return true;
+        }
+
+        std::vector<unsigned char> body(length - 2);
+        if (!read(pos + 4, body.size(), body.data())) {
+            return false;
+        }
+        if (!std::equal(std::begin(EXIF_ID), std::end(EXIF_ID), body.begin())) {
+            return true;
+        }
+        const int orientation = ParseExifOrientation(body.data() + sizeof(EXIF_ID), body.size() - sizeof(EXIF_ID));
+        result = GetExifOrientationTransform(orientation);
+        return false;
+    });
+    return result;
+}
+
+// Функция чтения для WalkJpegSegments поверх файла: позиция задаётся перед каждым чтением
+static auto MakeStreamReader(std::ifstream& in) {
+    return [&in](size_t pos, size_t size, unsigned char* dst) {
+        in.seekg(static_cast<std::streamoff>(pos));
+        in.read(reinterpret_cast<char*>(dst), static_cast<std::streamsize>(size));
+        AddCounter(Counter::BYTES_READ, in.gcount());
+        return in.gcount() == static_cast<std::streamsize>(size);
+    };
+}
+
+ImageTransform GetJPEGOrientation(const Path& file) {
+    ScopedStageTimer timer(Stage::HEADER);
+    std::ifstream in(file, std::ios::binary);
+    if (!in) {
+        return ImageTransform::NONE;
+    }
+    auto read = MakeStreamReader(in);
+    return FindExifOrientation(read);
+}
+
+ImageTransform GetJPEGOrientation(ByteSpan data) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data.data);
+    auto read = [bytes, &data](size_t pos, size_t size, unsigned char* dst) {
+        if (pos > data.size || size > data.size - pos) {
+            return false;
+        }
+        std::memcpy(dst, bytes + pos, size);
+        return true;
+    };
+    return FindExifOrientation(read);
+}
 
+// Сегменты от SOI до SOS включительно без APPn и COM - всё, что нужно jpeg_read_header.
+// EXIF, ICC-профиль и миниатюры бывают длиннее самих таблиц, поэтому они не читаются.
+// nullopt - если SOS не найден
+template <typename Read>
+static std::optional<std::vector<unsigned char>> ReadJpegTables(Read& read) {
+    std::vector<unsigned char> tables = {0xFF, JPEG_MARKER_SOI};
+    bool has_scan = false;
+    WalkJpegSegments(read, [&](unsigned char marker, size_t pos, size_t length) {
+        if ((marker >= 0xE0 && marker <= 0xEF) || marker == JPEG_MARKER_COM) {
+            return true;
+        }
+        const size_t old_size = tables.size();
+        tables.resize(old_size + 2 + length);
+        if (!read(pos, 2 + length, tables.data() + old_size)) {
+            return false;
+        }
+        has_scan = marker == JPEG_MARKER_SOS;
+        return !has_scan;
+    });
+    if (!has_scan) {
+        return std::nullopt;
+    }
+    return tables;
+}
+
+std::optional<ImageInfo> ProbeJPEG(const Path& file, const JpegLoadOptions& options) {
+    ScopedStageTimer timer(Stage::HEADER);
+    std::ifstream in(file, std::ios::binary);
+    if (!in) {
+        return std::nullopt;
+    }
+    auto read = MakeStreamReader(in);
+    const std::optional<std::vector<unsigned char>> tables = ReadJpegTables(read);
+    if (!tables) {
+        return std::nullopt;
+    }
+
+    // Таблицы разбирает сам libjpeg: так размер на выходе и раскладка компонент
+    // те же, что у декодера, включая выбор масштаба в IDCT
+    jpeg_decompress_struct cinfo;
+    my_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = my_error_exit;
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_decompress(&cinfo);
+        return std::nullopt;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, tables->data(), tables->size());
+    (void) jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_RGB;
+    ApplyLoadOptions(cinfo, options);
+    if (options.max_size) {
+        ChooseDCTScale(cinfo, *options.max_size);
+    } else {
+        jpeg_calc_output_dimensions(&cinfo);
+    }
+
+    ImageInfo info;
+    info.size = {static_cast<int>(cinfo.output_width), static_cast<int>(cinfo.output_height)};
+    // Коэффициенты хранятся блоками 8x8 по 2 байта, стороны округляются до целых MCU.
+    // Последовательному декодеру хватает одной строки MCU каждой компоненты; с запасом
+    // на соседние строки для интерполяции цветности и на преобразование цвета
+    uint64_t mcu_row_bytes = 0;
+    for (int c = 0; c < cinfo.num_components; ++c) {
+        const jpeg_component_info& component = cinfo.comp_info[c];
+        const uint64_t width_blocks = (component.width_in_blocks + component.h_samp_factor - 1)
+                                      / component.h_samp_factor * component.h_samp_factor;
+        const uint64_t height_blocks = (component.height_in_blocks + component.v_samp_factor - 1)
+                                       / component.v_samp_factor * component.v_samp_factor;
+        info.coefficient_bytes += width_blocks * height_blocks * DCTSIZE2 * sizeof(JCOEF);
+        mcu_row_bytes += width_blocks * DCTSIZE * component.v_samp_factor * DCTSIZE;
+    }
+    const uint64_t rows_bytes = jpeg_has_multiple_scans(&cinfo) ? info.coefficient_bytes : 3 * mcu_row_bytes;
+    info.decoder_bytes = ReadAheadFile::GetMaxBufferBytes(file) + rows_bytes
+                         + static_cast<uint64_t>(cinfo.output_width) * cinfo.output_components;
     jpeg_destroy_decompress(&cinfo);
-    fclose(infile);
+    return info;
+}
+
+uint64_t EstimateJPEGSaveMemory(Size size, const JpegSaveOptions& options) {
+    // блоки 8x8 по 2 байта: яркость и две компоненты цветности, прореженные по subsampling
+    const uint64_t luma_blocks = static_cast<uint64_t>((size.width + 15) / 16 * 2) * ((size.height + 15) / 16 * 2);
+    const uint64_t chroma_blocks = options.subsampling == JpegSubsampling::S444 ? luma_blocks
+                                   : options.subsampling == JpegSubsampling::S422 ? luma_blocks / 2
+                                                                                   : luma_blocks / 4;
+    const uint64_t coefficient_bytes = (luma_blocks + 2 * chroma_blocks) * DCTSIZE2 * sizeof(JCOEF);
+    // без прогрессивного режима и оптимизации таблиц коэффициенты сжимаются по строке MCU,
+    // с тем же запасом, что у декодера
+    const uint64_t mcu_row_bytes = coefficient_bytes / std::max((size.height + 15) / 16, 1);
+    const uint64_t buffered = options.progressive || options.optimize_coding ? coefficient_bytes : 3 * mcu_row_bytes;
+    return WriteBehindFile::GetMaxBufferBytes() + JPEG_DEST_BUFFER_BYTES + buffered;
+}
+
 
+// input - путь к файлу или ByteSpan с его содержимым
+template <typename Pixel, typename Input>
+static BasicImage<Pixel> LoadJPEGImpl(const Input& input, const JpegLoadOptions& options = {}) {
+    if constexpr (std::is_same_v<Pixel, Color>) {
+        JpegSource source;
+        if (!source.Open(input, JCS_RGB, options)) {
+            return {};
+        }
+        return ReadImage(source);
+    } else {
+        // RGB24 и Gray8 совпадают по раскладке со строками libjpeg,
+        // поэтому декодер пишет прямо в строки изображения
+        JpegSource source;
+        if (!source.Open(input, std::is_same_v<Pixel, Gray8> ? JCS_GRAYSCALE : JCS_RGB, options)) {
+            return {};
+        }
+
+        const Size size = source.GetSize();
+        BasicImage<Pixel> result(size.width, size.height);
+        for (int y = 0; y < size.height; ++y) {
+            if (!source.ReadRawRow(reinterpret_cast<JSAMPLE*>(result.GetLine(y)))) {
+                return {};
+            }
+        }
+        return result;
+    }
+}
+
+template <typename Input>
+static Image DecodeJPEGWithOptions(const Input& input, const JpegLoadOptions& options) {
+    if (!options.max_size) {
+        const size_t threads = options.threads == 0 ? GetDefaultThreadCount() : options.threads;
+        if (threads > 1) {
+            if (std::optional<Image> result = LoadJPEGStrips(input, options, threads)) {
+                return std::move(*result);
+            }
+        }
+        return LoadJPEGImpl<Color>(input, options);
+    }
+
+    JpegSource source;
+    if (!source.Open(input, JCS_RGB, options)) {
+        return {};
+    }
+    Image result = ReadImage(source);
+
+    // декодер уменьшил изображение не больше чем нужно, осталась лёгкая доводка
+    const Size target = FitWithin({result.GetWidth(), result.GetHeight()}, *options.max_size);
+    if (result && (target.width != result.GetWidth() || target.height != result.GetHeight())) {
+        result = Resize(result, target);
+    }
     return result;
 }
 
+template <typename Input>
+static Image LoadJPEGWithOptions(const Input& input, const JpegLoadOptions& options) {
+    const ImageTransform orientation = options.auto_orient ? GetJPEGOrientation(input) : ImageTransform::NONE;
+    if (orientation == ImageTransform::NONE) {
+        return DecodeJPEGWithOptions(input, options);
+    }
 
+    // max_size задан для уже повёрнутого изображения
+    JpegLoadOptions decode_options = options;
+    if (decode_options.max_size) {
+        decode_options.max_size = GetTransformedSize(*decode_options.max_size, orientation);
+    }
+    const Image image = DecodeJPEGWithOptions(input, decode_options);
+    return TransformImage(image, orientation, options.threads);
+}
 
+template <typename Pixel>
+BasicImage<Pixel> LoadJPEGAs(const Path& file) {
+    return LoadJPEGImpl<Pixel>(file);
+}
 
-// тип JSAMPLE фактически псевдоним для unsigned char
-void SaveImageLineToJPEGRow(const Image& in_image, int y, JSAMPLE* row) {
-    const Color* line = in_image.GetLine(y);
-    for (int x = 0; x < in_image.GetWidth(); ++x) {
-        JSAMPLE* pixel = row + x * 3;
-        // line[x] = Color{std::byte{pixel[0]}, std::byte{pixel[1]}, std::byte{pixel[2]}, std::byte{255}};
-        pixel[0] = static_cast<JSAMPLE>(line[x].r);
-        pixel[1] = static_cast<JSAMPLE>(line[x].g);
-        pixel[2] = static_cast<JSAMPLE>(line[x].b);
-        // pixel[3] = static_cast<JSAMPLE>(line[x].a);
-    }
-}
-
-// В эту функцию вставлен код примера из библиотеки libjpeg.
-// Измените его, чтобы адаптировать к переменным file и image.
-// Задание качества уберите - будет использовано качество по умолчанию
-bool SaveJPEG(const Path& file, const Image& image) {
-    
-    // Структура для хранения параметров изображения и сжатия из примера    
-    jpeg_compress_struct cinfo;
-    
-    // Структура из примера для хранения и вывода ошибок    
-    jpeg_error_mgr jerr;
-    /* More stuff */
-    FILE * outfile;       /* target file */
-    JSAMPROW row_pointer[1];  /* pointer to JSAMPLE row[s] */
-    int row_stride;       /* physical row width in image buffer */
-
-    /* Step 1: allocate and initialize JPEG compression object */
-    /* Шаг 1. Инициализация объекта JPEG */
-    
-    // перед инициализацией запишем в данные указатель на менеджер ошибок, а то вдруг при инициализации ошибка будет
-    cinfo.err = jpeg_std_error(&jerr);  
-    
-    jpeg_create_compress(&cinfo);
-    
-    // Шаг 2. Устанавливаем файл, куда будем записывать изображение
-
-    // Тут не избежать функции открытия файла из языка C,
-    // поэтому приходится использовать конвертацию пути к string.
-    // Под Visual Studio это может быть опасно, и нужно применить
-    // нестандартную функцию _wfopen
-#ifdef _MSC_VER
-    if ((outfile = _wfopen(file.wstring().c_str(), "wb")) == NULL) {
-#else
-    if ((outfile = fopen(file.string().c_str(), "wb")) == NULL) {
-#endif
-        // Исключили диагностические сообщения, выводимые функцией fprintf. 
-        return false;  // При ошибке вместо вызова exit верните false.
-    }
-
-    jpeg_stdio_dest(&cinfo, outfile);
-
-    // Шаг 3. Устанавливаем параметры изображения
-
-    cinfo.image_width = image.GetWidth();  /* image width and height, in pixels */
-    cinfo.image_height = image.GetHeight();
-    cinfo.input_components = 3;       /* # of color components per pixel */
-    cinfo.in_color_space = JCS_RGB;   /* colorspace of input image */
-    
-    // Устанавливаем параметры по умолчанию
-    jpeg_set_defaults(&cinfo);
-    
-    /* Далее можно было бы установить специальные параметры, в частности, качество изображения
-    // Убрали установку качества изображения, будет использоваться качество по умолчанию
+template Image LoadJPEGAs<Color>(const Path& file);
+template RGBImage LoadJPEGAs<RGB24>(const Path& file);
+template GrayImage LoadJPEGAs<Gray8>(const Path& file);
 
-    /* Шаг 4. Запуск сжатия */
+template <typename Pixel>
+BasicImage<Pixel> LoadJPEGAs(ByteSpan data) {
+    return LoadJPEGImpl<Pixel>(data);
+}
 
-    /* TRUE ensures that we will write a complete interchange-JPEG file.
-    * Pass TRUE unless you are very sure of what you're doing.
-    */
-    jpeg_start_compress(&cinfo, TRUE);
+template Image LoadJPEGAs<Color>(ByteSpan data);
+template RGBImage LoadJPEGAs<RGB24>(ByteSpan data);
+template GrayImage LoadJPEGAs<Gray8>(ByteSpan data);
 
-    /* Шаг 5: построчная запись while (scan lines remain to be written) */
-    /*           jpeg_write_scanlines(...); */
+img_lib::Image LoadJPEG(const Path& file) {
+    return LoadJPEGImpl<Color>(file);
+}
 
-    
-    row_stride = cinfo.image_width * 3; /* JSAMPLEs per row in image_buffer */
+img_lib::Image LoadJPEG(const Path& file, const JpegLoadOptions& options) {
+    return LoadJPEGWithOptions(file, options);
+}
 
-    // Построчный цикл
-    // статическая переменная cinfo.next_scanline используется как счетчик
-    while (cinfo.next_scanline < cinfo.image_height) {
-    // из изображения записываем строку в буфер попиксельно, 
-    // а из буфера затем разом в jpeg-объект 
-    int y = cinfo.next_scanline;
-    std::vector<JSAMPLE> image_buffer(row_stride);
-    SaveImageLineToJPEGRow(image, y, &image_buffer[0]); 
+img_lib::Image LoadJPEG(ByteSpan data) {
+    return LoadJPEGImpl<Color>(data);
+}
 
-    row_pointer[0] = & image_buffer[0];  /* было [cinfo.next_scanline * row_stride */;
-    (void) jpeg_write_scanlines(&cinfo, row_pointer, 1);
+img_lib::Image LoadJPEG(ByteSpan data, const JpegLoadOptions& options) {
+    return LoadJPEGWithOptions(data, options);
+}
+
+
+// Color перепаковывается построчно, а RGB24 и Gray8 передаются кодировщику напрямую.
+// output - путь к файлу или ByteBuffer
+template <typename Pixel, typename Output>
+static bool SaveJPEGImpl(Output& output, BasicImageView<const Pixel> image, const JpegSaveOptions& options = {}) {
+    JpegSink sink;
+    if (!sink.Open(output, {image.GetWidth(), image.GetHeight()},
+                   std::is_same_v<Pixel, Gray8> ? JCS_GRAYSCALE : JCS_RGB, options)) {
+        return false;
     }
 
-    /* Шаг 6: Завершение записи/сжатия */
+    if constexpr (std::is_same_v<Pixel, Color>) {
+        return WriteImage(image, sink);
+    } else {
+        for (int y = 0; y < image.GetHeight(); ++y) {
+            if (!sink.WriteRawRow(reinterpret_cast<const JSAMPLE*>(image.GetLine(y)))) {
+                return false;
+            }
+        }
+        return sink.Finish();
+    }
+}
 
-    jpeg_finish_compress(&cinfo);
-    /* After finish_compress, we can close the output file. */
-    fclose(outfile);
+template <typename Output>
+static bool SaveJPEGWithOptions(Output& output, ImageView image, const JpegSaveOptions& options) {
+    const size_t threads = options.threads == 0 ? GetDefaultThreadCount() : options.threads;
+    // полосы склеиваются в один baseline-скан с общими таблицами Хаффмана
+    if (threads <= 1 || options.progressive || options.optimize_coding
+        || image.GetHeight() <= GetJpegStripRows(image.GetHeight(), threads)) {
+        return SaveJPEGImpl(output, image, options);
+    }
+    return SaveJPEGStrips(output, image, options, threads);
+}
 
-    /* Шаг 7: освобождаем память (release JPEG compression object) */
-    jpeg_destroy_compress(&cinfo);
+bool SaveJPEG(const Path& file, ImageView image) {
+    return SaveJPEGImpl(file, image);
+}
+
+bool SaveJPEG(const Path& file, ImageView image, const JpegSaveOptions& options) {
+    return SaveJPEGWithOptions(file, image, options);
+}
+
+bool SaveJPEG(const Path& file, RGBImageView image) {
+    return SaveJPEGImpl(file, image);
+}
+
+bool SaveJPEG(const Path& file, GrayImageView image) {
+    return SaveJPEGImpl(file, image);
+}
+
+bool SaveJPEG(ByteBuffer& out, ImageView image) {
+    return SaveJPEGImpl(out, image);
+}
+
+bool SaveJPEG(ByteBuffer& out, ImageView image, const JpegSaveOptions& options) {
+    return SaveJPEGWithOptions(out, image, options);
+}
+
+bool SaveJPEG(ByteBuffer& out, RGBImageView image) {
+    return SaveJPEGImpl(out, image);
+}
+
+bool SaveJPEG(ByteBuffer& out, GrayImageView image) {
+    return SaveJPEGImpl(out, image);
+}
+
+// ---------- преобразования без перекодирования ----------
+//
+// Коэффициенты DCT каждого блока 8x8 переставляются так же, как пиксели при повороте:
+// транспонирование блока транспонирует матрицу коэффициентов, а отражение блока меняет
+// знак нечётных частот по отражаемой оси. Сами блоки переставляются внутри компоненты.
+// Поворот на 90 - транспонирование и отражение слева направо, на 270 - транспонирование
+// и отражение сверху вниз. Пиксели не декодируются, поэтому качество не теряется
 
-    /* And we're done! */
-    // В случае успеха возвратите true
-    return true; 
+// Преобразование одного файла. Как и в JpegSource, состояние libjpeg хранится в полях,
+// чтобы после longjmp объекты оставались в известном состоянии и освобождались деструктором
+class JpegTransformer {
+public:
+    ~JpegTransformer() {
+        if (dst_created_) {
+            jpeg_destroy_compress(&dst_);
+        }
+        if (src_created_) {
+            jpeg_destroy_decompress(&src_);
+        }
+        free(mem_buffer_);
+    }
+
+    bool Run(const Path& in_file, const Path& out_file, const JpegTransformOptions& options) {
+        {
+            ScopedStageTimer timer(Stage::OPEN);
+            // иначе файл был бы перезаписан раньше, чем прочитан
+            std::error_code ec;
+            if (std::filesystem::equivalent(in_file, out_file, ec) || !infile_.Open(in_file)) {
+                return false;
+            }
+            from_file_ = true;
+        }
+        if (!Transform(options)) {
+            return false;
+        }
+        // файл создаётся только после того, как вход прочитан без ошибок
+        if (!outfile_.Open(out_file)) {
+            return false;
+        }
+        to_file_ = true;
+        return Write(options) && outfile_.Close();
+    }
+
+    bool Run(ByteSpan in, ByteBuffer& out, const JpegTransformOptions& options) {
+        data_ = in;
+        if (!Transform(options) || !Write(options)) {
+            return false;
+        }
+        const std::byte* data = reinterpret_cast<const std::byte*>(mem_buffer_);
+        out.assign(data, data + mem_size_);
+        return true;
+    }
+
+private:
+    // Читает коэффициенты и переставляет их в массивы dst_coefs_
+    bool Transform(const JpegTransformOptions& options) {
+        src_.err = jpeg_std_error(&jerr_.pub);
+        jerr_.pub.error_exit = my_error_exit;
+
+        if (setjmp(jerr_.setjmp_buffer)) {
+            return false;
+        }
+
+        {
+            ScopedStageTimer timer(Stage::HEADER);
+            jpeg_create_decompress(&src_);
+            src_created_ = true;
+
+            if (from_file_) {
+                SetFileSource(src_, file_source_, infile_);
+            } else {
+                jpeg_mem_src(&src_, reinterpret_cast<const unsigned char*>(data_.data), data_.size);
+            }
+
+            if (options.copy_markers) {
+                jpeg_save_markers(&src_, JPEG_COM, 0xFFFF);
+                for (int i = 0; i < 16; ++i) {
+                    jpeg_save_markers(&src_, JPEG_APP0 + i, 0xFFFF);
+                }
+            }
+            (void) jpeg_read_header(&src_, TRUE);
+
+            if (!SetupGeometry(options)) {
+                return false;
+            }
+            RequestDestinationArrays();
+        }
+
+        {
+            ScopedStageTimer timer(Stage::DECODE);
+            src_coefs_ = jpeg_read_coefficients(&src_);
+        }
+
+        ScopedStageTimer timer(Stage::CONVERT);
+        if (!dst_coefs_) {
+            dst_coefs_ = src_coefs_;
+            return true;
+        }
+        for (int ci = 0; ci < src_.num_components; ++ci) {
+            TransformComponent(ci);
+        }
+        return true;
+    }
+
+    // Вычисляет обрезку и размер результата в пикселях исходного изображения.
+    // false - если область пуста или неполные MCU нельзя отбросить
+    bool SetupGeometry(const JpegTransformOptions& options) {
+        switch (options.transform) {
+            case JpegTransform::FLIP_H:
+                mirror_x_ = true;
+                break;
+            case JpegTransform::FLIP_V:
+                mirror_y_ = true;
+                break;
+            case JpegTransform::ROTATE_90:
+                transpose_ = mirror_x_ = true;
+                break;
+            case JpegTransform::ROTATE_180:
+                mirror_x_ = mirror_y_ = true;
+                break;
+            case JpegTransform::ROTATE_270:
+                transpose_ = mirror_y_ = true;
+                break;
+            case JpegTransform::TRANSPOSE:
+                transpose_ = true;
+                break;
+            case JpegTransform::TRANSVERSE:
+                transpose_ = mirror_x_ = mirror_y_ = true;
+                break;
+            default:
+                break;
+        }
+
+        const int width = static_cast<int>(src_.image_width);
+        const int height = static_cast<int>(src_.image_height);
+        mcu_width_ = src_.max_h_samp_factor * DCTSIZE;
+        mcu_height_ = src_.max_v_samp_factor * DCTSIZE;
+
+        crop_width_ = width;
+        crop_height_ = height;
+        if (options.crop_size) {
+            const Size crop = *options.crop_size;
+            if (crop.width <= 0 || crop.height <= 0 || options.crop_x < 0 || options.crop_y < 0
+                || options.crop_x >= width || options.crop_y >= height) {
+                return false;
+            }
+            crop_x_ = options.crop_x / mcu_width_ * mcu_width_;
+            crop_y_ = options.crop_y / mcu_height_ * mcu_height_;
+            crop_width_ = static_cast<int>(std::min<int64_t>(int64_t{options.crop_x} + crop.width, width)) - crop_x_;
+            crop_height_ = static_cast<int>(std::min<int64_t>(int64_t{options.crop_y} + crop.height, height)) - crop_y_;
+        }
+
+        // отражаемая ось результата - какая ось исходного изображения
+        const bool align_x = transpose_ ? mirror_y_ : mirror_x_;
+        const bool align_y = transpose_ ? mirror_x_ : mirror_y_;
+        if ((align_x && crop_width_ % mcu_width_ != 0) || (align_y && crop_height_ % mcu_height_ != 0)) {
+            if (!options.trim) {
+                return false;
+            }
+            if (align_x) {
+                crop_width_ -= crop_width_ % mcu_width_;
+            }
+            if (align_y) {
+                crop_height_ -= crop_height_ % mcu_height_;
+            }
+        }
+        return crop_width_ > 0 && crop_height_ > 0;
+    }
+
+    // Массивы результата запрашиваются у декодера до jpeg_read_coefficients,
+    // который выделяет память под все виртуальные массивы сразу
+    void RequestDestinationArrays() {
+        const bool crop = crop_x_ != 0 || crop_y_ != 0 || crop_width_ != static_cast<int>(src_.image_width)
+                          || crop_height_ != static_cast<int>(src_.image_height);
+        if (!transpose_ && !mirror_x_ && !mirror_y_ && !crop) {
+            return;
+        }
+
+        dst_coefs_ = static_cast<jvirt_barray_ptr*>((*src_.mem->alloc_small)(
+            reinterpret_cast<j_common_ptr>(&src_), JPOOL_IMAGE, sizeof(jvirt_barray_ptr) * src_.num_components));
+        for (int ci = 0; ci < src_.num_components; ++ci) {
+            const jpeg_component_info& comp = src_.comp_info[ci];
+            // множители компоненты в результате; при транспонировании меняются местами
+            const int h = transpose_ ? comp.v_samp_factor : comp.h_samp_factor;
+            const int v = transpose_ ? comp.h_samp_factor : comp.v_samp_factor;
+            const JDIMENSION width = static_cast<JDIMENSION>(GetDestinationBlocks(ci, true));
+            const JDIMENSION height = static_cast<JDIMENSION>(GetDestinationBlocks(ci, false));
+            // блоки за краем изображения остаются нулевыми
+            dst_coefs_[ci] = (*src_.mem->request_virt_barray)(
+                reinterpret_cast<j_common_ptr>(&src_), JPOOL_IMAGE, TRUE,
+                (width + h - 1) / h * h, (height + v - 1) / v * v, static_cast<JDIMENSION>(v));
+        }
+    }
+
+    // Ширина (horizontal) или высота компоненты ci результата в блоках,
+    // как её вычислит кодировщик по размеру изображения
+    int GetDestinationBlocks(int ci, bool horizontal) const {
+        const jpeg_component_info& comp = src_.comp_info[ci];
+        // ось исходного изображения, которая станет этой осью результата
+        const bool source_x = horizontal != transpose_;
+        const int64_t pixels = source_x ? crop_width_ : crop_height_;
+        const int64_t factor = source_x ? comp.h_samp_factor : comp.v_samp_factor;
+        const int64_t mcu = source_x ? mcu_width_ : mcu_height_;
+        return static_cast<int>((pixels * factor + mcu - 1) / mcu);
+    }
+
+    void TransformComponent(int ci) {
+        const jpeg_component_info& comp = src_.comp_info[ci];
+        const int v = transpose_ ? comp.h_samp_factor : comp.v_samp_factor;
+        const int width = GetDestinationBlocks(ci, true);
+        const int height = GetDestinationBlocks(ci, false);
+        // левый верхний блок обрезки в исходной компоненте
+        const int offset_x = crop_x_ / mcu_width_ * comp.h_samp_factor;
+        const int offset_y = crop_y_ / mcu_height_ * comp.v_samp_factor;
+        const int src_width = static_cast<int>(comp.width_in_blocks);
+        const int src_height = static_cast<int>(comp.height_in_blocks);
+        const j_common_ptr common = reinterpret_cast<j_common_ptr>(&src_);
+
+        // строки результата обрабатываются группами по v, как их потом прочитает кодировщик
+        for (int y0 = 0; y0 < height; y0 += v) {
+            const JBLOCKARRAY dst_rows = (*src_.mem->access_virt_barray)(
+                common, dst_coefs_[ci], static_cast<JDIMENSION>(y0), static_cast<JDIMENSION>(v), TRUE);
+            const int rows = std::min(v, height - y0);
+
+            if (!transpose_) {
+                for (int dy = 0; dy < rows; ++dy) {
+                    const int src_y = offset_y + (mirror_y_ ? height - 1 - (y0 + dy) : y0 + dy);
+                    if (src_y >= src_height) {
+                        continue;
+                    }
+                    const JBLOCKROW src_row = (*src_.mem->access_virt_barray)(
+                        common, src_coefs_[ci], static_cast<JDIMENSION>(src_y), 1, FALSE)[0];
+                    for (int x = 0; x < width; ++x) {
+                        const int src_x = offset_x + (mirror_x_ ? width - 1 - x : x);
+                        if (src_x < src_width) {
+                            TransformBlock(src_row[src_x], dst_rows[dy][x]);
+                        }
+                    }
+                }
+                continue;
+            }
+
+            // столбец результата - строка исходной компоненты: берём её один раз на всю группу
+            for (int x = 0; x < width; ++x) {
+                const int src_y = offset_y + (mirror_x_ ? width - 1 - x : x);
+                if (src_y >= src_height) {
+                    continue;
+                }
+                const JBLOCKROW src_row = (*src_.mem->access_virt_barray)(
+                    common, src_coefs_[ci], static_cast<JDIMENSION>(src_y), 1, FALSE)[0];
+                for (int dy = 0; dy < rows; ++dy) {
+                    const int src_x = offset_x + (mirror_y_ ? height - 1 - (y0 + dy) : y0 + dy);
+                    if (src_x < src_width) {
+                        TransformBlock(src_row[src_x], dst_rows[dy][x]);
+                    }
+                }
+            }
+        }
+    }
+
+    // Коэффициенты хранятся построчно в естественном порядке: [строка * 8 + столбец].
+    // Отражение слева направо меняет знак нечётных столбцов, сверху вниз - нечётных строк
+    void TransformBlock(const JBLOCK& in, JBLOCK& out) const {
+        for (int row = 0; row < DCTSIZE; ++row) {
+            for (int col = 0; col < DCTSIZE; ++col) {
+                const JCOEF value = transpose_ ? in[col * DCTSIZE + row] : in[row * DCTSIZE + col];
+                const bool negate = (mirror_x_ && (col & 1)) != (mirror_y_ && (row & 1));
+                out[row * DCTSIZE + col] = negate ? static_cast<JCOEF>(-value) : value;
+            }
+        }
+    }
+
+    // Сжимает переставленные коэффициенты в уже открытый файл или в память
+    bool Write(const JpegTransformOptions& options) {
+        ScopedStageTimer timer(Stage::ENCODE);
+
+        if (setjmp(jerr_.setjmp_buffer)) {
+            return false;
+        }
+
+        dst_.err = &jerr_.pub;
+        jpeg_create_compress(&dst_);
+        dst_created_ = true;
+
+        if (to_file_) {
+            SetFileDestination(dst_, file_dest_, outfile_);
+        } else {
+            jpeg_mem_dest(&dst_, &mem_buffer_, &mem_size_);
+        }
+
+        // таблицы квантования, компоненты и их множители берутся из исходного файла
+        jpeg_copy_critical_parameters(&src_, &dst_);
+        dst_.image_width = static_cast<JDIMENSION>(transpose_ ? crop_height_ : crop_width_);
+        dst_.image_height = static_cast<JDIMENSION>(transpose_ ? crop_width_ : crop_height_);
+        if (transpose_) {
+            for (int ci = 0; ci < dst_.num_components; ++ci) {
+                jpeg_component_info& comp = dst_.comp_info[ci];
+                std::swap(comp.h_samp_factor, comp.v_samp_factor);
+            }
+            for (JQUANT_TBL* table : dst_.quant_tbl_ptrs) {
+                if (!table) {
+                    continue;
+                }
+                for (int row = 0; row < DCTSIZE; ++row) {
+                    for (int col = row + 1; col < DCTSIZE; ++col) {
+                        std::swap(table->quantval[row * DCTSIZE + col], table->quantval[col * DCTSIZE + row]);
+                    }
+                }
+            }
+            std::swap(dst_.X_density, dst_.Y_density);
+        }
+
+        dst_.restart_in_rows = options.restart_rows;
+        dst_.optimize_coding = options.optimize_coding ? TRUE : FALSE;
+        if (options.progressive) {
+            jpeg_simple_progression(&dst_);
+        }
+
+        jpeg_write_coefficients(&dst_, dst_coefs_);
+
+        // маркеры JFIF и Adobe libjpeg уже записал сам, остальные копируются как есть
+        for (jpeg_saved_marker_ptr marker = src_.marker_list; marker; marker = marker->next) {
+            if (dst_.write_JFIF_header && marker->marker == JPEG_APP0 && marker->data_length >= 5
+                && std::memcmp(marker->data, "JFIF", 5) == 0) {
+                continue;
+            }
+            if (dst_.write_Adobe_marker && marker->marker == JPEG_APP0 + 14 && marker->data_length >= 5
+                && std::memcmp(marker->data, "Adobe", 5) == 0) {
+                continue;
+            }
+            jpeg_write_marker(&dst_, marker->marker, marker->data, marker->data_length);
+        }
+
+        jpeg_finish_compress(&dst_);
+        (void) jpeg_finish_decompress(&src_);
+        return true;
+    }
+
+    jpeg_decompress_struct src_;
+    jpeg_compress_struct dst_;
+    // одна точка возврата на оба объекта: ошибка в любом прерывает всё преобразование
+    my_error_mgr jerr_;
+    bool src_created_ = false;
+    bool dst_created_ = false;
+
+    ReadAheadFile infile_;
+    JpegFileSource file_source_;
+    bool from_file_ = false;
+    ByteSpan data_;
+
+    WriteBehindFile outfile_;
+    JpegFileDestination file_dest_;
+    bool to_file_ = false;
+    unsigned char* mem_buffer_ = nullptr;
+    unsigned long mem_size_ = 0;
+
+    bool transpose_ = false;
+    bool mirror_x_ = false;
+    bool mirror_y_ = false;
+    int mcu_width_ = 0;
+    int mcu_height_ = 0;
+    // обрезка в пикселях исходного изображения; угол выровнен по MCU
+    int crop_x_ = 0;
+    int crop_y_ = 0;
+    int crop_width_ = 0;
+    int crop_height_ = 0;
+
+    jvirt_barray_ptr* src_coefs_ = nullptr;
+    // nullptr, если коэффициенты переносятся без изменений
+    jvirt_barray_ptr* dst_coefs_ = nullptr;
+};
+
+bool TransformJPEG(const Path& in_file, const Path& out_file, const JpegTransformOptions& options) {
+    JpegTransformer transformer;
+    return transformer.Run(in_file, out_file, options);
 }
 
+bool TransformJPEG(ByteSpan in, ByteBuffer& out, const JpegTransformOptions& options) {
+    JpegTransformer transformer;
+    return transformer.Run(in, out, options);
+}
 
 }  // namespace img_lib
\ No newline at end of file
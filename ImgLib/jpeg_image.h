@@ -1,12 +1,169 @@
 #pragma once
 #include "img_lib.h"
+#include "orientation.h"
+#include "scanline.h"
 
 #include <filesystem>
+#include <memory>
+#include <optional>
 
 namespace img_lib {
 
+// Метод DCT. ISLOW - точный целочисленный, как в libjpeg по умолчанию;
+// IFAST быстрее, но теряет точность на высоком качестве; FLOAT точен,
+// а его скорость зависит от процессора
+enum class JpegDctMethod {
+    ISLOW,
+    IFAST,
+    FLOAT
+};
+
+// Прореживание цветности при сжатии: 4:4:4 - без прореживания,
+// 4:2:2 - вдвое по горизонтали, 4:2:0 - вдвое по обеим осям
+enum class JpegSubsampling {
+    S444,
+    S422,
+    S420
+};
+
+struct JpegLoadOptions {
+    // Если задано, изображение уменьшается, чтобы вписаться в max_size.
+    // Основную часть уменьшения делает сам декодер (масштабирование в IDCT
+    // с коэффициентом M/8), остаток доводится билинейным масштабированием
+    std::optional<Size> max_size;
+
+    // Потоков на декодирование (0 - по числу ядер). Параллельно декодируются файлы,
+    // в которых маркеры RST стоят на границах строк MCU: участки между ними
+    // независимы. Остальные файлы декодируются последовательно
+    size_t threads = 1;
+
+    JpegDctMethod dct_method = JpegDctMethod::ISLOW;
+    // Сглаживающая интерполяция прореженной цветности. Без неё цветность
+    // просто повторяется - быстрее, но на цветных границах заметны ступеньки
+    bool fancy_upsampling = true;
+    // сглаживание блоков прогрессивного файла, пока загружены не все его сканы
+    bool block_smoothing = true;
+    // Повернуть изображение по тегу EXIF Orientation (GetJPEGOrientation). max_size относится
+    // к повёрнутому изображению. Учитывается загрузкой целиком, но не OpenJPEGSource
+    bool auto_orient = false;
+};
+
+struct JpegSaveOptions {
+    // Потоков на кодирование (0 - по числу ядер). При нескольких потоках изображение
+    // сжимается полосами с маркером RST после каждой строки MCU, и полосы
+    // склеиваются в один обычный baseline JPEG. Прогрессивный файл и файл
+    // с оптимизированными таблицами Хаффмана сжимаются в одном потоке
+    size_t threads = 1;
+
+    // качество от 1 до 100, как у jpeg_set_quality
+    int quality = 75;
+    JpegDctMethod dct_method = JpegDctMethod::ISLOW;
+    // Таблицы Хаффмана строятся под изображение: файл меньше на несколько процентов
+    // без потери качества, но сжатие идёт в два прохода
+    bool optimize_coding = false;
+    // Прогрессивный файл обычно меньше baseline. Вместе с optimize_coding
+    // заставляет libjpeg держать в памяти коэффициенты всего изображения
+    bool progressive = false;
+    JpegSubsampling subsampling = JpegSubsampling::S420;
+    // маркер RST через каждые restart_rows строк MCU, 0 - без маркеров
+    int restart_rows = 0;
+};
+
+// Готовые наборы параметров. FAST - для превью: быстрый DCT, без интерполяции
+// цветности и сглаживания блоков. BALANCED - параметры libjpeg по умолчанию,
+// они же значения структур выше. SMALL - для архива: то же качество, но
+// оптимизированные таблицы Хаффмана и прогрессивный файл
+enum class JpegPreset {
+    FAST,
+    BALANCED,
+    SMALL
+};
+
+// threads и max_size остаются по умолчанию
+JpegLoadOptions GetJpegLoadPreset(JpegPreset preset);
+JpegSaveOptions GetJpegSavePreset(JpegPreset preset);
+
+// Преобразования JPEG без перекодирования, см. TransformJPEG - те же, что у TransformImage
+using JpegTransform = ImageTransform;
+
+struct JpegTransformOptions {
+    JpegTransform transform = JpegTransform::NONE;
+
+    // Если задано, из исходного изображения вырезается область crop_size с левым верхним
+    // углом (crop_x, crop_y), и преобразуется уже она. Угол сдвигается влево и вверх
+    // до границы MCU, а область расширяется на столько же; выходящее за изображение отбрасывается
+    std::optional<Size> crop_size;
+    int crop_x = 0;
+    int crop_y = 0;
+
+    // Отражаемая сторона должна состоять из целых MCU. Если trim, неполные MCU у её края
+    // отбрасываются, как в jpegtran -trim; иначе такое преобразование не выполняется
+    bool trim = true;
+    // копировать маркеры APPn и COM: EXIF, ICC-профиль, комментарии
+    bool copy_markers = true;
+
+    // параметры записи - как в JpegSaveOptions
+    int restart_rows = 0;
+    bool optimize_coding = false;
+    bool progressive = false;
+};
+
 Image LoadJPEG(const Path& file);
+Image LoadJPEG(const Path& file, const JpegLoadOptions& options);
+
+// Преобразование из тега EXIF Orientation, которое приводит изображение к правильному виду.
+// Читаются только сегменты до начала кадра. NONE - если EXIF нет или ориентация обычная
+ImageTransform GetJPEGOrientation(const Path& file);
+ImageTransform GetJPEGOrientation(ByteSpan data);
+
+bool SaveJPEG(const Path& file, ImageView image);
+bool SaveJPEG(const Path& file, ImageView image, const JpegSaveOptions& options);
+
+// Загружает изображение сразу в заданный формат пикселей: Color, RGB24 или Gray8.
+// Для RGB24 и Gray8 libjpeg декодирует прямо в строки изображения,
+// а Gray8 к тому же избавляет декодер от преобразования цвета
+template <typename Pixel>
+BasicImage<Pixel> LoadJPEGAs(const Path& file);
+
+// RGB24 сохраняется без перепаковки строк, Gray8 - как одноканальный JPEG
+bool SaveJPEG(const Path& file, RGBImageView image);
+bool SaveJPEG(const Path& file, GrayImageView image);
+
+// Построчное чтение и запись JPEG: строки идут прямо из jpeg_read_scanlines
+// и прямо в jpeg_write_scanlines. При ошибке возвращается nullptr
+std::unique_ptr<ScanlineSource> OpenJPEGSource(const Path& file);
+// Источник отдаёт строки уже уменьшенного декодером изображения: его размер
+// не меньше FitWithin(исходный размер, max_size), но может его превышать
+std::unique_ptr<ScanlineSource> OpenJPEGSource(const Path& file, const JpegLoadOptions& options);
+std::unique_ptr<ScanlineSink> CreateJPEGSink(const Path& file, Size size);
+// threads не учитывается: построчная запись идёт в одном потоке
+std::unique_ptr<ScanlineSink> CreateJPEGSink(const Path& file, Size size, const JpegSaveOptions& options);
+
+// Читает только сегменты до начала скана, пропуская APPn и COM, и разбирает их
+// jpeg_read_header. Размер - тот же, что у OpenJPEGSource с этими options: с учётом
+// масштаба IDCT для max_size, без поворота по EXIF. nullopt - если заголовок не читается
+std::optional<ImageInfo> ProbeJPEG(const Path& file, const JpegLoadOptions& options = {});
+// Оценка памяти кодировщика изображения size вместе с буферами файла. Прогрессивный файл
+// и оптимизированные таблицы Хаффмана требуют коэффициентов всего изображения
+uint64_t EstimateJPEGSaveMemory(Size size, const JpegSaveOptions& options = {});
+
+// Чтение и запись JPEG в памяти через jpeg_mem_src и jpeg_mem_dest - без временных файлов.
+// data - содержимое файла, out получает содержимое файла целиком; прежнее содержимое out заменяется
+Image LoadJPEG(ByteSpan data);
+Image LoadJPEG(ByteSpan data, const JpegLoadOptions& options);
+template <typename Pixel>
+BasicImage<Pixel> LoadJPEGAs(ByteSpan data);
+
+bool SaveJPEG(ByteBuffer& out, ImageView image);
+bool SaveJPEG(ByteBuffer& out, ImageView image, const JpegSaveOptions& options);
+bool SaveJPEG(ByteBuffer& out, RGBImageView image);
+bool SaveJPEG(ByteBuffer& out, GrayImageView image);
 
-bool SaveJPEG(const Path& file, const Image& image);
+// Поворачивает, отражает и обрезает JPEG прямо на квантованных коэффициентах DCT
+// (jpeg_read_coefficients и jpeg_write_coefficients), без декодирования и повторного
+// сжатия: на порядок быстрее и без потери качества. false - если файл не читается
+// или преобразование невыполнимо без trim. Входной и выходной файлы должны различаться
+bool TransformJPEG(const Path& in_file, const Path& out_file, const JpegTransformOptions& options);
+bool TransformJPEG(ByteSpan in, ByteBuffer& out, const JpegTransformOptions& options);
 
 } // of namespace img_lib
\ No newline at end of file
@@ -0,0 +1,178 @@
+#include "mapped_file.h"
+#include "pixel_format.h"
+#include "stats.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define IMGLIB_HAS_MMAP 1
+#endif
+
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace img_lib {
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : data_(std::exchange(other.data_, nullptr))
+    , size_(std::exchange(other.size_, 0)) {
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        Close();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+}
+
+#ifdef IMGLIB_HAS_MMAP
+
+bool MappedFile::Open(const Path& file, bool sequential) {
+    ScopedStageTimer timer(Stage::OPEN);
+    Close();
+
+    const int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void* addr = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    // после отображения дескриптор больше не нужен
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    if (sequential) {
+        ::madvise(addr, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+    }
+
+    data_ = static_cast<const std::byte*>(addr);
+    size_ = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+void MappedFile::Close() {
+    if (data_) {
+        ::munmap(const_cast<std::byte*>(data_), size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
+
+#else
+
+bool MappedFile::Open(const Path&, bool) {
+    return false;
+}
+
+void MappedFile::Close() {
+    data_ = nullptr;
+    size_ = 0;
+}
+
+#endif
+
+
+void UnpackRow(const std::byte* src, ChannelOrder order, Color* dst, int count) {
+    switch (order) {
+        case ChannelOrder::RGB:
+            UnpackRGB(src, dst, count);
+            break;
+        case ChannelOrder::BGR:
+            UnpackBGR(src, dst, count);
+            break;
+        case ChannelOrder::RGBA:
+            std::memcpy(dst, src, sizeof(Color) * count);
+            break;
+        case ChannelOrder::BGRA:
+            UnpackBGRA(src, dst, count);
+            break;
+        case ChannelOrder::RGBX:
+            UnpackRGBX(src, dst, count);
+            break;
+        case ChannelOrder::BGRX:
+            UnpackBGRX(src, dst, count);
+            break;
+    }
+}
+
+template <typename Pixel>
+BasicImage<Pixel> UnpackRowsAs(const PackedRowsView& view) {
+    ScopedStageTimer timer(Stage::CONVERT);
+    BasicImage<Pixel> result(view.size.width, view.size.height);
+    const int width = view.size.width;
+
+    // строки RGBA, лежащие подряд с тем же шагом, что и в изображении, копируются одним блоком
+    if constexpr (std::is_same_v<Pixel, Color>) {
+        if (view.order == ChannelOrder::RGBA && result
+            && view.row_step == static_cast<std::ptrdiff_t>(result.GetStep() * sizeof(Color))) {
+            std::memcpy(result.GetLine(0), view.top_row, view.row_step * view.size.height);
+            return result;
+        }
+    }
+
+    // RGB и RGBA переводятся в любой формат напрямую, остальные порядки
+    // в форматы, отличные от Color, - через промежуточную строку Color
+    std::vector<Color> row_buffer;
+    const bool direct = std::is_same_v<Pixel, Color> || view.order == ChannelOrder::RGB
+                        || view.order == ChannelOrder::RGBA;
+    if (!direct) {
+        row_buffer.resize(width);
+    }
+
+    for (int y = 0; y < view.size.height; ++y) {
+        const std::byte* row = view.GetRow(y);
+        Pixel* line = result.GetLine(y);
+
+        if constexpr (std::is_same_v<Pixel, Color>) {
+            UnpackRow(row, view.order, line, width);
+        } else if (view.order == ChannelOrder::RGB) {
+            ConvertRow(reinterpret_cast<const RGB24*>(row), line, width);
+        } else if (view.order == ChannelOrder::RGBA) {
+            ConvertRow(reinterpret_cast<const Color*>(row), line, width);
+        } else {
+            UnpackRow(row, view.order, row_buffer.data(), width);
+            ConvertRow(row_buffer.data(), line, width);
+        }
+    }
+
+    return result;
+}
+
+template BasicImage<Color> UnpackRowsAs<Color>(const PackedRowsView& view);
+template BasicImage<RGB24> UnpackRowsAs<RGB24>(const PackedRowsView& view);
+template BasicImage<Gray8> UnpackRowsAs<Gray8>(const PackedRowsView& view);
+
+template <typename Pixel>
+BasicImage<Pixel> MappedImage::ToImageAs() const {
+    // страницы отображения подгружаются при первом обращении, то есть при распаковке
+    AddCounter(Counter::BYTES_READ, file_.GetSize());
+    return UnpackRowsAs<Pixel>(view_);
+}
+
+template BasicImage<Color> MappedImage::ToImageAs<Color>() const;
+template BasicImage<RGB24> MappedImage::ToImageAs<RGB24>() const;
+template BasicImage<Gray8> MappedImage::ToImageAs<Gray8>() const;
+
+Image MappedImage::ToImage() const {
+    return ToImageAs<Color>();
+}
+
+}  // namespace img_lib
\ No newline at end of file
@@ -0,0 +1,105 @@
+#pragma once
+#include "img_lib.h"
+
+#include <cstddef>
+
+namespace img_lib {
+
+// Файл, целиком отображённый в память только для чтения.
+// Отображение поддерживается на POSIX-системах (mmap); на остальных
+// Open всегда возвращает false, и загрузчики читают файл через потоки
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    // Отображает файл в память. Пустые файлы не отображаются.
+    // sequential подсказывает ядру, что файл будет читаться подряд
+    bool Open(const Path& file, bool sequential = true);
+    void Close();
+
+    const std::byte* GetData() const {
+        return data_;
+    }
+    size_t GetSize() const {
+        return size_;
+    }
+
+    explicit operator bool() const {
+        return data_ != nullptr;
+    }
+
+private:
+    const std::byte* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+
+// порядок каналов в упакованной строке: 3 или 4 байта на пиксель.
+// X - байт без значения, пиксели с ним считаются непрозрачными
+enum class ChannelOrder {
+    RGB,
+    BGR,
+    RGBA,
+    BGRA,
+    RGBX,
+    BGRX
+};
+
+inline int GetPixelBytes(ChannelOrder order) {
+    return order == ChannelOrder::RGB || order == ChannelOrder::BGR ? 3 : 4;
+}
+
+// распаковывает строку из count пикселей в заданном порядке каналов
+void UnpackRow(const std::byte* src, ChannelOrder order, Color* dst, int count);
+
+// Представление пикселей файла без копирования: строки по 3 или 4 байта на пиксель.
+// Шаг строк может быть отрицательным - так описываются BMP, хранящиеся снизу вверх
+struct PackedRowsView {
+    const std::byte* top_row = nullptr;
+    std::ptrdiff_t row_step = 0;
+    Size size = {0, 0};
+    ChannelOrder order = ChannelOrder::RGB;
+
+    // строка y, считая сверху
+    const std::byte* GetRow(int y) const {
+        return top_row + row_step * y;
+    }
+};
+
+// распаковывает строки представления в изображение заданного формата (Color, RGB24 или Gray8)
+template <typename Pixel>
+BasicImage<Pixel> UnpackRowsAs(const PackedRowsView& view);
+
+// Отображённый в память файл изображения вместе с описанием его пикселей.
+// Представление действительно, пока жив объект
+class MappedImage {
+public:
+    MappedImage(MappedFile file, PackedRowsView view)
+        : file_(std::move(file))
+        , view_(view) {
+    }
+
+    const PackedRowsView& GetView() const {
+        return view_;
+    }
+
+    // распаковывает пиксели в новое изображение с непрозрачным альфа-каналом
+    Image ToImage() const;
+
+    // распаковывает пиксели в изображение заданного формата (Color, RGB24 или Gray8)
+    template <typename Pixel>
+    BasicImage<Pixel> ToImageAs() const;
+
+private:
+    MappedFile file_;
+    PackedRowsView view_;
+};
+
+}  // namespace img_lib
\ No newline at end of file
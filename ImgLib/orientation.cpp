@@ -0,0 +1,261 @@
+#include "orientation.h"
+#include "parallel.h"
+#include "pixel_kernels.h"
+#include "simd_target.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+
+namespace img_lib {
+
+// Сторона квадратного блока: блок источника и блок результата (по 4 КБ для Color)
+// вместе лежат в кэше L1, поэтому строки результата не вытесняют друг друга
+static const int TILE = 32;
+// столько строк обрабатывает поток за один раз при отражениях
+static const int BAND_ROWS = 16;
+
+bool SwapsAxes(ImageTransform transform) {
+    return transform == ImageTransform::ROTATE_90 || transform == ImageTransform::ROTATE_270
+           || transform == ImageTransform::TRANSPOSE || transform == ImageTransform::TRANSVERSE;
+}
+
+Size GetTransformedSize(Size size, ImageTransform transform) {
+    if (SwapsAxes(transform)) {
+        std::swap(size.width, size.height);
+    }
+    return size;
+}
+
+ImageTransform GetExifOrientationTransform(int orientation) {
+    switch (orientation) {
+        case 2:
+            return ImageTransform::FLIP_H;
+        case 3:
+            return ImageTransform::ROTATE_180;
+        case 4:
+            return ImageTransform::FLIP_V;
+        case 5:
+            return ImageTransform::TRANSPOSE;
+        case 6:
+            return ImageTransform::ROTATE_90;
+        case 7:
+            return ImageTransform::TRANSVERSE;
+        case 8:
+            return ImageTransform::ROTATE_270;
+        default:
+            return ImageTransform::NONE;
+    }
+}
+
+// ---------- переносимая реализация ----------
+
+template <typename Pixel>
+static void ReverseRowScalar(const Pixel* src, Pixel* dst, int width) {
+    for (int x = 0; x < width; ++x) {
+        dst[x] = src[width - 1 - x];
+    }
+}
+
+// Заполняет блок результата w x h: пиксель (x, y) блока берётся из origin + x * row_step + y * col_step.
+// row_step - смещение соседних строк источника (со знаком), col_step - соседних столбцов, +1 или -1
+template <typename Pixel>
+static void TransposeTileScalar(const Pixel* origin, ptrdiff_t row_step, ptrdiff_t col_step,
+                                Pixel* dst, ptrdiff_t dst_step, int w, int h) {
+    for (int y = 0; y < h; ++y) {
+        const Pixel* src = origin + y * col_step;
+        Pixel* line = dst + y * dst_step;
+        for (int x = 0; x < w; ++x) {
+            line[x] = src[x * row_step];
+        }
+    }
+}
+
+#ifdef IMGLIB_X86_KERNELS
+
+// ---------- SSSE3: 4 пикселя Color за раз ----------
+
+IMGLIB_TARGET_SSSE3 static void ReverseRowSSSE3(const Color* src, Color* dst, int width) {
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + width - 4 - x));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_shuffle_epi32(pixels, 0x1B));
+    }
+    for (; x < width; ++x) {
+        dst[x] = src[width - 1 - x];
+    }
+}
+
+// То же, что TransposeTileScalar: из строк источника берутся по 4 пикселя,
+// и матрица 4x4 32-битных слов транспонируется распаковками
+template <bool ReverseColumns>
+IMGLIB_TARGET_SSSE3 static void TransposeTileSSSE3(const Color* origin, ptrdiff_t row_step,
+                                                   Color* dst, ptrdiff_t dst_step, int w, int h) {
+    const ptrdiff_t col_step = ReverseColumns ? -1 : 1;
+    int y = 0;
+    for (; y + 4 <= h; y += 4) {
+        int x = 0;
+        for (; x + 4 <= w; x += 4) {
+            __m128i v[4];
+            for (int i = 0; i < 4; ++i) {
+                const Color* src = origin + (x + i) * row_step + y * col_step;
+                if constexpr (ReverseColumns) {
+                    v[i] = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src - 3)), 0x1B);
+                } else {
+                    v[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+                }
+            }
+            const __m128i t0 = _mm_unpacklo_epi32(v[0], v[1]);
+            const __m128i t1 = _mm_unpacklo_epi32(v[2], v[3]);
+            const __m128i t2 = _mm_unpackhi_epi32(v[0], v[1]);
+            const __m128i t3 = _mm_unpackhi_epi32(v[2], v[3]);
+            Color* out = dst + y * dst_step + x;
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi64(t0, t1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + dst_step), _mm_unpackhi_epi64(t0, t1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * dst_step), _mm_unpacklo_epi64(t2, t3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 3 * dst_step), _mm_unpackhi_epi64(t2, t3));
+        }
+        // правый край блока, не кратный 4
+        TransposeTileScalar(origin + x * row_step + y * col_step, row_step, col_step,
+                            dst + y * dst_step + x, dst_step, w - x, 4);
+    }
+    TransposeTileScalar(origin + y * col_step, row_step, col_step, dst + y * dst_step, dst_step, w, h - y);
+}
+
+static bool HasSSSE3Kernels() {
+    static const bool has = GetBestKernelLevel() != KernelLevel::SCALAR;
+    return has;
+}
+
+#endif
+
+template <typename Pixel>
+static void ReverseRow(const Pixel* src, Pixel* dst, int width) {
+#ifdef IMGLIB_X86_KERNELS
+    if constexpr (std::is_same_v<Pixel, Color>) {
+        if (HasSSSE3Kernels()) {
+            ReverseRowSSSE3(src, dst, width);
+            return;
+        }
+    }
+#endif
+    ReverseRowScalar(src, dst, width);
+}
+
+template <typename Pixel>
+static void TransposeTile(const Pixel* origin, ptrdiff_t row_step, ptrdiff_t col_step,
+                          Pixel* dst, ptrdiff_t dst_step, int w, int h) {
+#ifdef IMGLIB_X86_KERNELS
+    if constexpr (std::is_same_v<Pixel, Color>) {
+        if (HasSSSE3Kernels()) {
+            if (col_step < 0) {
+                TransposeTileSSSE3<true>(origin, row_step, dst, dst_step, w, h);
+            } else {
+                TransposeTileSSSE3<false>(origin, row_step, dst, dst_step, w, h);
+            }
+            return;
+        }
+    }
+#endif
+    TransposeTileScalar(origin, row_step, col_step, dst, dst_step, w, h);
+}
+
+// ---------- преобразования целиком ----------
+
+// Отражения и поворот на 180 градусов: строка результата - строка источника,
+// возможно другая и развёрнутая
+template <typename Pixel>
+static void FlipImage(BasicImageView<const Pixel> src, BasicImage<Pixel>& dst, bool flip_h, bool flip_v,
+                      size_t threads) {
+    const int width = src.GetWidth();
+    const int height = src.GetHeight();
+    ParallelFor(0, height, BAND_ROWS, threads, [&](int from, int to) {
+        for (int y = from; y < to; ++y) {
+            const Pixel* line = src.GetLine(flip_v ? height - 1 - y : y);
+            if (flip_h) {
+                ReverseRow(line, dst.GetLine(y), width);
+            } else {
+                std::copy_n(line, width, dst.GetLine(y));
+            }
+        }
+    });
+}
+
+// Преобразования с перестановкой осей: столбец x результата - строка источника
+// (снизу вверх, если reverse_rows), строка y результата - столбец источника
+// (справа налево, если reverse_columns). Результат заполняется блоками TILE x TILE,
+// потоки берут полосы блоков
+template <typename Pixel>
+static void TransposeImage(BasicImageView<const Pixel> src, BasicImage<Pixel>& dst, bool reverse_rows,
+                           bool reverse_columns, size_t threads) {
+    const int width = dst.GetWidth();
+    const int height = dst.GetHeight();
+    const ptrdiff_t row_step = reverse_rows ? -static_cast<ptrdiff_t>(src.GetStep()) : src.GetStep();
+    const ptrdiff_t col_step = reverse_columns ? -1 : 1;
+
+    ParallelFor(0, (height + TILE - 1) / TILE, 1, threads, [&](int from, int to) {
+        for (int y0 = from * TILE; y0 < std::min(height, to * TILE); y0 += TILE) {
+            const int h = std::min(TILE, height - y0);
+            const int column = reverse_columns ? src.GetWidth() - 1 - y0 : y0;
+            for (int x0 = 0; x0 < width; x0 += TILE) {
+                const int row = reverse_rows ? src.GetHeight() - 1 - x0 : x0;
+                TransposeTile(src.GetLine(row) + column, row_step, col_step, dst.GetLine(y0) + x0, dst.GetStep(),
+                              std::min(TILE, width - x0), h);
+            }
+        }
+    });
+}
+
+template <typename Pixel>
+static BasicImage<Pixel> TransformImageImpl(BasicImageView<const Pixel> src, ImageTransform transform,
+                                            size_t threads) {
+    if (!src) {
+        return {};
+    }
+
+    ScopedStageTimer timer(Stage::ORIENT);
+    const Size size = GetTransformedSize({src.GetWidth(), src.GetHeight()}, transform);
+    BasicImage<Pixel> result(size.width, size.height);
+    switch (transform) {
+        case ImageTransform::NONE:
+            FlipImage(src, result, false, false, threads);
+            break;
+        case ImageTransform::FLIP_H:
+            FlipImage(src, result, true, false, threads);
+            break;
+        case ImageTransform::FLIP_V:
+            FlipImage(src, result, false, true, threads);
+            break;
+        case ImageTransform::ROTATE_180:
+            FlipImage(src, result, true, true, threads);
+            break;
+        case ImageTransform::TRANSPOSE:
+            TransposeImage(src, result, false, false, threads);
+            break;
+        case ImageTransform::ROTATE_90:
+            TransposeImage(src, result, true, false, threads);
+            break;
+        case ImageTransform::ROTATE_270:
+            TransposeImage(src, result, false, true, threads);
+            break;
+        case ImageTransform::TRANSVERSE:
+            TransposeImage(src, result, true, true, threads);
+            break;
+    }
+    return result;
+}
+
+Image TransformImage(ImageView src, ImageTransform transform, size_t threads) {
+    return TransformImageImpl(src, transform, threads);
+}
+
+RGBImage TransformImage(RGBImageView src, ImageTransform transform, size_t threads) {
+    return TransformImageImpl(src, transform, threads);
+}
+
+GrayImage TransformImage(GrayImageView src, ImageTransform transform, size_t threads) {
+    return TransformImageImpl(src, transform, threads);
+}
+
+}  // namespace img_lib
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+#include "img_lib.h"
+
+#include <cstddef>
+
+namespace img_lib {
+
+// Поворот и отражение изображения
+enum class ImageTransform {
+    NONE,        // изображение не меняется
+    FLIP_H,      // отражение слева направо
+    FLIP_V,      // отражение сверху вниз
+    ROTATE_90,   // поворот по часовой стрелке
+    ROTATE_180,
+    ROTATE_270,
+    TRANSPOSE,   // отражение относительно главной диагонали
+    TRANSVERSE   // отражение относительно побочной диагонали
+};
+
+// true для преобразований, которые меняют ширину и высоту местами
+bool SwapsAxes(ImageTransform transform);
+
+Size GetTransformedSize(Size size, ImageTransform transform);
+
+// Преобразование, которое приводит к правильному виду изображение
+// с тегом EXIF Orientation 1..8. Для остальных значений - NONE
+ImageTransform GetExifOrientationTransform(int orientation);
+
+// Создаёт повёрнутую или отражённую копию изображения или его части.
+// Повороты на 90 градусов и отражения по диагоналям переставляют пиксели
+// квадратными блоками, которые вместе со своим местом в результате умещаются
+// в кэше L1; блоки Color транспонируются векторно по 4x4 пикселя (SSSE3).
+// Полосы блоков обрабатываются параллельно в threads потоках (0 - по числу ядер)
+Image TransformImage(ImageView src, ImageTransform transform, size_t threads = 0);
+RGBImage TransformImage(RGBImageView src, ImageTransform transform, size_t threads = 0);
+GrayImage TransformImage(GrayImageView src, ImageTransform transform, size_t threads = 0);
+
+}  // namespace img_lib
\ No newline at end of file
@@ -0,0 +1,171 @@
+#include "output_file.h"
+#include "parallel.h"
+#include "stats.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#define IMGLIB_HAS_PWRITE 1
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace img_lib {
+
+// размер полосы: достаточно крупный, чтобы системных вызовов было мало,
+// и достаточно мелкий, чтобы буфер полосы оставался в кэше
+static const size_t BAND_BYTES = 1 << 20;
+
+OutputFile::~OutputFile() {
+    Close();
+}
+
+#ifdef IMGLIB_HAS_PWRITE
+
+bool OutputFile::Open(const Path& file, uint64_t size) {
+    ScopedStageTimer timer(Stage::OPEN);
+    Close();
+    failed_ = false;
+
+    fd_ = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd_ < 0) {
+        return false;
+    }
+
+    // нехватку места лучше обнаружить до того, как потоки начнут работу
+#ifdef __linux__
+    if (size > 0 && ::posix_fallocate(fd_, 0, static_cast<off_t>(size)) == ENOSPC) {
+        Close();
+        return false;
+    }
+#endif
+    if (::ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+        Close();
+        return false;
+    }
+    return true;
+}
+
+bool OutputFile::WriteAt(uint64_t offset, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        const ssize_t written = ::pwrite(fd_, bytes, size, static_cast<off_t>(offset));
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            failed_ = true;
+            return false;
+        }
+        bytes += written;
+        offset += static_cast<uint64_t>(written);
+        size -= static_cast<size_t>(written);
+        AddCounter(Counter::BYTES_WRITTEN, static_cast<uint64_t>(written));
+    }
+    return true;
+}
+
+bool OutputFile::Close() {
+    if (fd_ >= 0) {
+        if (::close(fd_) != 0) {
+            failed_ = true;
+        }
+        fd_ = -1;
+    }
+    return !failed_;
+}
+
+#else
+
+bool OutputFile::Open(const Path& file, uint64_t) {
+    ScopedStageTimer timer(Stage::OPEN);
+    Close();
+    failed_ = false;
+    ofs_.open(file, std::ios::binary | std::ios::trunc);
+    return ofs_.is_open();
+}
+
+bool OutputFile::WriteAt(uint64_t offset, const void* data, size_t size) {
+    std::lock_guard lock(mutex_);
+    ofs_.seekp(static_cast<std::streamoff>(offset));
+    ofs_.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    if (!ofs_.good()) {
+        failed_ = true;
+    } else {
+        AddCounter(Counter::BYTES_WRITTEN, size);
+    }
+    return !failed_;
+}
+
+bool OutputFile::Close() {
+    if (ofs_.is_open()) {
+        ofs_.close();
+        if (ofs_.fail()) {
+            failed_ = true;
+        }
+    }
+    return !failed_;
+}
+
+#endif
+
+
+bool WriteRowsParallel(OutputFile& file, uint64_t data_offset, size_t row_bytes, int height,
+                       bool bottom_up, size_t threads,
+                       const std::function<void(int y, std::byte* dst)>& fill_row) {
+    if (height <= 0) {
+        return true;
+    }
+
+    const int band_rows = static_cast<int>(std::clamp<size_t>(BAND_BYTES / std::max<size_t>(row_bytes, 1), 1, height));
+    std::atomic<bool> ok = true;
+
+    ParallelFor(0, height, band_rows, threads, [&](int from, int to) {
+        if (!ok) {
+            return;
+        }
+
+        // буфер переиспользуется между полосами и вызовами, чтобы не платить
+        // за выделение и обнуление памяти; строки заполняются целиком
+        thread_local std::vector<std::byte> band;
+        const size_t band_bytes = static_cast<size_t>(to - from) * row_bytes;
+        band.resize(band_bytes);
+        {
+            ScopedStageTimer timer(Stage::CONVERT);
+            // при записи снизу вверх первой в файле идёт нижняя строка полосы
+            for (int y = from; y < to; ++y) {
+                const int row_in_band = bottom_up ? to - 1 - y : y - from;
+                fill_row(y, band.data() + static_cast<size_t>(row_in_band) * row_bytes);
+            }
+        }
+
+        ScopedStageTimer timer(Stage::WRITE);
+        const int first_file_row = bottom_up ? height - to : from;
+        if (!file.WriteAt(data_offset + static_cast<uint64_t>(first_file_row) * row_bytes, band.data(), band_bytes)) {
+            ok = false;
+        }
+    });
+
+    return ok;
+}
+
+void FillRowsParallel(std::byte* data, size_t row_bytes, int height, bool bottom_up, size_t threads,
+                      const std::function<void(int y, std::byte* dst)>& fill_row) {
+    if (height <= 0) {
+        return;
+    }
+
+    const int band_rows = static_cast<int>(std::clamp<size_t>(BAND_BYTES / std::max<size_t>(row_bytes, 1), 1, height));
+    ParallelFor(0, height, band_rows, threads, [&](int from, int to) {
+        ScopedStageTimer timer(Stage::CONVERT);
+        for (int y = from; y < to; ++y) {
+            const int file_row = bottom_up ? height - 1 - y : y;
+            fill_row(y, data + static_cast<size_t>(file_row) * row_bytes);
+        }
+    });
+}
+
+}  // namespace img_lib
\ No newline at end of file
@@ -0,0 +1,54 @@
+#pragma once
+#include "img_lib.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <mutex>
+
+namespace img_lib {
+
+// Файл для записи по смещениям, в том числе из нескольких потоков одновременно.
+// На POSIX-системах место под файл резервируется заранее, а запись идёт через pwrite;
+// на остальных - через ofstream под мьютексом
+class OutputFile {
+public:
+    OutputFile() = default;
+    ~OutputFile();
+
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+
+    // создаёт файл размером size байт, существующий файл перезаписывается
+    bool Open(const Path& file, uint64_t size);
+    // записывает size байт по смещению offset, можно вызывать из разных потоков
+    bool WriteAt(uint64_t offset, const void* data, size_t size);
+    // закрывает файл; false, если какая-то из записей не удалась
+    bool Close();
+
+private:
+#if defined(__unix__) || defined(__APPLE__)
+    int fd_ = -1;
+#else
+    std::ofstream ofs_;
+    std::mutex mutex_;
+#endif
+    // выставляется из WriteAt в любом из пишущих потоков
+    std::atomic<bool> failed_ = false;
+};
+
+// Упаковывает и записывает строки изображения полосами в несколько потоков
+// (0 - по числу ядер). fill_row(y, dst) заполняет все row_bytes байт строки y по адресу dst.
+// Строки лежат в файле подряд с data_offset: сверху вниз или, если bottom_up, снизу вверх.
+// Каждая полоса собирается в своём буфере и записывается одним вызовом
+bool WriteRowsParallel(OutputFile& file, uint64_t data_offset, size_t row_bytes, int height,
+                       bool bottom_up, size_t threads,
+                       const std::function<void(int y, std::byte* dst)>& fill_row);
+
+// То же для буфера в памяти: строки заполняются сразу на своих местах, начиная с data
+void FillRowsParallel(std::byte* data, size_t row_bytes, int height, bool bottom_up, size_t threads,
+                      const std::function<void(int y, std::byte* dst)>& fill_row);
+
+}  // namespace img_lib
\ No newline at end of file
@@ -0,0 +1,67 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace img_lib {
+
+size_t GetDefaultThreadCount() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void ParallelFor(int begin, int end, int grain, size_t thread_count,
+                 const std::function<void(int from, int to)>& body) {
+    if (begin >= end) {
+        return;
+    }
+
+    grain = std::max(grain, 1);
+    const int band_count = (end - begin + grain - 1) / grain;
+    if (thread_count == 0) {
+        thread_count = GetDefaultThreadCount();
+    }
+    thread_count = std::min(thread_count, static_cast<size_t>(band_count));
+
+    if (thread_count <= 1) {
+        body(begin, end);
+        return;
+    }
+
+    std::atomic<int> next_band{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto worker = [&] {
+        for (int band = next_band++; band < band_count; band = next_band++) {
+            const int from = begin + band * grain;
+            try {
+                body(from, std::min(end, from + grain));
+            } catch (...) {
+                std::lock_guard lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (size_t i = 1; i < thread_count; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+}  // namespace img_lib
\ No newline at end of file
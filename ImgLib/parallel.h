@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace img_lib {
+
+// число потоков по умолчанию - по количеству ядер процессора
+size_t GetDefaultThreadCount();
+
+// Делит диапазон [begin, end) на полосы не короче grain и обрабатывает их
+// в thread_count потоках (0 - по числу ядер). Вызывающий поток тоже участвует в работе.
+// body получает границы полосы [from, to). Полосы разбираются потоками по мере
+// освобождения, поэтому неравномерная нагрузка распределяется сама.
+// Первое исключение, выброшенное body, пробрасывается вызывающему после завершения всех потоков
+void ParallelFor(int begin, int end, int grain, size_t thread_count,
+                 const std::function<void(int from, int to)>& body);
+
+}  // namespace img_lib
\ No newline at end of file
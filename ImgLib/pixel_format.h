@@ -0,0 +1,133 @@
+#pragma once
+#include "img_lib.h"
+#include "pixel_kernels.h"
+
+#include <cstring>
+#include <type_traits>
+
+namespace img_lib {
+
+static_assert(sizeof(RGB24) == 3, "RGB24 must be packed into 3 bytes");
+static_assert(sizeof(Gray8) == 1, "Gray8 must occupy a single byte");
+
+// Свойства формата пикселей, известные на этапе компиляции,
+// и преобразования в Color и обратно
+template <typename Pixel>
+struct PixelTraits;
+
+template <>
+struct PixelTraits<Color> {
+    static constexpr PixelFormat FORMAT = PixelFormat::RGBA32;
+    static constexpr int CHANNELS = 4;
+
+    static Color ToColor(Color c) {
+        return c;
+    }
+    static Color FromColor(Color c) {
+        return c;
+    }
+};
+
+template <>
+struct PixelTraits<RGB24> {
+    static constexpr PixelFormat FORMAT = PixelFormat::RGB24;
+    static constexpr int CHANNELS = 3;
+
+    static Color ToColor(RGB24 p) {
+        return {p.r, p.g, p.b, std::byte{255}};
+    }
+    static RGB24 FromColor(Color c) {
+        return {c.r, c.g, c.b};
+    }
+};
+
+template <>
+struct PixelTraits<Gray8> {
+    static constexpr PixelFormat FORMAT = PixelFormat::GRAY8;
+    static constexpr int CHANNELS = 1;
+
+    static Color ToColor(Gray8 p) {
+        return {p.v, p.v, p.v, std::byte{255}};
+    }
+    // яркость по ITU-R BT.601 в целочисленной арифметике: 0.299 R + 0.587 G + 0.114 B
+    static Gray8 FromColor(Color c) {
+        const int luma = 77 * std::to_integer<int>(c.r) + 150 * std::to_integer<int>(c.g)
+                         + 29 * std::to_integer<int>(c.b) + 128;
+        return {static_cast<std::byte>(luma >> 8)};
+    }
+};
+
+
+// Преобразует строку из count пикселей одного формата в другой.
+// Переходы Color <-> RGB24 выполняются векторными ядрами
+template <typename To, typename From>
+void ConvertRow(const From* src, To* dst, int count) {
+    if constexpr (std::is_same_v<To, From>) {
+        std::memcpy(dst, src, sizeof(From) * count);
+    } else if constexpr (std::is_same_v<To, RGB24> && std::is_same_v<From, Color>) {
+        PackRGB(src, reinterpret_cast<std::byte*>(dst), count);
+    } else if constexpr (std::is_same_v<To, Color> && std::is_same_v<From, RGB24>) {
+        UnpackRGB(reinterpret_cast<const std::byte*>(src), dst, count);
+    } else {
+        for (int x = 0; x < count; ++x) {
+            dst[x] = PixelTraits<To>::FromColor(PixelTraits<From>::ToColor(src[x]));
+        }
+    }
+}
+
+// создаёт копию изображения или его части в другом формате пикселей
+template <typename To, typename From>
+BasicImage<To> ConvertImage(BasicImageView<const From> src) {
+    BasicImage<To> result(src.GetWidth(), src.GetHeight());
+    for (int y = 0; y < src.GetHeight(); ++y) {
+        ConvertRow(src.GetLine(y), result.GetLine(y), src.GetWidth());
+    }
+    return result;
+}
+
+template <typename To, typename From>
+BasicImage<To> ConvertImage(const BasicImage<From>& src) {
+    return ConvertImage<To>(src.GetView());
+}
+
+// раскладывает изображение или его часть по плоскостям R, G, B
+template <typename Pixel>
+PlanarImage ToPlanar(BasicImageView<const Pixel> src) {
+    PlanarImage result(src.GetWidth(), src.GetHeight());
+    for (int y = 0; y < src.GetHeight(); ++y) {
+        const Pixel* line = src.GetLine(y);
+        Gray8* r = result.GetPlane(0).GetLine(y);
+        Gray8* g = result.GetPlane(1).GetLine(y);
+        Gray8* b = result.GetPlane(2).GetLine(y);
+        for (int x = 0; x < src.GetWidth(); ++x) {
+            const Color c = PixelTraits<Pixel>::ToColor(line[x]);
+            r[x].v = c.r;
+            g[x].v = c.g;
+            b[x].v = c.b;
+        }
+    }
+    return result;
+}
+
+template <typename Pixel>
+PlanarImage ToPlanar(const BasicImage<Pixel>& src) {
+    return ToPlanar(src.GetView());
+}
+
+// собирает изображение из плоскостей R, G, B
+template <typename Pixel>
+BasicImage<Pixel> FromPlanar(const PlanarImage& src) {
+    BasicImage<Pixel> result(src.GetWidth(), src.GetHeight());
+    for (int y = 0; y < src.GetHeight(); ++y) {
+        const Gray8* r = src.GetPlane(0).GetLine(y);
+        const Gray8* g = src.GetPlane(1).GetLine(y);
+        const Gray8* b = src.GetPlane(2).GetLine(y);
+        Pixel* line = result.GetLine(y);
+        for (int x = 0; x < src.GetWidth(); ++x) {
+            line[x] = PixelTraits<Pixel>::FromColor({r[x].v, g[x].v, b[x].v, std::byte{255}});
+        }
+    }
+    return result;
+}
+
+}  // namespace img_lib
\ No newline at end of file
@@ -0,0 +1,265 @@
+#include "pixel_kernels.h"
+#include "simd_target.h"
+
+namespace img_lib {
+
+static_assert(sizeof(Color) == 4, "Color must be packed into 4 bytes for vector kernels");
+
+// ---------- переносимая реализация ----------
+
+template <bool Bgr>
+static void PackScalar(const Color* src, std::byte* dst, int count) {
+    for (int x = 0; x < count; ++x) {
+        dst[3 * x + 0] = Bgr ? src[x].b : src[x].r;
+        dst[3 * x + 1] = src[x].g;
+        dst[3 * x + 2] = Bgr ? src[x].r : src[x].b;
+    }
+}
+
+template <bool Bgr>
+static void UnpackScalar(const std::byte* src, Color* dst, int count) {
+    for (int x = 0; x < count; ++x) {
+        const std::byte* pixel = src + 3 * x;
+        dst[x].r = Bgr ? pixel[2] : pixel[0];
+        dst[x].g = pixel[1];
+        dst[x].b = Bgr ? pixel[0] : pixel[2];
+        dst[x].a = std::byte{255};
+    }
+}
+
+#ifdef IMGLIB_X86_KERNELS
+
+// ---------- SSSE3: 16 пикселей за итерацию ----------
+
+// Маска pshufb, собирающая из четырёх Color 12 байт RGB или BGR в младших байтах.
+// -1 обнуляет байт
+IMGLIB_TARGET_SSSE3 static __m128i PackMask128(bool bgr) {
+    return bgr ? _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)
+               : _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+}
+
+// Маска pshufb, раскладывающая 12 байт RGB или BGR по четырём Color (альфа обнуляется)
+IMGLIB_TARGET_SSSE3 static __m128i UnpackMask128(bool bgr) {
+    return bgr ? _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+               : _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+}
+
+template <bool Bgr>
+IMGLIB_TARGET_SSSE3 static void PackSSSE3(const Color* src, std::byte* dst, int count) {
+    const __m128i mask = PackMask128(Bgr);
+
+    int x = 0;
+    for (; x + 16 <= count; x += 16) {
+        const __m128i* in = reinterpret_cast<const __m128i*>(src + x);
+        const __m128i s0 = _mm_shuffle_epi8(_mm_loadu_si128(in + 0), mask);
+        const __m128i s1 = _mm_shuffle_epi8(_mm_loadu_si128(in + 1), mask);
+        const __m128i s2 = _mm_shuffle_epi8(_mm_loadu_si128(in + 2), mask);
+        const __m128i s3 = _mm_shuffle_epi8(_mm_loadu_si128(in + 3), mask);
+
+        // четыре блока по 12 байт склеиваются в три полных вектора
+        __m128i* out = reinterpret_cast<__m128i*>(dst + 3 * x);
+        _mm_storeu_si128(out + 0, _mm_or_si128(s0, _mm_slli_si128(s1, 12)));
+        _mm_storeu_si128(out + 1, _mm_or_si128(_mm_srli_si128(s1, 4), _mm_slli_si128(s2, 8)));
+        _mm_storeu_si128(out + 2, _mm_or_si128(_mm_srli_si128(s2, 8), _mm_slli_si128(s3, 4)));
+    }
+
+    PackScalar<Bgr>(src + x, dst + 3 * x, count - x);
+}
+
+template <bool Bgr>
+IMGLIB_TARGET_SSSE3 static void UnpackSSSE3(const std::byte* src, Color* dst, int count) {
+    const __m128i mask = UnpackMask128(Bgr);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+
+    int x = 0;
+    for (; x + 16 <= count; x += 16) {
+        const __m128i* in = reinterpret_cast<const __m128i*>(src + 3 * x);
+        const __m128i in0 = _mm_loadu_si128(in + 0);
+        const __m128i in1 = _mm_loadu_si128(in + 1);
+        const __m128i in2 = _mm_loadu_si128(in + 2);
+
+        // каждый вектор p начинается с очередных 12 байт входа
+        const __m128i p0 = in0;
+        const __m128i p1 = _mm_alignr_epi8(in1, in0, 12);
+        const __m128i p2 = _mm_alignr_epi8(in2, in1, 8);
+        const __m128i p3 = _mm_srli_si128(in2, 4);
+
+        __m128i* out = reinterpret_cast<__m128i*>(dst + x);
+        _mm_storeu_si128(out + 0, _mm_or_si128(_mm_shuffle_epi8(p0, mask), alpha));
+        _mm_storeu_si128(out + 1, _mm_or_si128(_mm_shuffle_epi8(p1, mask), alpha));
+        _mm_storeu_si128(out + 2, _mm_or_si128(_mm_shuffle_epi8(p2, mask), alpha));
+        _mm_storeu_si128(out + 3, _mm_or_si128(_mm_shuffle_epi8(p3, mask), alpha));
+    }
+
+    UnpackScalar<Bgr>(src + 3 * x, dst + x, count - x);
+}
+
+// ---------- AVX2: 8 пикселей на вектор ----------
+
+// pshufb в AVX2 работает внутри 128-битных половин, поэтому маска повторяется дважды
+IMGLIB_TARGET_AVX2 static __m256i PackMask256(bool bgr) {
+    return bgr ? _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                  2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)
+               : _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                  0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+}
+
+IMGLIB_TARGET_AVX2 static __m256i UnpackMask256(bool bgr) {
+    return bgr ? _mm256_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+                                  2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+               : _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                  0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+}
+
+template <bool Bgr>
+IMGLIB_TARGET_AVX2 static void PackAVX2(const Color* src, std::byte* dst, int count) {
+    const __m256i mask = PackMask256(Bgr);
+    // после pshufb в каждой половине 12 значимых байт; сдвигаем их вплотную друг к другу
+    const __m256i compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+
+    int x = 0;
+    for (; x + 8 <= count; x += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + x));
+        v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, mask), compact);
+
+        std::byte* out = dst + 3 * x;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(v));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + 16), _mm256_extracti128_si256(v, 1));
+    }
+
+    PackSSSE3<Bgr>(src + x, dst + 3 * x, count - x);
+}
+
+template <bool Bgr>
+IMGLIB_TARGET_AVX2 static void UnpackAVX2(const std::byte* src, Color* dst, int count) {
+    const __m256i mask = UnpackMask256(Bgr);
+    const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000u));
+    // младшая половина получает байты 0..11, старшая - 12..23
+    const __m256i spread = _mm256_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0);
+
+    int x = 0;
+    // загрузка читает 32 байта, из которых используются 24, поэтому
+    // цикл останавливается, не доходя до конца входа
+    for (; 3 * x + 32 <= 3 * count; x += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 3 * x));
+        v = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(v, spread), mask);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), _mm256_or_si256(v, alpha));
+    }
+
+    UnpackSSSE3<Bgr>(src + 3 * x, dst + x, count - x);
+}
+
+#endif  // IMGLIB_X86_KERNELS
+
+
+static const PixelKernels SCALAR_KERNELS = {
+    KernelLevel::SCALAR,
+    PackScalar<false>, PackScalar<true>,
+    UnpackScalar<false>, UnpackScalar<true>
+};
+
+#ifdef IMGLIB_X86_KERNELS
+static const PixelKernels SSSE3_KERNELS = {
+    KernelLevel::SSSE3,
+    PackSSSE3<false>, PackSSSE3<true>,
+    UnpackSSSE3<false>, UnpackSSSE3<true>
+};
+
+static const PixelKernels AVX2_KERNELS = {
+    KernelLevel::AVX2,
+    PackAVX2<false>, PackAVX2<true>,
+    UnpackAVX2<false>, UnpackAVX2<true>
+};
+#endif
+
+
+KernelLevel GetBestKernelLevel() {
+#ifdef IMGLIB_X86_KERNELS
+    static const KernelLevel level = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return KernelLevel::AVX2;
+        }
+        if (__builtin_cpu_supports("ssse3")) {
+            return KernelLevel::SSSE3;
+        }
+        return KernelLevel::SCALAR;
+    }();
+    return level;
+#else
+    return KernelLevel::SCALAR;
+#endif
+}
+
+const PixelKernels& GetPixelKernels(KernelLevel level) {
+#ifdef IMGLIB_X86_KERNELS
+    switch (level) {
+        case KernelLevel::AVX2:
+            return AVX2_KERNELS;
+        case KernelLevel::SSSE3:
+            return SSSE3_KERNELS;
+        default:
+            break;
+    }
+#endif
+    (void) level;
+    return SCALAR_KERNELS;
+}
+
+const PixelKernels& GetPixelKernels() {
+    static const PixelKernels& kernels = GetPixelKernels(GetBestKernelLevel());
+    return kernels;
+}
+
+
+void PackRGB(const Color* src, std::byte* dst, int count) {
+    GetPixelKernels().pack_rgb(src, dst, count);
+}
+
+void PackBGR(const Color* src, std::byte* dst, int count) {
+    GetPixelKernels().pack_bgr(src, dst, count);
+}
+
+void UnpackRGB(const std::byte* src, Color* dst, int count) {
+    GetPixelKernels().unpack_rgb(src, dst, count);
+}
+
+void UnpackBGR(const std::byte* src, Color* dst, int count) {
+    GetPixelKernels().unpack_bgr(src, dst, count);
+}
+
+
+
+template <bool Bgr, bool Opaque>
+static void Unpack32(const std::byte* src, Color* dst, int count) {
+    for (int x = 0; x < count; ++x) {
+        const std::byte* pixel = src + 4 * x;
+        dst[x].r = Bgr ? pixel[2] : pixel[0];
+        dst[x].g = pixel[1];
+        dst[x].b = Bgr ? pixel[0] : pixel[2];
+        dst[x].a = Opaque ? std::byte{255} : pixel[3];
+    }
+}
+
+void PackBGRA(const Color* src, std::byte* dst, int count) {
+    for (int x = 0; x < count; ++x) {
+        dst[4 * x + 0] = src[x].b;
+        dst[4 * x + 1] = src[x].g;
+        dst[4 * x + 2] = src[x].r;
+        dst[4 * x + 3] = src[x].a;
+    }
+}
+
+void UnpackBGRA(const std::byte* src, Color* dst, int count) {
+    Unpack32<true, false>(src, dst, count);
+}
+
+void UnpackRGBX(const std::byte* src, Color* dst, int count) {
+    Unpack32<false, true>(src, dst, count);
+}
+
+void UnpackBGRX(const std::byte* src, Color* dst, int count) {
+    Unpack32<true, true>(src, dst, count);
+}
+
+}  // namespace img_lib
\ No newline at end of file
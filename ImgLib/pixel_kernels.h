@@ -0,0 +1,55 @@
+#pragma once
+#include "img_lib.h"
+
+#include <cstddef>
+
+namespace img_lib {
+
+// Ядра упаковки строк: Color (4 байта) <-> 3 байта на пиксель в порядке RGB или BGR.
+// Распаковка всегда выставляет непрозрачный альфа-канал.
+// Реализация выбирается один раз при первом вызове по возможностям процессора
+
+void PackRGB(const Color* src, std::byte* dst, int count);
+void PackBGR(const Color* src, std::byte* dst, int count);
+
+void UnpackRGB(const std::byte* src, Color* dst, int count);
+void UnpackBGR(const std::byte* src, Color* dst, int count);
+
+// То же для 4 байт на пиксель. Порядок RGBA совпадает с Color и копируется memcpy.
+// X - байт без значения: при распаковке альфа-канал становится непрозрачным.
+// Перестановка байт внутри пикселя векторизуется компилятором, отдельных ядер нет
+void PackBGRA(const Color* src, std::byte* dst, int count);
+void UnpackBGRA(const std::byte* src, Color* dst, int count);
+void UnpackRGBX(const std::byte* src, Color* dst, int count);
+void UnpackBGRX(const std::byte* src, Color* dst, int count);
+
+
+// уровни реализации ядер, от переносимого к самому быстрому
+enum class KernelLevel {
+    SCALAR,
+    SSSE3,
+    AVX2
+};
+
+struct PixelKernels {
+    using PackFn = void (*)(const Color* src, std::byte* dst, int count);
+    using UnpackFn = void (*)(const std::byte* src, Color* dst, int count);
+
+    KernelLevel level;
+    PackFn pack_rgb;
+    PackFn pack_bgr;
+    UnpackFn unpack_rgb;
+    UnpackFn unpack_bgr;
+};
+
+// лучший уровень, который поддерживает текущий процессор
+KernelLevel GetBestKernelLevel();
+
+// Ядра заданного уровня - для сравнения реализаций между собой.
+// Уровень не должен превышать GetBestKernelLevel()
+const PixelKernels& GetPixelKernels(KernelLevel level);
+
+// ядра, выбранные для текущего процессора
+const PixelKernels& GetPixelKernels();
+
+}  // namespace img_lib
\ No newline at end of file
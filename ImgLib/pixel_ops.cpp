@@ -0,0 +1,339 @@
+#include "pixel_ops.h"
+#include "parallel.h"
+#include "pixel_kernels.h"
+#include "simd_target.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace img_lib {
+
+static_assert(sizeof(Color) == 4, "Color must be packed into 4 bytes for vector kernels");
+
+// столько пикселей (8 КБ) проходят все шаги цепочки, пока лежат в кэше L1
+static const int CHUNK_PIXELS = 2048;
+// столько строк обрабатывает поток за один раз
+static const int BAND_ROWS = 16;
+
+// ---------- запись операций ----------
+
+PixelPipeline& PixelPipeline::Grayscale() {
+    PixelOp op;
+    op.type = PixelOpType::GRAYSCALE;
+    ops_.push_back(op);
+    return *this;
+}
+
+PixelPipeline& PixelPipeline::Gamma(double gamma) {
+    assert(gamma > 0);
+    std::array<uint8_t, 256> table;
+    for (int v = 0; v < 256; ++v) {
+        table[v] = static_cast<uint8_t>(std::lround(255.0 * std::pow(v / 255.0, 1.0 / gamma)));
+    }
+    return Lut(table);
+}
+
+PixelPipeline& PixelPipeline::BrightnessContrast(double brightness, double contrast) {
+    std::array<uint8_t, 256> table;
+    for (int v = 0; v < 256; ++v) {
+        const long value = std::lround((v - 128) * contrast + 128 + brightness);
+        table[v] = static_cast<uint8_t>(std::clamp(value, 0L, 255L));
+    }
+    return Lut(table);
+}
+
+PixelPipeline& PixelPipeline::Invert() {
+    std::array<uint8_t, 256> table;
+    for (int v = 0; v < 256; ++v) {
+        table[v] = static_cast<uint8_t>(255 - v);
+    }
+    return Lut(table);
+}
+
+PixelPipeline& PixelPipeline::Lut(const std::array<uint8_t, 256>& table) {
+    PixelOp op;
+    op.type = PixelOpType::LUT;
+    op.table = table;
+    ops_.push_back(op);
+    return *this;
+}
+
+PixelPipeline& PixelPipeline::SwapChannels(std::array<int, 4> order) {
+    assert(std::all_of(order.begin(), order.end(), [](int c) {
+        return c >= 0 && c < 4;
+    }));
+    PixelOp op;
+    op.type = PixelOpType::SWAP_CHANNELS;
+    op.order = order;
+    ops_.push_back(op);
+    return *this;
+}
+
+PixelPipeline& PixelPipeline::FillAlpha(uint8_t alpha) {
+    PixelOp op;
+    op.type = PixelOpType::FILL_ALPHA;
+    op.alpha = alpha;
+    ops_.push_back(op);
+    return *this;
+}
+
+void PixelPipeline::Apply(MutableImageView image, size_t threads) const {
+    FusedPixelOps(*this).Apply(image, threads);
+}
+
+
+// ---------- ядра шагов ----------
+
+static void GrayscaleScalar(Color* pixels, int count) {
+    for (int x = 0; x < count; ++x) {
+        const int r = std::to_integer<int>(pixels[x].r);
+        const int g = std::to_integer<int>(pixels[x].g);
+        const int b = std::to_integer<int>(pixels[x].b);
+        // веса в сумме дают 256, поэтому белый остаётся белым
+        const std::byte y{static_cast<uint8_t>((77 * r + 150 * g + 29 * b + 128) >> 8)};
+        pixels[x].r = y;
+        pixels[x].g = y;
+        pixels[x].b = y;
+    }
+}
+
+static void ShuffleScalar(Color* pixels, int count, const std::array<int, 4>& source,
+                          const std::array<int, 4>& constant) {
+    for (int x = 0; x < count; ++x) {
+        const Color pixel = pixels[x];
+        const std::byte* in = reinterpret_cast<const std::byte*>(&pixel);
+        std::byte* out = reinterpret_cast<std::byte*>(pixels + x);
+        for (int c = 0; c < 4; ++c) {
+            out[c] = constant[c] >= 0 ? std::byte(constant[c]) : in[source[c]];
+        }
+    }
+}
+
+static void LutScalar(Color* pixels, int count, const std::array<int, 4>& source,
+                      const std::array<std::array<uint8_t, 256>, 4>& tables) {
+    const uint8_t* r = tables[0].data();
+    const uint8_t* g = tables[1].data();
+    const uint8_t* b = tables[2].data();
+    const uint8_t* a = tables[3].data();
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(pixels);
+    // все четыре байта пикселя читаются до записи: каналы могут переставляться
+    for (int x = 0; x < count; ++x, bytes += 4) {
+        const uint8_t out_r = r[bytes[source[0]]];
+        const uint8_t out_g = g[bytes[source[1]]];
+        const uint8_t out_b = b[bytes[source[2]]];
+        const uint8_t out_a = a[bytes[source[3]]];
+        bytes[0] = out_r;
+        bytes[1] = out_g;
+        bytes[2] = out_b;
+        bytes[3] = out_a;
+    }
+}
+
+#ifdef IMGLIB_X86_KERNELS
+
+// ---------- SSSE3: 4 пикселя за итерацию ----------
+
+// Та же сумма, что и в GrayscaleScalar: каналы расширяются до 16 бит, pmaddwd
+// и phaddd дают яркость каждого пикселя в своём 32-битном слове
+IMGLIB_TARGET_SSSE3 static void GrayscaleSSSE3(Color* pixels, int count) {
+    const __m128i weights = _mm_setr_epi16(77, 150, 29, 0, 77, 150, 29, 0);
+    const __m128i round = _mm_set1_epi32(128);
+    const __m128i spread = _mm_setr_epi8(0, 0, 0, -1, 4, 4, 4, -1, 8, 8, 8, -1, 12, 12, 12, -1);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+    const __m128i zero = _mm_setzero_si128();
+
+    int x = 0;
+    for (; x + 4 <= count; x += 4) {
+        __m128i* data = reinterpret_cast<__m128i*>(pixels + x);
+        const __m128i in = _mm_loadu_si128(data);
+        const __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(in, zero), weights);
+        const __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(in, zero), weights);
+        const __m128i y = _mm_srli_epi32(_mm_add_epi32(_mm_hadd_epi32(lo, hi), round), 8);
+        _mm_storeu_si128(data, _mm_or_si128(_mm_shuffle_epi8(y, spread), _mm_and_si128(in, alpha)));
+    }
+
+    GrayscaleScalar(pixels + x, count - x);
+}
+
+// перестановка байт внутри пикселей одной маской pshufb, постоянные каналы дописываются по or
+IMGLIB_TARGET_SSSE3 static void ShuffleSSSE3(Color* pixels, int count, const std::array<int, 4>& source,
+                                             const std::array<int, 4>& constant) {
+    alignas(16) int8_t mask_bytes[16];
+    alignas(16) uint8_t fill_bytes[16];
+    for (int i = 0; i < 16; ++i) {
+        const int c = i % 4;
+        mask_bytes[i] = constant[c] >= 0 ? int8_t{-1} : static_cast<int8_t>(i - c + source[c]);
+        fill_bytes[i] = constant[c] >= 0 ? static_cast<uint8_t>(constant[c]) : uint8_t{0};
+    }
+    const __m128i mask = _mm_load_si128(reinterpret_cast<const __m128i*>(mask_bytes));
+    const __m128i fill = _mm_load_si128(reinterpret_cast<const __m128i*>(fill_bytes));
+
+    int x = 0;
+    for (; x + 4 <= count; x += 4) {
+        __m128i* data = reinterpret_cast<__m128i*>(pixels + x);
+        _mm_storeu_si128(data, _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128(data), mask), fill));
+    }
+
+    ShuffleScalar(pixels + x, count - x, source, constant);
+}
+
+static bool HasSSSE3Kernels() {
+    static const bool has = GetBestKernelLevel() != KernelLevel::SCALAR;
+    return has;
+}
+
+#endif
+
+
+// ---------- слияние и выполнение ----------
+
+static bool IsIdentityTable(const std::array<uint8_t, 256>& table) {
+    for (int v = 0; v < 256; ++v) {
+        if (table[v] != v) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool IsConstantTable(const std::array<uint8_t, 256>& table) {
+    return std::all_of(table.begin(), table.end(), [&table](uint8_t v) {
+        return v == table[0];
+    });
+}
+
+FusedPixelOps::FusedPixelOps(const PixelPipeline& pipeline) {
+    // накопленные таблицы и перестановка, ещё не ставшие шагом
+    Step map;
+    for (std::array<uint8_t, 256>& table : map.tables) {
+        std::iota(table.begin(), table.end(), uint8_t{0});
+    }
+    const Step identity = map;
+
+    for (const PixelOp& op : pipeline.GetOps()) {
+        switch (op.type) {
+            case PixelOpType::GRAYSCALE:
+                AddMapStep(map);
+                map = identity;
+                // серое изображение повторный перевод не меняет
+                if (steps_.empty() || steps_.back().kind != StepKind::GRAYSCALE) {
+                    Step gray;
+                    gray.kind = StepKind::GRAYSCALE;
+                    steps_.push_back(gray);
+                }
+                break;
+            case PixelOpType::LUT:
+                for (int c = 0; c < 3; ++c) {
+                    for (uint8_t& v : map.tables[c]) {
+                        v = op.table[v];
+                    }
+                }
+                break;
+            case PixelOpType::SWAP_CHANNELS: {
+                const Step previous = map;
+                for (int c = 0; c < 4; ++c) {
+                    map.source[c] = previous.source[op.order[c]];
+                    map.tables[c] = previous.tables[op.order[c]];
+                }
+                break;
+            }
+            case PixelOpType::FILL_ALPHA:
+                map.tables[3].fill(op.alpha);
+                break;
+        }
+    }
+    AddMapStep(map);
+}
+
+void FusedPixelOps::AddMapStep(const Step& map) {
+    Step step = map;
+    bool identity = true;
+    bool shuffle = true;
+    for (int c = 0; c < 4; ++c) {
+        if (IsIdentityTable(step.tables[c])) {
+            identity = identity && step.source[c] == c;
+        } else if (IsConstantTable(step.tables[c])) {
+            step.constant[c] = step.tables[c][0];
+            identity = false;
+        } else {
+            shuffle = false;
+            identity = false;
+        }
+    }
+    if (identity) {
+        return;
+    }
+    step.kind = shuffle ? StepKind::SHUFFLE : StepKind::LUT;
+    steps_.push_back(step);
+}
+
+void FusedPixelOps::ApplyStep(const Step& step, Color* pixels, int count) const {
+    switch (step.kind) {
+        case StepKind::GRAYSCALE:
+#ifdef IMGLIB_X86_KERNELS
+            if (HasSSSE3Kernels()) {
+                GrayscaleSSSE3(pixels, count);
+                return;
+            }
+#endif
+            GrayscaleScalar(pixels, count);
+            return;
+        case StepKind::SHUFFLE:
+#ifdef IMGLIB_X86_KERNELS
+            if (HasSSSE3Kernels()) {
+                ShuffleSSSE3(pixels, count, step.source, step.constant);
+                return;
+            }
+#endif
+            ShuffleScalar(pixels, count, step.source, step.constant);
+            return;
+        case StepKind::LUT:
+            LutScalar(pixels, count, step.source, step.tables);
+            return;
+    }
+}
+
+void FusedPixelOps::ApplyRow(Color* row, int width) const {
+    for (int x = 0; x < width; x += CHUNK_PIXELS) {
+        const int count = std::min(CHUNK_PIXELS, width - x);
+        for (const Step& step : steps_) {
+            ApplyStep(step, row + x, count);
+        }
+    }
+}
+
+void FusedPixelOps::Apply(MutableImageView image, size_t threads) const {
+    if (steps_.empty() || !image) {
+        return;
+    }
+
+    ScopedStageTimer timer(Stage::PIXEL_OPS);
+    ParallelFor(0, image.GetHeight(), BAND_ROWS, threads, [&](int from, int to) {
+        for (int y = from; y < to; ++y) {
+            ApplyRow(image.GetLine(y), image.GetWidth());
+        }
+    });
+}
+
+
+bool PixelOpsSource::ReadRow(Color* row) {
+    if (!source_.ReadRow(row)) {
+        return false;
+    }
+    ScopedStageTimer timer(Stage::PIXEL_OPS);
+    ops_.ApplyRow(row, GetSize().width);
+    return true;
+}
+
+bool PixelOpsSink::WriteRow(const Color* row) {
+    {
+        ScopedStageTimer timer(Stage::PIXEL_OPS);
+        std::copy_n(row, row_.size(), row_.data());
+        ops_.ApplyRow(row_.data(), static_cast<int>(row_.size()));
+    }
+    return sink_.WriteRow(row_.data());
+}
+
+}  // namespace img_lib
\ No newline at end of file
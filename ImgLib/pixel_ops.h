@@ -0,0 +1,161 @@
+#pragma once
+#include "img_lib.h"
+#include "scanline.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace img_lib {
+
+// Поточечная операция над пикселем Color: результат зависит только от самого пикселя
+enum class PixelOpType {
+    // r = g = b = яркость по BT.601, альфа-канал не меняется
+    GRAYSCALE,
+    // r, g и b заменяются по таблице table
+    LUT,
+    // канал c результата берётся из канала order[c] исходного пикселя
+    SWAP_CHANNELS,
+    // альфа-канал заполняется значением alpha
+    FILL_ALPHA
+};
+
+struct PixelOp {
+    PixelOpType type = PixelOpType::LUT;
+    std::array<uint8_t, 256> table{};
+    // номера каналов: 0 - r, 1 - g, 2 - b, 3 - a
+    std::array<int, 4> order = {0, 1, 2, 3};
+    uint8_t alpha = 255;
+};
+
+// Цепочка поточечных операций. Методы только записывают операцию в конец цепочки;
+// пиксели обрабатываются в Apply или через FusedPixelOps
+class PixelPipeline {
+public:
+    PixelPipeline& Grayscale();
+    // v = 255 * (v / 255) ^ (1 / gamma) для r, g и b; gamma > 0
+    PixelPipeline& Gamma(double gamma);
+    // v = (v - 128) * contrast + 128 + brightness для r, g и b, с насыщением
+    PixelPipeline& BrightnessContrast(double brightness, double contrast);
+    // v = 255 - v для r, g и b
+    PixelPipeline& Invert();
+    PixelPipeline& Lut(const std::array<uint8_t, 256>& table);
+    // каждое значение order - от 0 до 3
+    PixelPipeline& SwapChannels(std::array<int, 4> order);
+    PixelPipeline& FillAlpha(uint8_t alpha);
+
+    const std::vector<PixelOp>& GetOps() const {
+        return ops_;
+    }
+
+    bool IsEmpty() const {
+        return ops_.empty();
+    }
+
+    // выполняет цепочку над изображением или его частью, см. FusedPixelOps::Apply
+    void Apply(MutableImageView image, size_t threads = 0) const;
+
+private:
+    std::vector<PixelOp> ops_;
+};
+
+// Цепочка, подготовленная к выполнению. Подряд идущие таблицы, перестановки каналов
+// и заполнение альфа-канала сливаются в один шаг - таблицу на канал или, если таблицы
+// тождественные или постоянные, в одну перестановку байт; шагом остаётся только
+// перевод в оттенки серого. Строка обрабатывается кусками, которые умещаются
+// в кэше L1, и каждый кусок проходит все шаги, прежде чем взяться за следующий.
+// Шаги перестановки и оттенков серого векторизованы (SSSE3).
+// Подготовленная цепочка не меняется, поэтому её можно выполнять из нескольких потоков
+class FusedPixelOps {
+public:
+    // пустая цепочка: строки не меняются
+    FusedPixelOps() = default;
+    explicit FusedPixelOps(const PixelPipeline& pipeline);
+
+    // применяет цепочку к строке на месте
+    void ApplyRow(Color* row, int width) const;
+
+    // Применяет цепочку ко всем строкам за один проход: полосы строк
+    // обрабатываются параллельно в threads потоках (0 - по числу ядер)
+    void Apply(MutableImageView image, size_t threads = 0) const;
+
+    bool IsEmpty() const {
+        return steps_.empty();
+    }
+
+    // число шагов после слияния
+    size_t GetStepCount() const {
+        return steps_.size();
+    }
+
+private:
+    enum class StepKind {
+        GRAYSCALE,
+        // канал c результата - tables[c][канал source[c] исходного пикселя]
+        LUT,
+        // то же без таблиц: канал c - байт source[c] или постоянное значение constant[c]
+        SHUFFLE
+    };
+
+    struct Step {
+        StepKind kind = StepKind::LUT;
+        std::array<int, 4> source = {0, 1, 2, 3};
+        std::array<std::array<uint8_t, 256>, 4> tables{};
+        // -1 - канал берётся из source
+        std::array<int, 4> constant = {-1, -1, -1, -1};
+    };
+
+    // добавляет шаг для накопленных таблиц и перестановки, если он что-то меняет
+    void AddMapStep(const Step& map);
+    void ApplyStep(const Step& step, Color* pixels, int count) const;
+
+    std::vector<Step> steps_;
+};
+
+// Источник и приёмник, которые применяют цепочку к каждой строке: так операции
+// выполняются при построчной загрузке или сохранении, пока строка ещё в кэше
+class PixelOpsSource : public ScanlineSource {
+public:
+    PixelOpsSource(ScanlineSource& source, const FusedPixelOps& ops)
+        : source_(source)
+        , ops_(ops) {
+    }
+
+    Size GetSize() const override {
+        return source_.GetSize();
+    }
+
+    bool ReadRow(Color* row) override;
+
+private:
+    ScanlineSource& source_;
+    const FusedPixelOps& ops_;
+};
+
+class PixelOpsSink : public ScanlineSink {
+public:
+    PixelOpsSink(ScanlineSink& sink, const FusedPixelOps& ops)
+        : sink_(sink)
+        , ops_(ops)
+        , row_(sink.GetSize().width) {
+    }
+
+    Size GetSize() const override {
+        return sink_.GetSize();
+    }
+
+    // строка копируется в собственный буфер: исходная не меняется
+    bool WriteRow(const Color* row) override;
+
+    bool Finish() override {
+        return sink_.Finish();
+    }
+
+private:
+    ScanlineSink& sink_;
+    const FusedPixelOps& ops_;
+    std::vector<Color> row_;
+};
+
+}  // namespace img_lib
\ No newline at end of file
@@ -1,106 +1,910 @@
 #include "ppm_image.h"
+#include "async_io.h"
+#include "output_file.h"
+#include "pixel_format.h"
+#include "pixel_kernels.h"
+#include "stats.h"
 
+#include <algorithm>
 #include <array>
-#include <iostream>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
 #include <string_view>
+#include <type_traits>
+#include <vector>
 
 using namespace std;
 
 namespace img_lib {
 
-static const string_view PPM_SIG = "P6"sv;
 static const int PPM_MAX = 255;
+// наибольшее значение отсчёта, которое допускает формат
+static const int PPM_MAX_WIDE = 65535;
+// строки текстовых форматов по стандарту не длиннее 70 символов
+static const size_t PPM_ASCII_LINE = 70;
+// столько байт от начала файла ProbePPM читает за первый раз
+static const size_t PPM_PROBE_BYTES = 1 << 12;
+// Дальше заголовка ProbePPM не читает: длиннее он бывает только из-за комментариев
+static const size_t PPM_MAX_HEADER_BYTES = 256 << 10;
 
-// реализуйте эту функцию самостоятельно
-bool SavePPM(const Path& file, const Image& image) {
-    bool res = false;
-    ofstream ofs(file, ios::binary);
+static int GetChannels(PpmFormat format) {
+    return format == PpmFormat::P6 || format == PpmFormat::P3 ? 3 : 1;
+}
 
-    if (!ofs.is_open()) {
-        std::cerr << "Error in input file opening"sv << std::endl;
-        return res;
-    }
-    
-    // Узнаем параметры изображения:
-    int w, h, step;
-    try {
-        w = image.GetWidth();
-        h = image.GetHeight();
-        step = image.GetStep();
-    } catch (...) {
-        return res;
-    }
-    
-    // Записываем заголовок 
-    ofs << PPM_SIG << "\n" << w << " " << h << "\n"  << PPM_MAX << "\n";
-    
-    std::vector<char> buff(w * 3);
-    try{
-        // Идем по строкам изображения 
-        for (int y = 0; y < h; ++y) {
-            // берем очередную строку изображения
-            const Color* color_line = image.GetLine(y);
-            for (int x = 0; x < w; ++x) {
-                buff[3 * x] = static_cast<char>(color_line[x].r);
-                buff[3 * x + 1] = static_cast<char>(color_line[x].g);
-                buff[3 * x + 2] = static_cast<char>(color_line[x].b);
-            }
-            // Заполняем padding
-            for (int x = w; x < step; x++) {
-                buff[3 * x] = static_cast<char>(Color::Black().r);
-                buff[3 * x + 1] = static_cast<char>(Color::Black().g);
-                buff[3 * x + 2] = static_cast<char>(Color::Black().b);
-            }
-            ofs.write(buff.data(), w * 3);
-        }
-    } catch (...) {
-        return res;
-    }
-    res = ofs.good();
-
-    return res;
+static bool IsAscii(PpmFormat format) {
+    return format == PpmFormat::P3 || format == PpmFormat::P2;
+}
 
+// байт на отсчёт в двоичных форматах
+static int GetSampleBytes(int max_value) {
+    return max_value > PPM_MAX ? 2 : 1;
 }
 
-Image LoadPPM(const Path& file) {
-    // открываем поток с флагом ios::binary
-    // поскольку будем читать даные в двоичном формате
-    ifstream ifs(file, ios::binary);
-    std::string sign;
-    int w, h, color_max;
+static bool IsSpace(char c) {
+    return isspace(static_cast<unsigned char>(c)) != 0;
+}
 
-    // читаем заголовок: он содержит формат, размеры изображения
-    // и максимальное значение цвета
-    ifs >> sign >> w >> h >> color_max;
 
-    // мы поддерживаем изображения только формата P6
-    // с максимальным значением цвета 255
-    if (sign != PPM_SIG || color_max != PPM_MAX) {
-        return {};
+// Параметры файла из заголовка
+struct PpmHeader {
+    PpmFormat format = PpmFormat::P6;
+    Size size = {0, 0};
+    int max_value = PPM_MAX;
+    // смещение первого отсчёта
+    size_t pixels_offset = 0;
+
+    size_t GetRowSamples() const {
+        return static_cast<size_t>(size.width) * GetChannels(format);
+    }
+    // байт на строку двоичного файла
+    size_t GetRowBytes() const {
+        return GetRowSamples() * GetSampleBytes(max_value);
+    }
+    // P6 с отсчётами 0..255 совпадает по раскладке с RGB24 и читается без перевода отсчётов
+    bool IsPackedRGB() const {
+        return format == PpmFormat::P6 && max_value == PPM_MAX;
     }
+};
 
-    // пропускаем один байт - это конец строки
-    const char next = ifs.get();
-    if (next != '\n') {
-        return {};
+enum class PpmHeaderStatus {
+    OK,
+    // данные кончились раньше заголовка - он может продолжаться дальше в файле
+    INCOMPLETE,
+    INVALID
+};
+
+// Разбирает заголовок в памяти без копирования: сигнатура, ширина, высота и наибольшее
+// значение, разделённые пробельными символами и комментариями от # до конца строки.
+// После наибольшего значения идёт ровно один пробельный символ
+static PpmHeaderStatus ParsePPMHeaderPrefix(string_view data, PpmHeader& header) {
+    size_t pos = 0;
+
+    auto skip_spaces = [&] {
+        while (pos < data.size()) {
+            if (data[pos] == '#') {
+                while (pos < data.size() && data[pos] != '\n' && data[pos] != '\r') {
+                    ++pos;
+                }
+            } else if (IsSpace(data[pos])) {
+                ++pos;
+            } else {
+                break;
+            }
+        }
+    };
+    // число, дочитанное до конца данных, может продолжаться
+    auto read_int = [&](int& value) {
+        skip_spaces();
+        if (pos == data.size()) {
+            return PpmHeaderStatus::INCOMPLETE;
+        }
+        const auto [ptr, ec] = from_chars(data.data() + pos, data.data() + data.size(), value);
+        if (ec != errc{}) {
+            return PpmHeaderStatus::INVALID;
+        }
+        pos = ptr - data.data();
+        return pos == data.size() ? PpmHeaderStatus::INCOMPLETE : PpmHeaderStatus::OK;
+    };
+
+    skip_spaces();
+    if (pos == data.size() || data[pos] != 'P') {
+        return pos == data.size() ? PpmHeaderStatus::INCOMPLETE : PpmHeaderStatus::INVALID;
+    }
+    if (pos + 1 == data.size()) {
+        return PpmHeaderStatus::INCOMPLETE;
+    }
+    switch (data[pos + 1]) {
+        case '6': header.format = PpmFormat::P6; break;
+        case '5': header.format = PpmFormat::P5; break;
+        case '3': header.format = PpmFormat::P3; break;
+        case '2': header.format = PpmFormat::P2; break;
+        default: return PpmHeaderStatus::INVALID;
+    }
+    pos += 2;
+
+    for (int* value : {&header.size.width, &header.size.height, &header.max_value}) {
+        if (const PpmHeaderStatus status = read_int(*value); status != PpmHeaderStatus::OK) {
+            return status;
+        }
+    }
+    if (header.max_value < 1 || header.max_value > PPM_MAX_WIDE || header.size.width <= 0 || header.size.height <= 0) {
+        return PpmHeaderStatus::INVALID;
+    }
+
+    // пропускаем один байт - обычно это конец строки
+    if (!IsSpace(data[pos])) {
+        return PpmHeaderStatus::INVALID;
+    }
+    header.pixels_offset = pos + 1;
+    return PpmHeaderStatus::OK;
+}
+
+static bool ParsePPMHeader(string_view data, PpmHeader& header) {
+    return ParsePPMHeaderPrefix(data, header) == PpmHeaderStatus::OK;
+}
+
+static char GetSignatureDigit(PpmFormat format) {
+    switch (format) {
+        case PpmFormat::P5:
+            return '5';
+        case PpmFormat::P3:
+            return '3';
+        case PpmFormat::P2:
+            return '2';
+        default:
+            return '6';
+    }
+}
+
+static string MakePPMHeader(Size size, const PpmSaveOptions& options = {}) {
+    return string{'P', GetSignatureDigit(options.format)} + "\n" + to_string(size.width) + " "
+           + to_string(size.height) + "\n" + to_string(options.max_value) + "\n";
+}
+
+static bool IsValid(const PpmSaveOptions& options) {
+    return options.max_value >= 1 && options.max_value <= PPM_MAX_WIDE;
+}
+
+
+// ---------- разбор текстовых P2 и P3 ----------
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define IMGLIB_PPM_SWAR 1
+
+// Разбирает число в начале p сразу по 8 байт (SWAR). Сначала по всем байтам сразу
+// ищется первый байт, не являющийся цифрой, затем цифры сворачиваются в значение
+// тремя умножениями. Читает ровно 8 байт. Возвращает количество цифр;
+// 8 - число может продолжаться дальше, и value тогда не вычисляется
+static size_t ParseDigitsSwar(const char* p, uint32_t& value) {
+    uint64_t chunk;
+    std::memcpy(&chunk, p, sizeof(chunk));
+
+    // байт - цифра, если его старшая тетрада 3, а младшая не больше 9
+    const uint64_t high = (chunk & 0xF0F0F0F0F0F0F0F0) ^ 0x3030303030303030;
+    const uint64_t low = ((chunk + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) ^ 0x3030303030303030;
+    const uint64_t non_digit = high | low;
+    // старший бит каждого ненулевого байта; переносы между байтами невозможны
+    const uint64_t mask = (((non_digit & 0x7F7F7F7F7F7F7F7F) + 0x7F7F7F7F7F7F7F7F) | non_digit) & 0x8080808080808080;
+    const size_t length = mask == 0 ? 8 : static_cast<size_t>(__builtin_ctzll(mask)) / 8;
+    if (length == 0 || length == 8) {
+        return length;
+    }
+
+    // цифры сдвигаются к старшим байтам, освободившиеся младшие дают ведущие нули
+    uint64_t digits = chunk << (8 * (8 - length));
+    digits = (digits & 0x0F0F0F0F0F0F0F0F) * 2561 >> 8;
+    digits = (digits & 0x00FF00FF00FF00FF) * 6553601 >> 16;
+    value = static_cast<uint32_t>((digits & 0x0000FFFF0000FFFF) * 42949672960001 >> 32);
+    return length;
+}
+#endif
+
+// Разбирает до count десятичных отсчётов из [pos, end), разделённых пробельными символами.
+// Если final == false, за end текст продолжается, и число, упирающееся в end, может
+// быть не дочитано: разбор останавливается перед ним. pos сдвигается за разобранные отсчёты.
+// Возвращает количество разобранных отсчётов или nullopt, если встретилось не число
+// или значение больше max_value
+static optional<size_t> ParseAsciiSamples(const char*& pos, const char* end, bool final,
+                                          uint16_t* dst, size_t count, int max_value) {
+    const char* p = pos;
+    size_t parsed = 0;
+    while (parsed < count) {
+        while (p < end && IsSpace(*p)) {
+            ++p;
+        }
+        if (p == end) {
+            break;
+        }
+
+        uint32_t value = 0;
+        size_t length = 0;
+#ifdef IMGLIB_PPM_SWAR
+        if (end - p >= 8) {
+            length = ParseDigitsSwar(p, value);
+        }
+#endif
+        // у конца данных и для длинных чисел - по одной цифре
+        if (length == 0 || length == 8) {
+            value = 0;
+            length = 0;
+            while (p + length < end && p[length] >= '0' && p[length] <= '9') {
+                value = min<uint32_t>(value * 10 + (p[length] - '0'), PPM_MAX_WIDE + 1);
+                ++length;
+            }
+        }
+
+        if (p + length == end && !final) {
+            break;
+        }
+        if (length == 0 || value > static_cast<uint32_t>(max_value) || (p + length < end && !IsSpace(p[length]))) {
+            pos = p;
+            return nullopt;
+        }
+        dst[parsed++] = static_cast<uint16_t>(value);
+        p += length;
+    }
+    pos = p;
+    return parsed;
+}
+
+
+// Переводит отсчёты файла в пиксели Color. Отсчёты больше max_value
+// в двоичных файлах считаются равными max_value
+class PpmRowConverter {
+public:
+    explicit PpmRowConverter(const PpmHeader& header)
+        : header_(header)
+        , samples_(header.GetRowSamples()) {
+        if (header_.IsPackedRGB()) {
+            return;
+        }
+        // таблица перевода 0..max_value в 0..255 с округлением
+        scale_.resize(size_t{1} << (8 * GetSampleBytes(header_.max_value)), uint8_t{PPM_MAX});
+        for (int v = 0; v <= header_.max_value; ++v) {
+            scale_[v] = static_cast<uint8_t>((v * PPM_MAX + header_.max_value / 2) / header_.max_value);
+        }
     }
 
-    Image result(w, h, Color::Black());
-    std::vector<char> buff(w * 3);
+    // буфер на строку отсчётов для FromSamples
+    uint16_t* GetSampleBuffer() {
+        return samples_.data();
+    }
+
+    // строка двоичного файла: GetRowBytes() байт
+    void FromBinary(const byte* src, Color* dst) {
+        const int width = header_.size.width;
+        if (header_.IsPackedRGB()) {
+            UnpackRGB(src, dst, width);
+            return;
+        }
+
+        const size_t count = samples_.size();
+        if (GetSampleBytes(header_.max_value) == 1) {
+            for (size_t i = 0; i < count; ++i) {
+                samples_[i] = to_integer<uint16_t>(src[i]);
+            }
+        } else {
+            // двухбайтовые отсчёты записаны старшим байтом вперёд
+            for (size_t i = 0; i < count; ++i) {
+                samples_[i] = static_cast<uint16_t>(to_integer<unsigned>(src[2 * i]) << 8
+                                                    | to_integer<unsigned>(src[2 * i + 1]));
+            }
+        }
+        FromSamples(samples_.data(), dst);
+    }
+
+    // строка отсчётов: GetRowSamples() значений
+    void FromSamples(const uint16_t* samples, Color* dst) const {
+        const int width = header_.size.width;
+        if (GetChannels(header_.format) == 3) {
+            for (int x = 0; x < width; ++x, samples += 3) {
+                dst[x] = {byte{scale_[samples[0]]}, byte{scale_[samples[1]]}, byte{scale_[samples[2]]}, byte{255}};
+            }
+        } else {
+            for (int x = 0; x < width; ++x) {
+                const byte v{scale_[samples[x]]};
+                dst[x] = {v, v, v, byte{255}};
+            }
+        }
+    }
+
+private:
+    PpmHeader header_;
+    vector<uint8_t> scale_;
+    vector<uint16_t> samples_;
+};
+
+
+// Переводит строки изображения в отсчёты файла заданной разновидности
+class PpmRowPacker {
+public:
+    explicit PpmRowPacker(const PpmSaveOptions& options)
+        : options_(options) {
+        for (int v = 0; v <= PPM_MAX; ++v) {
+            scale_[v] = static_cast<uint16_t>((v * options_.max_value + PPM_MAX / 2) / PPM_MAX);
+        }
+    }
+
+    // байт на строку двоичного файла
+    size_t GetRowBytes(int width) const {
+        return static_cast<size_t>(width) * GetChannels(options_.format) * GetSampleBytes(options_.max_value);
+    }
+
+    // строка двоичного файла: GetRowBytes(width) байт
+    template <typename Pixel>
+    void PackBinary(const Pixel* line, byte* dst, int width) const {
+        if (options_.format == PpmFormat::P6 && options_.max_value == PPM_MAX) {
+            PackRowRGB(line, dst, width);
+            return;
+        }
+
+        const bool wide = GetSampleBytes(options_.max_value) == 2;
+        ForEachSample(line, width, [&dst, wide](uint16_t sample) {
+            if (wide) {
+                *dst++ = static_cast<byte>(sample >> 8);
+            }
+            *dst++ = static_cast<byte>(sample);
+        });
+    }
+
+    // Дописывает строку текстового файла в out. Каждая строка изображения
+    // начинается с новой строки текста, длинные переносятся
+    template <typename Pixel>
+    void AppendAscii(const Pixel* line, int width, string& out) const {
+        size_t line_start = out.size();
+        ForEachSample(line, width, [&out, &line_start](uint16_t sample) {
+            char digits[8];
+            const size_t length = to_chars(digits, digits + sizeof(digits), sample).ptr - digits;
+            if (out.size() > line_start) {
+                if (out.size() - line_start + 1 + length > PPM_ASCII_LINE) {
+                    out.push_back('\n');
+                    line_start = out.size();
+                } else {
+                    out.push_back(' ');
+                }
+            }
+            out.append(digits, length);
+        });
+        out.push_back('\n');
+    }
 
-    for (int y = 0; y < h; ++y) {
-        Color* line = result.GetLine(y);
-        ifs.read(buff.data(), w * 3);
+private:
+    // упаковывает строку в RGB; форматы, отличные от Color, приводятся к нему через буфер потока
+    template <typename Pixel>
+    static void PackRowRGB(const Pixel* line, byte* dst, int width) {
+        if constexpr (is_same_v<Pixel, Color>) {
+            PackRGB(line, dst, width);
+        } else {
+            thread_local vector<Color> row;
+            row.resize(width);
+            ConvertRow(line, row.data(), width);
+            PackRGB(row.data(), dst, width);
+        }
+    }
 
-        for (int x = 0; x < w; ++x) {
-            line[x].r = static_cast<byte>(buff[x * 3 + 0]);
-            line[x].g = static_cast<byte>(buff[x * 3 + 1]);
-            line[x].b = static_cast<byte>(buff[x * 3 + 2]);
+    // вызывает emit(отсчёт) для каждого отсчёта строки по порядку: R, G, B или яркость
+    template <typename Pixel, typename Emit>
+    void ForEachSample(const Pixel* line, int width, Emit emit) const {
+        const bool rgb = GetChannels(options_.format) == 3;
+        for (int x = 0; x < width; ++x) {
+            const Color c = PixelTraits<Pixel>::ToColor(line[x]);
+            if (rgb) {
+                emit(scale_[to_integer<int>(c.r)]);
+                emit(scale_[to_integer<int>(c.g)]);
+                emit(scale_[to_integer<int>(c.b)]);
+            } else if constexpr (is_same_v<Pixel, Gray8>) {
+                emit(scale_[to_integer<int>(line[x].v)]);
+            } else {
+                emit(scale_[to_integer<int>(PixelTraits<Gray8>::FromColor(c).v)]);
+            }
         }
     }
 
+    PpmSaveOptions options_;
+    // перевод 0..255 в 0..max_value с округлением
+    array<uint16_t, PPM_MAX + 1> scale_;
+};
+
+
+// Источник строк PPM: заголовок читается при открытии, пиксели - по одной строке.
+// Файл читается с упреждением, поэтому строки разбираются, пока с диска идут следующие
+class PpmSource : public ScanlineSource {
+public:
+    bool Open(const Path& file) {
+        ScopedStageTimer timer(Stage::OPEN);
+        if (!file_.Open(file)) {
+            return false;
+        }
+
+        // заголовок целиком лежит в первом прочитанном блоке
+        const ByteSpan head = file_.Peek();
+        if (!ParsePPMHeader(string_view(reinterpret_cast<const char*>(head.data), head.size), header_)) {
+            return false;
+        }
+        file_.Consume(header_.pixels_offset);
+
+        converter_.emplace(header_);
+        if (!IsAscii(header_.format)) {
+            buff_.resize(header_.GetRowBytes());
+        }
+        return true;
+    }
+
+    Size GetSize() const override {
+        return header_.size;
+    }
+
+    bool ReadRow(Color* line) override {
+        if (IsAscii(header_.format)) {
+            uint16_t* samples = converter_->GetSampleBuffer();
+            {
+                ScopedStageTimer timer(Stage::READ);
+                if (!ReadAsciiSamples(samples, header_.GetRowSamples())) {
+                    return false;
+                }
+            }
+            ScopedStageTimer timer(Stage::CONVERT);
+            converter_->FromSamples(samples, line);
+            return true;
+        }
+
+        {
+            ScopedStageTimer timer(Stage::READ);
+            if (file_.Read(buff_.data(), buff_.size()) != buff_.size()) {
+                return false;
+            }
+        }
+
+        ScopedStageTimer timer(Stage::CONVERT);
+        converter_->FromBinary(reinterpret_cast<const byte*>(buff_.data()), line);
+        return true;
+    }
+
+private:
+    // Число может оказаться разорвано между блоками файла, поэтому текст копится в text_:
+    // недочитанный хвост переносится в начало, и к нему дописывается следующий блок
+    bool ReadAsciiSamples(uint16_t* dst, size_t count) {
+        size_t parsed = 0;
+        while (true) {
+            const char* pos = text_.data() + text_pos_;
+            const optional<size_t> received = ParseAsciiSamples(pos, text_.data() + text_.size(), text_end_,
+                                                                dst + parsed, count - parsed, header_.max_value);
+            if (!received) {
+                return false;
+            }
+            parsed += *received;
+            text_pos_ = pos - text_.data();
+            if (parsed == count) {
+                return true;
+            }
+            if (text_end_) {
+                return false;
+            }
+
+            text_.erase(text_.begin(), text_.begin() + text_pos_);
+            text_pos_ = 0;
+            const ByteSpan block = file_.Peek();
+            if (block.size == 0) {
+                text_end_ = true;
+                if (file_.IsFailed()) {
+                    return false;
+                }
+                continue;
+            }
+            text_.insert(text_.end(), reinterpret_cast<const char*>(block.data),
+                         reinterpret_cast<const char*>(block.data) + block.size);
+            file_.Consume(block.size);
+        }
+    }
+
+    ReadAheadFile file_;
+    PpmHeader header_;
+    optional<PpmRowConverter> converter_;
+    std::vector<char> buff_;
+    // текст P2 и P3, ещё не разобранный до конца
+    std::vector<char> text_;
+    size_t text_pos_ = 0;
+    bool text_end_ = false;
+};
+
+
+// Приёмник строк PPM: заголовок пишется при создании.
+// Строки уходят на диск в фоновом потоке, пока упаковываются следующие
+class PpmSink : public ScanlineSink {
+public:
+    explicit PpmSink(const PpmSaveOptions& options)
+        : options_(options)
+        , packer_(options) {
+    }
+
+    bool Open(const Path& file, Size size) {
+        size_ = size;
+        const string header = MakePPMHeader(size_, options_);
+        // размер текстового файла заранее неизвестен
+        uint64_t file_size = 0;
+        if (!IsAscii(options_.format)) {
+            buff_.resize(packer_.GetRowBytes(size_.width));
+            file_size = header.size() + static_cast<uint64_t>(buff_.size()) * size_.height;
+        }
+
+        if (!file_.Open(file, file_size)) {
+            std::cerr << "Error in input file opening"sv << std::endl;
+            return false;
+        }
+
+        // Записываем заголовок
+        return file_.Write(header.data(), header.size());
+    }
+
+    Size GetSize() const override {
+        return size_;
+    }
+
+    bool WriteRow(const Color* color_line) override {
+        if (rows_written_ >= size_.height) {
+            return false;
+        }
+
+        {
+            ScopedStageTimer timer(Stage::CONVERT);
+            if (IsAscii(options_.format)) {
+                text_.clear();
+                packer_.AppendAscii(color_line, size_.width, text_);
+            } else {
+                packer_.PackBinary(color_line, reinterpret_cast<byte*>(buff_.data()), size_.width);
+            }
+        }
+        {
+            ScopedStageTimer timer(Stage::WRITE);
+            const bool ok = IsAscii(options_.format) ? file_.Write(text_.data(), text_.size())
+                                                     : file_.Write(buff_.data(), buff_.size());
+            if (!ok) {
+                return false;
+            }
+        }
+        ++rows_written_;
+        return true;
+    }
+
+    bool Finish() override {
+        ScopedStageTimer timer(Stage::WRITE);
+        return file_.Close() && rows_written_ == size_.height;
+    }
+
+private:
+    PpmSaveOptions options_;
+    PpmRowPacker packer_;
+    WriteBehindFile file_;
+    Size size_ = {0, 0};
+    int rows_written_ = 0;
+    std::vector<char> buff_;
+    std::string text_;
+};
+
+
+std::unique_ptr<ScanlineSource> OpenPPMSource(const Path& file) {
+    auto source = std::make_unique<PpmSource>();
+    if (!source->Open(file)) {
+        return nullptr;
+    }
+    return source;
+}
+
+std::unique_ptr<ScanlineSink> CreatePPMSink(const Path& file, Size size) {
+    return CreatePPMSink(file, size, {});
+}
+
+std::unique_ptr<ScanlineSink> CreatePPMSink(const Path& file, Size size, const PpmSaveOptions& options) {
+    if (!IsValid(options)) {
+        return nullptr;
+    }
+    auto sink = std::make_unique<PpmSink>(options);
+    if (!sink->Open(file, size)) {
+        return nullptr;
+    }
+    return sink;
+}
+
+std::optional<ImageInfo> ProbePPM(const Path& file) {
+    ScopedStageTimer timer(Stage::HEADER);
+    ifstream ifs(file, ios::binary);
+    if (!ifs.is_open()) {
+        return nullopt;
+    }
+
+    // Заголовок обычно умещается в первый блок, но комментарии могут его удлинить:
+    // тогда блок удваивается до PPM_MAX_HEADER_BYTES. Испорченный заголовок
+    // отвергается сразу, не дочитывая файл
+    string head;
+    PpmHeader header;
+    while (true) {
+        const PpmHeaderStatus status = ParsePPMHeaderPrefix(head, header);
+        if (status == PpmHeaderStatus::OK) {
+            break;
+        }
+        if (status == PpmHeaderStatus::INVALID || head.size() >= PPM_MAX_HEADER_BYTES) {
+            return nullopt;
+        }
+        const size_t old_size = head.size();
+        head.resize(min(PPM_MAX_HEADER_BYTES, max(PPM_PROBE_BYTES, old_size * 2)));
+        ifs.read(head.data() + old_size, static_cast<streamsize>(head.size() - old_size));
+        AddCounter(Counter::BYTES_READ, ifs.gcount());
+        head.resize(old_size + static_cast<size_t>(ifs.gcount()));
+        if (head.size() == old_size) {
+            return nullopt;
+        }
+    }
+
+    ImageInfo info;
+    info.size = header.size;
+    // файл читается с упреждением; строка текстового файла разбирается в отсчёты по 2 байта
+    info.decoder_bytes = ReadAheadFile::GetMaxBufferBytes(file)
+        + (IsAscii(header.format) ? header.GetRowSamples() * sizeof(uint16_t) : header.GetRowBytes());
+    return info;
+}
+
+
+// Текстовый файл собирается построчно в одном потоке
+template <typename Pixel>
+static string MakeAsciiPPM(BasicImageView<const Pixel> image, const PpmSaveOptions& options) {
+    ScopedStageTimer timer(Stage::CONVERT);
+    const PpmRowPacker packer(options);
+    string text = MakePPMHeader({image.GetWidth(), image.GetHeight()}, options);
+    for (int y = 0; y < image.GetHeight(); ++y) {
+        packer.AppendAscii(image.GetLine(y), image.GetWidth(), text);
+    }
+    return text;
+}
+
+// Размер двоичного файла известен заранее, поэтому строки упаковываются и записываются
+// полосами прямо на свои места в файле, в том числе из нескольких потоков
+template <typename Pixel>
+static bool SavePPMImpl(const Path& file, BasicImageView<const Pixel> image, const PpmSaveOptions& options) {
+    if (!IsValid(options)) {
+        return false;
+    }
+
+    OutputFile out;
+    if (IsAscii(options.format)) {
+        const string text = MakeAsciiPPM(image, options);
+        if (!out.Open(file, text.size())) {
+            std::cerr << "Error in input file opening"sv << std::endl;
+            return false;
+        }
+        const bool ok = out.WriteAt(0, text.data(), text.size());
+        return out.Close() && ok;
+    }
+
+    const int width = image.GetWidth();
+    const int height = image.GetHeight();
+    const string header = MakePPMHeader({width, height}, options);
+    const PpmRowPacker packer(options);
+    const size_t row_bytes = packer.GetRowBytes(width);
+
+    if (!out.Open(file, header.size() + row_bytes * height)) {
+        std::cerr << "Error in input file opening"sv << std::endl;
+        return false;
+    }
+
+    const bool ok = out.WriteAt(0, header.data(), header.size())
+                    && WriteRowsParallel(out, header.size(), row_bytes, height, false, options.threads,
+                                         [&image, &packer, width](int y, byte* dst) {
+        packer.PackBinary(image.GetLine(y), dst, width);
+    });
+
+    return out.Close() && ok;
+}
+
+bool SavePPM(const Path& file, ImageView image) {
+    return SavePPMImpl(file, image, {});
+}
+
+bool SavePPM(const Path& file, ImageView image, const PpmSaveOptions& options) {
+    return SavePPMImpl(file, image, options);
+}
+
+bool SavePPM(const Path& file, RGBImageView image) {
+    return SavePPMImpl(file, image, {});
+}
+
+bool SavePPM(const Path& file, GrayImageView image) {
+    return SavePPMImpl(file, image, {});
+}
+
+bool SavePPM(const Path& file, RGBImageView image, const PpmSaveOptions& options) {
+    return SavePPMImpl(file, image, options);
+}
+
+bool SavePPM(const Path& file, GrayImageView image, const PpmSaveOptions& options) {
+    return SavePPMImpl(file, image, options);
+}
+
+// то же в буфер памяти: out получает содержимое файла целиком
+template <typename Pixel>
+static bool SavePPMImpl(ByteBuffer& out, BasicImageView<const Pixel> image, const PpmSaveOptions& options) {
+    if (!IsValid(options)) {
+        return false;
+    }
+
+    if (IsAscii(options.format)) {
+        const string text = MakeAsciiPPM(image, options);
+        const byte* data = reinterpret_cast<const byte*>(text.data());
+        out.assign(data, data + text.size());
+        return true;
+    }
+
+    const int width = image.GetWidth();
+    const int height = image.GetHeight();
+    const string header = MakePPMHeader({width, height}, options);
+    const PpmRowPacker packer(options);
+    const size_t row_bytes = packer.GetRowBytes(width);
+
+    out.resize(header.size() + row_bytes * height);
+    std::memcpy(out.data(), header.data(), header.size());
+    FillRowsParallel(out.data() + header.size(), row_bytes, height, false, options.threads,
+                     [&image, &packer, width](int y, byte* dst) {
+        packer.PackBinary(image.GetLine(y), dst, width);
+    });
+    return true;
+}
+
+bool SavePPM(ByteBuffer& out, ImageView image) {
+    return SavePPMImpl(out, image, {});
+}
+
+bool SavePPM(ByteBuffer& out, ImageView image, const PpmSaveOptions& options) {
+    return SavePPMImpl(out, image, options);
+}
+
+bool SavePPM(ByteBuffer& out, RGBImageView image) {
+    return SavePPMImpl(out, image, {});
+}
+
+bool SavePPM(ByteBuffer& out, GrayImageView image) {
+    return SavePPMImpl(out, image, {});
+}
+
+bool SavePPM(ByteBuffer& out, RGBImageView image, const PpmSaveOptions& options) {
+    return SavePPMImpl(out, image, options);
+}
+
+bool SavePPM(ByteBuffer& out, GrayImageView image, const PpmSaveOptions& options) {
+    return SavePPMImpl(out, image, options);
+}
+
+// Разбирает заголовок файла, целиком лежащего в памяти. Для P6 с наибольшим
+// значением 255 в view записывается представление пикселей без копирования
+static bool ParsePPM(ByteSpan file, PpmHeader& header, std::optional<PackedRowsView>& view) {
+    const string_view data(reinterpret_cast<const char*>(file.data), file.size);
+    if (!ParsePPMHeader(data, header)) {
+        return false;
+    }
+
+    // текст проверяется при разборе, двоичные строки должны поместиться целиком
+    if (!IsAscii(header.format) && header.pixels_offset + header.GetRowBytes() * header.size.height > data.size()) {
+        return false;
+    }
+
+    if (header.IsPackedRGB()) {
+        PackedRowsView packed;
+        packed.top_row = file.data + header.pixels_offset;
+        packed.row_step = header.GetRowBytes();
+        packed.size = header.size;
+        packed.order = ChannelOrder::RGB;
+        view = packed;
+    }
+    return true;
+}
+
+// Переводит в изображение файл в памяти, пиксели которого нельзя взять как есть
+template <typename Pixel>
+static BasicImage<Pixel> DecodePPMAs(ByteSpan file, const PpmHeader& header) {
+    ScopedStageTimer timer(Stage::CONVERT);
+    const int width = header.size.width;
+    const size_t row_samples = header.GetRowSamples();
+    PpmRowConverter converter(header);
+    BasicImage<Pixel> result(width, header.size.height);
+    std::vector<Color> row_buffer;
+    if constexpr (!is_same_v<Pixel, Color>) {
+        row_buffer.resize(width);
+    }
+
+    const char* pos = reinterpret_cast<const char*>(file.data + header.pixels_offset);
+    const char* end = reinterpret_cast<const char*>(file.data + file.size);
+    for (int y = 0; y < header.size.height; ++y) {
+        Color* line = nullptr;
+        if constexpr (is_same_v<Pixel, Color>) {
+            line = result.GetLine(y);
+        } else {
+            line = row_buffer.data();
+        }
+
+        if (IsAscii(header.format)) {
+            uint16_t* samples = converter.GetSampleBuffer();
+            const optional<size_t> parsed = ParseAsciiSamples(pos, end, true, samples, row_samples, header.max_value);
+            if (parsed != row_samples) {
+                return {};
+            }
+            converter.FromSamples(samples, line);
+        } else {
+            converter.FromBinary(file.data + header.pixels_offset + header.GetRowBytes() * y, line);
+        }
+
+        if constexpr (!is_same_v<Pixel, Color>) {
+            ConvertRow(line, result.GetLine(y), width);
+        }
+    }
     return result;
 }
 
+std::optional<MappedImage> MapPPM(const Path& file) {
+    MappedFile mapped;
+    if (!mapped.Open(file)) {
+        return std::nullopt;
+    }
+
+    PpmHeader header;
+    std::optional<PackedRowsView> view;
+    if (!ParsePPM({mapped.GetData(), mapped.GetSize()}, header, view) || !view) {
+        return std::nullopt;
+    }
+    return MappedImage(std::move(mapped), *view);
+}
+
+template <typename Pixel>
+BasicImage<Pixel> LoadPPMAs(const Path& file) {
+    // на POSIX-системах файл отображается в память, и пиксели
+    // переставляются или переводятся прямо из отображения в изображение
+    if (MappedFile mapped; mapped.Open(file)) {
+        PpmHeader header;
+        std::optional<PackedRowsView> view;
+        if (!ParsePPM({mapped.GetData(), mapped.GetSize()}, header, view)) {
+            return {};
+        }
+        if (view) {
+            return MappedImage(std::move(mapped), *view).ToImageAs<Pixel>();
+        }
+        AddCounter(Counter::BYTES_READ, mapped.GetSize());
+        return DecodePPMAs<Pixel>({mapped.GetData(), mapped.GetSize()}, header);
+    }
+
+    auto source = OpenPPMSource(file);
+    if (!source) {
+        return {};
+    }
+    return ReadImageAs<Pixel>(*source);
+}
+
+template Image LoadPPMAs<Color>(const Path& file);
+template RGBImage LoadPPMAs<RGB24>(const Path& file);
+template GrayImage LoadPPMAs<Gray8>(const Path& file);
+
+Image LoadPPM(const Path& file) {
+    return LoadPPMAs<Color>(file);
+}
+
+template <typename Pixel>
+BasicImage<Pixel> LoadPPMAs(ByteSpan data) {
+    PpmHeader header;
+    std::optional<PackedRowsView> view;
+    if (!ParsePPM(data, header, view)) {
+        return {};
+    }
+    return view ? UnpackRowsAs<Pixel>(*view) : DecodePPMAs<Pixel>(data, header);
+}
+
+template Image LoadPPMAs<Color>(ByteSpan data);
+template RGBImage LoadPPMAs<RGB24>(ByteSpan data);
+template GrayImage LoadPPMAs<Gray8>(ByteSpan data);
+
+Image LoadPPM(ByteSpan data) {
+    return LoadPPMAs<Color>(data);
+}
+
 }  // namespace img_lib
\ No newline at end of file
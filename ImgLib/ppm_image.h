@@ -1,12 +1,77 @@
 #pragma once
 #include "img_lib.h"
+#include "mapped_file.h"
+#include "scanline.h"
 
 #include <filesystem>
+#include <memory>
+#include <optional>
 
 namespace img_lib {
 using Path = std::filesystem::path;
 
-bool SavePPM(const Path& file, const Image& image);
+// Разновидности формата: P6 и P5 - двоичные, цветной и в оттенках серого (PGM),
+// P3 и P2 - то же, но отсчёты записаны десятичными числами
+enum class PpmFormat {
+    P6,
+    P5,
+    P3,
+    P2
+};
+
+struct PpmSaveOptions {
+    // Потоков на упаковку строк (0 - по числу ядер). Файл создаётся сразу
+    // нужного размера, и потоки записывают в него непересекающиеся полосы строк.
+    // Текстовые форматы пишутся в одном потоке
+    size_t threads = 1;
+    PpmFormat format = PpmFormat::P6;
+    // Наибольшее значение отсчёта, 1..65535. Больше 255 - по два байта на отсчёт
+    // в двоичных форматах; восьмибитные значения пикселей растягиваются до него
+    int max_value = 255;
+};
+
+// Загрузка понимает P2, P3, P5 и P6 с любым наибольшим значением до 65535 включительно
+// и комментариями в заголовке. Отсчёты приводятся к 0..255 с округлением
+bool SavePPM(const Path& file, ImageView image);
+bool SavePPM(const Path& file, ImageView image, const PpmSaveOptions& options);
 Image LoadPPM(const Path& file);
 
+// Загружает изображение сразу в заданный формат пикселей: Color, RGB24 или Gray8
+template <typename Pixel>
+BasicImage<Pixel> LoadPPMAs(const Path& file);
+
+// сохранение изображений без альфа-канала и в оттенках серого
+bool SavePPM(const Path& file, RGBImageView image);
+bool SavePPM(const Path& file, GrayImageView image);
+bool SavePPM(const Path& file, RGBImageView image, const PpmSaveOptions& options);
+bool SavePPM(const Path& file, GrayImageView image, const PpmSaveOptions& options);
+
+// Построчное чтение и запись PPM. При ошибке открытия или
+// некорректном заголовке возвращается nullptr
+std::unique_ptr<ScanlineSource> OpenPPMSource(const Path& file);
+std::unique_ptr<ScanlineSink> CreatePPMSink(const Path& file, Size size);
+std::unique_ptr<ScanlineSink> CreatePPMSink(const Path& file, Size size, const PpmSaveOptions& options);
+
+// Читает только заголовок: размер изображения и память источника строк.
+// nullopt - если файл не открывается или заголовок некорректен
+std::optional<ImageInfo> ProbePPM(const Path& file);
+
+// Отображает P6 в память и возвращает представление его строк без копирования.
+// nullopt - если отображение недоступно, файл некорректен или это не P6
+// с наибольшим значением 255: пиксели остальных разновидностей нужно переводить
+std::optional<MappedImage> MapPPM(const Path& file);
+
+// Чтение и запись PPM в памяти - без временных файлов. data - содержимое файла,
+// out получает содержимое файла целиком; прежнее содержимое out заменяется
+Image LoadPPM(ByteSpan data);
+template <typename Pixel>
+BasicImage<Pixel> LoadPPMAs(ByteSpan data);
+
+bool SavePPM(ByteBuffer& out, ImageView image);
+bool SavePPM(ByteBuffer& out, ImageView image, const PpmSaveOptions& options);
+bool SavePPM(ByteBuffer& out, RGBImageView image);
+bool SavePPM(ByteBuffer& out, GrayImageView image);
+bool SavePPM(ByteBuffer& out, RGBImageView image, const PpmSaveOptions& options);
+bool SavePPM(ByteBuffer& out, GrayImageView image, const PpmSaveOptions& options);
+
 }  // namespace img_lib
\ No newline at end of file
@@ -0,0 +1,502 @@
+#include "resample.h"
+#include "parallel.h"
+#include "pixel_kernels.h"
+#include "simd_target.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace img_lib {
+
+Size FitWithin(Size src, Size box) {
+    if (src.width <= box.width && src.height <= box.height) {
+        return src;
+    }
+
+    const double ratio = std::min(static_cast<double>(box.width) / src.width,
+                                  static_cast<double>(box.height) / src.height);
+    return {std::max(1, static_cast<int>(std::lround(src.width * ratio))),
+            std::max(1, static_cast<int>(std::lround(src.height * ratio)))};
+}
+
+
+// веса хранятся с фиксированной точкой: единице соответствует WEIGHT_ONE
+static const int WEIGHT_BITS = 14;
+static const int WEIGHT_ONE = 1 << WEIGHT_BITS;
+static const int WEIGHT_HALF = WEIGHT_ONE / 2;
+
+// столько строк обрабатывает поток за один раз
+static const int BAND_ROWS = 16;
+
+static const double PI = 3.14159265358979323846;
+
+// ---------- ядра фильтров ----------
+
+static double Triangle(double x) {
+    x = std::abs(x);
+    return x < 1. ? 1. - x : 0.;
+}
+
+// кубический фильтр Кейса с параметром a = -0.5
+static double Cubic(double x) {
+    const double a = -0.5;
+    x = std::abs(x);
+    if (x < 1.) {
+        return ((a + 2.) * x - (a + 3.)) * x * x + 1.;
+    }
+    if (x < 2.) {
+        return ((a * x - 5. * a) * x + 8. * a) * x - 4. * a;
+    }
+    return 0.;
+}
+
+static double Sinc(double x) {
+    if (x == 0.) {
+        return 1.;
+    }
+    x *= PI;
+    return std::sin(x) / x;
+}
+
+static double Lanczos3(double x) {
+    return std::abs(x) < 3. ? Sinc(x) * Sinc(x / 3.) : 0.;
+}
+
+struct FilterKernel {
+    double (*weight)(double x);
+    // радиус ядра при масштабе 1:1
+    double support;
+};
+
+static FilterKernel GetFilterKernel(ResampleFilter filter) {
+    switch (filter) {
+        case ResampleFilter::BICUBIC:
+            return {Cubic, 2.};
+        case ResampleFilter::LANCZOS3:
+            return {Lanczos3, 3.};
+        default:
+            return {Triangle, 1.};
+    }
+}
+
+// Веса для одного направления: координата результата i складывается
+// из count[i] исходных отсчётов подряд, начиная с first[i]
+struct FilterWeights {
+    std::vector<int> first;
+    std::vector<int> count;
+    std::vector<int16_t> weights;
+    int stride = 0;
+
+    const int16_t* Get(int i) const {
+        return weights.data() + static_cast<size_t>(i) * stride;
+    }
+};
+
+// Наибольшее число исходных отсчётов на один отсчёт результата: при уменьшении
+// ядро растягивается на весь участок исходника, который приходится на один отсчёт результата
+static int GetFilterTaps(int src_len, int dst_len, ResampleFilter filter) {
+    if (filter == ResampleFilter::NEAREST) {
+        return 1;
+    }
+    const double filter_scale = std::max(static_cast<double>(src_len) / dst_len, 1.);
+    return static_cast<int>(std::ceil(GetFilterKernel(filter).support * filter_scale)) * 2 + 1;
+}
+
+static FilterWeights ComputeWeights(int src_len, int dst_len, ResampleFilter filter) {
+    FilterWeights result;
+    result.first.resize(dst_len);
+    result.count.resize(dst_len);
+    const double scale = static_cast<double>(src_len) / dst_len;
+
+    if (filter == ResampleFilter::NEAREST) {
+        result.stride = 1;
+        result.weights.assign(dst_len, WEIGHT_ONE);
+        for (int i = 0; i < dst_len; ++i) {
+            result.first[i] = std::min(static_cast<int>((i + 0.5) * scale), src_len - 1);
+            result.count[i] = 1;
+        }
+        return result;
+    }
+
+    const FilterKernel kernel = GetFilterKernel(filter);
+    const double filter_scale = std::max(scale, 1.);
+    const double support = kernel.support * filter_scale;
+    result.stride = GetFilterTaps(src_len, dst_len, filter);
+    result.weights.assign(static_cast<size_t>(dst_len) * result.stride, 0);
+
+    std::vector<double> values(result.stride);
+    for (int i = 0; i < dst_len; ++i) {
+        const double center = (i + 0.5) * scale;
+        int first = std::max(0, static_cast<int>(center - support + 0.5));
+        const int last = std::min(src_len, static_cast<int>(center + support + 0.5));
+        int count = std::min(last - first, result.stride);
+
+        double sum = 0.;
+        for (int k = 0; k < count; ++k) {
+            values[k] = kernel.weight((first + k + 0.5 - center) / filter_scale);
+            sum += values[k];
+        }
+        if (sum == 0.) {
+            sum = 1.;
+        }
+
+        int16_t* weights = result.weights.data() + static_cast<size_t>(i) * result.stride;
+        int total = 0;
+        int largest = 0;
+        for (int k = 0; k < count; ++k) {
+            const long value = std::lround(values[k] / sum * WEIGHT_ONE);
+            weights[k] = static_cast<int16_t>(std::clamp(value, -32767L, 32767L));
+            total += weights[k];
+            if (std::abs(weights[k]) > std::abs(weights[largest])) {
+                largest = k;
+            }
+        }
+        // после округления сумма весов может отличаться от единицы; поправка уходит
+        // в наибольший вес, чтобы однотонные области не меняли цвет
+        weights[largest] = static_cast<int16_t>(weights[largest] + WEIGHT_ONE - total);
+
+        // нулевые веса по краям - лишняя работа
+        while (count > 1 && weights[count - 1] == 0) {
+            --count;
+        }
+        int skip = 0;
+        while (skip + 1 < count && weights[skip] == 0) {
+            ++skip;
+        }
+        if (skip > 0) {
+            std::copy(weights + skip, weights + count, weights);
+            std::fill(weights + count - skip, weights + count, 0);
+            first += skip;
+            count -= skip;
+        }
+
+        result.first[i] = first;
+        result.count[i] = count;
+    }
+    return result;
+}
+
+// ---------- переносимая реализация проходов ----------
+
+static std::byte ClampChannel(int sum) {
+    return static_cast<std::byte>(std::clamp(sum >> WEIGHT_BITS, 0, 255));
+}
+
+static void ResampleRowScalar(const Color* src, Color* dst, int width, const FilterWeights& filter) {
+    for (int x = 0; x < width; ++x) {
+        const Color* pixels = src + filter.first[x];
+        const int16_t* weights = filter.Get(x);
+
+        int r = WEIGHT_HALF, g = WEIGHT_HALF, b = WEIGHT_HALF, a = WEIGHT_HALF;
+        for (int k = 0; k < filter.count[x]; ++k) {
+            r += std::to_integer<int>(pixels[k].r) * weights[k];
+            g += std::to_integer<int>(pixels[k].g) * weights[k];
+            b += std::to_integer<int>(pixels[k].b) * weights[k];
+            a += std::to_integer<int>(pixels[k].a) * weights[k];
+        }
+        dst[x] = {ClampChannel(r), ClampChannel(g), ClampChannel(b), ClampChannel(a)};
+    }
+}
+
+// столбцы [from, to) вертикального прохода
+static void ResampleColumnRange(const Color* const* rows, const int16_t* weights, int count, Color* dst, int from, int to) {
+    for (int x = from; x < to; ++x) {
+        int r = WEIGHT_HALF, g = WEIGHT_HALF, b = WEIGHT_HALF, a = WEIGHT_HALF;
+        for (int k = 0; k < count; ++k) {
+            const Color pixel = rows[k][x];
+            r += std::to_integer<int>(pixel.r) * weights[k];
+            g += std::to_integer<int>(pixel.g) * weights[k];
+            b += std::to_integer<int>(pixel.b) * weights[k];
+            a += std::to_integer<int>(pixel.a) * weights[k];
+        }
+        dst[x] = {ClampChannel(r), ClampChannel(g), ClampChannel(b), ClampChannel(a)};
+    }
+}
+
+static void ResampleColumnsScalar(const Color* const* rows, const int16_t* weights, int count, Color* dst, int width) {
+    ResampleColumnRange(rows, weights, count, dst, 0, width);
+}
+
+#ifdef IMGLIB_X86_KERNELS
+
+// ---------- SSSE3: пары отсчётов через pmaddwd ----------
+
+// пара весов, размноженная на все четыре 32-битные ячейки
+IMGLIB_TARGET_SSSE3 static __m128i WeightPair(int16_t w0, int16_t w1) {
+    return _mm_set1_epi32(static_cast<int>(static_cast<uint16_t>(w0) | (static_cast<uint32_t>(static_cast<uint16_t>(w1)) << 16)));
+}
+
+// четыре суммы 32 бита -> Color с насыщением до 0..255
+IMGLIB_TARGET_SSSE3 static __m128i PackSums(__m128i lo, __m128i hi) {
+    lo = _mm_srai_epi32(lo, WEIGHT_BITS);
+    hi = _mm_srai_epi32(hi, WEIGHT_BITS);
+    const __m128i words = _mm_packs_epi32(lo, hi);
+    return _mm_packus_epi16(words, words);
+}
+
+IMGLIB_TARGET_SSSE3 static void ResampleRowSSSE3(const Color* src, Color* dst, int width, const FilterWeights& filter) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi32(WEIGHT_HALF);
+
+    for (int x = 0; x < width; ++x) {
+        const Color* pixels = src + filter.first[x];
+        const int16_t* weights = filter.Get(x);
+        const int count = filter.count[x];
+
+        __m128i sum = half;
+        int k = 0;
+        for (; k + 2 <= count; k += 2) {
+            // r0 g0 b0 a0 r1 g1 b1 a1 -> r0 r1 g0 g1 b0 b1 a0 a1
+            __m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pixels + k)), zero);
+            v = _mm_unpacklo_epi16(v, _mm_srli_si128(v, 8));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(v, WeightPair(weights[k], weights[k + 1])));
+        }
+        if (k < count) {
+            int32_t pixel;
+            std::memcpy(&pixel, pixels + k, sizeof(pixel));
+            const __m128i v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(pixel), zero), zero);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(v, WeightPair(weights[k], 0)));
+        }
+
+        const int32_t packed = _mm_cvtsi128_si32(PackSums(sum, sum));
+        std::memcpy(dst + x, &packed, sizeof(packed));
+    }
+}
+
+// Четыре пикселя за итерацию: каналы двух строк чередуются,
+// и pmaddwd сразу даёт сумму вклада обеих строк
+IMGLIB_TARGET_SSSE3 static void ResampleColumnsSSSE3(const Color* const* rows, const int16_t* weights, int count, Color* dst, int width) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi32(WEIGHT_HALF);
+
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i sum0 = half, sum1 = half, sum2 = half, sum3 = half;
+
+        for (int k = 0; k < count; k += 2) {
+            const bool has_pair = k + 1 < count;
+            const __m128i pair = WeightPair(weights[k], has_pair ? weights[k + 1] : 0);
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k] + x));
+            const __m128i b = has_pair ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k + 1] + x)) : zero;
+
+            const __m128i a_lo = _mm_unpacklo_epi8(a, zero);
+            const __m128i b_lo = _mm_unpacklo_epi8(b, zero);
+            const __m128i a_hi = _mm_unpackhi_epi8(a, zero);
+            const __m128i b_hi = _mm_unpackhi_epi8(b, zero);
+            sum0 = _mm_add_epi32(sum0, _mm_madd_epi16(_mm_unpacklo_epi16(a_lo, b_lo), pair));
+            sum1 = _mm_add_epi32(sum1, _mm_madd_epi16(_mm_unpackhi_epi16(a_lo, b_lo), pair));
+            sum2 = _mm_add_epi32(sum2, _mm_madd_epi16(_mm_unpacklo_epi16(a_hi, b_hi), pair));
+            sum3 = _mm_add_epi32(sum3, _mm_madd_epi16(_mm_unpackhi_epi16(a_hi, b_hi), pair));
+        }
+
+        sum0 = _mm_srai_epi32(sum0, WEIGHT_BITS);
+        sum1 = _mm_srai_epi32(sum1, WEIGHT_BITS);
+        sum2 = _mm_srai_epi32(sum2, WEIGHT_BITS);
+        sum3 = _mm_srai_epi32(sum3, WEIGHT_BITS);
+        const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(sum0, sum1), _mm_packs_epi32(sum2, sum3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), packed);
+    }
+
+    ResampleColumnRange(rows, weights, count, dst, x, width);
+}
+
+#endif  // IMGLIB_X86_KERNELS
+
+
+struct ResampleKernels {
+    // горизонтальный проход: одна строка исходника -> одна строка результата
+    void (*row)(const Color* src, Color* dst, int width, const FilterWeights& filter);
+    // вертикальный проход: взвешенная сумма count строк
+    void (*columns)(const Color* const* rows, const int16_t* weights, int count, Color* dst, int width);
+};
+
+static const ResampleKernels& GetResampleKernels() {
+    static const ResampleKernels scalar = {ResampleRowScalar, ResampleColumnsScalar};
+#ifdef IMGLIB_X86_KERNELS
+    static const ResampleKernels ssse3 = {ResampleRowSSSE3, ResampleColumnsSSSE3};
+    if (GetBestKernelLevel() != KernelLevel::SCALAR) {
+        return ssse3;
+    }
+#endif
+    return scalar;
+}
+
+Image Resize(ImageView src, Size size, const ResizeOptions& options) {
+    if (!src || size.width <= 0 || size.height <= 0) {
+        return {};
+    }
+
+    ScopedStageTimer timer(Stage::RESIZE);
+    const ResampleKernels& kernels = GetResampleKernels();
+    const int src_width = src.GetWidth();
+    const int src_height = src.GetHeight();
+
+    const bool resize_rows = size.height != src_height;
+    FilterWeights vertical;
+    if (resize_rows) {
+        vertical = ComputeWeights(src_height, size.height, options.filter);
+    }
+
+    // Горизонтальный проход даёт изображение ширины результата и высоты исходника.
+    // Строки, которые не понадобятся вертикальному проходу, пропускаются
+    ImageView columns_src = src;
+    Image horizontal;
+    if (size.width != src_width) {
+        std::vector<char> needed(src_height, !resize_rows);
+        for (int y = 0; resize_rows && y < size.height; ++y) {
+            std::fill_n(needed.begin() + vertical.first[y], vertical.count[y], 1);
+        }
+
+        const FilterWeights weights = ComputeWeights(src_width, size.width, options.filter);
+        horizontal = Image(size.width, src_height);
+        ParallelFor(0, src_height, BAND_ROWS, options.threads, [&](int from, int to) {
+            for (int y = from; y < to; ++y) {
+                if (needed[y]) {
+                    kernels.row(src.GetLine(y), horizontal.GetLine(y), size.width, weights);
+                }
+            }
+        });
+        columns_src = horizontal;
+    }
+
+    if (!resize_rows) {
+        // размер не меняется - результат всё равно отдельное изображение
+        return horizontal ? std::move(horizontal) : Image(src);
+    }
+
+    Image result(size.width, size.height);
+    ParallelFor(0, size.height, BAND_ROWS, options.threads, [&](int from, int to) {
+        std::vector<const Color*> rows(vertical.stride);
+        for (int y = from; y < to; ++y) {
+            const int count = vertical.count[y];
+            for (int k = 0; k < count; ++k) {
+                rows[k] = columns_src.GetLine(vertical.first[y] + k);
+            }
+            kernels.columns(rows.data(), vertical.Get(y), count, result.GetLine(y), size.width);
+        }
+    });
+
+    return result;
+}
+
+bool Resize(ScanlineSource& source, Size size, ScanlineSink& sink, const ResizeOptions& options) {
+    const Size src_size = source.GetSize();
+    if (src_size.width <= 0 || src_size.height <= 0 || size.width <= 0 || size.height <= 0) {
+        return false;
+    }
+
+    const ResampleKernels& kernels = GetResampleKernels();
+    const bool resize_columns = size.width != src_size.width;
+    const bool resize_rows = size.height != src_size.height;
+    FilterWeights horizontal;
+    if (resize_columns) {
+        horizontal = ComputeWeights(src_size.width, size.width, options.filter);
+    }
+
+    // Без изменения высоты каждая строка исходника сразу даёт строку результата.
+    // Иначе строка y складывается из строк [first[y], first[y] + count[y]) - прочитанные
+    // строки после горизонтального прохода хранятся в кольцевом окне
+    FilterWeights vertical;
+    std::vector<int> lowest_needed;
+    int window_rows = 1;
+    if (resize_rows) {
+        vertical = ComputeWeights(src_size.height, size.height, options.filter);
+        // first почти не убывает, но обрезка нулевых весов может сдвинуть его назад;
+        // строка отбрасывается, только когда она не нужна ни одной следующей строке результата
+        lowest_needed.resize(size.height);
+        int lowest = src_size.height;
+        for (int y = size.height - 1; y >= 0; --y) {
+            lowest = std::min(lowest, vertical.first[y]);
+            lowest_needed[y] = lowest;
+        }
+        int last_needed = 0;
+        for (int y = 0; y < size.height; ++y) {
+            last_needed = std::max(last_needed, vertical.first[y] + vertical.count[y]);
+            window_rows = std::max(window_rows, last_needed - lowest_needed[y]);
+        }
+    }
+
+    std::vector<Color> src_row(resize_columns ? src_size.width : 0);
+    std::vector<Color> window(static_cast<size_t>(window_rows) * size.width);
+    const auto window_row = [&](int src_y) {
+        return window.data() + static_cast<size_t>(src_y % window_rows) * size.width;
+    };
+
+    // читает следующую строку исходника в окно
+    int rows_read = 0;
+    const auto read_row = [&]() {
+        Color* dst = window_row(rows_read++);
+        if (!resize_columns) {
+            return source.ReadRow(dst);
+        }
+        if (!source.ReadRow(src_row.data())) {
+            return false;
+        }
+        ScopedStageTimer timer(Stage::RESIZE);
+        kernels.row(src_row.data(), dst, size.width, horizontal);
+        return true;
+    };
+
+    if (!resize_rows) {
+        for (int y = 0; y < size.height; ++y) {
+            if (!read_row() || !sink.WriteRow(window_row(y))) {
+                return false;
+            }
+        }
+        return sink.Finish();
+    }
+
+    std::vector<Color> dst_row(size.width);
+    std::vector<const Color*> rows(vertical.stride);
+    for (int y = 0; y < size.height; ++y) {
+        const int first = vertical.first[y];
+        const int count = vertical.count[y];
+        while (rows_read < first + count) {
+            // строка, которая займёт место в окне, должна быть уже не нужна
+            assert(rows_read - window_rows < lowest_needed[y]);
+            if (!read_row()) {
+                return false;
+            }
+        }
+
+        {
+            ScopedStageTimer timer(Stage::RESIZE);
+            for (int k = 0; k < count; ++k) {
+                rows[k] = window_row(first + k);
+            }
+            kernels.columns(rows.data(), vertical.Get(y), count, dst_row.data(), size.width);
+        }
+        if (!sink.WriteRow(dst_row.data())) {
+            return false;
+        }
+    }
+
+    // строки исходника ниже последней нужной не читаются вовсе
+    return sink.Finish();
+}
+
+uint64_t EstimateResizeMemory(Size src, Size size, const ResizeOptions& options, bool streaming) {
+    const uint64_t pixel_bytes = sizeof(Color);
+    const int column_taps = GetFilterTaps(src.width, size.width, options.filter);
+    const int row_taps = GetFilterTaps(src.height, size.height, options.filter);
+    // веса по 2 байта и начало с длиной для каждой строки и столбца результата
+    const uint64_t weights = (static_cast<uint64_t>(size.width) * column_taps + static_cast<uint64_t>(size.height) * row_taps)
+                             * sizeof(int16_t) + (static_cast<uint64_t>(size.width) + size.height) * 2 * sizeof(int);
+    if (streaming) {
+        // исходная строка и окно строк после горизонтального прохода
+        return weights + (static_cast<uint64_t>(src.width) + static_cast<uint64_t>(row_taps) * size.width) * pixel_bytes;
+    }
+
+    const uint64_t result = static_cast<uint64_t>(size.width) * size.height * pixel_bytes;
+    const uint64_t horizontal = size.width != src.width && size.height != src.height
+        ? static_cast<uint64_t>(size.width) * src.height * pixel_bytes
+        : 0;
+    return weights + horizontal + result;
+}
+
+}  // namespace img_lib
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+#include "img_lib.h"
+#include "scanline.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace img_lib {
+
+// Вписывает размер src в прямоугольник box с сохранением пропорций.
+// Изображения, которые уже помещаются в box, не увеличиваются
+Size FitWithin(Size src, Size box);
+
+// Фильтры масштабирования, от самого быстрого к самому качественному
+enum class ResampleFilter {
+    NEAREST,
+    BILINEAR,
+    BICUBIC,
+    LANCZOS3
+};
+
+struct ResizeOptions {
+    ResampleFilter filter = ResampleFilter::BILINEAR;
+    // 0 - по числу ядер процессора
+    size_t threads = 0;
+};
+
+// Масштабирует изображение до заданного размера раздельным фильтром:
+// сначала по горизонтали, затем по вертикали. Веса фильтра вычисляются
+// заранее для каждой строки и столбца результата, при уменьшении фильтр
+// расширяется, чтобы не было муара. Строки делятся на полосы, которые
+// обрабатываются параллельно. src может быть частью изображения
+Image Resize(ImageView src, Size size, const ResizeOptions& options = {});
+
+// То же потоком: строки читаются из source и по мере готовности записываются в sink,
+// запись завершается. В памяти держится лишь окно исходных строк, которое нужно
+// вертикальному фильтру, поэтому размер изображения не ограничен объёмом памяти.
+// Результат совпадает с Resize; работает в одном потоке, options.threads не учитывается
+bool Resize(ScanlineSource& source, Size size, ScanlineSink& sink, const ResizeOptions& options = {});
+
+// Оценка памяти на масштабирование src до size сверх исходного изображения: результат,
+// промежуточное изображение после горизонтального прохода и веса фильтра. Если streaming,
+// оценка для потокового Resize: вместо изображений - окно строк
+uint64_t EstimateResizeMemory(Size src, Size size, const ResizeOptions& options = {}, bool streaming = false);
+
+}  // namespace img_lib
\ No newline at end of file
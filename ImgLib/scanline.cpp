@@ -0,0 +1,28 @@
+#include "scanline.h"
+
+namespace img_lib {
+
+Image ReadImage(ScanlineSource& source) {
+    const Size size = source.GetSize();
+    Image result(size.width, size.height);
+
+    for (int y = 0; y < size.height; ++y) {
+        if (!source.ReadRow(result.GetLine(y))) {
+            return {};
+        }
+    }
+
+    return result;
+}
+
+bool WriteImage(ImageView image, ScanlineSink& sink) {
+    for (int y = 0; y < image.GetHeight(); ++y) {
+        if (!sink.WriteRow(image.GetLine(y))) {
+            return false;
+        }
+    }
+
+    return sink.Finish();
+}
+
+}  // namespace img_lib
\ No newline at end of file
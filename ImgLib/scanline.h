@@ -0,0 +1,88 @@
+#pragma once
+#include "img_lib.h"
+#include "pixel_format.h"
+
+#include <type_traits>
+#include <vector>
+
+namespace img_lib {
+
+// Источник строк изображения. Строки выдаются по одной сверху вниз,
+// так что в памяти одновременно находится лишь несколько строк, а не всё изображение
+class ScanlineSource {
+public:
+    virtual ~ScanlineSource() = default;
+
+    virtual Size GetSize() const = 0;
+
+    // Читает очередную строку (GetSize().width пикселей) в row.
+    // Возвращает false при ошибке чтения или если строки закончились
+    virtual bool ReadRow(Color* row) = 0;
+};
+
+// Приёмник строк изображения. Размер изображения задаётся при создании приёмника,
+// строки передаются сверху вниз
+class ScanlineSink {
+public:
+    virtual ~ScanlineSink() = default;
+
+    virtual Size GetSize() const = 0;
+
+    // записывает очередную строку из GetSize().width пикселей
+    virtual bool WriteRow(const Color* row) = 0;
+
+    // Завершает запись: дописывает хвост файла и сбрасывает буферы.
+    // Возвращает false, если записаны не все строки или произошла ошибка
+    virtual bool Finish() = 0;
+};
+
+// читает все строки источника в новое изображение; при ошибке возвращает пустое изображение
+Image ReadImage(ScanlineSource& source);
+
+// записывает изображение или его часть в приёмник построчно и завершает запись
+bool WriteImage(ImageView image, ScanlineSink& sink);
+
+// то же для изображений с другим форматом пикселей: каждая строка
+// преобразуется через буфер из одной строки Color
+template <typename Pixel>
+BasicImage<Pixel> ReadImageAs(ScanlineSource& source) {
+    if constexpr (std::is_same_v<Pixel, Color>) {
+        return ReadImage(source);
+    } else {
+        const Size size = source.GetSize();
+        BasicImage<Pixel> result(size.width, size.height);
+        std::vector<Color> row(size.width);
+
+        for (int y = 0; y < size.height; ++y) {
+            if (!source.ReadRow(row.data())) {
+                return {};
+            }
+            ConvertRow(row.data(), result.GetLine(y), size.width);
+        }
+        return result;
+    }
+}
+
+template <typename Pixel>
+bool WriteImageAs(BasicImageView<const Pixel> image, ScanlineSink& sink) {
+    if constexpr (std::is_same_v<Pixel, Color>) {
+        return WriteImage(image, sink);
+    } else {
+        std::vector<Color> row(image.GetWidth());
+
+        for (int y = 0; y < image.GetHeight(); ++y) {
+            ConvertRow(image.GetLine(y), row.data(), image.GetWidth());
+            if (!sink.WriteRow(row.data())) {
+                return false;
+            }
+        }
+        return sink.Finish();
+    }
+}
+
+template <typename Pixel>
+bool WriteImageAs(const BasicImage<Pixel>& image, ScanlineSink& sink) {
+    return WriteImageAs(image.GetView(), sink);
+}
+
+}  // namespace img_lib
\ No newline at end of file
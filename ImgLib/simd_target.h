@@ -0,0 +1,12 @@
+#pragma once
+
+// Векторные ядра собираются только для x86 компиляторами GCC и Clang:
+// атрибут target позволяет включить SSSE3/AVX2 для отдельных функций,
+// не требуя этих инструкций от всей библиотеки.
+// Выбор реализации во время работы - через GetBestKernelLevel() из pixel_kernels.h
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define IMGLIB_X86_KERNELS 1
+#include <immintrin.h>
+#define IMGLIB_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define IMGLIB_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
\ No newline at end of file
@@ -0,0 +1,155 @@
+#include "stats.h"
+
+#include <chrono>
+#include <ctime>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define IMGLIB_HAS_RUSAGE 1
+#endif
+
+using namespace std;
+
+namespace img_lib {
+
+namespace {
+
+struct AtomicStageStats {
+    atomic<uint64_t> calls{0};
+    atomic<uint64_t> wall_ns{0};
+    atomic<uint64_t> cpu_ns{0};
+};
+
+array<AtomicStageStats, static_cast<size_t>(Stage::COUNT)> stage_stats;
+array<atomic<uint64_t>, static_cast<size_t>(Counter::COUNT)> counters;
+
+}  // namespace
+
+string_view GetStageName(Stage stage) {
+    switch (stage) {
+        case Stage::OPEN:
+            return "open"sv;
+        case Stage::HEADER:
+            return "header"sv;
+        case Stage::READ:
+            return "read"sv;
+        case Stage::DECODE:
+            return "decode"sv;
+        case Stage::CONVERT:
+            return "convert"sv;
+        case Stage::RESIZE:
+            return "resize"sv;
+        case Stage::ORIENT:
+            return "orient"sv;
+        case Stage::PIXEL_OPS:
+            return "pixel_ops"sv;
+        case Stage::ENCODE:
+            return "encode"sv;
+        case Stage::WRITE:
+            return "write"sv;
+        default:
+            return "unknown"sv;
+    }
+}
+
+void EnableStats(bool enabled) {
+    stats_enabled.store(enabled, memory_order_relaxed);
+}
+
+uint64_t GetWallNanoseconds() {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t GetThreadCpuNanoseconds() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+    }
+#endif
+    return 0;
+}
+
+void AddStageTime(Stage stage, uint64_t wall_ns, uint64_t cpu_ns) {
+    AtomicStageStats& stats = stage_stats[static_cast<size_t>(stage)];
+    stats.calls.fetch_add(1, memory_order_relaxed);
+    stats.wall_ns.fetch_add(wall_ns, memory_order_relaxed);
+    stats.cpu_ns.fetch_add(cpu_ns, memory_order_relaxed);
+}
+
+void AddCounter(Counter counter, uint64_t value) {
+    if (IsStatsEnabled()) {
+        counters[static_cast<size_t>(counter)].fetch_add(value, memory_order_relaxed);
+    }
+}
+
+Stats GetStats() {
+    Stats result;
+    for (size_t i = 0; i < result.stages.size(); ++i) {
+        result.stages[i].calls = stage_stats[i].calls.load(memory_order_relaxed);
+        result.stages[i].wall_ns = stage_stats[i].wall_ns.load(memory_order_relaxed);
+        result.stages[i].cpu_ns = stage_stats[i].cpu_ns.load(memory_order_relaxed);
+    }
+    for (size_t i = 0; i < result.counters.size(); ++i) {
+        result.counters[i] = counters[i].load(memory_order_relaxed);
+    }
+    result.pool = BufferPool::Instance().GetStats();
+    result.heap_allocations = heap_allocations.load(memory_order_relaxed);
+
+#ifdef IMGLIB_HAS_RUSAGE
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        // macOS сообщает ru_maxrss в байтах, остальные системы - в килобайтах
+#ifdef __APPLE__
+        result.peak_rss_bytes = static_cast<uint64_t>(usage.ru_maxrss);
+#else
+        result.peak_rss_bytes = static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+        const auto to_ns = [](const timeval& tv) {
+            return static_cast<uint64_t>(tv.tv_sec) * 1'000'000'000 + static_cast<uint64_t>(tv.tv_usec) * 1'000;
+        };
+        result.process_cpu_ns = to_ns(usage.ru_utime) + to_ns(usage.ru_stime);
+    }
+#endif
+    return result;
+}
+
+void ResetStats() {
+    for (AtomicStageStats& stats : stage_stats) {
+        stats.calls = 0;
+        stats.wall_ns = 0;
+        stats.cpu_ns = 0;
+    }
+    for (atomic<uint64_t>& counter : counters) {
+        counter = 0;
+    }
+    heap_allocations = 0;
+}
+
+void PrintStatsJson(const Stats& stats, ostream& out) {
+    const auto to_ms = [](uint64_t ns) {
+        return static_cast<double>(ns) / 1e6;
+    };
+
+    out << "{\"stages\":{"sv;
+    bool first = true;
+    for (size_t i = 0; i < stats.stages.size(); ++i) {
+        const StageStats& stage = stats.stages[i];
+        if (stage.calls == 0) {
+            continue;
+        }
+        out << (first ? ""sv : ","sv) << '"' << GetStageName(static_cast<Stage>(i)) << "\":{\"calls\":"sv
+            << stage.calls << ",\"wall_ms\":"sv << to_ms(stage.wall_ns) << ",\"cpu_ms\":"sv << to_ms(stage.cpu_ns)
+            << '}';
+        first = false;
+    }
+    out << "},\"bytes_read\":"sv << stats.counters[static_cast<size_t>(Counter::BYTES_READ)]
+        << ",\"bytes_written\":"sv << stats.counters[static_cast<size_t>(Counter::BYTES_WRITTEN)]
+        << ",\"heap_allocations\":"sv << stats.heap_allocations
+        << ",\"pool\":{\"allocations\":"sv << stats.pool.allocations << ",\"reuses\":"sv << stats.pool.reuses
+        << ",\"cached_bytes\":"sv << stats.pool.cached_bytes << '}'
+        << ",\"peak_rss_bytes\":"sv << stats.peak_rss_bytes
+        << ",\"process_cpu_ms\":"sv << to_ms(stats.process_cpu_ns) << "}\n"sv;
+}
+
+}  // namespace img_lib
\ No newline at end of file
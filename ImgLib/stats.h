@@ -0,0 +1,116 @@
+#pragma once
+#include "buffer_pool.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+
+namespace img_lib {
+
+// Этапы обработки изображения, время которых учитывается отдельно
+enum class Stage {
+    OPEN,       // открытие и отображение файлов
+    HEADER,     // разбор и запись заголовков
+    READ,       // чтение пикселей из файла
+    DECODE,     // декодирование JPEG
+    CONVERT,    // перепаковка строк между форматами пикселей
+    RESIZE,     // масштабирование
+    ORIENT,     // поворот и отражение (orientation.h)
+    PIXEL_OPS,  // поточечные операции над пикселями (pixel_ops.h)
+    ENCODE,     // кодирование JPEG
+    WRITE,      // запись в файл
+    COUNT
+};
+
+enum class Counter {
+    BYTES_READ,
+    BYTES_WRITTEN,
+    COUNT
+};
+
+std::string_view GetStageName(Stage stage);
+
+// Сбор статистики выключен по умолчанию. Выключенные таймеры и счётчики
+// стоят одну проверку флага, поэтому они встроены в кодеки постоянно
+void EnableStats(bool enabled);
+
+inline std::atomic<bool> stats_enabled{false};
+
+inline bool IsStatsEnabled() {
+    return stats_enabled.load(std::memory_order_relaxed);
+}
+
+// время по часам и процессорное время текущего потока, в наносекундах
+uint64_t GetWallNanoseconds();
+uint64_t GetThreadCpuNanoseconds();
+
+void AddStageTime(Stage stage, uint64_t wall_ns, uint64_t cpu_ns);
+void AddCounter(Counter counter, uint64_t value);
+
+// Замеряет время от создания до разрушения и добавляет его к этапу.
+// Время параллельных участков суммируется по всем потокам
+class ScopedStageTimer {
+public:
+    explicit ScopedStageTimer(Stage stage)
+        : stage_(stage)
+        , enabled_(IsStatsEnabled()) {
+        if (enabled_) {
+            wall_start_ = GetWallNanoseconds();
+            cpu_start_ = GetThreadCpuNanoseconds();
+        }
+    }
+
+    ~ScopedStageTimer() {
+        if (enabled_) {
+            AddStageTime(stage_, GetWallNanoseconds() - wall_start_, GetThreadCpuNanoseconds() - cpu_start_);
+        }
+    }
+
+    ScopedStageTimer(const ScopedStageTimer&) = delete;
+    ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+
+private:
+    Stage stage_;
+    bool enabled_;
+    uint64_t wall_start_ = 0;
+    uint64_t cpu_start_ = 0;
+};
+
+struct StageStats {
+    uint64_t calls = 0;
+    uint64_t wall_ns = 0;
+    uint64_t cpu_ns = 0;
+};
+
+struct Stats {
+    std::array<StageStats, static_cast<size_t>(Stage::COUNT)> stages;
+    std::array<uint64_t, static_cast<size_t>(Counter::COUNT)> counters = {};
+    BufferPool::Stats pool;
+    // Число выделений памяти в куче. Считает его приложение, заменившее
+    // глобальный operator new и вызывающее CountHeapAllocation; иначе 0
+    uint64_t heap_allocations = 0;
+    // пиковый размер резидентной памяти процесса и его процессорное время
+    // с момента запуска; 0, если система их не сообщает
+    uint64_t peak_rss_bytes = 0;
+    uint64_t process_cpu_ns = 0;
+};
+
+inline std::atomic<uint64_t> heap_allocations{0};
+
+inline void CountHeapAllocation() {
+    if (IsStatsEnabled()) {
+        heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// накопленная статистика с момента запуска или последнего ResetStats
+Stats GetStats();
+void ResetStats();
+
+// печатает статистику одним JSON-объектом в строку
+void PrintStatsJson(const Stats& stats, std::ostream& out);
+
+}  // namespace img_lib
\ No newline at end of file
@@ -0,0 +1,183 @@
+// Проверка ядер упаковки: на каждом уровне, который поддерживает процессор,
+// результат должен побайтно совпадать со скалярной реализацией.
+// Ширины 0..64 и несколько больших нечётных покрывают все хвосты векторных циклов,
+// сдвиги начала буферов - невыровненный доступ. Байты за концом вывода
+// проверяются тоже: ядро не должно писать за пределы count пикселей
+
+#include <img_lib.h>
+#include <pixel_kernels.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+using namespace img_lib;
+
+namespace {
+
+// значение, которым заполняется вывод до вызова ядра
+constexpr byte GUARD{0xCD};
+// запас после вывода, в котором не должно быть записи
+constexpr size_t GUARD_BYTES = 64;
+
+// простой детерминированный генератор, чтобы ошибки воспроизводились
+class XorShift {
+public:
+    uint32_t operator()() {
+        state_ ^= state_ << 13;
+        state_ ^= state_ >> 17;
+        state_ ^= state_ << 5;
+        return state_;
+    }
+
+private:
+    uint32_t state_ = 2463534242u;
+};
+
+vector<int> GetWidths() {
+    vector<int> widths;
+    for (int width = 0; width <= 64; ++width) {
+        widths.push_back(width);
+    }
+    for (int width : {127, 255, 1001, 4099}) {
+        widths.push_back(width);
+    }
+    return widths;
+}
+
+const int OFFSETS[] = {0, 1, 3};
+
+vector<byte> MakeRandomBytes(XorShift& rnd, size_t count) {
+    vector<byte> bytes(count);
+    for (byte& b : bytes) {
+        b = static_cast<byte>(rnd());
+    }
+    return bytes;
+}
+
+class Checker {
+public:
+    void Check(string_view kernel, string_view level, int width, int offset, const vector<byte>& result,
+               const vector<byte>& expected) {
+        ++checks_;
+        if (result == expected) {
+            return;
+        }
+        ++failures_;
+        const size_t pos = mismatch(result.begin(), result.end(), expected.begin()).first - result.begin();
+        cerr << kernel << " ["sv << level << "] width "sv << width << ", offset "sv << offset
+             << ": first mismatch at byte "sv << pos << endl;
+    }
+
+    int GetChecks() const {
+        return checks_;
+    }
+
+    int GetFailures() const {
+        return failures_;
+    }
+
+private:
+    int checks_ = 0;
+    int failures_ = 0;
+};
+
+string_view GetKernelLevelName(KernelLevel level) {
+    switch (level) {
+        case KernelLevel::SCALAR:
+            return "scalar"sv;
+        case KernelLevel::SSSE3:
+            return "ssse3"sv;
+        case KernelLevel::AVX2:
+            return "avx2"sv;
+    }
+    return "unknown"sv;
+}
+
+// Color -> packed_size байт на пиксель; вывод начинается со сдвига offset
+vector<byte> RunPack(PixelKernels::PackFn fn, const vector<byte>& src, int width, int offset, int packed_size) {
+    vector<byte> dst(offset + static_cast<size_t>(width) * packed_size + GUARD_BYTES, GUARD);
+    fn(reinterpret_cast<const Color*>(src.data() + offset), dst.data() + offset, width);
+    return dst;
+}
+
+vector<byte> RunUnpack(PixelKernels::UnpackFn fn, const vector<byte>& src, int width, int offset) {
+    vector<byte> dst(offset + static_cast<size_t>(width) * sizeof(Color) + GUARD_BYTES, GUARD);
+    fn(src.data() + offset, reinterpret_cast<Color*>(dst.data() + offset), width);
+    return dst;
+}
+
+// эталон для 4-байтовых перестановок, у которых нет отдельных уровней
+vector<byte> Reorder(const vector<byte>& src, int width, int offset, const int (&order)[4], bool opaque) {
+    vector<byte> dst(offset + static_cast<size_t>(width) * 4 + GUARD_BYTES, GUARD);
+    for (int x = 0; x < width; ++x) {
+        for (int c = 0; c < 4; ++c) {
+            dst[offset + x * 4 + c] = src[offset + x * 4 + order[c]];
+        }
+        if (opaque) {
+            dst[offset + x * 4 + 3] = byte{255};
+        }
+    }
+    return dst;
+}
+
+void CheckLevel(const PixelKernels& kernels, XorShift& rnd, Checker& checker) {
+    const PixelKernels& scalar = GetPixelKernels(KernelLevel::SCALAR);
+    const string_view level = GetKernelLevelName(kernels.level);
+
+    for (int width : GetWidths()) {
+        for (int offset : OFFSETS) {
+            const vector<byte> src = MakeRandomBytes(rnd, offset + static_cast<size_t>(width) * sizeof(Color));
+
+            checker.Check("PackRGB"sv, level, width, offset, RunPack(kernels.pack_rgb, src, width, offset, 3),
+                          RunPack(scalar.pack_rgb, src, width, offset, 3));
+            checker.Check("PackBGR"sv, level, width, offset, RunPack(kernels.pack_bgr, src, width, offset, 3),
+                          RunPack(scalar.pack_bgr, src, width, offset, 3));
+            checker.Check("UnpackRGB"sv, level, width, offset, RunUnpack(kernels.unpack_rgb, src, width, offset),
+                          RunUnpack(scalar.unpack_rgb, src, width, offset));
+            checker.Check("UnpackBGR"sv, level, width, offset, RunUnpack(kernels.unpack_bgr, src, width, offset),
+                          RunUnpack(scalar.unpack_bgr, src, width, offset));
+        }
+    }
+}
+
+// 4-байтовые ядра не зависят от уровня и сверяются с побайтной перестановкой
+void CheckFourBytes(XorShift& rnd, Checker& checker) {
+    const int bgra[4] = {2, 1, 0, 3};
+    const int rgba[4] = {0, 1, 2, 3};
+
+    for (int width : GetWidths()) {
+        for (int offset : OFFSETS) {
+            const vector<byte> src = MakeRandomBytes(rnd, offset + static_cast<size_t>(width) * sizeof(Color));
+
+            checker.Check("PackBGRA"sv, "auto"sv, width, offset, RunPack(PackBGRA, src, width, offset, 4),
+                          Reorder(src, width, offset, bgra, false));
+            checker.Check("UnpackBGRA"sv, "auto"sv, width, offset, RunUnpack(UnpackBGRA, src, width, offset),
+                          Reorder(src, width, offset, bgra, false));
+            checker.Check("UnpackRGBX"sv, "auto"sv, width, offset, RunUnpack(UnpackRGBX, src, width, offset),
+                          Reorder(src, width, offset, rgba, true));
+            checker.Check("UnpackBGRX"sv, "auto"sv, width, offset, RunUnpack(UnpackBGRX, src, width, offset),
+                          Reorder(src, width, offset, bgra, true));
+        }
+    }
+}
+
+}  // namespace
+
+int main() {
+    XorShift rnd;
+    Checker checker;
+
+    for (int level = 0; level <= static_cast<int>(GetBestKernelLevel()); ++level) {
+        CheckLevel(GetPixelKernels(static_cast<KernelLevel>(level)), rnd, checker);
+    }
+    CheckFourBytes(rnd, checker);
+
+    cout << "pixel_kernels_test: best level "sv << GetKernelLevelName(GetBestKernelLevel()) << ", "sv
+         << checker.GetChecks() << " checks, "sv << checker.GetFailures() << " failures"sv << endl;
+    return checker.GetFailures() == 0 ? 0 : 1;
+}
\ No newline at end of file
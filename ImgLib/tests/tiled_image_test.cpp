@@ -0,0 +1,195 @@
+// Проверка тайлового изображения: бюджет памяти меньше изображения, поэтому тайлы
+// вытесняются в файл подкачки и читаются обратно. Строки, прочитанные через TiledImageSource
+// с каждым из преобразований, должны совпадать с TransformImage над тем же изображением
+
+#include <img_lib.h>
+#include <orientation.h>
+#include <scanline.h>
+#include <tiled_image.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+using namespace img_lib;
+
+namespace {
+
+// простой детерминированный генератор, чтобы ошибки воспроизводились
+class XorShift {
+public:
+    uint32_t operator()() {
+        state_ ^= state_ << 13;
+        state_ ^= state_ >> 17;
+        state_ ^= state_ << 5;
+        return state_;
+    }
+
+private:
+    uint32_t state_ = 2463534242u;
+};
+
+class ImageSource : public ScanlineSource {
+public:
+    explicit ImageSource(const Image& image)
+        : image_(image) {
+    }
+
+    Size GetSize() const override {
+        return {image_.GetWidth(), image_.GetHeight()};
+    }
+
+    bool ReadRow(Color* row) override {
+        if (next_row_ >= image_.GetHeight()) {
+            return false;
+        }
+        const Color* line = image_.GetLine(next_row_++);
+        copy(line, line + image_.GetWidth(), row);
+        return true;
+    }
+
+private:
+    const Image& image_;
+    int next_row_ = 0;
+};
+
+class ImageSink : public ScanlineSink {
+public:
+    explicit ImageSink(Image& image)
+        : image_(image) {
+    }
+
+    Size GetSize() const override {
+        return {image_.GetWidth(), image_.GetHeight()};
+    }
+
+    bool WriteRow(const Color* row) override {
+        if (next_row_ >= image_.GetHeight()) {
+            return false;
+        }
+        copy(row, row + image_.GetWidth(), image_.GetLine(next_row_++));
+        return true;
+    }
+
+    bool Finish() override {
+        return next_row_ == image_.GetHeight();
+    }
+
+private:
+    Image& image_;
+    int next_row_ = 0;
+};
+
+bool SameRow(const Color* lhs, const Color* rhs, int width) {
+    return memcmp(lhs, rhs, static_cast<size_t>(width) * sizeof(Color)) == 0;
+}
+
+Image MakeRandomImage(int width, int height) {
+    XorShift rnd;
+    Image image(width, height);
+    for (int y = 0; y < height; ++y) {
+        Color* line = image.GetLine(y);
+        for (int x = 0; x < width; ++x) {
+            const uint32_t value = rnd();
+            line[x] = {byte(value), byte(value >> 8), byte(value >> 16), byte(value >> 24)};
+        }
+    }
+    return image;
+}
+
+string_view GetTransformName(ImageTransform transform) {
+    switch (transform) {
+        case ImageTransform::NONE:
+            return "none"sv;
+        case ImageTransform::FLIP_H:
+            return "flip-h"sv;
+        case ImageTransform::FLIP_V:
+            return "flip-v"sv;
+        case ImageTransform::ROTATE_90:
+            return "rot90"sv;
+        case ImageTransform::ROTATE_180:
+            return "rot180"sv;
+        case ImageTransform::ROTATE_270:
+            return "rot270"sv;
+        case ImageTransform::TRANSPOSE:
+            return "transpose"sv;
+        case ImageTransform::TRANSVERSE:
+            return "transverse"sv;
+    }
+    return "unknown"sv;
+}
+
+const ImageTransform TRANSFORMS[] = {
+    ImageTransform::NONE,       ImageTransform::FLIP_H,     ImageTransform::FLIP_V,    ImageTransform::ROTATE_90,
+    ImageTransform::ROTATE_180, ImageTransform::ROTATE_270, ImageTransform::TRANSPOSE, ImageTransform::TRANSVERSE,
+};
+
+}  // namespace
+
+int main() {
+    // стороны не кратны тайлу, чтобы проверить неполные крайние тайлы
+    const Image image = MakeRandomImage(1000, 701);
+    TiledImageOptions options;
+    options.tile_size = 64;
+    // бюджет меньше одного тайла поднимается до столбца тайлов - это 16 из 176
+    options.memory_budget = 1;
+
+    ImageSource source(image);
+    TiledImage tiled = ReadTiledImage(source, options);
+    if (!tiled) {
+        cerr << "ReadTiledImage failed"sv << endl;
+        return 1;
+    }
+
+    int failures = 0;
+    for (ImageTransform transform : TRANSFORMS) {
+        const Image expected = TransformImage(image, transform, 1);
+        TiledImageSource tiled_source(tiled, transform);
+        const Size size = tiled_source.GetSize();
+        if (size.width != expected.GetWidth() || size.height != expected.GetHeight()) {
+            cerr << GetTransformName(transform) << ": wrong size"sv << endl;
+            ++failures;
+            continue;
+        }
+
+        vector<Color> row(size.width);
+        bool rows_match = true;
+        for (int y = 0; y < size.height && rows_match; ++y) {
+            rows_match = tiled_source.ReadRow(row.data()) && SameRow(row.data(), expected.GetLine(y), size.width);
+            if (!rows_match) {
+                cerr << GetTransformName(transform) << ": row "sv << y << " differs"sv << endl;
+                ++failures;
+            }
+        }
+        if (rows_match && tiled_source.ReadRow(row.data())) {
+            cerr << GetTransformName(transform) << ": row past the end"sv << endl;
+            ++failures;
+        }
+    }
+
+    Image written(image.GetWidth(), image.GetHeight());
+    ImageSink sink(written);
+    if (!WriteTiledImage(tiled, sink)) {
+        cerr << "WriteTiledImage failed"sv << endl;
+        ++failures;
+    }
+    for (int y = 0; y < image.GetHeight() && failures == 0; ++y) {
+        if (!SameRow(written.GetLine(y), image.GetLine(y), image.GetWidth())) {
+            cerr << "WriteTiledImage: row "sv << y << " differs"sv << endl;
+            ++failures;
+        }
+    }
+
+    if (tiled.GetSpilledBytes() == 0) {
+        cerr << "no tiles were spilled to the scratch file"sv << endl;
+        ++failures;
+    }
+
+    cout << "tiled_image_test: "sv << tiled.GetSpilledBytes() << " bytes spilled, "sv << failures << " failures"sv
+         << endl;
+    return failures == 0 ? 0 : 1;
+}
\ No newline at end of file
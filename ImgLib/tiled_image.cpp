@@ -0,0 +1,405 @@
+#include "tiled_image.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#define IMGLIB_HAS_PREAD 1
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <utility>
+
+namespace img_lib {
+
+TiledImage::TiledImage(int w, int h, const TiledImageOptions& options) {
+    if (w <= 0 || h <= 0 || options.tile_size <= 0) {
+        return;
+    }
+
+    width_ = w;
+    height_ = h;
+    tile_size_ = options.tile_size;
+    tiles_x_ = (w + tile_size_ - 1) / tile_size_;
+    tiles_y_ = (h + tile_size_ - 1) / tile_size_;
+    tile_bytes_ = static_cast<size_t>(tile_size_) * tile_size_ * sizeof(Color);
+    max_resident_ = std::max(options.memory_budget / tile_bytes_, static_cast<size_t>(std::max(tiles_x_, tiles_y_)));
+    tiles_.resize(static_cast<size_t>(tiles_x_) * tiles_y_);
+    scratch_dir_ = options.scratch_dir;
+}
+
+uint64_t TiledImage::GetMaxTileBytes(Size size, const TiledImageOptions& options) {
+    if (size.width <= 0 || size.height <= 0 || options.tile_size <= 0) {
+        return 0;
+    }
+    const uint64_t tiles_x = (size.width + options.tile_size - 1) / options.tile_size;
+    const uint64_t tiles_y = (size.height + options.tile_size - 1) / options.tile_size;
+    const uint64_t tile_bytes = static_cast<uint64_t>(options.tile_size) * options.tile_size * sizeof(Color);
+    const uint64_t resident = std::max<uint64_t>(options.memory_budget / tile_bytes, std::max(tiles_x, tiles_y));
+    return std::min(resident, tiles_x * tiles_y) * tile_bytes;
+}
+
+TiledImage::~TiledImage() {
+    CloseScratch();
+}
+
+TiledImage::TiledImage(TiledImage&& other) noexcept {
+    MoveFrom(other);
+}
+
+TiledImage& TiledImage::operator=(TiledImage&& other) noexcept {
+    if (this != &other) {
+        CloseScratch();
+        MoveFrom(other);
+    }
+    return *this;
+}
+
+void TiledImage::MoveFrom(TiledImage& other) noexcept {
+    width_ = std::exchange(other.width_, 0);
+    height_ = std::exchange(other.height_, 0);
+    tile_size_ = std::exchange(other.tile_size_, 0);
+    tiles_x_ = std::exchange(other.tiles_x_, 0);
+    tiles_y_ = std::exchange(other.tiles_y_, 0);
+    tile_bytes_ = std::exchange(other.tile_bytes_, 0);
+    max_resident_ = std::exchange(other.max_resident_, 0);
+    // итераторы std::list остаются действительными при перемещении списка
+    tiles_ = std::move(other.tiles_);
+    lru_ = std::move(other.lru_);
+    other.tiles_.clear();
+    other.lru_.clear();
+    scratch_dir_ = std::move(other.scratch_dir_);
+#ifdef IMGLIB_HAS_PREAD
+    scratch_fd_ = std::exchange(other.scratch_fd_, -1);
+#else
+    scratch_ = std::move(other.scratch_);
+    scratch_path_ = std::exchange(other.scratch_path_, Path());
+#endif
+    spilled_bytes_ = std::exchange(other.spilled_bytes_, 0);
+}
+
+const Color* TiledImage::GetTile(int tx, int ty) {
+    return LoadTile(tx, ty, false);
+}
+
+Color* TiledImage::GetMutableTile(int tx, int ty) {
+    return LoadTile(tx, ty, true);
+}
+
+Color* TiledImage::LoadTile(int tx, int ty, bool modify) {
+    assert(tx >= 0 && tx < tiles_x_ && ty >= 0 && ty < tiles_y_);
+    const size_t index = static_cast<size_t>(ty) * tiles_x_ + tx;
+    Tile& tile = tiles_[index];
+
+    if (tile.resident) {
+        lru_.splice(lru_.begin(), lru_, tile.lru_pos);
+    } else {
+        // память вытесненного тайла сразу переходит новому
+        PixelBuffer pixels;
+        if (lru_.size() >= max_resident_) {
+            if (!EvictOldest(pixels)) {
+                return nullptr;
+            }
+        } else {
+            pixels = PixelBuffer(tile_bytes_);
+        }
+
+        if (tile.spilled) {
+            if (!ReadScratch(index, pixels.GetData())) {
+                return nullptr;
+            }
+        } else {
+            std::memset(pixels.GetData(), 0, tile_bytes_);
+        }
+
+        tile.pixels = std::move(pixels);
+        tile.resident = true;
+        tile.dirty = false;
+        lru_.push_front(index);
+        tile.lru_pos = lru_.begin();
+    }
+
+    if (modify) {
+        tile.dirty = true;
+    }
+    return static_cast<Color*>(tile.pixels.GetData());
+}
+
+bool TiledImage::EvictOldest(PixelBuffer& freed) {
+    const size_t index = lru_.back();
+    Tile& tile = tiles_[index];
+
+    // неизменённый тайл уже лежит в файле подкачки или ещё нулевой
+    if (tile.dirty) {
+        if (!WriteScratch(index, tile.pixels.GetData())) {
+            return false;
+        }
+        tile.spilled = true;
+        spilled_bytes_ += tile_bytes_;
+    }
+
+    lru_.pop_back();
+    tile.resident = false;
+    tile.dirty = false;
+    freed = std::move(tile.pixels);
+    return true;
+}
+
+bool TiledImage::ReadRow(int y, Color* row) {
+    assert(y >= 0 && y < height_);
+    const int ty = y / tile_size_;
+    const size_t offset = static_cast<size_t>(y % tile_size_) * tile_size_;
+
+    for (int tx = 0; tx < tiles_x_; ++tx) {
+        const Color* tile = GetTile(tx, ty);
+        if (!tile) {
+            return false;
+        }
+        const int x = tx * tile_size_;
+        std::copy_n(tile + offset, std::min(tile_size_, width_ - x), row + x);
+    }
+    return true;
+}
+
+bool TiledImage::WriteRow(int y, const Color* row) {
+    assert(y >= 0 && y < height_);
+    const int ty = y / tile_size_;
+    const size_t offset = static_cast<size_t>(y % tile_size_) * tile_size_;
+
+    for (int tx = 0; tx < tiles_x_; ++tx) {
+        Color* tile = GetMutableTile(tx, ty);
+        if (!tile) {
+            return false;
+        }
+        const int x = tx * tile_size_;
+        std::copy_n(row + x, std::min(tile_size_, width_ - x), tile + offset);
+    }
+    return true;
+}
+
+// Файл подкачки: тайл с номером index лежит по смещению index * tile_bytes_.
+// Место под тайлы, которые никогда не вытеснялись, на диске не занимается
+#ifdef IMGLIB_HAS_PREAD
+
+bool TiledImage::OpenScratch() {
+    if (scratch_fd_ >= 0) {
+        return true;
+    }
+
+    std::error_code ec;
+    const Path dir = scratch_dir_.empty() ? std::filesystem::temp_directory_path(ec) : scratch_dir_;
+    std::string name = (dir / "imglib-tiles-XXXXXX").string();
+    scratch_fd_ = ::mkstemp(name.data());
+    if (scratch_fd_ < 0) {
+        return false;
+    }
+    // у файла не остаётся имени: система удалит его, даже если процесс упадёт
+    ::unlink(name.c_str());
+    return true;
+}
+
+bool TiledImage::WriteScratch(size_t index, const void* data) {
+    if (!OpenScratch()) {
+        return false;
+    }
+
+    const char* bytes = static_cast<const char*>(data);
+    off_t offset = static_cast<off_t>(index * tile_bytes_);
+    size_t size = tile_bytes_;
+    while (size > 0) {
+        const ssize_t written = ::pwrite(scratch_fd_, bytes, size, offset);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        bytes += written;
+        offset += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+bool TiledImage::ReadScratch(size_t index, void* data) {
+    char* bytes = static_cast<char*>(data);
+    off_t offset = static_cast<off_t>(index * tile_bytes_);
+    size_t size = tile_bytes_;
+    while (size > 0) {
+        const ssize_t received = ::pread(scratch_fd_, bytes, size, offset);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        bytes += received;
+        offset += received;
+        size -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+void TiledImage::CloseScratch() {
+    if (scratch_fd_ >= 0) {
+        ::close(scratch_fd_);
+        scratch_fd_ = -1;
+    }
+}
+
+#else
+
+bool TiledImage::OpenScratch() {
+    if (scratch_.is_open()) {
+        return true;
+    }
+
+    std::error_code ec;
+    const Path dir = scratch_dir_.empty() ? std::filesystem::temp_directory_path(ec) : scratch_dir_;
+    for (int attempt = 0; attempt < 100 && !scratch_.is_open(); ++attempt) {
+        scratch_path_ = dir / ("imglib-tiles-" + std::to_string(reinterpret_cast<uintptr_t>(this)) + "-"
+                               + std::to_string(attempt));
+        if (!std::filesystem::exists(scratch_path_, ec)) {
+            scratch_.open(scratch_path_, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+        }
+    }
+    return scratch_.is_open();
+}
+
+bool TiledImage::WriteScratch(size_t index, const void* data) {
+    if (!OpenScratch()) {
+        return false;
+    }
+    scratch_.seekp(static_cast<std::streamoff>(index * tile_bytes_));
+    scratch_.write(static_cast<const char*>(data), static_cast<std::streamsize>(tile_bytes_));
+    return scratch_.good();
+}
+
+bool TiledImage::ReadScratch(size_t index, void* data) {
+    scratch_.seekg(static_cast<std::streamoff>(index * tile_bytes_));
+    scratch_.read(static_cast<char*>(data), static_cast<std::streamsize>(tile_bytes_));
+    return scratch_.good();
+}
+
+void TiledImage::CloseScratch() {
+    if (scratch_.is_open()) {
+        scratch_.close();
+        std::error_code ec;
+        std::filesystem::remove(scratch_path_, ec);
+    }
+}
+
+#endif
+
+
+TiledImage ReadTiledImage(ScanlineSource& source, const TiledImageOptions& options) {
+    const Size size = source.GetSize();
+    TiledImage result(size.width, size.height, options);
+    if (!result) {
+        return {};
+    }
+
+    std::vector<Color> row(size.width);
+    for (int y = 0; y < size.height; ++y) {
+        if (!source.ReadRow(row.data()) || !result.WriteRow(y, row.data())) {
+            return {};
+        }
+    }
+    return result;
+}
+
+bool WriteTiledImage(TiledImage& image, ScanlineSink& sink) {
+    std::vector<Color> row(image.GetWidth());
+    for (int y = 0; y < image.GetHeight(); ++y) {
+        if (!image.ReadRow(y, row.data()) || !sink.WriteRow(row.data())) {
+            return false;
+        }
+    }
+    return sink.Finish();
+}
+
+
+TiledImageSource::TiledImageSource(TiledImage& image, ImageTransform transform)
+    : image_(image)
+    , transform_(transform)
+    , size_(GetTransformedSize({image.GetWidth(), image.GetHeight()}, transform)) {
+}
+
+bool TiledImageSource::ReadRow(Color* row) {
+    if (next_row_ >= size_.height) {
+        return false;
+    }
+    const int y = next_row_++;
+    const int w = image_.GetWidth();
+    const int h = image_.GetHeight();
+
+    // Пиксель x строки y берётся из (sx + x * dx, sy + x * dy) исходного изображения
+    int sx = 0;
+    int sy = 0;
+    int dx = 0;
+    int dy = 0;
+    switch (transform_) {
+        case ImageTransform::NONE:
+            return image_.ReadRow(y, row);
+        case ImageTransform::FLIP_H:
+            sx = w - 1;
+            sy = y;
+            dx = -1;
+            break;
+        case ImageTransform::FLIP_V:
+            return image_.ReadRow(h - 1 - y, row);
+        case ImageTransform::ROTATE_180:
+            sx = w - 1;
+            sy = h - 1 - y;
+            dx = -1;
+            break;
+        case ImageTransform::TRANSPOSE:
+            sx = y;
+            sy = 0;
+            dy = 1;
+            break;
+        case ImageTransform::ROTATE_90:
+            sx = y;
+            sy = h - 1;
+            dy = -1;
+            break;
+        case ImageTransform::ROTATE_270:
+            sx = w - 1 - y;
+            sy = 0;
+            dy = 1;
+            break;
+        case ImageTransform::TRANSVERSE:
+            sx = w - 1 - y;
+            sy = h - 1;
+            dy = -1;
+            break;
+    }
+
+    // строка собирается отрезками: каждый тайл на пути запрашивается один раз
+    const int tile_size = image_.GetTileSize();
+    const ptrdiff_t step = dx + static_cast<ptrdiff_t>(dy) * tile_size;
+    for (int x = 0; x < size_.width;) {
+        const int lx = sx % tile_size;
+        const int ly = sy % tile_size;
+        const int left_in_tile = dx > 0 ? tile_size - lx : dx < 0 ? lx + 1 : dy > 0 ? tile_size - ly : ly + 1;
+        const int count = std::min(left_in_tile, size_.width - x);
+
+        const Color* tile = image_.GetTile(sx / tile_size, sy / tile_size);
+        if (!tile) {
+            return false;
+        }
+        const Color* src = tile + static_cast<ptrdiff_t>(ly) * tile_size + lx;
+        for (int i = 0; i < count; ++i, src += step) {
+            row[x + i] = *src;
+        }
+        x += count;
+        sx += count * dx;
+        sy += count * dy;
+    }
+    return true;
+}
+
+}  // namespace img_lib
\ No newline at end of file
@@ -0,0 +1,153 @@
+#pragma once
+#include "img_lib.h"
+#include "orientation.h"
+#include "scanline.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <list>
+#include <vector>
+
+namespace img_lib {
+
+struct TiledImageOptions {
+    // сторона квадратного тайла в пикселях
+    int tile_size = 256;
+    // Сколько памяти могут занимать тайлы. Бюджет увеличивается до одного ряда или столбца
+    // тайлов, иначе обход по строкам или столбцам читал бы каждый тайл из файла подкачки заново
+    size_t memory_budget = size_t{256} << 20;
+    // каталог для файла подкачки, пустой - системный каталог временных файлов
+    Path scratch_dir;
+};
+
+// Изображение из квадратных тайлов, которое не обязано помещаться в памяти целиком.
+// В памяти держится не больше memory_budget байт тайлов, давно не использованные
+// тайлы вытесняются в файл подкачки и при обращении читаются обратно. Файл создаётся
+// при первом вытеснении и удаляется вместе с изображением.
+// Тайлы, в которые ещё не писали, заполнены нулями. Класс не потокобезопасен
+class TiledImage {
+public:
+    // создаёт пустое изображение
+    TiledImage() = default;
+    TiledImage(int w, int h, const TiledImageOptions& options = {});
+    ~TiledImage();
+
+    TiledImage(const TiledImage&) = delete;
+    TiledImage& operator=(const TiledImage&) = delete;
+    TiledImage(TiledImage&& other) noexcept;
+    TiledImage& operator=(TiledImage&& other) noexcept;
+
+    int GetWidth() const {
+        return width_;
+    }
+    int GetHeight() const {
+        return height_;
+    }
+    int GetTileSize() const {
+        return tile_size_;
+    }
+    int GetTilesX() const {
+        return tiles_x_;
+    }
+    int GetTilesY() const {
+        return tiles_y_;
+    }
+
+    // Тайл (tx, ty): GetTileSize() строк по GetTileSize() пикселей подряд. У крайних тайлов
+    // пиксели за границей изображения не используются. Указатель действителен до следующего
+    // обращения к изображению. nullptr - если тайл не удалось прочитать или вытеснить другой
+    const Color* GetTile(int tx, int ty);
+    Color* GetMutableTile(int tx, int ty);
+
+    // копирует строку y (GetWidth() пикселей) из изображения или в него
+    bool ReadRow(int y, Color* row);
+    bool WriteRow(int y, const Color* row);
+
+    // сколько памяти займут тайлы изображения size с параметрами options
+    static uint64_t GetMaxTileBytes(Size size, const TiledImageOptions& options = {});
+
+    // сколько байт тайлов записано в файл подкачки за всё время
+    uint64_t GetSpilledBytes() const {
+        return spilled_bytes_;
+    }
+
+    explicit operator bool() const {
+        return width_ > 0 && height_ > 0;
+    }
+
+    bool operator!() const {
+        return !operator bool();
+    }
+
+private:
+    struct Tile {
+        PixelBuffer pixels;
+        // место в списке lru_, если тайл в памяти
+        std::list<size_t>::iterator lru_pos;
+        bool resident = false;
+        // тайл менялся с тех пор, как был записан в файл подкачки
+        bool dirty = false;
+        // копия тайла есть в файле подкачки
+        bool spilled = false;
+    };
+
+    Color* LoadTile(int tx, int ty, bool modify);
+    // вытесняет самый давно использованный тайл и отдаёт его память
+    bool EvictOldest(PixelBuffer& freed);
+    bool OpenScratch();
+    bool WriteScratch(size_t index, const void* data);
+    bool ReadScratch(size_t index, void* data);
+    void CloseScratch();
+    void MoveFrom(TiledImage& other) noexcept;
+
+    int width_ = 0;
+    int height_ = 0;
+    int tile_size_ = 0;
+    int tiles_x_ = 0;
+    int tiles_y_ = 0;
+    size_t tile_bytes_ = 0;
+    size_t max_resident_ = 0;
+
+    std::vector<Tile> tiles_;
+    // номера тайлов в памяти, в начале - использованные последними
+    std::list<size_t> lru_;
+
+    Path scratch_dir_;
+#if defined(__unix__) || defined(__APPLE__)
+    int scratch_fd_ = -1;
+#else
+    std::fstream scratch_;
+    Path scratch_path_;
+#endif
+    uint64_t spilled_bytes_ = 0;
+};
+
+// читает все строки источника в тайловое изображение; при ошибке возвращает пустое изображение
+TiledImage ReadTiledImage(ScanlineSource& source, const TiledImageOptions& options = {});
+
+// записывает тайловое изображение в приёмник построчно и завершает запись
+bool WriteTiledImage(TiledImage& image, ScanlineSink& sink);
+
+// Построчный источник поверх тайлового изображения, например для масштабирования потоком.
+// С преобразованием transform отдаёт строки повёрнутого или отражённого изображения,
+// как TransformImage: при повороте на 90 градусов строка результата - столбец тайлов,
+// и соседние строки берутся из тех же тайлов. Изображение должно жить дольше источника
+class TiledImageSource : public ScanlineSource {
+public:
+    explicit TiledImageSource(TiledImage& image, ImageTransform transform = ImageTransform::NONE);
+
+    Size GetSize() const override {
+        return size_;
+    }
+
+    bool ReadRow(Color* row) override;
+
+private:
+    TiledImage& image_;
+    ImageTransform transform_;
+    Size size_;
+    int next_row_ = 0;
+};
+
+}  // namespace img_lib
\ No newline at end of file